@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "audio_art.h"
+#include "audio_library.h"
+#include "audio_player.h"
+#include "file_manager.h"
+#include "media_tags.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_tjpgd.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "ART";
+
+#define ART_INDEX_PATH  AUDIO_ART_DIR "/index"
+#define ART_INDEX_MAGIC 0x31545241  // "ART1"
+#define ART_NAME_MAX    48
+#define ART_WORK_SIZE   3100        // TJpgDec work area
+#define SCAN_FILL       (AUDIO_RINGBUF_SIZE * 3 / 4)  // decoding waits below this while playing
+#define SCAN_WAIT_MS    50
+#define SCAN_START_MS   5000        // after the library scan
+
+static const uint16_t art_sizes[] = { AUDIO_ART_LARGE, AUDIO_ART_SMALL };
+#define ART_NSIZES      (int)(sizeof(art_sizes) / sizeof(art_sizes[0]))
+
+typedef struct {
+    uint32_t id;                    // 0 for a free slot
+    uint32_t used;                  // LRU clock when last shown
+} art_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t clock;
+    art_entry_t entries[AUDIO_ART_CACHE_ENTRIES];
+} art_index_t;
+
+typedef struct {
+    uint32_t id;
+    char path[AUDIO_PATH_MAX];
+} art_req_t;
+
+// One decode: picture bytes in, size x size RGB565 out
+typedef struct {
+    FILE *fp;
+    uint32_t left;                  // picture bytes not read yet
+    uint16_t *px;
+    uint16_t size;
+    uint16_t x0, y0;                // square crop of the scaled picture
+    uint16_t map[AUDIO_ART_LARGE];  // crop offset sampled by each output row / column
+} art_job_t;
+
+static SemaphoreHandle_t art_lock;  // s_index
+static QueueHandle_t art_q;
+static art_index_t s_index;
+static bool s_dirty = false;        // LRU order changed since the last save
+static volatile uint32_t s_pending = 0;  // queued for extraction, not asked for again
+static media_tags_t s_tags;         // art task only, kept off its stack
+
+static void art_name(char *buf, uint32_t id, uint16_t size)
+{
+    snprintf(buf, ART_NAME_MAX, "%s/%08lx_%u.bin", AUDIO_ART_DIR, (unsigned long)id, size);
+}
+
+static int art_find(uint32_t id)
+{
+    for (int i = 0; i < AUDIO_ART_CACHE_ENTRIES; i++) {
+        if (s_index.entries[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void art_remove_files(uint32_t id)
+{
+    char name[ART_NAME_MAX];
+
+    for (int s = 0; s < ART_NSIZES; s++) {
+        art_name(name, id, art_sizes[s]);
+        remove(name);
+    }
+}
+
+// Under art_lock
+static void art_index_save(void)
+{
+    FILE *f = fopen(ART_INDEX_PATH, "wb");
+    bool ok = f && fwrite(&s_index, sizeof(s_index), 1, f) == 1;
+
+    if (f) {
+        ok = fclose(f) == 0 && ok;
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", ART_INDEX_PATH);
+    }
+    s_dirty = false;
+}
+
+// Files the index does not know about are left over from an interrupted write
+static bool art_orphan_cb(const char *path, const struct stat *st, void *arg)
+{
+    unsigned long id;
+    unsigned size;
+    const char *name = strrchr(path, '/') + 1;
+
+    if (sscanf(name, "%8lx_%u.bin", &id, &size) == 2 && art_find(id) < 0) {
+        ESP_LOGI(TAG, "Removing stale %s", name);
+        remove(path);
+    }
+    return true;
+}
+
+static void art_index_load(void)
+{
+    FILE *f = fopen(ART_INDEX_PATH, "rb");
+    bool ok = f && fread(&s_index, sizeof(s_index), 1, f) == 1 && s_index.magic == ART_INDEX_MAGIC;
+
+    if (f) {
+        fclose(f);
+    }
+    if (!ok) {
+        memset(&s_index, 0, sizeof(s_index));
+        s_index.magic = ART_INDEX_MAGIC;
+    }
+    sd_fs_walk(AUDIO_ART_DIR, art_orphan_cb, NULL);
+}
+
+static int art_used(void)
+{
+    int used = 0;
+
+    for (int i = 0; i < AUDIO_ART_CACHE_ENTRIES; i++) {
+        used += s_index.entries[i].id != 0;
+    }
+    return used;
+}
+
+// Slot for a new picture, -1 if the cache is full and evict is false
+static int art_slot(bool evict)
+{
+    int lru = -1;
+
+    for (int i = 0; i < AUDIO_ART_CACHE_ENTRIES; i++) {
+        if (s_index.entries[i].id == 0) {
+            return i;
+        }
+        if (lru < 0 || s_index.entries[i].used < s_index.entries[lru].used) {
+            lru = i;
+        }
+    }
+    if (!evict) {
+        return -1;
+    }
+    art_remove_files(s_index.entries[lru].id);
+    s_index.entries[lru].id = 0;
+    return lru;
+}
+
+/* ---- decoding ---- */
+
+static uint32_t art_input(esp_rom_tjpgd_dec_t *dec, uint8_t *buf, uint32_t len)
+{
+    art_job_t *job = dec->device;
+
+    if (len > job->left) {
+        len = job->left;
+    }
+    if (buf) {
+        len = fread(buf, 1, len, job->fp);
+    } else if (fseek(job->fp, len, SEEK_CUR) != 0) {
+        return 0;
+    }
+    job->left -= len;
+    return len;
+}
+
+// Nearest sample of each output pixel falling in this block, the block is RGB888
+static uint32_t art_output(esp_rom_tjpgd_dec_t *dec, void *bitmap, esp_rom_tjpgd_rect_t *rect)
+{
+    art_job_t *job = dec->device;
+    const uint8_t *rgb = bitmap;
+    uint32_t w = rect->right - rect->left + 1;
+
+    for (int ty = 0; ty < job->size; ty++) {
+        uint32_t y = job->y0 + job->map[ty];
+        if (y < rect->top || y > rect->bottom) {
+            continue;
+        }
+        for (int tx = 0; tx < job->size; tx++) {
+            uint32_t x = job->x0 + job->map[tx];
+            if (x < rect->left || x > rect->right) {
+                continue;
+            }
+            const uint8_t *p = rgb + ((y - rect->top) * w + (x - rect->left)) * 3;
+            job->px[ty * job->size + tx] = (p[0] & 0xF8) << 8 | (p[1] & 0xFC) << 3 | p[2] >> 3;
+        }
+    }
+    return 1;
+}
+
+static bool art_decode(art_job_t *job, uint32_t off, uint32_t len, void *work)
+{
+    esp_rom_tjpgd_dec_t dec;
+
+    job->left = len;
+    if (fseek(job->fp, off, SEEK_SET) != 0 ||
+        esp_rom_tjpgd_prepare(&dec, art_input, work, ART_WORK_SIZE, job) != JDR_OK ||
+        dec.width > AUDIO_ART_MAX_SIDE || dec.height > AUDIO_ART_MAX_SIDE) {
+        return false;
+    }
+
+    // Decoder-side reduction as far as it keeps the crop at least size across
+    uint8_t scale = 0;
+    uint32_t side = dec.width < dec.height ? dec.width : dec.height;
+    while (scale < 3 && (side >> (scale + 1)) >= job->size) {
+        scale++;
+    }
+    side >>= scale;
+    job->x0 = ((dec.width >> scale) - side) / 2;
+    job->y0 = ((dec.height >> scale) - side) / 2;
+    for (int i = 0; i < job->size; i++) {
+        job->map[i] = (2 * i + 1) * side / (2 * job->size);
+    }
+
+    memset(job->px, 0, job->size * job->size * sizeof(uint16_t));
+    return esp_rom_tjpgd_decomp(&dec, art_output, scale) == JDR_OK;
+}
+
+static bool art_write(uint32_t id, uint16_t size, const uint16_t *px)
+{
+    char name[ART_NAME_MAX];
+    lv_image_header_t h = {
+        .magic = LV_IMAGE_HEADER_MAGIC,
+        .cf = LV_COLOR_FORMAT_RGB565,
+        .w = size,
+        .h = size,
+        .stride = size * sizeof(uint16_t),
+    };
+
+    art_name(name, id, size);
+    FILE *f = fopen(name, "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(px, sizeof(uint16_t), size * size, f) == size * size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        remove(name);
+    }
+    return ok;
+}
+
+// Stay out of the reader's way while it is refilling the ring
+static void art_throttle(void)
+{
+    while (audio_player_is_playing() && audio_ring_fill(&audio_ring) < SCAN_FILL) {
+        vTaskDelay(pdMS_TO_TICKS(SCAN_WAIT_MS));
+    }
+}
+
+// Thumbnails of picture id from path; false only when memory is short
+static bool art_extract(uint32_t id, const char *path, bool evict)
+{
+    size_t need = ART_WORK_SIZE + AUDIO_ART_LARGE * AUDIO_ART_LARGE * sizeof(uint16_t);
+    static art_job_t job;
+    uint8_t magic[2];
+    bool ok = true;
+    int slot;
+
+    xSemaphoreTake(art_lock, portMAX_DELAY);
+    slot = art_find(id) < 0 ? art_slot(evict) : -1;
+    xSemaphoreGive(art_lock);
+    if (slot < 0) {
+        return true;            // cached already, or full
+    }
+
+    // The file may have changed since it was indexed
+    if (!media_tags_read(path, &s_tags) || s_tags.art_id != id) {
+        return true;
+    }
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < need + AUDIO_ART_HEAP_RESERVE) {
+        return false;
+    }
+
+    job.fp = fopen(path, "rb");
+    if (!job.fp) {
+        return true;
+    }
+    setvbuf(job.fp, NULL, _IONBF, 0);
+    if (fseek(job.fp, s_tags.art_offset, SEEK_SET) != 0 || fread(magic, 1, 2, job.fp) != 2 ||
+        magic[0] != 0xFF || magic[1] != 0xD8) {
+        ESP_LOGI(TAG, "%s: picture is not a JPEG", path);
+        fclose(job.fp);
+        return true;
+    }
+
+    void *work = malloc(ART_WORK_SIZE);
+    job.px = malloc(AUDIO_ART_LARGE * AUDIO_ART_LARGE * sizeof(uint16_t));
+    int64_t t0 = esp_timer_get_time();
+
+    art_throttle();
+    for (int s = 0; ok && s < ART_NSIZES; s++) {
+        job.size = art_sizes[s];
+        ok = work && job.px && art_decode(&job, s_tags.art_offset, s_tags.art_size, work) &&
+             art_write(id, job.size, job.px);
+    }
+    fclose(job.fp);
+    free(work);
+    free(job.px);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "%s: failed to make thumbnails", path);
+        art_remove_files(id);
+        return true;
+    }
+
+    xSemaphoreTake(art_lock, portMAX_DELAY);
+    s_index.entries[slot].id = id;
+    s_index.entries[slot].used = ++s_index.clock;
+    art_index_save();
+    xSemaphoreGive(art_lock);
+
+    ESP_LOGI(TAG, "%08lx from %s, %lu bytes, %lld ms", (unsigned long)id, path,
+             (unsigned long)s_tags.art_size, (esp_timer_get_time() - t0) / 1000);
+    return true;
+}
+
+static void audio_art_task(void *arg)
+{
+    static audio_library_track_t track;
+    static char path[AUDIO_PATH_MAX];
+    static art_req_t req;
+    uint32_t gen = 0;               // library generation being walked
+    uint32_t next = 0;              // next track of the walk
+    uint32_t last = 0;              // art of the previous track, an album comes together
+    TickType_t saved = 0;
+    bool walked = false;
+
+    vTaskDelay(pdMS_TO_TICKS(SCAN_START_MS));
+
+    xSemaphoreTake(art_lock, portMAX_DELAY);
+    art_index_load();
+    xSemaphoreGive(art_lock);
+
+    while (1) {
+        if (gen != audio_library_generation()) {
+            gen = audio_library_generation();
+            next = 0;
+            walked = false;
+        }
+
+        // Asked-for pictures go first, the walk fills in between
+        TickType_t wait = walked ? pdMS_TO_TICKS(AUDIO_ART_FLUSH_MS) : 0;
+        if (xQueueReceive(art_q, &req, wait) == pdTRUE) {
+            if (!art_extract(req.id, req.path, true)) {
+                vTaskDelay(pdMS_TO_TICKS(AUDIO_ART_RETRY_MS));
+            }
+            s_pending = 0;
+            continue;
+        }
+
+        if (!walked) {
+            if (next >= audio_library_count()) {
+                walked = true;
+                ESP_LOGI(TAG, "Library walked, %d of %d pictures cached", art_used(), AUDIO_ART_CACHE_ENTRIES);
+            } else if (audio_library_get(next, &track) && track.art && track.art != last &&
+                       audio_library_path(next, path, sizeof(path)) && !art_extract(track.art, path, false)) {
+                vTaskDelay(pdMS_TO_TICKS(AUDIO_ART_RETRY_MS));
+                continue;       // same track again
+            } else {
+                last = track.art;
+                next++;
+            }
+        }
+
+        // Shown pictures only move in the LRU order, that can wait a little
+        if (s_dirty && xTaskGetTickCount() - saved >= pdMS_TO_TICKS(AUDIO_ART_FLUSH_MS)) {
+            xSemaphoreTake(art_lock, portMAX_DELAY);
+            art_index_save();
+            xSemaphoreGive(art_lock);
+            saved = xTaskGetTickCount();
+        }
+    }
+}
+
+bool audio_art_init(void)
+{
+    mkdir(AUDIO_ART_DIR, 0775);
+
+    art_lock = xSemaphoreCreateMutex();
+    art_q = xQueueCreate(AUDIO_ART_QUEUE_LEN, sizeof(art_req_t));
+    if (!art_lock || !art_q) {
+        return false;
+    }
+
+    if (xTaskCreate(audio_art_task, "audio_art", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start art extraction");
+        return false;
+    }
+    return true;
+}
+
+bool audio_art_load(uint32_t id, uint16_t size, const char *path, lv_image_dsc_t *dsc)
+{
+    char name[ART_NAME_MAX];
+    lv_image_header_t h;
+    uint32_t bytes = size * size * sizeof(uint16_t);
+
+    memset(dsc, 0, sizeof(*dsc));
+    if (!id || !art_lock) {
+        return false;
+    }
+
+    xSemaphoreTake(art_lock, portMAX_DELAY);
+    int i = art_find(id);
+    if (i >= 0) {
+        s_index.entries[i].used = ++s_index.clock;
+        s_dirty = true;
+    }
+    xSemaphoreGive(art_lock);
+
+    if (i >= 0) {
+        // Header and pixels in one sequential read, no decoding
+        art_name(name, id, size);
+        FILE *f = fopen(name, "rb");
+        bool valid = f && fread(&h, sizeof(h), 1, f) == 1 && h.magic == LV_IMAGE_HEADER_MAGIC &&
+                     h.cf == LV_COLOR_FORMAT_RGB565 && h.w == size && h.h == size;
+        uint8_t *px = valid ? malloc(bytes) : NULL;
+        bool ok = px && fread(px, 1, bytes, f) == bytes;
+        if (f) {
+            fclose(f);
+        }
+        if (ok) {
+            dsc->header = h;
+            dsc->data_size = bytes;
+            dsc->data = px;
+            return true;
+        }
+        free(px);
+        if (valid && !px) {
+            return false;       // short of memory, the cached files are fine
+        }
+
+        ESP_LOGW(TAG, "%s unreadable, extracting again", name);
+        xSemaphoreTake(art_lock, portMAX_DELAY);
+        if (s_index.entries[i].id == id) {
+            s_index.entries[i].id = 0;
+        }
+        xSemaphoreGive(art_lock);
+    }
+
+    if (s_pending != id) {
+        art_req_t req = { .id = id };
+        snprintf(req.path, sizeof(req.path), "%s", path);
+        if (xQueueSend(art_q, &req, 0) == pdTRUE) {
+            s_pending = id;
+        }
+    }
+    return false;
+}
+
+// The image cache is off (LV_CACHE_DEF_SIZE 0), nothing else holds the pixels once the widget lets go
+void audio_art_release(lv_image_dsc_t *dsc)
+{
+    if (dsc->data) {
+        free((void *)dsc->data);
+        dsc->data = NULL;
+    }
+}
@@ -0,0 +1,285 @@
+#include <math.h>
+#include <string.h>
+#include "audio_dsp.h"
+
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "DSP";
+
+#define Q30_ONE         (1 << 30)
+#define Q28_ONE         (1 << 28)
+#define Q15_ONE         (1 << 15)
+#define BQ_SHIFT        28
+#define BQ_FRAC_MASK    ((1u << BQ_SHIFT) - 1)
+#define EQ_Q            1.0
+#define LIM_THRESHOLD   AUDIO_DSP_LIMIT_CEILING
+#define LIM_RELEASE     11          // release time constant of 2^11 frames, ~46 ms
+
+static const uint16_t s_eq_freq[AUDIO_DSP_EQ_BANDS] = { 60, 250, 1000, 4000, 12000 };
+
+static inline int16_t sat16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : (int16_t)v);
+}
+
+// Perceptual taper: square of the slider position
+static int32_t volume_to_gain(uint8_t percent)
+{
+    return (int32_t)((int64_t)percent * percent * Q30_ONE / (100 * 100));
+}
+
+void audio_dsp_init(audio_dsp_t *dsp, uint32_t sample_rate)
+{
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->sample_rate = sample_rate;
+    dsp->volume = AUDIO_DSP_DEFAULT_VOLUME;
+    dsp->gain_target = volume_to_gain(AUDIO_DSP_DEFAULT_VOLUME);
+    dsp->gain = dsp->gain_target;
+    dsp->gain_goal = dsp->gain_target;
+    dsp->track_gain = Q28_ONE;
+    dsp->lim_gain = Q15_ONE;
+}
+
+void audio_dsp_set_volume(audio_dsp_t *dsp, uint8_t percent)
+{
+    if (percent > 100) {
+        percent = 100;
+    }
+    dsp->volume = percent;
+    dsp->gain_target = volume_to_gain(percent);
+}
+
+uint8_t audio_dsp_get_volume(const audio_dsp_t *dsp)
+{
+    return dsp->volume;
+}
+
+void audio_dsp_set_track_gain(audio_dsp_t *dsp, int16_t centi_db)
+{
+    if (centi_db > AUDIO_DSP_TRACK_MAX_DB * 100) {
+        centi_db = AUDIO_DSP_TRACK_MAX_DB * 100;
+    } else if (centi_db < AUDIO_DSP_TRACK_MIN_DB * 100) {
+        centi_db = AUDIO_DSP_TRACK_MIN_DB * 100;
+    }
+    dsp->track_gain = (int32_t)lrintf(Q28_ONE * powf(10, centi_db / 2000.0f));
+}
+
+void audio_dsp_set_eq(audio_dsp_t *dsp, uint8_t band, int8_t db)
+{
+    if (band >= AUDIO_DSP_EQ_BANDS) {
+        return;
+    }
+    if (db > AUDIO_DSP_EQ_MAX_DB) {
+        db = AUDIO_DSP_EQ_MAX_DB;
+    } else if (db < -AUDIO_DSP_EQ_MAX_DB) {
+        db = -AUDIO_DSP_EQ_MAX_DB;
+    }
+    dsp->eq_db[band] = db;
+    dsp->eq_version++;
+}
+
+void audio_dsp_reset(audio_dsp_t *dsp)
+{
+    for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+        audio_biquad_t *bq = &dsp->eq[b];
+        for (int ch = 0; ch < 2; ch++) {
+            bq->x1[ch] = bq->x2[ch] = 0;
+            bq->y1[ch] = bq->y2[ch] = 0;
+            bq->err[ch] = 0;
+        }
+    }
+    dsp->lim_gain = Q15_ONE;
+}
+
+// RBJ cookbook peaking filter, built in float only when a band changes
+static void biquad_peaking(audio_biquad_t *bq, double fs, double f0, double db)
+{
+    double A = pow(10.0, db / 40.0);
+    double w0 = 2 * M_PI * f0 / fs;
+    double alpha = sin(w0) / (2 * EQ_Q);
+    double a0 = 1 + alpha / A;
+    double k = (double)(1 << BQ_SHIFT) / a0;
+
+    bq->b0 = (int32_t)lrint((1 + alpha * A) * k);
+    bq->b1 = (int32_t)lrint(-2 * cos(w0) * k);
+    bq->b2 = (int32_t)lrint((1 - alpha * A) * k);
+    bq->a1 = bq->b1;
+    bq->a2 = (int32_t)lrint((1 - alpha / A) * k);
+}
+
+static void eq_update(audio_dsp_t *dsp)
+{
+    uint32_t version = dsp->eq_version;
+
+    dsp->eq_active = 0;
+    for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+        int8_t db = dsp->eq_db[b];
+        // Close to Nyquist the peaking shape degenerates, leave the band flat
+        if (db == 0 || s_eq_freq[b] >= dsp->sample_rate * 9 / 20) {
+            continue;
+        }
+        biquad_peaking(&dsp->eq[b], dsp->sample_rate, s_eq_freq[b], db);
+        dsp->eq_active |= 1 << b;
+    }
+    dsp->eq_applied = version;
+}
+
+static void stage_gain(audio_dsp_t *dsp, const int16_t *in, int32_t *out, size_t frames)
+{
+    // Volume and track gain are set separately, combined once per block
+    int64_t goal = ((int64_t)dsp->gain_target * dsp->track_gain) >> 28;
+    if (goal > INT32_MAX) {
+        goal = INT32_MAX;
+    }
+
+    if (goal != dsp->gain_goal) {
+        dsp->gain_goal = (int32_t)goal;
+        dsp->gain_step = (dsp->gain_goal - dsp->gain) / AUDIO_DSP_RAMP_FRAMES;
+        dsp->ramp_left = AUDIO_DSP_RAMP_FRAMES;
+    }
+
+    int32_t gain = dsp->gain;
+
+    for (size_t i = 0; i < frames; i++) {
+        if (dsp->ramp_left) {
+            gain += dsp->gain_step;
+            if (--dsp->ramp_left == 0) {
+                gain = dsp->gain_goal;      // land exactly, step was truncated
+            }
+        }
+        int32_t g = gain >> 15;             // Q15
+        out[2 * i] = (in[2 * i] * g) >> 15;
+        out[2 * i + 1] = (in[2 * i + 1] * g) >> 15;
+    }
+    dsp->gain = gain;
+}
+
+static void stage_biquad(audio_biquad_t *bq, int32_t *buf, size_t frames)
+{
+    for (int ch = 0; ch < 2; ch++) {
+        int32_t x1 = bq->x1[ch], x2 = bq->x2[ch];
+        int32_t y1 = bq->y1[ch], y2 = bq->y2[ch];
+        uint32_t err = bq->err[ch];
+        int32_t *p = buf + ch;
+
+        for (size_t i = 0; i < frames; i++, p += 2) {
+            int32_t x0 = *p;
+            int64_t acc = (int64_t)bq->b0 * x0 + (int64_t)bq->b1 * x1 +
+                          (int64_t)bq->b2 * x2 - (int64_t)bq->a1 * y1 -
+                          (int64_t)bq->a2 * y2 + err;
+            int32_t y0 = (int32_t)(acc >> BQ_SHIFT);
+            // Carry the truncated fraction into the next sample; without it
+            // the low bands' poles turn the rounding bias into a DC offset
+            err = (uint32_t)acc & BQ_FRAC_MASK;
+            x2 = x1;
+            x1 = x0;
+            y2 = y1;
+            y1 = y0;
+            *p = y0;
+        }
+
+        bq->x1[ch] = x1;
+        bq->x2[ch] = x2;
+        bq->y1[ch] = y1;
+        bq->y2[ch] = y2;
+        bq->err[ch] = err;
+    }
+}
+
+// Instant attack, exponential release; the only place samples are saturated
+static void stage_limiter(audio_dsp_t *dsp, const int32_t *in, int16_t *out, size_t frames)
+{
+    int32_t lg = dsp->lim_gain;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t l = in[2 * i];
+        int32_t r = in[2 * i + 1];
+        int32_t peak = l < 0 ? -l : l;
+        int32_t pr = r < 0 ? -r : r;
+        if (pr > peak) {
+            peak = pr;
+        }
+
+        if (((int64_t)peak * lg >> 15) > LIM_THRESHOLD) {
+            lg = (int32_t)(((int64_t)LIM_THRESHOLD << 15) / peak);
+        }
+
+        out[2 * i] = sat16((int32_t)((int64_t)l * lg >> 15));
+        out[2 * i + 1] = sat16((int32_t)((int64_t)r * lg >> 15));
+
+        // Rounded up, or the last 2^LIM_RELEASE steps would truncate to nothing
+        lg += (Q15_ONE - lg + (1 << LIM_RELEASE) - 1) >> LIM_RELEASE;
+    }
+    dsp->lim_gain = lg;
+}
+
+void audio_dsp_process(audio_dsp_t *dsp, int16_t *pcm, size_t frames)
+{
+    if (dsp->eq_version != dsp->eq_applied) {
+        eq_update(dsp);
+    }
+
+    while (frames) {
+        size_t n = frames < AUDIO_DSP_BLOCK_FRAMES ? frames : AUDIO_DSP_BLOCK_FRAMES;
+        uint32_t t0 = esp_cpu_get_cycle_count();
+
+        stage_gain(dsp, pcm, dsp->work, n);
+        uint32_t t1 = esp_cpu_get_cycle_count();
+
+        for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+            if (dsp->eq_active & (1 << b)) {
+                stage_biquad(&dsp->eq[b], dsp->work, n);
+            }
+        }
+        uint32_t t2 = esp_cpu_get_cycle_count();
+
+        stage_limiter(dsp, dsp->work, pcm, n);
+        uint32_t t3 = esp_cpu_get_cycle_count();
+
+        dsp->cycles[AUDIO_DSP_STAGE_GAIN] += t1 - t0;
+        dsp->cycles[AUDIO_DSP_STAGE_EQ] += t2 - t1;
+        dsp->cycles[AUDIO_DSP_STAGE_LIMITER] += t3 - t2;
+        dsp->blocks++;
+        dsp->frames += n;
+
+        pcm += n * 2;
+        frames -= n;
+    }
+}
+
+uint32_t audio_dsp_load_permille(const audio_dsp_t *dsp)
+{
+    uint64_t total = 0;
+    for (int s = 0; s < AUDIO_DSP_STAGE_COUNT; s++) {
+        total += dsp->cycles[s];
+    }
+
+    // Cycles spent vs cycles available for the audio played
+    uint64_t budget = (uint64_t)dsp->frames * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000 / dsp->sample_rate;
+    return budget ? total * 1000 / budget : 0;
+}
+
+void audio_dsp_report(const audio_dsp_t *dsp)
+{
+    if (dsp->blocks == 0) {
+        return;
+    }
+
+    uint32_t load = audio_dsp_load_permille(dsp);
+
+    ESP_LOGI(TAG, "%lu blocks: gain %lu, eq %lu (%u bands), limiter %lu cycles/block",
+             (unsigned long)dsp->blocks,
+             (unsigned long)(dsp->cycles[AUDIO_DSP_STAGE_GAIN] / dsp->blocks),
+             (unsigned long)(dsp->cycles[AUDIO_DSP_STAGE_EQ] / dsp->blocks),
+             __builtin_popcount(dsp->eq_active),
+             (unsigned long)(dsp->cycles[AUDIO_DSP_STAGE_LIMITER] / dsp->blocks));
+    if (load > AUDIO_DSP_CPU_BUDGET_PCT * 10) {
+        ESP_LOGW(TAG, "Chain load %lu.%lu%% of one core, over the %d%% budget",
+                 (unsigned long)(load / 10), (unsigned long)(load % 10), AUDIO_DSP_CPU_BUDGET_PCT);
+    } else {
+        ESP_LOGI(TAG, "Chain load %lu.%lu%% of one core",
+                 (unsigned long)(load / 10), (unsigned long)(load % 10));
+    }
+}
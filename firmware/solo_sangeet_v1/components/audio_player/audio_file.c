@@ -0,0 +1,325 @@
+#define _GNU_SOURCE     // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "audio_file.h"
+#include "audio_stats.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "AFILE";
+
+typedef struct {
+    int fd;
+    FILE *fp;
+    off_t size;
+    off_t pos;          // logical position seen through the FILE
+    off_t fd_pos;       // where the next read() on fd lands
+    // PSRAM track cache: bytes [0, loaded) of the file, capacity track_size
+    uint8_t *track;
+    size_t track_size;
+    size_t loaded;
+} audio_file_t;
+
+// Shared cluster cache
+static uint8_t *cache;
+static const audio_file_t *cache_owner;
+static off_t cache_start;
+static size_t cache_len;
+
+static audio_file_t *open_files[AUDIO_FILE_MAX_OPEN];
+
+bool audio_file_init(void)
+{
+    // DMA capable so the SD driver can transfer into it without bouncing
+    cache = heap_caps_malloc(AUDIO_FILE_CLUSTER, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (!cache) {
+        ESP_LOGE(TAG, "Failed to allocate %d byte read cache", AUDIO_FILE_CLUSTER);
+        return false;
+    }
+    return true;
+}
+
+#if AUDIO_FILE_INJECT_DELAY_MS || AUDIO_FILE_INJECT_STALL_EVERY
+static void inject_latency(void)
+{
+    static uint32_t reads;
+    uint32_t ms = AUDIO_FILE_INJECT_DELAY_MS ? esp_random() % (AUDIO_FILE_INJECT_DELAY_MS + 1) : 0;
+
+    if (AUDIO_FILE_INJECT_STALL_EVERY && ++reads % AUDIO_FILE_INJECT_STALL_EVERY == 0) {
+        ms += AUDIO_FILE_INJECT_STALL_MS;
+    }
+    if (ms) {
+        vTaskDelay(pdMS_TO_TICKS(ms));
+    }
+}
+#endif
+
+static ssize_t file_read_at(audio_file_t *af, off_t off, void *dst, size_t len)
+{
+    if (af->fd_pos != off && lseek(af->fd, off, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+#if AUDIO_FILE_INJECT_DELAY_MS || AUDIO_FILE_INJECT_STALL_EVERY
+    inject_latency();
+#endif
+    ssize_t n = read(af->fd, dst, len);
+    audio_stats_read(esp_timer_get_time() - t0, n > 0 ? n : 0);
+
+    af->fd_pos = off + (n > 0 ? n : 0);
+    return n;
+}
+
+static ssize_t audio_file_read(void *cookie, char *buf, size_t size)
+{
+    audio_file_t *af = cookie;
+    size_t done = 0;
+
+    while (done < size) {
+        off_t pos = af->pos;
+
+        if (pos < (off_t)af->loaded) {
+            size_t n = af->loaded - pos;
+            if (n > size - done) {
+                n = size - done;
+            }
+            memcpy(buf + done, af->track + pos, n);
+            af->pos += n;
+            done += n;
+            continue;
+        }
+
+        if (cache_owner == af && pos >= cache_start && pos < cache_start + (off_t)cache_len) {
+            size_t n = cache_start + cache_len - pos;
+            if (n > size - done) {
+                n = size - done;
+            }
+            memcpy(buf + done, cache + (pos - cache_start), n);
+            af->pos += n;
+            done += n;
+            continue;
+        }
+
+        size_t want = size - done;
+        if (pos % AUDIO_FILE_CLUSTER == 0 && want >= AUDIO_FILE_CLUSTER) {
+            // Whole clusters: skip the cache
+            want -= want % AUDIO_FILE_CLUSTER;
+            ssize_t n = file_read_at(af, pos, buf + done, want);
+            if (n <= 0) {
+                break;
+            }
+            af->pos += n;
+            done += n;
+            continue;
+        }
+
+        // Refill with the cluster holding pos
+        off_t start = pos - pos % AUDIO_FILE_CLUSTER;
+        cache_owner = NULL;
+        ssize_t n = file_read_at(af, start, cache, AUDIO_FILE_CLUSTER);
+        if (n <= 0) {
+            break;
+        }
+        cache_owner = af;
+        cache_start = start;
+        cache_len = n;
+        if (pos >= start + n) {
+            break;      // end of file
+        }
+    }
+
+    return done;
+}
+
+static int audio_file_seek(void *cookie, off_t *offset, int whence)
+{
+    audio_file_t *af = cookie;
+    off_t pos;
+
+    switch (whence) {
+    case SEEK_SET:
+        pos = *offset;
+        break;
+    case SEEK_CUR:
+        pos = af->pos + *offset;
+        break;
+    case SEEK_END:
+        pos = lseek(af->fd, 0, SEEK_END);
+        af->fd_pos = pos;
+        if (pos < 0) {
+            return -1;
+        }
+        pos += *offset;
+        break;
+    default:
+        return -1;
+    }
+
+    if (pos < 0) {
+        return -1;
+    }
+    // No I/O here, the next read decides what to fetch
+    af->pos = pos;
+    *offset = pos;
+    return 0;
+}
+
+static int audio_file_close(void *cookie)
+{
+    audio_file_t *af = cookie;
+
+    if (cache_owner == af) {
+        cache_owner = NULL;
+    }
+    for (int i = 0; i < AUDIO_FILE_MAX_OPEN; i++) {
+        if (open_files[i] == af) {
+            open_files[i] = NULL;
+        }
+    }
+    if (af->track) {
+        heap_caps_free(af->track);
+    }
+    int ret = close(af->fd);
+    free(af);
+    return ret;
+}
+
+FILE *audio_file_open(const char *path)
+{
+    audio_file_t *af = calloc(1, sizeof(*af));
+    if (!af) {
+        return NULL;
+    }
+
+    struct stat st;
+    af->fd = open(path, O_RDONLY);
+    if (af->fd < 0 || fstat(af->fd, &st) != 0) {
+        if (af->fd >= 0) {
+            close(af->fd);
+        }
+        free(af);
+        return NULL;
+    }
+    af->size = st.st_size;
+
+    static const cookie_io_functions_t io = {
+        .read = audio_file_read,
+        .seek = audio_file_seek,
+        .close = audio_file_close,
+    };
+    FILE *fp = fopencookie(af, "r", io);
+    if (!fp) {
+        close(af->fd);
+        free(af);
+        return NULL;
+    }
+
+    // The cluster cache is the buffer; stdio would only add a copy
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    af->fp = fp;
+    for (int i = 0; i < AUDIO_FILE_MAX_OPEN; i++) {
+        if (!open_files[i]) {
+            open_files[i] = af;
+            break;
+        }
+    }
+    return fp;
+}
+
+#if CONFIG_SPIRAM
+static audio_file_t *audio_file_find(FILE *fp)
+{
+    for (int i = 0; fp && i < AUDIO_FILE_MAX_OPEN; i++) {
+        if (open_files[i] && open_files[i]->fp == fp) {
+            return open_files[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+bool audio_file_cache(FILE *fp, bool whole)
+{
+#if CONFIG_SPIRAM
+    audio_file_t *af = audio_file_find(fp);
+    if (!af) {
+        return false;
+    }
+
+    size_t want = af->size;
+    if (!whole && want > AUDIO_FILE_HEAD_BYTES) {
+        want = AUDIO_FILE_HEAD_BYTES;
+    }
+    if (want <= af->track_size) {
+        return af->track != NULL;
+    }
+
+    // Leave PSRAM for others; a track that does not fit just streams
+    size_t grow = want - af->track_size;
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) < want ||
+        heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < grow + AUDIO_FILE_PSRAM_KEEP) {
+        ESP_LOGW(TAG, "No PSRAM for a %u byte track cache, streaming", (unsigned)want);
+        return af->track != NULL;
+    }
+
+    uint8_t *track = heap_caps_realloc(af->track, want, MALLOC_CAP_SPIRAM);
+    if (!track) {
+        return af->track != NULL;
+    }
+    af->track = track;
+    af->track_size = want;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool audio_file_load_step(FILE *fp)
+{
+#if CONFIG_SPIRAM
+    audio_file_t *af = audio_file_find(fp);
+    if (!af || af->loaded >= af->track_size) {
+        return false;
+    }
+
+    // PSRAM is not DMA capable: read whole clusters into the internal cache
+    // (one multi-block transfer each) and copy them out
+    for (int i = 0; i < AUDIO_FILE_BURST / AUDIO_FILE_CLUSTER && af->loaded < af->track_size; i++) {
+        cache_owner = NULL;
+        ssize_t n = file_read_at(af, af->loaded, cache, AUDIO_FILE_CLUSTER);
+        if (n <= 0) {
+            af->track_size = af->loaded;    // short file or read error, stop here
+            break;
+        }
+        cache_owner = af;
+        cache_start = af->loaded;
+        cache_len = n;
+
+        size_t copy = af->track_size - af->loaded;
+        if (copy > (size_t)n) {
+            copy = n;
+        }
+        memcpy(af->track + af->loaded, cache, copy);
+        af->loaded += copy;
+    }
+
+    if (af->loaded >= af->track_size && af->track_size == (size_t)af->size) {
+        ESP_LOGI(TAG, "Track cached, %u bytes", (unsigned)af->loaded);
+    }
+    return af->loaded < af->track_size;
+#else
+    return false;
+#endif
+}
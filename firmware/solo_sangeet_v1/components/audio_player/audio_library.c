@@ -0,0 +1,867 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "audio_library.h"
+#include "audio_player.h"
+#include "file_manager.h"
+#include "media_tags.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "LIBRARY";
+
+#define LIB_MAGIC       0x3442494C  // "LIB4"
+#define LIB_TMP_PATH    AUDIO_LIBRARY_PATH ".tmp"
+#define LIB_STR_PATH    AUDIO_LIBRARY_PATH ".str"
+#define LIB_REC_PATH    AUDIO_LIBRARY_PATH ".rec"
+#define LIB_KEY_LEN     8           // folded file name prefix sorted in RAM
+#define LIB_GROW        128         // sort table entries added at a time
+#define LIB_TEXT_CACHE  8           // recent artists and albums shared between records
+#define SCAN_FILL       (AUDIO_RINGBUF_SIZE * 3 / 4)  // walk waits below this while playing
+#define SCAN_WAIT_MS    50
+#define SCAN_START_MS   2000        // after the UI is up
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;                 // records
+    uint32_t strings;               // string table bytes
+    uint32_t dirs;                  // directory table entries
+} lib_header_t;
+
+// One track; text fields are string table offsets, 0 is ""
+typedef struct {
+    uint32_t dir;
+    uint32_t name;
+    uint32_t title;                 // 0: the file name stands in
+    uint32_t artist;
+    uint32_t album;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t duration_ms;
+    uint32_t art;                   // media_tags_t art_id
+} lib_rec_t;
+
+// Directory table, after the records and in the same order
+typedef struct {
+    uint32_t path;                  // string table offset
+    uint32_t time;                  // sd_dir_stamp_t as of the build
+    uint32_t sum;
+    uint16_t entries;
+    uint16_t tracks;                // records from first on
+    uint32_t first;
+} lib_dir_rec_t;
+
+typedef struct {
+    int32_t page;                   // -1 when empty
+    uint32_t len;                   // valid bytes, short at the end of the file
+    uint32_t used;                  // LRU stamp
+    uint8_t data[AUDIO_LIBRARY_PAGE_SIZE];
+} lib_page_t;
+
+// Sort table entry, the records themselves wait in LIB_REC_PATH
+typedef struct {
+    uint32_t name;                  // for ties past the key
+    uint16_t rec;                   // position in walk order
+    uint16_t dir;
+    char key[LIB_KEY_LEN];
+} lib_sort_t;
+
+typedef struct {
+    uint32_t off;                   // in the string table
+    uint32_t hash;
+    uint16_t pool;                  // in dir_pool
+    uint16_t rank;                  // position in sorted order
+    uint16_t tracks;
+    uint32_t first;
+    sd_dir_stamp_t stamp;
+} lib_dir_t;
+
+typedef struct {
+    uint32_t off;                   // 0 while the slot is unused
+    char text[AUDIO_LIBRARY_TEXT_MAX];
+} lib_text_t;
+
+typedef struct {
+    FILE *str;                      // string table as it grows
+    FILE *rec;                      // records in walk order
+    uint32_t str_len;
+    lib_sort_t *sort;
+    uint32_t count;
+    uint32_t cap;
+    lib_dir_t dirs[AUDIO_LIBRARY_MAX_DIRS];
+    uint32_t ndirs;
+    int32_t last_dir;               // files of one directory come together
+    char dir_pool[AUDIO_LIBRARY_DIR_POOL];
+    uint32_t dir_pool_len;
+    char cmp[2][AUDIO_PATH_MAX];    // names compared past their keys
+    lib_text_t text_cache[LIB_TEXT_CACHE];
+    uint32_t text_next;             // cache slot replaced next
+    media_tags_t tags;
+    uint32_t tags_read;
+    int64_t tags_us;
+    uint32_t dirs_read;             // directories whose files were visited
+    uint32_t reused;                // tracks carried over from the old index
+    bool full;
+    bool short_of_memory;
+    bool failed;
+} lib_build_t;
+
+static TaskHandle_t lib_task_hdl = NULL;
+static SemaphoreHandle_t lib_lock;  // index file, its header and the page cache
+static FILE *lib_fp = NULL;
+static uint32_t s_count = 0;
+static uint32_t s_dirs = 0;
+static uint32_t s_dir_base = 0;     // file offset of the directory table
+static uint32_t s_str_base = 0;     // file offset of the string table
+static uint32_t s_generation = 0;
+static lib_page_t s_pages[AUDIO_LIBRARY_PAGES];
+static uint32_t s_page_clock = 0;
+static lib_build_t *s_build;        // for the qsort comparators
+
+static uint32_t str_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+// strcasecmp with a length limit on a only
+static int fold_cmp(const char *a, size_t alen, const char *b)
+{
+    for (size_t i = 0;; i++) {
+        int ca = i < alen ? tolower((unsigned char)a[i]) : 0;
+        int cb = tolower((unsigned char)b[i]);
+        if (ca != cb || ca == 0) {
+            return ca - cb;
+        }
+    }
+}
+
+/* ---- reading ---- */
+
+static void lib_cache_reset(void)
+{
+    for (int i = 0; i < AUDIO_LIBRARY_PAGES; i++) {
+        s_pages[i].page = -1;
+        s_pages[i].used = 0;
+    }
+}
+
+static const lib_page_t *lib_page(uint32_t page)
+{
+    lib_page_t *victim = &s_pages[0];
+
+    for (int i = 0; i < AUDIO_LIBRARY_PAGES; i++) {
+        lib_page_t *p = &s_pages[i];
+        if (p->page == (int32_t)page) {
+            p->used = ++s_page_clock;
+            return p;
+        }
+        if (p->used < victim->used) {
+            victim = p;
+        }
+    }
+
+    victim->page = -1;
+    if (fseek(lib_fp, page * AUDIO_LIBRARY_PAGE_SIZE, SEEK_SET) != 0) {
+        return NULL;
+    }
+    victim->len = fread(victim->data, 1, AUDIO_LIBRARY_PAGE_SIZE, lib_fp);
+    if (victim->len == 0) {
+        return NULL;
+    }
+    victim->page = page;
+    victim->used = ++s_page_clock;
+    return victim;
+}
+
+static bool lib_read(uint32_t off, void *dst, size_t len)
+{
+    uint8_t *out = dst;
+
+    while (len) {
+        const lib_page_t *p = lib_page(off / AUDIO_LIBRARY_PAGE_SIZE);
+        uint32_t at = off % AUDIO_LIBRARY_PAGE_SIZE;
+        if (!p || at >= p->len) {
+            return false;
+        }
+        size_t n = p->len - at < len ? p->len - at : len;
+        memcpy(out, p->data + at, n);
+        out += n;
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+// NUL-terminated string from the table, cut to len - 1
+static bool lib_read_str(uint32_t off, char *dst, size_t len)
+{
+    off += s_str_base;
+
+    while (len > 1) {
+        const lib_page_t *p = lib_page(off / AUDIO_LIBRARY_PAGE_SIZE);
+        uint32_t at = off % AUDIO_LIBRARY_PAGE_SIZE;
+        if (!p || at >= p->len) {
+            return false;
+        }
+        size_t n = p->len - at < len - 1 ? p->len - at : len - 1;
+        const uint8_t *end = memchr(p->data + at, 0, n);
+        if (end) {
+            n = end - (p->data + at);
+        }
+        memcpy(dst, p->data + at, n);
+        dst += n;
+        off += n;
+        len -= n;
+        if (end) {
+            break;
+        }
+    }
+    *dst = '\0';
+    return true;
+}
+
+static bool lib_read_rec(uint32_t index, lib_rec_t *rec)
+{
+    return index < s_count && lib_read(sizeof(lib_header_t) + index * sizeof(lib_rec_t), rec, sizeof(*rec));
+}
+
+// Open the index on the card, called with lib_lock held
+static bool lib_load(void)
+{
+    lib_header_t hdr;
+    struct stat st;
+
+    if (lib_fp) {
+        fclose(lib_fp);
+        lib_fp = NULL;
+    }
+    s_count = 0;
+    s_dirs = 0;
+    lib_cache_reset();
+
+    if (stat(AUDIO_LIBRARY_PATH, &st) != 0) {
+        return false;
+    }
+    lib_fp = fopen(AUDIO_LIBRARY_PATH, "rb");
+    if (!lib_fp) {
+        return false;
+    }
+    // The page cache is the buffer
+    setvbuf(lib_fp, NULL, _IONBF, 0);
+
+    if (fread(&hdr, sizeof(hdr), 1, lib_fp) != 1 || hdr.magic != LIB_MAGIC ||
+        sizeof(hdr) + (uint64_t)hdr.count * sizeof(lib_rec_t) + (uint64_t)hdr.dirs * sizeof(lib_dir_rec_t) +
+        hdr.strings != (uint64_t)st.st_size) {
+        ESP_LOGW(TAG, "Ignoring %s, bad header", AUDIO_LIBRARY_PATH);
+        fclose(lib_fp);
+        lib_fp = NULL;
+        return false;
+    }
+
+    s_count = hdr.count;
+    s_dirs = hdr.dirs;
+    s_dir_base = sizeof(hdr) + hdr.count * sizeof(lib_rec_t);
+    s_str_base = s_dir_base + hdr.dirs * sizeof(lib_dir_rec_t);
+    s_generation++;
+    return true;
+}
+
+// Directory entry of the current index, binary search like the records
+static bool lib_find_dir(const char *dir, lib_dir_rec_t *out)
+{
+    char str[AUDIO_PATH_MAX];
+    bool found = false;
+
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+    uint32_t lo = 0, hi = s_dirs;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (!lib_read(s_dir_base + mid * sizeof(lib_dir_rec_t), out, sizeof(*out)) ||
+            !lib_read_str(out->path, str, sizeof(str))) {
+            break;
+        }
+        int r = strcasecmp(dir, str);
+        if (r == 0) {
+            found = true;
+            break;
+        }
+        if (r > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    xSemaphoreGive(lib_lock);
+
+    return found;
+}
+
+/* ---- building ---- */
+
+static void *build_alloc(size_t size)
+{
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + AUDIO_LIBRARY_HEAP_RESERVE) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+// Stay out of the reader's way while it is refilling the ring
+static void build_throttle(void)
+{
+    while (audio_player_is_playing() && audio_ring_fill(&audio_ring) < SCAN_FILL) {
+        vTaskDelay(pdMS_TO_TICKS(SCAN_WAIT_MS));
+    }
+}
+
+static uint32_t build_str(lib_build_t *b, const char *s, size_t len)
+{
+    uint32_t off = b->str_len;
+
+    if (fwrite(s, 1, len, b->str) != len || fputc('\0', b->str) == EOF) {
+        b->failed = true;
+        return 0;
+    }
+    b->str_len += len + 1;
+    return off;
+}
+
+// Tag text; tracks of an album come together, so a few recent strings catch the repeats
+static uint32_t build_text(lib_build_t *b, const char *s)
+{
+    if (!*s) {
+        return 0;
+    }
+    for (int i = 0; i < LIB_TEXT_CACHE; i++) {
+        if (b->text_cache[i].off && strcmp(b->text_cache[i].text, s) == 0) {
+            return b->text_cache[i].off;
+        }
+    }
+
+    size_t len = strnlen(s, AUDIO_LIBRARY_TEXT_MAX - 1);
+    uint32_t off = build_str(b, s, len);
+    if (off) {
+        lib_text_t *e = &b->text_cache[b->text_next++ % LIB_TEXT_CACHE];
+        memcpy(e->text, s, len);
+        e->text[len] = '\0';
+        e->off = off;
+    }
+    return off;
+}
+
+// Intern a directory, -1 if the table is full
+static int32_t build_dir(lib_build_t *b, const char *dir, size_t len)
+{
+    uint32_t hash = str_hash(dir, len);
+
+    if (b->last_dir >= 0) {
+        const lib_dir_t *d = &b->dirs[b->last_dir];
+        if (d->hash == hash && fold_cmp(dir, len, b->dir_pool + d->pool) == 0) {
+            return b->last_dir;
+        }
+    }
+    for (uint32_t i = 0; i < b->ndirs; i++) {
+        if (b->dirs[i].hash == hash && fold_cmp(dir, len, b->dir_pool + b->dirs[i].pool) == 0) {
+            return b->last_dir = i;
+        }
+    }
+
+    if (b->ndirs == AUDIO_LIBRARY_MAX_DIRS || b->dir_pool_len + len + 1 > sizeof(b->dir_pool)) {
+        return -1;
+    }
+    lib_dir_t *d = &b->dirs[b->ndirs];
+    d->hash = hash;
+    d->pool = b->dir_pool_len;
+    d->off = build_str(b, dir, len);
+    memcpy(b->dir_pool + d->pool, dir, len);
+    b->dir_pool[d->pool + len] = '\0';
+    b->dir_pool_len += len + 1;
+    return b->last_dir = b->ndirs++;
+}
+
+static bool build_grow(lib_build_t *b)
+{
+    if (b->count < b->cap) {
+        return true;
+    }
+
+    size_t size = (b->cap + LIB_GROW) * sizeof(lib_sort_t);
+    lib_sort_t *sort = build_alloc(size);
+    if (!sort) {
+        return false;
+    }
+    if (b->sort) {
+        memcpy(sort, b->sort, b->count * sizeof(lib_sort_t));
+        free(b->sort);
+    }
+    b->sort = sort;
+    b->cap += LIB_GROW;
+    return true;
+}
+
+static void build_add(lib_build_t *b, int32_t dir, const lib_rec_t *rec, const char *name)
+{
+    lib_sort_t *e = &b->sort[b->count];
+
+    e->name = rec->name;
+    e->rec = b->count;
+    e->dir = dir;
+    for (int i = 0; i < LIB_KEY_LEN; i++) {
+        e->key[i] = (char)tolower((unsigned char)*name);
+        name += *name != '\0';
+    }
+
+    if (fwrite(rec, sizeof(*rec), 1, b->rec) != 1) {
+        b->failed = true;
+    }
+    b->count++;
+}
+
+static bool build_visit(const char *path, const struct stat *st, void *arg)
+{
+    lib_build_t *b = arg;
+    const char *name = strrchr(path, '/');
+
+    if (!name || !audio_path_is_track(path)) {
+        return true;
+    }
+    name++;
+
+    int32_t dir = b->count < AUDIO_LIBRARY_MAX_TRACKS ? build_dir(b, path, name - 1 - path) : -1;
+    if (dir < 0) {
+        b->full = true;
+        return false;
+    }
+    if (!build_grow(b)) {
+        b->short_of_memory = true;
+        return false;
+    }
+
+    build_throttle();
+
+    // Read once here so nothing parses tags at play time
+    int64_t t0 = esp_timer_get_time();
+    media_tags_read(path, &b->tags);
+    b->tags_us += esp_timer_get_time() - t0;
+    b->tags_read++;
+
+    lib_rec_t rec = {
+        .dir = b->dirs[dir].off,
+        .name = build_str(b, name, strlen(name)),
+        .title = build_text(b, b->tags.title),
+        .artist = build_text(b, b->tags.artist),
+        .album = build_text(b, b->tags.album),
+        .size = (uint32_t)st->st_size,
+        .mtime = (uint32_t)st->st_mtime,
+        .duration_ms = b->tags.duration_ms,
+        .art = b->tags.art_id,
+    };
+    build_add(b, dir, &rec, name);
+    return !b->failed;
+}
+
+// Carry an unchanged directory's tracks over from the current index
+static void build_reuse(lib_build_t *b, int32_t dir, const lib_dir_rec_t *old)
+{
+    char *str = b->cmp[0];
+    lib_rec_t rec;
+
+    for (uint32_t i = old->first; i < old->first + old->tracks && !b->failed; i++) {
+        if (b->count == AUDIO_LIBRARY_MAX_TRACKS) {
+            b->full = true;
+            return;
+        }
+        if (!build_grow(b)) {
+            b->short_of_memory = true;
+            return;
+        }
+
+        xSemaphoreTake(lib_lock, portMAX_DELAY);
+        bool ok = lib_read_rec(i, &rec);
+        uint32_t *text[] = { &rec.title, &rec.artist, &rec.album, &rec.name };
+        for (int t = 0; ok && t < 4; t++) {
+            ok = !*text[t] || lib_read_str(*text[t], str, AUDIO_PATH_MAX);
+            if (ok && *text[t]) {
+                *text[t] = t < 3 ? build_text(b, str) : build_str(b, str, strlen(str));
+            }
+        }
+        xSemaphoreGive(lib_lock);
+
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to read %s", AUDIO_LIBRARY_PATH);
+            b->failed = true;
+            return;
+        }
+        // str still holds the name
+        rec.dir = b->dirs[dir].off;
+        build_add(b, dir, &rec, str);
+        b->reused++;
+    }
+}
+
+static bool build_visit_dir(const char *dir, const sd_dir_stamp_t *stamp, void *arg)
+{
+    lib_build_t *b = arg;
+    lib_dir_rec_t old;
+    int32_t d = build_dir(b, dir, strlen(dir));
+
+    if (d < 0) {
+        b->full = true;
+        return false;
+    }
+    b->dirs[d].stamp = *stamp;
+
+    // Same entries as at the last build: nothing in it needs reading
+    if (lib_find_dir(dir, &old) && old.time == stamp->time && old.sum == stamp->sum &&
+        old.entries == stamp->entries) {
+        build_reuse(b, d, &old);
+        return false;
+    }
+    b->dirs_read++;
+    return !b->full && !b->short_of_memory && !b->failed;
+}
+
+static int dir_cmp(const void *a, const void *b)
+{
+    const lib_dir_t *da = &s_build->dirs[*(const uint16_t *)a];
+    const lib_dir_t *db = &s_build->dirs[*(const uint16_t *)b];
+
+    return strcasecmp(s_build->dir_pool + da->pool, s_build->dir_pool + db->pool);
+}
+
+// Name and whatever follows it, the NUL ends the compare
+static void build_name(lib_build_t *b, uint32_t off, char *dst)
+{
+    size_t n = 0;
+
+    if (fseek(b->str, off, SEEK_SET) == 0) {
+        n = fread(dst, 1, AUDIO_PATH_MAX - 1, b->str);
+    }
+    dst[n] = '\0';
+}
+
+static int sort_cmp(const void *a, const void *b)
+{
+    const lib_sort_t *ea = a, *eb = b;
+    int r = (int)s_build->dirs[ea->dir].rank - (int)s_build->dirs[eb->dir].rank;
+
+    if (r == 0) {
+        r = memcmp(ea->key, eb->key, LIB_KEY_LEN);
+    }
+    // Keys alike and both longer than a key: only now go to the card
+    if (r == 0 && ea->key[LIB_KEY_LEN - 1] != '\0') {
+        build_name(s_build, ea->name, s_build->cmp[0]);
+        build_name(s_build, eb->name, s_build->cmp[1]);
+        r = strcasecmp(s_build->cmp[0], s_build->cmp[1]);
+    }
+    return r;
+}
+
+// Sorted records and the string table into LIB_TMP_PATH
+static bool build_write(lib_build_t *b)
+{
+    FILE *out = fopen(LIB_TMP_PATH, "wb");
+    lib_header_t hdr = {
+        .magic = LIB_MAGIC,
+        .count = b->count,
+        .strings = b->str_len,
+        .dirs = b->ndirs,
+    };
+    uint16_t order[AUDIO_LIBRARY_MAX_DIRS];
+    lib_rec_t rec;
+    bool ok;
+
+    if (!out) {
+        ESP_LOGE(TAG, "Failed to create %s", LIB_TMP_PATH);
+        return false;
+    }
+
+    s_build = b;
+    for (uint32_t i = 0; i < b->ndirs; i++) {
+        order[i] = i;
+    }
+    qsort(order, b->ndirs, sizeof(order[0]), dir_cmp);
+    for (uint32_t i = 0; i < b->ndirs; i++) {
+        b->dirs[order[i]].rank = i;
+    }
+    qsort(b->sort, b->count, sizeof(lib_sort_t), sort_cmp);
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+    for (uint32_t i = 0; ok && i < b->count; i++) {
+        lib_dir_t *d = &b->dirs[b->sort[i].dir];
+        if (d->tracks++ == 0) {
+            d->first = i;
+        }
+        ok = fseek(b->rec, b->sort[i].rec * sizeof(rec), SEEK_SET) == 0 &&
+             fread(&rec, sizeof(rec), 1, b->rec) == 1 &&
+             fwrite(&rec, sizeof(rec), 1, out) == 1;
+    }
+
+    // Stamps for the next build, in the records' directory order
+    for (uint32_t i = 0; ok && i < b->ndirs; i++) {
+        const lib_dir_t *d = &b->dirs[order[i]];
+        lib_dir_rec_t dr = {
+            .path = d->off,
+            .time = d->stamp.time,
+            .sum = d->stamp.sum,
+            .entries = d->stamp.entries,
+            .tracks = d->tracks,
+            .first = d->first,
+        };
+        ok = fwrite(&dr, sizeof(dr), 1, out) == 1;
+    }
+
+    ok = ok && fseek(b->str, 0, SEEK_SET) == 0;
+    for (uint32_t left = b->str_len; ok && left;) {
+        size_t n = left < sizeof(b->cmp) ? left : sizeof(b->cmp);
+        ok = fread(b->cmp, 1, n, b->str) == n && fwrite(b->cmp, 1, n, out) == n;
+        left -= n;
+    }
+
+    ok = (fclose(out) == 0) && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", LIB_TMP_PATH);
+        remove(LIB_TMP_PATH);
+    }
+    return ok;
+}
+
+// One walk over the card, false if it has to be retried later
+static bool build_pass(void)
+{
+    lib_build_t *b = build_alloc(sizeof(lib_build_t));
+    int64_t t0 = esp_timer_get_time();
+    bool incremental = s_dirs > 0;
+    bool ok = false;
+
+    if (!b) {
+        ESP_LOGW(TAG, "Not enough memory to build the library, retrying later");
+        return false;
+    }
+    memset(b, 0, sizeof(*b));
+    b->last_dir = -1;
+
+    b->str = fopen(LIB_STR_PATH, "w+b");
+    b->rec = fopen(LIB_REC_PATH, "w+b");
+    if (!b->str || !b->rec) {
+        ESP_LOGE(TAG, "Failed to create build files");
+        b->failed = true;
+    } else {
+        // Offset 0 is the empty string
+        build_str(b, "", 0);
+        sd_fs_walk_dirs(SD_MOUNT_POINT, build_visit_dir, build_visit, b);
+    }
+
+    ESP_LOGI(TAG, "%s scan: %lu dirs, %lu read, %lu tracks kept, %lu found, %lld ms",
+             incremental ? "Incremental" : "Full", (unsigned long)b->ndirs, (unsigned long)b->dirs_read,
+             (unsigned long)b->reused, (unsigned long)(b->count - b->reused),
+             (esp_timer_get_time() - t0) / 1000);
+    if (b->tags_read) {
+        ESP_LOGI(TAG, "Tags of %lu tracks read in %lld ms, %lld per second", (unsigned long)b->tags_read,
+                 b->tags_us / 1000, (int64_t)b->tags_read * 1000000 / (b->tags_us ? b->tags_us : 1));
+    }
+
+    if (b->full) {
+        ESP_LOGW(TAG, "Library full, indexing the first %lu tracks", (unsigned long)b->count);
+    }
+    if (b->short_of_memory) {
+        ESP_LOGW(TAG, "Not enough memory at %lu tracks, retrying later", (unsigned long)b->count);
+    } else if (!b->failed && incremental && b->dirs_read == 0 && b->ndirs == s_dirs) {
+        // No directory changed or went away, keep the index and its generation
+        ok = true;
+    } else if (!b->failed && build_write(b)) {
+        // FAT cannot rename over an existing file
+        xSemaphoreTake(lib_lock, portMAX_DELAY);
+        if (lib_fp) {
+            fclose(lib_fp);
+            lib_fp = NULL;
+        }
+        remove(AUDIO_LIBRARY_PATH);
+        ok = rename(LIB_TMP_PATH, AUDIO_LIBRARY_PATH) == 0;
+        lib_load();
+        xSemaphoreGive(lib_lock);
+
+        if (ok) {
+            ESP_LOGI(TAG, "Indexed %lu tracks in %lu dirs, %lu bytes of strings, %lld ms",
+                     (unsigned long)b->count, (unsigned long)b->ndirs, (unsigned long)b->str_len,
+                     (esp_timer_get_time() - t0) / 1000);
+        } else {
+            ESP_LOGE(TAG, "Failed to replace %s", AUDIO_LIBRARY_PATH);
+        }
+    }
+
+    if (b->str) {
+        fclose(b->str);
+    }
+    if (b->rec) {
+        fclose(b->rec);
+    }
+    remove(LIB_STR_PATH);
+    remove(LIB_REC_PATH);
+    free(b->sort);
+    bool retry = b->short_of_memory;
+    free(b);
+    return ok || !retry;
+}
+
+static void audio_library_task(void *arg)
+{
+    // The index from the last boot is in use meanwhile, only changed directories are read
+    bool pending = true;
+
+    vTaskDelay(pdMS_TO_TICKS(SCAN_START_MS));
+
+    while (1) {
+        if (pending) {
+            pending = !build_pass();
+        }
+        TickType_t wait = pending ? pdMS_TO_TICKS(AUDIO_LIBRARY_RETRY_MS) : portMAX_DELAY;
+        pending = ulTaskNotifyTake(pdTRUE, wait) || pending;
+    }
+}
+
+bool audio_library_init(void)
+{
+    lib_lock = xSemaphoreCreateMutex();
+    if (!lib_lock) {
+        return false;
+    }
+
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+    if (lib_load()) {
+        ESP_LOGI(TAG, "%lu tracks from %s", (unsigned long)s_count, AUDIO_LIBRARY_PATH);
+    }
+    xSemaphoreGive(lib_lock);
+
+    if (xTaskCreate(audio_library_task, "audio_lib", 4096, NULL, tskIDLE_PRIORITY + 1,
+                    &lib_task_hdl) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start library scanner");
+        return false;
+    }
+    return true;
+}
+
+uint32_t audio_library_count(void)
+{
+    return s_count;
+}
+
+uint32_t audio_library_generation(void)
+{
+    return s_generation;
+}
+
+bool audio_library_get(uint32_t index, audio_library_track_t *out)
+{
+    lib_rec_t rec;
+    bool ok;
+
+    if (!lib_lock) {
+        return false;
+    }
+
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+    ok = lib_read_rec(index, &rec) &&
+         lib_read_str(rec.title ? rec.title : rec.name, out->title, sizeof(out->title)) &&
+         lib_read_str(rec.artist, out->artist, sizeof(out->artist)) &&
+         lib_read_str(rec.album, out->album, sizeof(out->album));
+    xSemaphoreGive(lib_lock);
+
+    if (!ok) {
+        return false;
+    }
+    if (!rec.title) {
+        char *dot = strrchr(out->title, '.');
+        if (dot && dot != out->title) {
+            *dot = '\0';
+        }
+    }
+    out->size = rec.size;
+    out->mtime = rec.mtime;
+    out->duration_ms = rec.duration_ms;
+    out->art = rec.art;
+    return true;
+}
+
+bool audio_library_path(uint32_t index, char *buf, size_t len)
+{
+    lib_rec_t rec;
+    bool ok;
+
+    if (!lib_lock || len < 2) {
+        return false;
+    }
+
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+    ok = lib_read_rec(index, &rec) && lib_read_str(rec.dir, buf, len - 1);
+    if (ok) {
+        size_t n = strlen(buf);
+        buf[n++] = '/';
+        ok = lib_read_str(rec.name, buf + n, len - n);
+    }
+    xSemaphoreGive(lib_lock);
+
+    return ok;
+}
+
+int32_t audio_library_find(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    char str[AUDIO_PATH_MAX];
+    int32_t found = -1;
+
+    if (!lib_lock || !name) {
+        return -1;
+    }
+    size_t dir_len = name++ - path;
+
+    // Same order as the build: directory first, then file name
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+    uint32_t lo = 0, hi = s_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        lib_rec_t rec;
+
+        if (!lib_read_rec(mid, &rec) || !lib_read_str(rec.dir, str, sizeof(str))) {
+            break;
+        }
+        int r = fold_cmp(path, dir_len, str);
+        if (r == 0) {
+            if (!lib_read_str(rec.name, str, sizeof(str))) {
+                break;
+            }
+            r = strcasecmp(name, str);
+        }
+        if (r == 0) {
+            found = mid;
+            break;
+        }
+        if (r > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    xSemaphoreGive(lib_lock);
+
+    return found;
+}
+
+void audio_library_rescan(void)
+{
+    if (lib_task_hdl) {
+        xTaskNotifyGive(lib_task_hdl);
+    }
+}
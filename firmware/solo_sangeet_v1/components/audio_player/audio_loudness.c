@@ -0,0 +1,649 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "audio_loudness.h"
+#include "audio_player.h"
+#include "wav_parser.h"
+#include "mp3_decoder.h"
+#include "flac_decoder.h"
+#include "file_manager.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "LOUDNESS";
+
+#define DB_MAGIC        0x3144554C  // "LUD1"
+#define DB_TMP_PATH     AUDIO_LOUDNESS_DB_PATH ".tmp"
+#define SCAN_IO_BUF     4096
+#define SCAN_PCM_BYTES  MP3_PCM_BUF_BYTES
+#define SCAN_WAIT_MS    50          // poll period while the ring is low
+#define SCAN_START_MS   10000       // let BT and the UI take their memory first
+
+// Meter
+#define HIST_MIN        (-70)       // LUFS, also the absolute gate
+#define HIST_BINS       750         // 0.1 LU steps up to +5 LUFS
+#define REL_GATE        10          // LU below the ungated mean
+#define TP_TAPS         12          // per phase of the 4x interpolator
+#define TP_PHASES       4
+#define TP_MARGIN       0.5f        // only interpolate within 6 dB of the peak
+
+// One sidecar entry, the file is a magic word then these sorted by key
+typedef struct {
+    uint32_t key;                   // FNV-1a of the path
+    uint32_t size;
+    uint32_t mtime;
+    int16_t lufs;
+    int16_t peak;
+} db_rec_t;
+
+typedef struct {
+    float b0, b1, b2, a1, a2;
+    float x1, x2, y1, y2;
+} kw_biquad_t;
+
+typedef struct {
+    uint8_t channels;
+    kw_biquad_t shelf[2];           // K-weighting: high shelf then high pass
+    kw_biquad_t hpf[2];
+    uint32_t sub_len;               // frames in 100 ms
+    uint32_t sub_pos;
+    float sub_sum;
+    float sub[4];                   // energy of the last four 100 ms pieces
+    uint32_t subs;
+    uint32_t hist[HIST_BINS];       // 400 ms block loudness, 75% overlap
+    float tp_hist[2][TP_TAPS * 2];  // written twice so a window is contiguous
+    uint32_t tp_pos;
+    float peak;
+} meter_t;
+
+typedef struct {
+    int16_t pcm[SCAN_PCM_BYTES / 2];
+    char io[SCAN_IO_BUF];
+    meter_t meter;
+    audio_codec_t codec;
+    mp3_decoder_t *mp3;
+    flac_decoder_t *flac;
+    wav_info_t wav;
+    uint32_t wav_left;
+    FILE *db;                       // sidecar as of the last merge
+    db_rec_t pending[AUDIO_LOUDNESS_BATCH];
+    uint32_t npending;
+    uint32_t scanned;
+    bool short_of_memory;
+} scan_t;
+
+static TaskHandle_t scan_task_hdl = NULL;
+static SemaphoreHandle_t db_lock;   // held while the sidecar is swapped or read
+static float s_tp_coef[TP_PHASES - 1][TP_TAPS];
+
+static uint32_t path_key(const char *path)
+{
+    uint32_t h = 2166136261u;
+
+    while (*path) {
+        h = (h ^ (uint8_t)*path++) * 16777619u;
+    }
+    return h;
+}
+
+// Windowed sinc for the points 1/4, 2/4 and 3/4 between samples 5 and 6
+static void tp_tables_init(void)
+{
+    for (int p = 1; p < TP_PHASES; p++) {
+        float sum = 0;
+        for (int j = 0; j < TP_TAPS; j++) {
+            float t = (float)p / TP_PHASES + (TP_TAPS / 2 - 1) - j;
+            float x = (float)M_PI * t;
+            float w = 0.5f * (1 + cosf(x / (TP_TAPS / 2)));
+            s_tp_coef[p - 1][j] = sinf(x) / x * w;
+            sum += s_tp_coef[p - 1][j];
+        }
+        for (int j = 0; j < TP_TAPS; j++) {
+            s_tp_coef[p - 1][j] /= sum;
+        }
+    }
+}
+
+// BS.1770 pre-filter, coefficients for any rate as derived for libebur128
+static void meter_begin(meter_t *m, uint32_t rate, uint8_t channels)
+{
+    memset(m, 0, sizeof(*m));
+    m->channels = channels > 1 ? 2 : 1;
+    m->sub_len = rate / 10;
+
+    double K = tan(M_PI * 1681.974450955533 / rate);
+    double Q = 0.7071752369554196;
+    double Vh = pow(10.0, 3.999843853973347 / 20);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+    kw_biquad_t shelf = {
+        .b0 = (Vh + Vb * K / Q + K * K) / a0,
+        .b1 = 2 * (K * K - Vh) / a0,
+        .b2 = (Vh - Vb * K / Q + K * K) / a0,
+        .a1 = 2 * (K * K - 1) / a0,
+        .a2 = (1 - K / Q + K * K) / a0,
+    };
+
+    K = tan(M_PI * 38.13547087602444 / rate);
+    Q = 0.5003270373238773;
+    a0 = 1 + K / Q + K * K;
+    kw_biquad_t hpf = {
+        .b0 = 1, .b1 = -2, .b2 = 1,
+        .a1 = 2 * (K * K - 1) / a0,
+        .a2 = (1 - K / Q + K * K) / a0,
+    };
+
+    for (int c = 0; c < 2; c++) {
+        m->shelf[c] = shelf;
+        m->hpf[c] = hpf;
+    }
+}
+
+static inline float biquad_run(kw_biquad_t *f, float x)
+{
+    float y = f->b0 * x + f->b1 * f->x1 + f->b2 * f->x2 - f->a1 * f->y1 - f->a2 * f->y2;
+
+    f->x2 = f->x1;
+    f->x1 = x;
+    f->y2 = f->y1;
+    f->y1 = y;
+    return y;
+}
+
+/*
+ * Inter-sample peaks sit next to large samples, so the three interpolated
+ * points are only worked out where one of the two neighbours is within
+ * TP_MARGIN of the peak so far. Results lag the input by half a window.
+ */
+static void tp_feed(meter_t *m, int c, float x)
+{
+    float *h = m->tp_hist[c];
+    uint32_t pos = m->tp_pos;
+    float a = fabsf(x);
+
+    h[pos] = h[pos + TP_TAPS] = x;
+    if (a > m->peak) {
+        m->peak = a;
+    }
+
+    const float *w = &h[pos + 1];       // oldest first
+    float limit = m->peak * TP_MARGIN;
+    if (fabsf(w[TP_TAPS / 2 - 1]) < limit && fabsf(w[TP_TAPS / 2]) < limit) {
+        return;
+    }
+    for (int p = 0; p < TP_PHASES - 1; p++) {
+        float y = 0;
+        for (int j = 0; j < TP_TAPS; j++) {
+            y += w[j] * s_tp_coef[p][j];
+        }
+        y = fabsf(y);
+        if (y > m->peak) {
+            m->peak = y;
+        }
+    }
+}
+
+static void meter_block(meter_t *m)
+{
+    m->sub[m->subs++ & 3] = m->sub_sum / m->sub_len;
+    m->sub_sum = 0;
+    m->sub_pos = 0;
+    if (m->subs < 4) {
+        return;
+    }
+
+    float e = (m->sub[0] + m->sub[1] + m->sub[2] + m->sub[3]) / 4;
+    if (e <= 0) {
+        return;
+    }
+    float lufs = -0.691f + 10 * log10f(e);
+    if (lufs < HIST_MIN) {
+        return;
+    }
+    int bin = (int)((lufs - HIST_MIN) * 10);
+    m->hist[bin < HIST_BINS ? bin : HIST_BINS - 1]++;
+}
+
+static void meter_feed(meter_t *m, const int16_t *pcm, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        float e = 0;
+        for (int c = 0; c < m->channels; c++) {
+            float x = pcm[2 * i + c] * (1.0f / 32768);
+            float z = biquad_run(&m->hpf[c], biquad_run(&m->shelf[c], x));
+            e += z * z;
+            tp_feed(m, c, x);
+        }
+        m->tp_pos = (m->tp_pos + 1) % TP_TAPS;
+        m->sub_sum += e;
+        if (++m->sub_pos == m->sub_len) {
+            meter_block(m);
+        }
+    }
+}
+
+static float bin_energy(int b)
+{
+    return powf(10, (HIST_MIN + (b + 0.5f) / 10 + 0.691f) / 10);
+}
+
+// Gated mean over the histogram, in 1/100 LU
+static int16_t meter_integrated(const meter_t *m)
+{
+    double sum = 0;
+    uint32_t n = 0;
+
+    for (int b = 0; b < HIST_BINS; b++) {
+        sum += (double)m->hist[b] * bin_energy(b);
+        n += m->hist[b];
+    }
+    if (n == 0) {
+        return AUDIO_LOUDNESS_UNKNOWN;
+    }
+
+    float gate = -0.691f + 10 * log10f(sum / n) - REL_GATE;
+    int first = gate > HIST_MIN ? (int)ceilf((gate - HIST_MIN) * 10 - 0.5f) : 0;
+
+    sum = 0;
+    n = 0;
+    for (int b = first; b < HIST_BINS; b++) {
+        sum += (double)m->hist[b] * bin_energy(b);
+        n += m->hist[b];
+    }
+    if (n == 0) {
+        return AUDIO_LOUDNESS_UNKNOWN;
+    }
+    return (int16_t)lroundf(100 * (-0.691f + 10 * log10f(sum / n)));
+}
+
+static int16_t meter_peak(const meter_t *m)
+{
+    float db = m->peak > 0 ? 20 * log10f(m->peak) : HIST_MIN;
+
+    return (int16_t)lroundf(100 * (db > HIST_MIN ? db : HIST_MIN));
+}
+
+/* ---- sidecar ---- */
+
+static int rec_cmp(const void *a, const void *b)
+{
+    uint32_t ka = ((const db_rec_t *)a)->key, kb = ((const db_rec_t *)b)->key;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+static FILE *db_open(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    uint32_t magic;
+
+    if (fp && (fread(&magic, sizeof(magic), 1, fp) != 1 || magic != DB_MAGIC)) {
+        ESP_LOGW(TAG, "Ignoring %s, bad header", path);
+        fclose(fp);
+        fp = NULL;
+    }
+    return fp;
+}
+
+// Binary search straight on the card, one record read per step
+static bool db_find(FILE *db, uint32_t key, db_rec_t *out)
+{
+    if (fseek(db, 0, SEEK_END) != 0) {
+        return false;
+    }
+    long lo = 0, hi = (ftell(db) - (long)sizeof(uint32_t)) / (long)sizeof(db_rec_t);
+
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (fseek(db, sizeof(uint32_t) + mid * sizeof(db_rec_t), SEEK_SET) != 0 ||
+            fread(out, sizeof(*out), 1, db) != 1) {
+            return false;
+        }
+        if (out->key == key) {
+            return true;
+        }
+        if (out->key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+/*
+ * Merge the pending results into a new sidecar beside the old one, then
+ * swap them. Lookups only wait for the swap, not for the rewrite.
+ */
+static bool db_merge(scan_t *s)
+{
+    FILE *out = fopen(DB_TMP_PATH, "wb");
+    uint32_t magic = DB_MAGIC;
+    db_rec_t old;
+    bool have_old = false;
+    bool ok;
+
+    if (!out) {
+        ESP_LOGE(TAG, "Failed to create %s", DB_TMP_PATH);
+        return false;
+    }
+
+    qsort(s->pending, s->npending, sizeof(db_rec_t), rec_cmp);
+
+    ok = fwrite(&magic, sizeof(magic), 1, out) == 1;
+    if (s->db) {
+        fseek(s->db, sizeof(uint32_t), SEEK_SET);
+        have_old = fread(&old, sizeof(old), 1, s->db) == 1;
+    }
+    for (uint32_t i = 0; ok && (have_old || i < s->npending);) {
+        if (i < s->npending && (!have_old || s->pending[i].key <= old.key)) {
+            if (have_old && s->pending[i].key == old.key) {
+                have_old = fread(&old, sizeof(old), 1, s->db) == 1;    // rescanned
+            }
+            ok = fwrite(&s->pending[i++], sizeof(db_rec_t), 1, out) == 1;
+        } else {
+            ok = fwrite(&old, sizeof(old), 1, out) == 1;
+            have_old = fread(&old, sizeof(old), 1, s->db) == 1;
+        }
+    }
+    ok = (fclose(out) == 0) && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", DB_TMP_PATH);
+        remove(DB_TMP_PATH);
+        return false;
+    }
+
+    if (s->db) {
+        fclose(s->db);
+        s->db = NULL;
+    }
+
+    // FAT cannot rename over an existing file
+    xSemaphoreTake(db_lock, portMAX_DELAY);
+    remove(AUDIO_LOUDNESS_DB_PATH);
+    ok = rename(DB_TMP_PATH, AUDIO_LOUDNESS_DB_PATH) == 0;
+    xSemaphoreGive(db_lock);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to replace %s", AUDIO_LOUDNESS_DB_PATH);
+    }
+    s->db = db_open(AUDIO_LOUDNESS_DB_PATH);
+    s->npending = 0;
+    return ok;
+}
+
+/* ---- scanner ---- */
+
+static void *scan_alloc(size_t size)
+{
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + AUDIO_LOUDNESS_HEAP_RESERVE) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+// Stay out of the reader's way while it is refilling the ring
+static void scan_throttle(void)
+{
+    while (audio_player_is_playing() && audio_ring_fill(&audio_ring) < AUDIO_LOUDNESS_SCAN_FILL) {
+        vTaskDelay(pdMS_TO_TICKS(SCAN_WAIT_MS));
+    }
+}
+
+static bool scan_open(scan_t *s, FILE *fp)
+{
+    switch (s->codec) {
+    case AUDIO_CODEC_WAV:
+        if (!wav_parse_header(fp, &s->wav)) {
+            return false;
+        }
+        s->wav_left = s->wav.data_size;
+        return true;
+    case AUDIO_CODEC_MP3:
+        s->mp3 = scan_alloc(sizeof(mp3_decoder_t));
+        if (!s->mp3 || !mp3_decoder_init(s->mp3)) {
+            s->short_of_memory = true;
+            return false;
+        }
+        mp3_decoder_open(s->mp3, fp);
+        return true;
+    case AUDIO_CODEC_FLAC:
+        s->flac = scan_alloc(sizeof(flac_decoder_t));
+        if (!s->flac) {
+            s->short_of_memory = true;
+            return false;
+        }
+        return flac_decoder_open(s->flac, fp);
+    }
+    return false;
+}
+
+// Next block of 16-bit stereo into s->pcm, 0 at the end
+static size_t scan_decode(scan_t *s, FILE *fp, uint32_t *rate, uint8_t *channels)
+{
+    size_t bytes = 0;
+
+    switch (s->codec) {
+    case AUDIO_CODEC_WAV: {
+        size_t want = pcm_input_bytes_for(&s->wav, sizeof(s->pcm));
+        if (want > s->wav_left) {
+            want = s->wav_left - s->wav_left % s->wav.block_align;
+        }
+        size_t got = fread(s->pcm, 1, want, fp);
+        got -= got % s->wav.block_align;
+        s->wav_left -= got;
+        bytes = pcm_to_s16_stereo(&s->wav, (uint8_t *)s->pcm, got);
+        *rate = s->wav.sample_rate;
+        *channels = s->wav.channels;
+        break;
+    }
+    case AUDIO_CODEC_MP3:
+        bytes = mp3_decoder_decode(s->mp3, fp, s->pcm);
+        *rate = s->mp3->info.samprate;
+        *channels = s->mp3->info.nChans;
+        break;
+    case AUDIO_CODEC_FLAC:
+        bytes = flac_decoder_read(s->flac, (uint8_t *)s->pcm, sizeof(s->pcm));
+        *rate = s->flac->sample_rate;
+        *channels = s->flac->channels;
+        break;
+    }
+    return bytes;
+}
+
+static bool scan_track(scan_t *s, const char *path, db_rec_t *rec)
+{
+    FILE *fp = fopen(path, "rb");
+    bool started = false;
+    bool ok = false;
+
+    if (!fp) {
+        return false;
+    }
+    setvbuf(fp, s->io, _IOFBF, sizeof(s->io));
+
+    s->codec = audio_codec_from_path(path);
+    if (scan_open(s, fp)) {
+        uint32_t rate = 0;
+        uint8_t channels = 0;
+        size_t bytes;
+
+        while (true) {
+            scan_throttle();
+            bytes = scan_decode(s, fp, &rate, &channels);
+            if (bytes == 0) {
+                break;
+            }
+            if (!started) {
+                if (rate < 8000 || rate > 192000) {
+                    break;
+                }
+                meter_begin(&s->meter, rate, channels);
+                started = true;
+            }
+            meter_feed(&s->meter, s->pcm, bytes / 4);
+        }
+        ok = started;
+    }
+
+    if (s->mp3) {
+        mp3_decoder_deinit(s->mp3);
+    }
+    free(s->mp3);
+    free(s->flac);
+    s->mp3 = NULL;
+    s->flac = NULL;
+    fclose(fp);
+
+    if (ok) {
+        rec->lufs = meter_integrated(&s->meter);
+        rec->peak = meter_peak(&s->meter);
+    }
+    return ok;
+}
+
+static bool scan_visit(const char *path, const struct stat *st, void *arg)
+{
+    scan_t *s = arg;
+    db_rec_t rec = {
+        .key = path_key(path),
+        .size = (uint32_t)st->st_size,
+        .mtime = (uint32_t)st->st_mtime,
+        .lufs = AUDIO_LOUDNESS_UNKNOWN,
+        .peak = AUDIO_LOUDNESS_UNKNOWN,
+    };
+    db_rec_t old;
+
+    if (!audio_path_is_track(path)) {
+        return true;
+    }
+    if (s->db && db_find(s->db, rec.key, &old) && old.size == rec.size && old.mtime == rec.mtime) {
+        return true;
+    }
+
+    if (scan_track(s, path, &rec)) {
+        ESP_LOGI(TAG, "%s: %s%d.%02d LUFS, peak %s%d.%02d dBTP", path,
+                 rec.lufs < 0 ? "-" : "", abs(rec.lufs) / 100, abs(rec.lufs) % 100,
+                 rec.peak < 0 ? "-" : "", abs(rec.peak) / 100, abs(rec.peak) % 100);
+        s->scanned++;
+    } else if (s->short_of_memory) {
+        return false;
+    } else {
+        // Recorded anyway so a file that cannot be decoded is not retried
+        ESP_LOGW(TAG, "Cannot measure %s", path);
+    }
+
+    s->pending[s->npending++] = rec;
+    if (s->npending == AUDIO_LOUDNESS_BATCH) {
+        return db_merge(s);
+    }
+    return true;
+}
+
+// One walk over the card, false if it has to be retried later
+static bool scan_pass(void)
+{
+    scan_t *s = scan_alloc(sizeof(scan_t));
+    bool done;
+
+    if (!s) {
+        ESP_LOGW(TAG, "Not enough memory to scan, retrying later");
+        return false;
+    }
+    memset(s, 0, sizeof(*s));
+    s->db = db_open(AUDIO_LOUDNESS_DB_PATH);
+
+    done = sd_fs_walk(SD_MOUNT_POINT, scan_visit, s);
+    if (s->npending) {
+        done = db_merge(s) && done;
+    }
+    if (s->short_of_memory) {
+        ESP_LOGW(TAG, "Not enough memory for a decoder, retrying later");
+    }
+    if (s->scanned) {
+        ESP_LOGI(TAG, "Measured %lu tracks", (unsigned long)s->scanned);
+    }
+
+    if (s->db) {
+        fclose(s->db);
+    }
+    free(s);
+    return done;
+}
+
+static void audio_loudness_task(void *arg)
+{
+    vTaskDelay(pdMS_TO_TICKS(SCAN_START_MS));
+
+    while (1) {
+        TickType_t wait = scan_pass() ? portMAX_DELAY : pdMS_TO_TICKS(AUDIO_LOUDNESS_RETRY_MS);
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+bool audio_loudness_init(void)
+{
+    db_lock = xSemaphoreCreateMutex();
+    if (!db_lock) {
+        return false;
+    }
+    tp_tables_init();
+
+    // Just above idle: it only gets the CPU nobody else wants
+    if (xTaskCreate(audio_loudness_task, "audio_loud", 6144, NULL, tskIDLE_PRIORITY + 1,
+                    &scan_task_hdl) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start loudness scanner");
+        return false;
+    }
+    return true;
+}
+
+bool audio_loudness_lookup(const char *path, audio_loudness_t *out)
+{
+    struct stat st;
+    db_rec_t rec;
+    bool found = false;
+
+    if (!db_lock || stat(path, &st) != 0) {
+        return false;
+    }
+
+    xSemaphoreTake(db_lock, portMAX_DELAY);
+    FILE *db = db_open(AUDIO_LOUDNESS_DB_PATH);
+    if (db) {
+        found = db_find(db, path_key(path), &rec);
+        fclose(db);
+    }
+    xSemaphoreGive(db_lock);
+
+    if (!found || rec.size != (uint32_t)st.st_size || rec.mtime != (uint32_t)st.st_mtime ||
+        rec.lufs == AUDIO_LOUDNESS_UNKNOWN) {
+        return false;
+    }
+    out->lufs = rec.lufs;
+    out->peak = rec.peak;
+    return true;
+}
+
+int16_t audio_loudness_gain(const audio_loudness_t *l)
+{
+    int32_t gain = AUDIO_LOUDNESS_TARGET * 100 - l->lufs;
+    int32_t room = AUDIO_LOUDNESS_CEILING * 100 - l->peak;
+
+    // The peak only limits a boost, it never turns one into a cut
+    if (gain > 0 && gain > room) {
+        gain = room > 0 ? room : 0;
+    }
+    return (int16_t)(gain < INT16_MIN ? INT16_MIN : gain);
+}
+
+void audio_loudness_rescan(void)
+{
+    if (scan_task_hdl) {
+        xTaskNotifyGive(scan_task_hdl);
+    }
+}
@@ -0,0 +1,192 @@
+#include <string.h>
+#include "audio_output.h"
+#include "audio_player.h"
+#include "bt_manager.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "driver/i2s_std.h"
+
+static const char *TAG = "AOUT";
+
+static volatile audio_output_t active = AUDIO_SIM_ENABLE ? AUDIO_OUTPUT_SIM : AUDIO_OUTPUT_BT;
+static i2s_chan_handle_t i2s_tx = NULL;
+static TaskHandle_t i2s_task_hdl = NULL;
+static TaskHandle_t sim_task_hdl = NULL;
+static uint32_t ring_busy = 0;      // an output is inside audio_player_read()
+
+// One descriptor's worth per write
+static uint8_t i2s_buf[AUDIO_I2S_DMA_FRAMES * 4];
+
+#if AUDIO_SIM_ENABLE
+// Room for a tick with the worst jitter on top
+#define SIM_MAX_FRAMES  ((AUDIO_SIM_TICK_MS + AUDIO_SIM_JITTER_MS) * AUDIO_SAMPLE_RATE / 1000 + AUDIO_SIM_SBC_FRAMES)
+static uint8_t sim_buf[SIM_MAX_FRAMES * 4];
+#endif
+
+/*
+ * The ring has a single consumer. Around a switch the old output may still
+ * be in its last read when the new one starts, so the read is guarded and
+ * whoever loses the race sends silence for that one buffer.
+ */
+static void output_read(audio_output_t who, uint8_t *data, int32_t len)
+{
+    if (active != who || __atomic_exchange_n(&ring_busy, 1, __ATOMIC_ACQUIRE)) {
+        memset(data, 0, len);
+        return;
+    }
+    audio_player_read(data, len);
+    __atomic_store_n(&ring_busy, 0, __ATOMIC_RELEASE);
+}
+
+static void audio_i2s_task(void *arg)
+{
+    bool enabled = false;
+
+    while (1) {
+        if (active != AUDIO_OUTPUT_I2S) {
+            if (enabled) {
+                i2s_channel_disable(i2s_tx);
+                enabled = false;
+                ESP_LOGI(TAG, "I2S output stopped");
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!enabled) {
+            if (i2s_channel_enable(i2s_tx) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to start I2S, back to BT");
+                active = AUDIO_OUTPUT_BT;
+                continue;
+            }
+            enabled = true;
+            ESP_LOGI(TAG, "I2S output started");
+        }
+
+        size_t written;
+        output_read(AUDIO_OUTPUT_I2S, i2s_buf, sizeof(i2s_buf));
+        i2s_channel_write(i2s_tx, i2s_buf, sizeof(i2s_buf), &written, portMAX_DELAY);
+    }
+}
+
+#if AUDIO_SIM_ENABLE
+static void audio_sim_task(void *arg)
+{
+    int64_t start = 0;
+    uint64_t sent = 0;          // frames pulled since start
+
+    while (1) {
+        if (active != AUDIO_OUTPUT_SIM) {
+            start = 0;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (start == 0) {
+            start = esp_timer_get_time();
+            sent = 0;
+        }
+
+        uint32_t jitter = AUDIO_SIM_JITTER_MS ? esp_random() % (AUDIO_SIM_JITTER_MS + 1) : 0;
+        vTaskDelay(pdMS_TO_TICKS(AUDIO_SIM_TICK_MS + jitter));
+
+        // Frames owed by the clock, whole SBC frames only; a late pull catches up
+        uint64_t due = (uint64_t)(esp_timer_get_time() - start) * AUDIO_SAMPLE_RATE / 1000000;
+        uint32_t frames = (due - sent) / AUDIO_SIM_SBC_FRAMES * AUDIO_SIM_SBC_FRAMES;
+        if (frames > SIM_MAX_FRAMES) {
+            // Task was held off longer than a tick can cover, drop the backlog
+            sent = due - SIM_MAX_FRAMES;
+            frames = SIM_MAX_FRAMES / AUDIO_SIM_SBC_FRAMES * AUDIO_SIM_SBC_FRAMES;
+        }
+        if (frames) {
+            output_read(AUDIO_OUTPUT_SIM, sim_buf, frames * 4);
+            sent += frames;
+        }
+    }
+}
+#endif
+
+bool audio_output_init(void)
+{
+#if AUDIO_SIM_ENABLE
+    // Same priority as the Bluedroid BTC task that runs the real data callback
+    xTaskCreate(audio_sim_task, "audio_sim", 3072, NULL, 19, &sim_task_hdl);
+    ESP_LOGW(TAG, "Simulated A2DP output, %d ms pulls with up to %d ms jitter",
+             AUDIO_SIM_TICK_MS, AUDIO_SIM_JITTER_MS);
+#endif
+
+    i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    chan_cfg.dma_desc_num = AUDIO_I2S_DMA_DESC;
+    chan_cfg.dma_frame_num = AUDIO_I2S_DMA_FRAMES;
+    chan_cfg.auto_clear = true;     // underruns play silence, not the last buffer
+
+    if (i2s_new_channel(&chan_cfg, &i2s_tx, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create I2S channel");
+        return false;
+    }
+
+    i2s_std_config_t std_cfg = {
+        .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(AUDIO_SAMPLE_RATE),
+        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO),
+        .gpio_cfg = {
+            .mclk = I2S_GPIO_UNUSED,
+            .bclk = AUDIO_I2S_PIN_BCK,
+            .ws = AUDIO_I2S_PIN_WS,
+            .dout = AUDIO_I2S_PIN_DOUT,
+            .din = I2S_GPIO_UNUSED,
+        },
+    };
+
+    if (i2s_channel_init_std_mode(i2s_tx, &std_cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure I2S");
+        i2s_del_channel(i2s_tx);
+        i2s_tx = NULL;
+        return false;
+    }
+
+    // Same priority as the reader: it only runs when a descriptor frees up
+    xTaskCreate(audio_i2s_task, "audio_i2s", 3072, NULL, 5, &i2s_task_hdl);
+    return true;
+}
+
+void audio_output_set(audio_output_t out)
+{
+    if (out == active) {
+        return;
+    }
+    if ((out == AUDIO_OUTPUT_I2S && !i2s_task_hdl) || (out == AUDIO_OUTPUT_SIM && !sim_task_hdl)) {
+        ESP_LOGW(TAG, "Output %d not available", out);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Output: %s", out == AUDIO_OUTPUT_I2S ? "I2S" : out == AUDIO_OUTPUT_SIM ? "SIM" : "BT");
+    active = out;
+    if (i2s_task_hdl) {
+        xTaskNotifyGive(i2s_task_hdl);
+    }
+    if (sim_task_hdl) {
+        xTaskNotifyGive(sim_task_hdl);
+    }
+
+    // Only BT needs the A2DP stream, let it suspend while another output plays
+    if (out == AUDIO_OUTPUT_BT && audio_player_is_playing()) {
+        bt_media_start();
+    } else if (out != AUDIO_OUTPUT_BT) {
+        bt_media_idle();
+    }
+
+    // An absolute-volume sink only sets the level while it is the output
+    audio_player_set_volume(audio_player_get_volume());
+}
+
+audio_output_t audio_output_get(void)
+{
+    return active;
+}
+
+int32_t audio_output_bt_read(uint8_t *data, int32_t len)
+{
+    output_read(AUDIO_OUTPUT_BT, data, len);
+    return len;
+}
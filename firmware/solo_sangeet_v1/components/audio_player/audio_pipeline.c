@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio_pipeline.h"
+
+#define AUDIO_PIPE_FRAME_BYTES  4       // 16-bit stereo
+
+bool audio_pipeline_init(audio_pipeline_t *p, uint32_t buf_bytes)
+{
+    memset(p, 0, sizeof(*p));
+
+    p->buf_frames = buf_bytes / AUDIO_PIPE_FRAME_BYTES;
+    p->pool = malloc((size_t)AUDIO_PIPE_POOL_BUFS * p->buf_frames * AUDIO_PIPE_FRAME_BYTES);
+    if (!p->pool) {
+        return false;
+    }
+    p->pool_free = (1u << AUDIO_PIPE_POOL_BUFS) - 1;
+    return true;
+}
+
+void audio_pipeline_set_source(audio_pipeline_t *p, const audio_source_t *source)
+{
+    p->source = source;
+}
+
+void audio_pipeline_set_sink(audio_pipeline_t *p, const audio_sink_t *sink)
+{
+    p->sink = sink;
+}
+
+bool audio_pipeline_add(audio_pipeline_t *p, audio_element_t *el)
+{
+    if (p->count == AUDIO_PIPE_MAX_ELEMENTS) {
+        return false;
+    }
+    el->pipe = p;
+    el->index = p->count;
+    p->elements[p->count++] = el;
+    return true;
+}
+
+bool audio_pipeline_get_buf(audio_pipeline_t *p, audio_buf_t *buf, uint32_t rate)
+{
+    uint32_t bytes = p->buf_frames * AUDIO_PIPE_FRAME_BYTES;
+
+    buf->frames = 0;
+    buf->capacity = p->buf_frames;
+    buf->rate = rate;
+
+    // Already at the output rate: write where the sink will read it
+    if (p->sink && rate && rate == p->sink->rate) {
+        uint8_t *span = p->sink->acquire(p->sink->ctx, bytes);
+        if (!span) {
+            return false;
+        }
+        buf->pcm = (int16_t *)span;
+        buf->borrowed = true;
+        return true;
+    }
+
+    if (!p->pool_free) {
+        return false;
+    }
+    uint8_t slot = __builtin_ctz(p->pool_free);
+    p->pool_free &= ~(1u << slot);
+
+    buf->pcm = p->pool + (size_t)slot * p->buf_frames * 2;
+    buf->borrowed = false;
+    buf->slot = slot;
+    return true;
+}
+
+void audio_pipeline_put_buf(audio_pipeline_t *p, audio_buf_t *buf)
+{
+    if (!buf->borrowed) {
+        p->pool_free |= 1u << buf->slot;
+    }
+}
+
+static audio_pipe_status_t sink_write(audio_pipeline_t *p, audio_buf_t *buf)
+{
+    const audio_sink_t *sink = p->sink;
+    uint32_t bytes = buf->frames * AUDIO_PIPE_FRAME_BYTES;
+
+    if (bytes == 0) {
+        return AUDIO_PIPE_OK;
+    }
+    if (!buf->borrowed) {
+        // Copy path, only for blocks that could not be produced in place
+        uint8_t *span = sink->acquire(sink->ctx, bytes);
+        if (!span) {
+            return AUDIO_PIPE_ABORT;
+        }
+        memcpy(span, buf->pcm, bytes);
+    }
+    sink->commit(sink->ctx, bytes);
+    return AUDIO_PIPE_OK;
+}
+
+audio_pipe_status_t audio_pipeline_emit(audio_element_t *el, audio_buf_t *buf)
+{
+    audio_pipeline_t *p = el->pipe;
+    uint8_t next = el->index + 1;
+
+    if (next < p->count) {
+        return p->elements[next]->process(p->elements[next], buf);
+    }
+    return sink_write(p, buf);
+}
+
+static audio_pipe_status_t pipeline_resume(audio_pipeline_t *p, uint32_t rate)
+{
+    for (uint8_t i = 0; i < p->count; i++) {
+        if (p->elements[i]->resume) {
+            audio_pipe_status_t status = p->elements[i]->resume(p->elements[i], rate);
+            if (status != AUDIO_PIPE_OK) {
+                return status;
+            }
+        }
+    }
+    return AUDIO_PIPE_OK;
+}
+
+audio_pipe_status_t audio_pipeline_run(audio_pipeline_t *p)
+{
+    audio_buf_t buf;
+    audio_pipe_status_t status;
+    uint32_t rate = p->source->rate(p->source->ctx);
+
+    // Whatever an element still holds goes out before new input comes in
+    status = pipeline_resume(p, rate);
+    if (status != AUDIO_PIPE_OK) {
+        return status;
+    }
+
+    if (!audio_pipeline_get_buf(p, &buf, rate)) {
+        return AUDIO_PIPE_ABORT;
+    }
+
+    if (!p->source->read(p->source->ctx, &buf)) {
+        status = AUDIO_PIPE_EOS;
+    } else if (p->count) {
+        status = p->elements[0]->process(p->elements[0], &buf);
+    } else {
+        status = sink_write(p, &buf);
+    }
+
+    audio_pipeline_put_buf(p, &buf);
+    return status;
+}
+
+audio_pipe_status_t audio_pipeline_finish(audio_pipeline_t *p)
+{
+    return pipeline_resume(p, 0);
+}
+
+void audio_pipeline_reset(audio_pipeline_t *p)
+{
+    for (uint8_t i = 0; i < p->count; i++) {
+        if (p->elements[i]->reset) {
+            p->elements[i]->reset(p->elements[i]);
+        }
+    }
+}
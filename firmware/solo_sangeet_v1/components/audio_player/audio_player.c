@@ -1,20 +1,95 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "audio_player.h"
+#include "wav_parser.h"
+#include "mp3_decoder.h"
+#include "flac_decoder.h"
+#include "resampler.h"
+#include "audio_ring.h"
+#include "audio_dsp.h"
+#include "seek_index.h"
+#include "audio_stats.h"
+#include "audio_file.h"
+#include "audio_pipeline.h"
+#include "audio_output.h"
+#include "audio_spectrum.h"
+#include "audio_loudness.h"
+#include "audio_library.h"
+#include "audio_art.h"
+#include "audio_queue.h"
 
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "lvgl.h"
 #include "file_manager.h"
 #include "ui_manager.h"
+#include "bt_manager.h"
 
-RingbufHandle_t audio_rb;
+audio_ring_t audio_ring;
 TaskHandle_t reader_task_hdl = NULL;
-const char *current_file = "/sdcard/TEST_00.WAV";
+static char current_path[AUDIO_PATH_MAX] = "/sdcard/TEST_00.WAV";
+const char *current_file = current_path;
 QueueHandle_t audio_cmd_q;
+volatile bool audio_trace_armed = false;
 
 static const char *TAG = "AUDIO";
+static QueueHandle_t reader_cmd_q;
+static volatile audio_reader_state_t reader_state = AUDIO_READER_IDLE;
+static volatile bool output_paused = false;   // consumer holds its tail while set
 static FILE *audio_fp = NULL;
-static bool playing = false;
-static volatile bool stop_requested = false;
+static audio_codec_t audio_codec = AUDIO_CODEC_WAV;
+static wav_info_t audio_fmt;
+static uint32_t data_remaining = 0;
+static mp3_decoder_t *mp3_dec = NULL;     // allocated on first MP3, kept for reuse
+static flac_decoder_t *flac_dec = NULL;   // allocated on first FLAC, kept for reuse
+static resampler_t *resampler = NULL;     // allocated on first non-44.1 kHz source
+static uint32_t resampler_rate = 0;       // source rate the resampler is set up for
+static bool resampler_tail = false;       // input in it that only a flush pushes out
+static audio_dsp_t audio_dsp;             // effect chain, always at AUDIO_SAMPLE_RATE
+static seek_index_t *seek_idx = NULL;     // allocated on first compressed track
+static uint32_t skip_frames = 0;          // decoded frames to drop after a seek
+static uint32_t seek_guess = 0;           // target of a seek by byte ratio, until the index places it
+static uint32_t ring_sleep_us = 0;        // reader time asleep on a full ring, this block
+static volatile uint32_t stream_pos = 0;  // source frames produced for the current track
+static volatile audio_state_t control_state = AUDIO_STATE_IDLE;  // mirror for other tasks
+static volatile int64_t remote_cmd_us = 0;  // when the pending remote command was sent
+static volatile uint32_t track_serial = 0;  // bumped whenever current_file changes
+// Latest file and playlist picked in the UI, for AUDIO_CMD_FILE/PLAYLIST; the
+// control task takes them, so it is the only writer of current_path
+static QueueHandle_t file_pick_q;
+static QueueHandle_t playlist_pick_q;
+static volatile uint8_t player_volume = AUDIO_DSP_DEFAULT_VOLUME;  // percent, as the user sees it
+// Latest volume for AUDIO_CMD_VOLUME; only the control task applies volume
+typedef struct {
+    uint8_t percent;
+    bool tell_sink;             // false when the sink set it
+} volume_pick_t;
+static QueueHandle_t volume_pick_q;
+
+// Pipeline block, sized for the largest decoder frame
+#define AUDIO_PCM_BUF_SIZE  (MP3_PCM_BUF_BYTES > AUDIO_READ_CHUNK ? MP3_PCM_BUF_BYTES : AUDIO_READ_CHUNK)
+static audio_pipeline_t pipeline;
+static bool audio_pipeline_setup(void);
+
+// Tracks to play after the current one, owned by the reader task
+static char track_queue[AUDIO_QUEUE_LEN][AUDIO_PATH_MAX];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+static FILE *next_fp = NULL;              // head of the queue, opened ahead of time
+static char next_path[AUDIO_PATH_MAX];
+static int16_t next_gain;                 // its loudness gain, looked up with the open
+
+// Play-press-to-first-audio trace, in esp_timer microseconds
+static struct {
+    int64_t cmd;
+    int64_t opened;
+    int64_t first_block;
+    volatile int64_t first_audio;
+    bool reported;
+} play_trace;
 
 void log_mem(const char *tag)
 {
@@ -34,112 +109,1073 @@ void audio_player_init(void)
     audio_cmd_q = xQueueCreate(8, sizeof(audio_cmd_t));
     configASSERT(audio_cmd_q);
 
-    // Create ring buffer ONCE
-    audio_rb = xRingbufferCreate(AUDIO_RINGBUF_SIZE, RINGBUF_TYPE_BYTEBUF);
-    configASSERT(audio_rb);
+    reader_cmd_q = xQueueCreate(4, sizeof(audio_reader_msg_t));
+    configASSERT(reader_cmd_q);
+
+    file_pick_q = xQueueCreate(1, AUDIO_PATH_MAX);
+    playlist_pick_q = xQueueCreate(1, AUDIO_PATH_MAX);
+    volume_pick_q = xQueueCreate(1, sizeof(volume_pick_t));
+    configASSERT(file_pick_q && playlist_pick_q && volume_pick_q);
 
-    // Start audio control task
-    xTaskCreate(audio_control_task, "audio_ctrl", 4096, NULL, 6, NULL);
+    // Create ring buffer ONCE; slack lets decoders write a whole block in place
+    configASSERT(audio_ring_init(&audio_ring, AUDIO_RINGBUF_SIZE, AUDIO_PCM_BUF_SIZE));
 
-    playing = false;
+    configASSERT(audio_file_init());
+    configASSERT(audio_pipeline_setup());
+    audio_dsp_init(&audio_dsp, AUDIO_SAMPLE_RATE);
+    audio_stats_init();
+
+    audio_spectrum_init();
+
+    // Normalisation is optional, tracks play at their own level without it
+    if (!audio_loudness_init()) {
+        ESP_LOGW(TAG, "No loudness scan, tracks play unnormalised");
+    }
+
+    // The index from the last boot is there at once, a first build runs in the background
+    if (!audio_library_init()) {
+        ESP_LOGW(TAG, "No media library");
+    }
+    // Thumbnails come from the library, tracks just show no art without them
+    if (!audio_art_init()) {
+        ESP_LOGW(TAG, "No album art");
+    }
+    // The whole library in order until a track or playlist is picked
+    if (!audio_queue_init()) {
+        ESP_LOGW(TAG, "No play queue");
+    } else if (audio_queue_library(0)) {
+        audio_queue_step(0, current_path, sizeof(current_path));
+    }
+
+    // Local output is optional, BT works without it
+    if (!audio_output_init()) {
+        ESP_LOGW(TAG, "No I2S output, BT only");
+    }
+
+    // Reader task lives for the whole session and is driven by reader_cmd_q
+    xTaskCreate(audio_reader_task, "audio_reader", 4096 * 2, NULL, 5, &reader_task_hdl);
+
+    // Start audio control task, playlists are parsed on its stack
+    xTaskCreate(audio_control_task, "audio_ctrl", 4096 + 2048, NULL, 6, NULL);
+}
+
+static bool audio_reader_post(audio_reader_cmd_t cmd, const char *path, uint32_t arg)
+{
+    audio_reader_msg_t msg = {
+        .cmd = cmd,
+        .arg = arg,
+    };
+
+    if (path) {
+        snprintf(msg.path, sizeof(msg.path), "%s", path);
+    }
+
+    if (xQueueSend(reader_cmd_q, &msg, pdMS_TO_TICKS(100)) != pdTRUE) {
+        ESP_LOGE(TAG, "Reader command %d dropped", cmd);
+        return false;
+    }
+    // The reader may be asleep on the ring watermark rather than the queue
+    xTaskNotifyGive(reader_task_hdl);
+    return true;
 }
 
 bool audio_player_start(const char *path)
 {
-    if (playing) {
-        ESP_LOGW(TAG, "Audio already playing");
+    output_paused = false;
+    play_trace.cmd = esp_timer_get_time();
+    play_trace.first_audio = 0;
+    play_trace.reported = false;
+
+    return audio_reader_post(AUDIO_READER_CMD_OPEN, path, 0);
+}
+
+// Leave path for the control task; a pick it has not got to yet is replaced
+static bool audio_player_pick(QueueHandle_t pick_q, audio_cmd_t cmd, const char *path)
+{
+    char buf[AUDIO_PATH_MAX];
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    xQueueOverwrite(pick_q, buf);
+    return xQueueSend(audio_cmd_q, &cmd, 0) == pdTRUE;
+}
+
+bool audio_player_play_file(const char *path)
+{
+    return audio_player_pick(file_pick_q, AUDIO_CMD_FILE, path);
+}
+
+bool audio_player_play_playlist(const char *path)
+{
+    // Loading takes a while, the control task does it rather than the caller
+    return audio_player_pick(playlist_pick_q, AUDIO_CMD_PLAYLIST, path);
+}
+
+bool audio_player_cmd(audio_cmd_t cmd)
+{
+    return xQueueSend(audio_cmd_q, &cmd, 0) == pdTRUE;
+}
+
+uint32_t audio_player_track_serial(void)
+{
+    return track_serial;
+}
+
+void audio_player_stop(void)
+{
+    audio_reader_post(AUDIO_READER_CMD_CLOSE, NULL, 0);
+}
+
+void audio_player_pause(void)
+{
+    // Freeze the consumer now; ring contents and file offset stay as they are
+    output_paused = true;
+    audio_reader_post(AUDIO_READER_CMD_PAUSE, NULL, 0);
+}
+
+void audio_player_resume(void)
+{
+    // Whatever was buffered at pause time plays straight away
+    audio_reader_post(AUDIO_READER_CMD_RESUME, NULL, 0);
+    output_paused = false;
+}
+
+bool audio_player_seek(uint32_t ms)
+{
+    return audio_reader_post(AUDIO_READER_CMD_SEEK, NULL, ms);
+}
+
+bool audio_player_enqueue(const char *path)
+{
+    return audio_reader_post(AUDIO_READER_CMD_ENQUEUE, path, 0);
+}
+
+bool audio_player_skip(void)
+{
+    return audio_reader_post(AUDIO_READER_CMD_SKIP, NULL, 0);
+}
+
+bool audio_player_remote_cmd(audio_cmd_t cmd)
+{
+    // Runs on the BT stack's task: a queue copy, no allocation, no waiting
+    remote_cmd_us = esp_timer_get_time();
+    if (xQueueSend(audio_cmd_q, &cmd, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Remote command %d dropped", cmd);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * A sink with AVRCP absolute volume turns itself down, so the DSP stays at
+ * full scale rather than applying the level a second time.
+ */
+static void volume_apply(uint8_t percent, bool tell_sink)
+{
+    bool sink = audio_output_get() == AUDIO_OUTPUT_BT && bt_avrc_abs_volume();
+
+    player_volume = percent > 100 ? 100 : percent;
+    audio_dsp_set_volume(&audio_dsp, sink ? 100 : player_volume);
+    if (sink && tell_sink) {
+        bt_avrc_set_volume(player_volume);
+    }
+    bt_avrc_notify_volume();
+}
+
+// Leave the level for the control task, a slider drag only keeps the last one
+static bool volume_post(uint8_t percent, bool tell_sink)
+{
+    audio_cmd_t cmd = AUDIO_CMD_VOLUME;
+
+    xQueueOverwrite(volume_pick_q, &(volume_pick_t){ percent, tell_sink });
+    if (xQueueSend(audio_cmd_q, &cmd, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Volume %u dropped", percent);
+        return false;
+    }
+    return true;
+}
+
+void audio_player_set_volume(uint8_t percent)
+{
+    volume_post(percent, true);
+}
+
+uint8_t audio_player_get_volume(void)
+{
+    return player_volume;
+}
+
+bool audio_player_remote_volume(uint8_t percent)
+{
+    return volume_post(percent, false);
+}
+
+void audio_player_set_eq(uint8_t band, int8_t db)
+{
+    audio_dsp_set_eq(&audio_dsp, band, db);
+}
+
+void audio_trace_first_audio(void)
+{
+    // Called from the A2DP data callback: one store, no logging
+    audio_trace_armed = false;
+    play_trace.first_audio = esp_timer_get_time();
+}
+
+audio_codec_t audio_codec_from_path(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    if (ext && strcasecmp(ext, ".mp3") == 0) {
+        return AUDIO_CODEC_MP3;
+    }
+    if (ext && strcasecmp(ext, ".flac") == 0) {
+        return AUDIO_CODEC_FLAC;
+    }
+    return AUDIO_CODEC_WAV;
+}
+
+bool audio_path_is_track(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    return ext && (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".mp3") == 0 ||
+                   strcasecmp(ext, ".flac") == 0);
+}
+
+// Produce the next block of 16-bit stereo PCM in buf, 0 at end of stream
+static size_t audio_read_block(uint8_t *buf)
+{
+    switch (audio_codec) {
+    case AUDIO_CODEC_MP3:
+        return mp3_decoder_decode(mp3_dec, audio_fp, (int16_t *)buf);
+
+    case AUDIO_CODEC_FLAC:
+        return flac_decoder_read(flac_dec, buf, AUDIO_READ_CHUNK);
+
+    case AUDIO_CODEC_WAV:
+    default: {
+        size_t chunk = pcm_input_bytes_for(&audio_fmt, AUDIO_READ_CHUNK);
+        size_t want = chunk < data_remaining ? chunk : data_remaining;
+        size_t bytes = want ? fread(buf, 1, want, audio_fp) : 0;
+
+        bytes -= bytes % audio_fmt.block_align;
+        data_remaining -= bytes;
+        return pcm_to_s16_stereo(&audio_fmt, buf, bytes);
+    }
+    }
+}
+
+// Source rate of the current stream; MP3 only knows it after the first frame
+static uint32_t audio_source_rate(void)
+{
+    switch (audio_codec) {
+    case AUDIO_CODEC_MP3:
+        return mp3_dec->info.samprate;
+    case AUDIO_CODEC_FLAC:
+        return flac_dec->sample_rate;
+    case AUDIO_CODEC_WAV:
+    default:
+        return audio_fmt.sample_rate;
+    }
+}
+
+// Track length in source frames, 0 while unknown
+static uint32_t audio_total_frames(void)
+{
+    switch (audio_codec) {
+    case AUDIO_CODEC_MP3:
+        if (seek_idx && seek_idx->complete) {
+            return seek_idx->total_samples;
+        }
+        // Until the index is done, estimate from the first frame's bitrate
+        if (seek_idx && mp3_dec->info.bitrate) {
+            return (uint64_t)(seek_idx->file_size - mp3_dec->data_start) * 8 *
+                   mp3_dec->info.samprate / mp3_dec->info.bitrate;
+        }
+        return 0;
+    case AUDIO_CODEC_FLAC:
+        return flac_dec->total_samples;
+    case AUDIO_CODEC_WAV:
+    default:
+        return audio_fmt.block_align ? audio_fmt.data_size / audio_fmt.block_align : 0;
+    }
+}
+
+// Any pending command preempts streaming
+static inline bool reader_interrupted(void)
+{
+    return uxQueueMessagesWaiting(reader_cmd_q) > 0;
+}
+
+/*
+ * Wait for len contiguous bytes of ring space, NULL if a command arrived meanwhile.
+ *
+ * Once the ring is full the reader does not poll: it sleeps until the
+ * consumer has drained it to AUDIO_RING_LOW_WATER, then refills it to the
+ * top in one burst. SD reads come in bunches of whole clusters instead of a
+ * small read every few milliseconds.
+ */
+static uint8_t *audio_ring_wait(uint32_t len)
+{
+    uint8_t *span;
+
+    while ((span = audio_ring_acquire(&audio_ring, len)) == NULL) {
+        if (reader_interrupted()) {
+            return NULL;
+        }
+        audio_stats_ring_full();
+        // Ring is full: use the idle time to pull the current track, then the
+        // head of the next one, into PSRAM, then to build the seek index
+        if (audio_ring_fill(&audio_ring) > AUDIO_RING_LOW_WATER &&
+            (audio_file_load_step(audio_fp) || audio_file_load_step(next_fp) ||
+             (seek_idx && seek_index_step(seek_idx)))) {
+            continue;
+        }
+        int64_t t0 = esp_timer_get_time();
+        audio_ring_wait_below(&audio_ring, AUDIO_RING_LOW_WATER, pdMS_TO_TICKS(AUDIO_RING_WAIT_MS));
+        ring_sleep_us += esp_timer_get_time() - t0;
+    }
+    return span;
+}
+
+/* ---------------- pipeline: decoder -> seek trim -> resampler -> DSP -> ring ---------------- */
+
+static uint32_t decoder_rate(void *ctx)
+{
+    return audio_fp ? audio_source_rate() : 0;
+}
+
+static bool decoder_read(void *ctx, audio_buf_t *buf)
+{
+    size_t bytes = audio_read_block((uint8_t *)buf->pcm);
+
+    buf->frames = bytes / 4;
+    buf->rate = audio_source_rate();
+    return bytes != 0;
+}
+
+static const audio_source_t decoder_source = {
+    .name = "decoder",
+    .rate = decoder_rate,
+    .read = decoder_read,
+};
+
+// Drop decoded frames short of a seek target, count the rest
+static audio_pipe_status_t trim_process(audio_element_t *el, audio_buf_t *buf)
+{
+    uint32_t landed;
+
+    // A guessed seek learns where it really landed once the index gets there
+    if (seek_guess && seek_index_probed(seek_idx, &landed)) {
+        stream_pos = stream_pos - seek_guess + landed;
+        seek_guess = 0;
+    }
+    if (skip_frames) {
+        uint32_t drop = buf->frames < skip_frames ? buf->frames : skip_frames;
+        skip_frames -= drop;
+        buf->frames -= drop;
+        if (buf->frames == 0) {
+            return AUDIO_PIPE_OK;
+        }
+        memmove(buf->pcm, buf->pcm + drop * 2, buf->frames * 4);
+    }
+    stream_pos += buf->frames;
+    return audio_pipeline_emit(el, buf);
+}
+
+// A decoder block always fits the resampler whole, so an abort never strands input
+_Static_assert(AUDIO_PCM_BUF_SIZE / 4 <= RESAMPLER_BLOCK_FRAMES, "resampler block too small");
+
+// Hand on what the resampler holds; on an abort the rest waits in it for resume
+static audio_pipe_status_t resample_drain(audio_element_t *el)
+{
+    while (resampler_ready(resampler)) {
+        audio_buf_t out;
+
+        if (reader_interrupted() || !audio_pipeline_get_buf(el->pipe, &out, AUDIO_SAMPLE_RATE)) {
+            return AUDIO_PIPE_ABORT;
+        }
+        out.frames = resampler_read(resampler, out.pcm, out.capacity);
+
+        audio_pipe_status_t status = audio_pipeline_emit(el, &out);
+        audio_pipeline_put_buf(el->pipe, &out);
+        if (status != AUDIO_PIPE_OK) {
+            return status;
+        }
+    }
+    return AUDIO_PIPE_OK;
+}
+
+// Convert to AUDIO_SAMPLE_RATE; output blocks are borrowed from the ring
+static audio_pipe_status_t resample_process(audio_element_t *el, audio_buf_t *buf)
+{
+    if (buf->rate == AUDIO_SAMPLE_RATE) {
+        return audio_pipeline_emit(el, buf);
+    }
+
+    if (!resampler) {
+        resampler = malloc(sizeof(resampler_t));
+        if (!resampler) {
+            ESP_LOGE(TAG, "No memory for resampler, playing at source rate");
+            return audio_pipeline_emit(el, buf);
+        }
+    }
+
+    if (resampler_rate != buf->rate) {
+        resampler_init(resampler, buf->rate, AUDIO_SAMPLE_RATE, AUDIO_RESAMPLER_QUALITY);
+        resampler_rate = buf->rate;
+    }
+
+    // resume() emptied it, so the whole block is taken
+    resampler_write(resampler, buf->pcm, buf->frames);
+    resampler_tail = true;
+    return resample_drain(el);
+}
+
+// Before a block at another rate (or the end), the last filter length of input goes out too
+static audio_pipe_status_t resample_resume(audio_element_t *el, uint32_t rate)
+{
+    if (!resampler_rate) {
+        return AUDIO_PIPE_OK;
+    }
+    if (rate != resampler_rate && resampler_tail) {
+        resampler_flush(resampler);
+        resampler_tail = false;
+    }
+
+    audio_pipe_status_t status = resample_drain(el);
+    if (status == AUDIO_PIPE_OK && rate != resampler_rate) {
+        resampler_rate = 0;     // set up afresh for the next rate
+    }
+    return status;
+}
+
+static void resample_reset(audio_element_t *el)
+{
+    if (resampler_rate) {
+        resampler_reset(resampler);
+    }
+    resampler_tail = false;
+}
+
+// Effect chain, only at the rate it was set up for
+static audio_pipe_status_t dsp_process(audio_element_t *el, audio_buf_t *buf)
+{
+    if (buf->rate == AUDIO_SAMPLE_RATE) {
+        audio_dsp_process(&audio_dsp, buf->pcm, buf->frames);
+    }
+    return audio_pipeline_emit(el, buf);
+}
+
+static void dsp_reset(audio_element_t *el)
+{
+    audio_dsp_reset(&audio_dsp);
+}
+
+static uint8_t *ring_sink_acquire(void *ctx, uint32_t bytes)
+{
+    return audio_ring_wait(bytes);
+}
+
+static void ring_sink_commit(void *ctx, uint32_t bytes)
+{
+    audio_ring_commit(&audio_ring, bytes);
+}
+
+static const audio_sink_t ring_sink = {
+    .name = "ring",
+    .rate = AUDIO_SAMPLE_RATE,
+    .acquire = ring_sink_acquire,
+    .commit = ring_sink_commit,
+};
+
+static audio_element_t trim_element = { .name = "trim", .process = trim_process };
+static audio_element_t resample_element = {
+    .name = "resample", .process = resample_process, .reset = resample_reset,
+    .resume = resample_resume,
+};
+static audio_element_t dsp_element = { .name = "dsp", .process = dsp_process, .reset = dsp_reset };
+
+static bool audio_pipeline_setup(void)
+{
+    if (!audio_pipeline_init(&pipeline, AUDIO_PCM_BUF_SIZE)) {
+        ESP_LOGE(TAG, "Failed to allocate pipeline buffers");
         return false;
     }
+    audio_pipeline_set_source(&pipeline, &decoder_source);
+    audio_pipeline_add(&pipeline, &trim_element);
+    audio_pipeline_add(&pipeline, &resample_element);
+    audio_pipeline_add(&pipeline, &dsp_element);
+    audio_pipeline_set_sink(&pipeline, &ring_sink);
+    return true;
+}
 
-    audio_fp = fopen(path, "rb");
+static void reader_close(void)
+{
     if (!audio_fp) {
-        ESP_LOGE(TAG, "Failed to open WAV file");
+        return;
+    }
+
+    if (audio_codec == AUDIO_CODEC_MP3) {
+        mp3_decoder_report(mp3_dec);
+    }
+    if (resampler_rate) {
+        resampler_report(resampler);
+    }
+    audio_dsp_report(&audio_dsp);
+    audio_spectrum_report();
+    if (seek_idx) {
+        seek_index_close(seek_idx);
+    }
+
+    fclose(audio_fp);
+    audio_fp = NULL;
+}
+
+static FILE *reader_fopen(const char *path)
+{
+    FILE *fp = audio_file_open(path);
+
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to open audio file: %s", path);
+        return NULL;
+    }
+    return fp;
+}
+
+// Loudness gain in 1/100 dB; a sidecar lookup on the card, kept off the track switch
+static int16_t reader_track_gain(const char *path)
+{
+    audio_loudness_t loudness;
+
+    // Unscanned tracks play at unity until the scanner gets to them
+    return audio_loudness_lookup(path, &loudness) ? audio_loudness_gain(&loudness) : 0;
+}
+
+// Take over an open file as the current stream and set up its decoder
+static bool reader_begin(FILE *fp, const char *path, int16_t gain)
+{
+    // Whole track into PSRAM if there is room, grows a prefetched head cache
+    audio_file_cache(fp, true);
+
+    audio_codec = audio_codec_from_path(path);
+
+    bool ok = false;
+
+    switch (audio_codec) {
+    case AUDIO_CODEC_WAV:
+        ok = wav_parse_header(fp, &audio_fmt);
+        data_remaining = audio_fmt.data_size;
+        break;
+    case AUDIO_CODEC_MP3:
+        if (!mp3_dec) {
+            mp3_dec = malloc(sizeof(mp3_decoder_t));
+            if (mp3_dec && !mp3_decoder_init(mp3_dec)) {
+                free(mp3_dec);
+                mp3_dec = NULL;
+            }
+        }
+        if (mp3_dec) {
+            mp3_decoder_open(mp3_dec, fp);
+            ok = true;
+        }
+        break;
+    case AUDIO_CODEC_FLAC:
+        if (!flac_dec) {
+            flac_dec = malloc(sizeof(flac_decoder_t));
+        }
+        if (flac_dec) {
+            ok = flac_decoder_open(flac_dec, fp);
+        }
+        break;
+    }
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Unsupported audio file: %s", path);
+        fclose(fp);
         return false;
     }
 
-    fseek(audio_fp, WAV_HEADER_SIZE, SEEK_SET);
+    audio_dsp_set_track_gain(&audio_dsp, gain);
 
-    xRingbufferPrintInfo(audio_rb);
-    playing = true;
-    
-    xTaskCreate(audio_reader_task, "audio_reader", 4096 * 2, NULL, 5, &reader_task_hdl);
+    // Published last: other tasks use it to tell a decoder is set up
+    audio_fp = fp;
+    stream_pos = 0;
+    skip_frames = 0;
+    seek_guess = 0;
 
-    ESP_LOGI(TAG, "Audio playback started");
+    // PCM offsets are computed, compressed formats need a frame table
+    if (audio_codec != AUDIO_CODEC_WAV) {
+        if (!seek_idx) {
+            seek_idx = calloc(1, sizeof(seek_index_t));
+        }
+        if (seek_idx) {
+            bool mp3 = audio_codec == AUDIO_CODEC_MP3;
+            seek_index_open(seek_idx, path, mp3 ? SEEK_INDEX_MP3 : SEEK_INDEX_FLAC,
+                            mp3 ? mp3_dec->data_start : flac_dec->data_start,
+                            mp3 ? 0 : flac_dec->sample_rate);
+        }
+    }
     return true;
 }
 
-void audio_player_stop(void)
+static bool reader_open(const char *path)
 {
-    if (!playing) {
+    // After EOF the ring holds the end of the previous track, which still plays
+    bool stopped = reader_state != AUDIO_READER_IDLE;
+
+    reader_close();
+
+    FILE *fp = reader_fopen(path);
+    if (!fp || !reader_begin(fp, path, reader_track_gain(path))) {
+        return false;
+    }
+
+    // Force a fresh resampler history for the new stream
+    resampler_rate = 0;
+    resampler_tail = false;
+
+    // Nothing from a track cut short may leak into this one
+    if (stopped) {
+        audio_ring_flush(&audio_ring);
+    }
+    return true;
+}
+
+static void reader_enqueue(const char *path)
+{
+    if (queue_count == AUDIO_QUEUE_LEN) {
+        ESP_LOGW(TAG, "Play queue full, dropping %s", path);
         return;
     }
 
-    stop_requested = true;
-    ESP_LOGI(TAG, "Audio playback stopped");
+    uint8_t slot = (queue_head + queue_count) % AUDIO_QUEUE_LEN;
+    snprintf(track_queue[slot], AUDIO_PATH_MAX, "%s", path);
+    queue_count++;
 }
 
-void audio_reader_task(void *arg)
+static void reader_clear_queue(void)
 {
-    uint8_t buffer[AUDIO_READ_CHUNK];
+    if (next_fp) {
+        fclose(next_fp);
+        next_fp = NULL;
+    }
+    queue_head = 0;
+    queue_count = 0;
+}
 
-    ESP_LOGI(TAG, "Audio reader task started");
+// Open the next queued track while the current one is still streaming
+static void reader_prefetch(void)
+{
+    while (!next_fp && queue_count) {
+        snprintf(next_path, sizeof(next_path), "%s", track_queue[queue_head]);
+        queue_head = (queue_head + 1) % AUDIO_QUEUE_LEN;
+        queue_count--;
+
+        next_fp = reader_fopen(next_path);
+        if (next_fp) {
+            audio_file_cache(next_fp, false);
+            next_gain = reader_track_gain(next_path);
+        }
+    }
+}
+
+/*
+ * Gapless switch at end of stream: the prefetched file becomes the current
+ * one and the ring is left alone, so its first block lands right after the
+ * last frame of the previous track. Resampler history is kept if the rate
+ * does not change, and flushed out ahead of the new track if it does.
+ */
+static bool reader_next_track(void)
+{
+    reader_close();
+
+    while (1) {
+        reader_prefetch();
+        if (!next_fp) {
+            return false;
+        }
+
+        FILE *fp = next_fp;
+        next_fp = NULL;
+
+        if (reader_begin(fp, next_path, next_gain)) {
+            ESP_LOGI(TAG, "Gapless switch to %s", next_path);
+            return true;
+        }
+    }
+}
+
+/*
+ * Position the decoder at ms with sample accuracy: one fseek to the nearest
+ * frame at or before the target, then the decoded frames up to it are dropped.
+ * The ring flush makes sure nothing from the old position reaches A2DP.
+ *
+ * Past the end of a seek index still being built the offset is a guess by
+ * the byte ratio, and the decoder syncs to the next frame after it. The
+ * index notes which sample that frame starts at when its scan gets there,
+ * and the reported position is corrected then.
+ */
+static void reader_seek(uint32_t ms)
+{
+    if (!audio_fp) {
+        return;
+    }
+
+    uint32_t total = audio_total_frames();
+    uint32_t rate = audio_codec == AUDIO_CODEC_MP3 && seek_idx && seek_idx->sample_rate ?
+                    seek_idx->sample_rate : audio_source_rate();
+    uint32_t target = (uint64_t)ms * rate / 1000;
+    if (total && target > total) {
+        target = total;
+    }
+
+    if (audio_codec == AUDIO_CODEC_WAV) {
+        uint32_t offset = target * audio_fmt.block_align;
+        if (offset > audio_fmt.data_size) {
+            offset = audio_fmt.data_size;
+        }
+        fseek(audio_fp, audio_fmt.data_offset + offset, SEEK_SET);
+        data_remaining = audio_fmt.data_size - offset;
+        skip_frames = 0;
+    } else {
+        bool mp3 = audio_codec == AUDIO_CODEC_MP3;
+        uint32_t start = mp3 ? mp3_dec->data_start : flac_dec->data_start;
+        seek_point_t point;
+
+        if (!seek_idx) {
+            ESP_LOGW(TAG, "No seek index, ignoring seek");
+            return;
+        }
+
+        seek_guess = 0;
+        if (seek_idx->complete || seek_idx->next_sample > target) {
+            // MP3 frames may borrow bits from up to two frames back
+            uint32_t preroll = mp3 ? 2 * MP3_MAX_FRAME_SAMPLES : 0;
+            if (!seek_index_lookup(seek_idx, target > preroll ? target - preroll : 0, &point)) {
+                return;
+            }
+            skip_frames = target - point.sample;
+        } else if (!total) {
+            ESP_LOGW(TAG, "Track length unknown, ignoring seek");
+            return;
+        } else {
+            point.offset = start + (uint64_t)(seek_idx->file_size - start) * target / total;
+            if (point.offset <= seek_idx->pos) {
+                // Only just past the scan, whose position is exact
+                point.offset = seek_idx->pos;
+                target = seek_idx->next_sample;
+            } else {
+                seek_index_probe(seek_idx, point.offset);
+                seek_guess = target;
+            }
+            skip_frames = 0;
+        }
+
+        if (mp3) {
+            mp3_decoder_seek(mp3_dec, audio_fp, point.offset);
+        } else {
+            flac_decoder_seek(flac_dec, point.offset);
+        }
+    }
+
+    ESP_LOGI(TAG, "Seek to %lu ms (frame %lu)", (unsigned long)ms, (unsigned long)target);
+
+    stream_pos = target;
+    audio_pipeline_reset(&pipeline);
+    audio_ring_flush(&audio_ring);
+}
+
+static void reader_trace_report(void)
+{
+    if (play_trace.reported || play_trace.first_audio == 0) {
+        return;
+    }
+    play_trace.reported = true;
 
-    while (!stop_requested) {
+    ESP_LOGI(TAG, "Play latency: open %lld us, first block %lld us, first audio %lld us",
+             play_trace.opened - play_trace.cmd,
+             play_trace.first_block - play_trace.cmd,
+             play_trace.first_audio - play_trace.cmd);
+}
+
+static void reader_handle_cmd(const audio_reader_msg_t *msg)
+{
+    ESP_LOGD(TAG, "Reader CMD %d in state %d", msg->cmd, reader_state);
 
-        size_t bytes = fread(buffer, 1, sizeof(buffer), audio_fp);
-        if (bytes == 0) {
-            ESP_LOGI(TAG, "End of WAV file");
-     
+    switch (msg->cmd) {
+    case AUDIO_READER_CMD_OPEN:
+        // Whatever was queued followed the old track
+        reader_clear_queue();
+        if (reader_open(msg->path)) {
+            play_trace.opened = esp_timer_get_time();
+            play_trace.first_block = 0;
+            reader_state = AUDIO_READER_STREAMING;
+            ESP_LOGI(TAG, "Audio playback started");
+        } else {
+            reader_state = AUDIO_READER_IDLE;
             audio_cmd_t cmd = AUDIO_CMD_EOF;
             xQueueSend(audio_cmd_q, &cmd, 0);
-
+        }
+        break;
+    case AUDIO_READER_CMD_SEEK:
+        reader_seek(msg->arg);
+        break;
+    case AUDIO_READER_CMD_PAUSE:
+        if (reader_state == AUDIO_READER_STREAMING) {
+            reader_state = AUDIO_READER_PAUSED;
+        }
+        break;
+    case AUDIO_READER_CMD_RESUME:
+        if (reader_state == AUDIO_READER_PAUSED) {
+            reader_state = AUDIO_READER_STREAMING;
+        }
+        break;
+    case AUDIO_READER_CMD_ENQUEUE:
+        reader_enqueue(msg->path);
+        break;
+    case AUDIO_READER_CMD_SKIP:
+        if (reader_state == AUDIO_READER_IDLE || (!next_fp && !queue_count)) {
+            ESP_LOGI(TAG, "Nothing queued to skip to");
             break;
         }
-
-        if (xRingbufferSend(audio_rb, buffer, bytes,
-                            pdMS_TO_TICKS(100)) != pdTRUE) {
-            ESP_LOGW(TAG, "Ring buffer full");
-            vTaskDelay(pdMS_TO_TICKS(10));
+        {
+            // Same switch as at end of stream, minus the audio still buffered
+            audio_cmd_t cmd = AUDIO_CMD_TRACK_CHANGED;
+            if (!reader_next_track()) {
+                reader_state = AUDIO_READER_IDLE;
+                cmd = AUDIO_CMD_EOF;
+            }
+            audio_pipeline_reset(&pipeline);
+            audio_ring_flush(&audio_ring);
+            xQueueSend(audio_cmd_q, &cmd, 0);
         }
+        break;
+    case AUDIO_READER_CMD_CLOSE:
+        reader_clear_queue();
+        // After EOF the ring holds the end of the track, let it drain
+        if (reader_state != AUDIO_READER_IDLE) {
+            reader_close();
+            audio_ring_flush(&audio_ring);
+        }
+        reader_state = AUDIO_READER_IDLE;
+        ESP_LOGI(TAG, "Audio playback stopped");
+        break;
     }
+}
 
-    /* ---- CLEANUP SECTION ---- */
+// Produce one block into the ring; false at end of stream
+static bool reader_stream_block(void)
+{
+    int64_t t0 = esp_timer_get_time();
 
-    ESP_LOGI(TAG, "Audio reader task exiting");
+    ring_sleep_us = 0;
+    audio_pipe_status_t status = audio_pipeline_run(&pipeline);
+    audio_stats_busy(esp_timer_get_time() - t0 - ring_sleep_us);
 
-    stop_requested = false;
-    playing = false;
+    if (status == AUDIO_PIPE_EOS) {
+        return false;
+    }
 
-    if (audio_fp) {
-        fclose(audio_fp);
-        audio_fp = NULL;
+    if (status == AUDIO_PIPE_OK && play_trace.first_block == 0) {
+        play_trace.first_block = esp_timer_get_time();
+        audio_trace_armed = true;
     }
+    return true;    // or a command is waiting
+}
 
-    vTaskDelete(NULL);
+void audio_reader_task(void *arg)
+{
+    audio_reader_msg_t msg;
+
+    ESP_LOGI(TAG, "Audio reader task started");
+
+    while (1) {
+        // Block on the queue unless there is audio to produce
+        TickType_t wait = reader_state == AUDIO_READER_STREAMING ? 0 : portMAX_DELAY;
+
+        if (xQueueReceive(reader_cmd_q, &msg, wait) == pdTRUE) {
+            reader_handle_cmd(&msg);
+            continue;
+        }
+
+        if (!reader_stream_block()) {
+            ESP_LOGI(TAG, "End of audio file");
+
+            audio_cmd_t cmd = AUDIO_CMD_TRACK_CHANGED;
+            if (!reader_next_track()) {
+                // Nothing follows, so what the resampler still holds ends the track
+                audio_pipeline_finish(&pipeline);
+                reader_state = AUDIO_READER_IDLE;
+                cmd = AUDIO_CMD_EOF;
+            }
+            xQueueSend(audio_cmd_q, &cmd, 0);
+        } else if (play_trace.first_block) {
+            // Start-up comes first, then get the next file ready
+            reader_prefetch();
+        }
+
+        reader_trace_report();
+    }
+}
+
+uint32_t audio_player_get_position_ms(void)
+{
+    uint32_t rate = audio_fp ? audio_source_rate() : 0;
+
+    if (rate == 0) {
+        return 0;
+    }
+
+    // What is still in the ring has not been heard yet
+    uint32_t queued_ms = (uint64_t)audio_ring_fill(&audio_ring) / 4 * 1000 / AUDIO_SAMPLE_RATE;
+    uint32_t pos_ms = (uint64_t)stream_pos * 1000 / rate;
+    return pos_ms > queued_ms ? pos_ms - queued_ms : 0;
 }
 
+uint32_t audio_player_get_duration_ms(void)
+{
+    uint32_t rate = audio_fp ? audio_source_rate() : 0;
+
+    return rate ? (uint64_t)audio_total_frames() * 1000 / rate : 0;
+}
 
 bool audio_player_is_playing(void)
 {
-    return playing;
+    if (output_paused) {
+        return false;
+    }
+    // Keep draining after EOF until the ring is empty
+    return reader_state != AUDIO_READER_IDLE || audio_ring_fill(&audio_ring) > 0;
+}
+
+bool audio_player_is_paused(void)
+{
+    return output_paused;
+}
+
+audio_state_t audio_player_get_state(void)
+{
+    return control_state;
+}
+
+int32_t audio_player_read(uint8_t *data, int32_t len)
+{
+    if (!audio_player_is_playing()) {
+        memset(data, 0, len);
+        return len;
+    }
+
+    // Single copy out of the lock-free ring, pad any shortfall with silence
+    uint32_t fill = audio_ring_fill(&audio_ring);
+    uint32_t got = audio_ring_read(&audio_ring, data, len);
+
+    audio_stats_consumer(fill, audio_ring.size, len, got);
+
+    if (got && audio_trace_armed) {
+        audio_trace_first_audio();
+    }
+
+    if (got < len) {
+        memset(data + got, 0, len - got);
+    }
+    return len;
+}
+
+// Move the play queue and make its new entry current_file
+static bool control_step(int32_t step)
+{
+    if (!audio_queue_step(step, current_path, sizeof(current_path))) {
+        return false;
+    }
+    track_serial++;
+    return true;
+}
+
+// Start current_file with the next queue entry behind it for a gapless switch
+static void control_start(void)
+{
+    char path[AUDIO_PATH_MAX];
+
+    audio_player_start(current_file);
+    if (audio_queue_peek(1, path, sizeof(path))) {
+        audio_player_enqueue(path);
+    }
+}
+
+// The reader moved on to the entry queued behind the current one
+static void control_track_changed(void)
+{
+    char path[AUDIO_PATH_MAX];
+
+    control_step(1);
+    if (audio_queue_peek(1, path, sizeof(path))) {
+        audio_player_enqueue(path);
+    }
+    bt_avrc_notify_track();
+}
+
+static void control_prev(void)
+{
+    // Well into the track, or nothing before it: back to its start
+    if (audio_player_get_position_ms() > AUDIO_QUEUE_RESTART_MS || !control_step(-1)) {
+        audio_player_seek(0);
+        return;
+    }
+    xQueueSend(audio_cmd_q, &(audio_cmd_t){ AUDIO_CMD_OPEN }, 0);
 }
 
 void audio_control_task(void *arg)
 {
     audio_state_t state = AUDIO_STATE_IDLE;
     audio_cmd_t cmd = AUDIO_CMD_NONE;
+    bool eof_pending = false;
+    char pick[AUDIO_PATH_MAX];
 
     while (1) {
         if (xQueueReceive(audio_cmd_q, &cmd, portMAX_DELAY)) {
 
             ESP_LOGI(TAG, "Audio CMD %d in state %d", cmd, state);
 
+            // A picked file plays from its start, whatever the state; only the
+            // latest pick is left when several come in quick succession
+            if (cmd == AUDIO_CMD_FILE) {
+                cmd = AUDIO_CMD_NONE;
+                if (xQueueReceive(file_pick_q, pick, 0) == pdTRUE) {
+                    snprintf(current_path, sizeof(current_path), "%s", pick);
+                    track_serial++;
+                    cmd = AUDIO_CMD_OPEN;
+                }
+            }
+            // A playlist plays from its first entry, whatever the state
+            if (cmd == AUDIO_CMD_PLAYLIST) {
+                cmd = xQueueReceive(playlist_pick_q, pick, 0) == pdTRUE && audio_queue_load(pick) &&
+                      control_step(0) ? AUDIO_CMD_OPEN : AUDIO_CMD_NONE;
+            }
+            // Volume is applied here only, whichever task it came from
+            if (cmd == AUDIO_CMD_VOLUME) {
+                volume_pick_t vol;
+                if (xQueueReceive(volume_pick_q, &vol, 0) == pdTRUE) {
+                    volume_apply(vol.percent, vol.tell_sink);
+                }
+                cmd = AUDIO_CMD_NONE;
+            } else if (cmd == AUDIO_CMD_VOLUME_UP || cmd == AUDIO_CMD_VOLUME_DOWN) {
+                int step = cmd == AUDIO_CMD_VOLUME_UP ? BT_AVRC_VOL_STEP : -BT_AVRC_VOL_STEP;
+                int vol = player_volume + step;
+                volume_apply(vol < 0 ? 0 : vol, true);
+                cmd = AUDIO_CMD_NONE;
+            }
+
             switch (state) {
 
             case AUDIO_STATE_IDLE:
             case AUDIO_STATE_STOPPED:
-                if (cmd == AUDIO_CMD_PLAY) {
-                    audio_player_start(current_file);
+                if (cmd == AUDIO_CMD_PLAY || cmd == AUDIO_CMD_OPEN) {
+                    // Stream start and file open overlap, the ring fills during the handshake
+                    if (audio_output_get() == AUDIO_OUTPUT_BT) {
+                        bt_media_start();
+                    }
+                    control_start();
                     state = AUDIO_STATE_PLAYING;
                 }
                 break;
@@ -149,15 +1185,37 @@ void audio_control_task(void *arg)
                     log_mem(TAG);
                     switch(cmd) {
                         case AUDIO_CMD_PAUSE:
-                            audio_player_stop();
+                            audio_player_pause();
+                            bt_media_idle();
                             state = AUDIO_STATE_PAUSED;
                             break;
                         // case AUDIO_CMD_STOP:
                         //     audio_player_stop();
                         //     state = AUDIO_STATE_STOPPED;
                         //     break;
+                        case AUDIO_CMD_TRACK_CHANGED:
+                            // Reader already switched files, nothing to stop
+                            control_track_changed();
+                            break;
+                        case AUDIO_CMD_NEXT:
+                            audio_player_skip();
+                            break;
+                        case AUDIO_CMD_PREV:
+                            control_prev();
+                            break;
+                        case AUDIO_CMD_OPEN:
+                            control_start();
+                            bt_avrc_notify_track();
+                            break;
                         case AUDIO_CMD_EOF:
+                            // The queued track would not open, try the one after it
+                            if (control_step(1)) {
+                                control_start();
+                                bt_avrc_notify_track();
+                                break;
+                            }
                             audio_player_stop();
+                            bt_media_idle();
                             state = AUDIO_STATE_STOPPED;
                             // ui_notify_play_reset();  // async LVGL
                             ui_reset_play_button();
@@ -169,14 +1227,58 @@ void audio_control_task(void *arg)
                 break;
 
             case AUDIO_STATE_PAUSED:
-                if (cmd == AUDIO_CMD_PLAY) {
-                    audio_player_start(current_file);
+                if (cmd == AUDIO_CMD_OPEN) {
+                    if (audio_output_get() == AUDIO_OUTPUT_BT) {
+                        bt_media_start();
+                    }
+                    control_start();
+                    eof_pending = false;
+                    state = AUDIO_STATE_PLAYING;
+                    bt_avrc_notify_track();
+                } else if (cmd == AUDIO_CMD_PLAY) {
+                    if (audio_output_get() == AUDIO_OUTPUT_BT) {
+                        bt_media_start();
+                    }
+                    audio_player_resume();
                     state = AUDIO_STATE_PLAYING;
+                    if (eof_pending) {
+                        // Replay the EOF now that the buffered tail can drain
+                        eof_pending = false;
+                        xQueueSend(audio_cmd_q, &(audio_cmd_t){ AUDIO_CMD_EOF }, 0);
+                    }
                 } else if (cmd == AUDIO_CMD_STOP) {
+                    audio_player_stop();
+                    eof_pending = false;
                     state = AUDIO_STATE_STOPPED;
+                } else if (cmd == AUDIO_CMD_EOF) {
+                    // Reader hit the end just before the pause
+                    eof_pending = true;
+                } else if (cmd == AUDIO_CMD_TRACK_CHANGED) {
+                    // A skip while paused, the new track waits for PLAY
+                    eof_pending = false;
+                    control_track_changed();
+                } else if (cmd == AUDIO_CMD_NEXT) {
+                    audio_player_skip();
+                } else if (cmd == AUDIO_CMD_PREV) {
+                    control_prev();
                 }
                 break;
             }
+
+            if (remote_cmd_us) {
+                ESP_LOGI(TAG, "Remote CMD %d handled %lld us after the key",
+                         cmd, esp_timer_get_time() - remote_cmd_us);
+                remote_cmd_us = 0;
+            }
+
+            if (state != control_state) {
+                bool new_track = control_state == AUDIO_STATE_IDLE || control_state == AUDIO_STATE_STOPPED;
+                control_state = state;
+                bt_avrc_notify_play_status();
+                if (new_track && state == AUDIO_STATE_PLAYING) {
+                    bt_avrc_notify_track();
+                }
+            }
         }
 
         vTaskDelay(pdMS_TO_TICKS(10)); // keep WDT happy
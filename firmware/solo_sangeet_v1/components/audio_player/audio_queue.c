@@ -0,0 +1,488 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "audio_queue.h"
+#include "audio_player.h"
+#include "audio_library.h"
+#include "file_manager.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "QUEUE";
+
+#define QUEUE_GROW      512         // playlist entries added at a time
+#define QUEUE_SEARCH_LINES  32      // searched for one by one, longer lists hash the library
+
+// Library path, case folded and hashed; 64 bits leave no room for a false match
+typedef struct {
+    uint32_t hash[2];
+    uint32_t index;
+} queue_key_t;
+
+typedef struct {
+    uint32_t *ids;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t lines;                 // track lines read, queued or not
+    queue_key_t *keys;              // every library track, sorted by hash
+    uint32_t nkeys;
+    bool no_keys;                   // no memory for them, search line by line
+} queue_build_t;
+
+typedef struct {
+    uint32_t n;                     // playlists still to pass
+    char *path;
+    size_t len;
+} queue_find_t;
+
+static SemaphoreHandle_t q_lock;    // everything below
+static uint32_t *q_ids = NULL;      // playlist entries, NULL: the whole library
+static uint32_t q_count = 0;
+static uint32_t q_pos = 0;
+static uint32_t q_gen = 0;          // library generation the entries belong to
+static uint32_t q_serial = 0;       // bumped whenever the entries are replaced
+static char q_playlist[AUDIO_PATH_MAX];     // "" for the library
+static char q_path[AUDIO_PATH_MAX];         // current entry, found again after a rebuild
+
+static uint32_t queue_len(void)
+{
+    return q_ids ? q_count : audio_library_count();
+}
+
+static uint32_t queue_id(uint32_t pos)
+{
+    return q_ids ? q_ids[pos] : pos;
+}
+
+static bool queue_grow(queue_build_t *b)
+{
+    if (b->count < b->cap) {
+        return true;
+    }
+    if (b->cap == AUDIO_QUEUE_MAX_ENTRIES) {
+        return false;
+    }
+
+    size_t size = (b->cap + QUEUE_GROW) * sizeof(uint32_t);
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + AUDIO_QUEUE_HEAP_RESERVE) {
+        return false;
+    }
+    uint32_t *ids = malloc(size);
+    if (!ids) {
+        return false;
+    }
+    if (b->ids) {
+        memcpy(ids, b->ids, b->count * sizeof(uint32_t));
+        free(b->ids);
+    }
+    b->ids = ids;
+    b->cap += QUEUE_GROW;
+    return true;
+}
+
+// Drop "." and empty segments, fold ".." into its parent; p starts with '/'
+static bool path_tidy(char *p)
+{
+    char *out = p;
+    const char *in = p;
+
+    while (*in) {
+        while (*in == '/') {
+            in++;
+        }
+        const char *seg = in;
+        while (*in && *in != '/') {
+            in++;
+        }
+        size_t n = in - seg;
+
+        if (n == 0 || (n == 1 && seg[0] == '.')) {
+            continue;
+        }
+        if (n == 2 && seg[0] == '.' && seg[1] == '.') {
+            if (out == p) {
+                return false;
+            }
+            while (*--out != '/') {
+            }
+            continue;
+        }
+        *out++ = '/';
+        memmove(out, seg, n);
+        out += n;
+    }
+    *out = '\0';
+    return out != p;
+}
+
+// Card path of one playlist line, relative lines start from dir
+static bool line_path(char *line, const char *dir, char *path, size_t len)
+{
+    char name[AUDIO_PATH_MAX];
+
+    // Streams and file:// URLs have no place in the library
+    if (strstr(line, "://")) {
+        return false;
+    }
+    for (char *c = line; *c; c++) {
+        if (*c == '\\') {
+            *c = '/';
+        }
+    }
+    // Playlists written on a PC name the card's drive
+    if (isalpha((unsigned char)line[0]) && line[1] == ':') {
+        line += 2;
+    }
+    if (!sd_path_from_text(line, name, sizeof(name))) {
+        return false;
+    }
+
+    size_t mount_len = strlen(SD_MOUNT_POINT);
+    int n;
+    if (!strncasecmp(name, SD_MOUNT_POINT "/", mount_len + 1)) {
+        n = snprintf(path, len, "%s", name);
+    } else if (name[0] == '/') {
+        n = snprintf(path, len, SD_MOUNT_POINT "%s", name);
+    } else {
+        n = snprintf(path, len, "%s/%s", dir, name);
+    }
+    return n > 0 && (size_t)n < len && path_tidy(path);
+}
+
+static void path_hash(const char *path, uint32_t hash[2])
+{
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+
+    for (const char *c = path; *c; c++) {
+        h = (h ^ (uint8_t)tolower((unsigned char)*c)) * 1099511628211ULL;
+    }
+    hash[0] = h >> 32;
+    hash[1] = h;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+    const queue_key_t *x = a, *y = b;
+
+    if (x->hash[0] != y->hash[0]) {
+        return x->hash[0] < y->hash[0] ? -1 : 1;
+    }
+    return x->hash[1] < y->hash[1] ? -1 : x->hash[1] > y->hash[1];
+}
+
+/*
+ * One pass over the library in index order reads each page once, where a
+ * search per line would read about a dozen in random order. Worth it for
+ * a long playlist, not for a short one.
+ */
+static bool queue_keys(queue_build_t *b)
+{
+    char path[AUDIO_PATH_MAX];
+    uint32_t count = audio_library_count();
+    size_t size = count * sizeof(queue_key_t);
+
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) < size + AUDIO_QUEUE_HEAP_RESERVE ||
+        !(b->keys = malloc(size))) {
+        ESP_LOGW(TAG, "Not enough memory to hash the library, searching line by line");
+        return false;
+    }
+
+    for (b->nkeys = 0; b->nkeys < count; b->nkeys++) {
+        if (!audio_library_path(b->nkeys, path, sizeof(path))) {
+            break;
+        }
+        path_hash(path, b->keys[b->nkeys].hash);
+        b->keys[b->nkeys].index = b->nkeys;
+    }
+    qsort(b->keys, b->nkeys, sizeof(queue_key_t), key_cmp);
+    return true;
+}
+
+// Short lists search; albums are usually listed in order, so the record after the last hit comes first
+static int32_t line_find(queue_build_t *b, const char *path, int32_t last)
+{
+    char next[AUDIO_PATH_MAX];
+
+    if (!b->keys && !b->no_keys && b->lines > QUEUE_SEARCH_LINES) {
+        b->no_keys = !queue_keys(b);
+    }
+    if (b->keys) {
+        queue_key_t key;
+        path_hash(path, key.hash);
+        queue_key_t *hit = bsearch(&key, b->keys, b->nkeys, sizeof(queue_key_t), key_cmp);
+        return hit ? (int32_t)hit->index : -1;
+    }
+
+    if (last >= 0 && audio_library_path(last + 1, next, sizeof(next)) && !strcasecmp(next, path)) {
+        return last + 1;
+    }
+    return audio_library_find(path);
+}
+
+static bool queue_parse(const char *playlist, queue_build_t *b)
+{
+    char line[AUDIO_PATH_MAX];
+    char dir[AUDIO_PATH_MAX];
+    char path[AUDIO_PATH_MAX];
+    int32_t last = -1;
+
+    FILE *fp = fopen(playlist, "r");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to open %s", playlist);
+        return false;
+    }
+
+    snprintf(dir, sizeof(dir), "%s", playlist);
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        size_t n = strlen(line);
+        bool whole = n && line[n - 1] == '\n';
+
+        // Too long for a card path; drop the rest of it
+        if (!whole && !feof(fp)) {
+            int c;
+            while ((c = fgetc(fp)) != EOF && c != '\n') {
+            }
+            b->lines++;
+            continue;
+        }
+        while (n && isspace((unsigned char)line[n - 1])) {
+            line[--n] = '\0';
+        }
+        char *s = line;
+        if (b->lines == 0 && !memcmp(s, "\xEF\xBB\xBF", 3)) {
+            s += 3;                 // UTF-8 BOM
+        }
+        while (isspace((unsigned char)*s)) {
+            s++;
+        }
+        if (*s == '\0' || *s == '#') {
+            continue;
+        }
+        b->lines++;
+
+        if (!line_path(s, dir, path, sizeof(path))) {
+            continue;
+        }
+        int32_t index = line_find(b, path, last);
+        if (index < 0) {
+            ESP_LOGD(TAG, "Not in the library: %s", path);
+            continue;
+        }
+        if (!queue_grow(b)) {
+            ESP_LOGW(TAG, "Playlist cut at %lu entries", (unsigned long)b->count);
+            break;
+        }
+        b->ids[b->count++] = index;
+        last = index;
+    }
+
+    fclose(fp);
+    free(b->keys);
+    b->keys = NULL;
+    return true;
+}
+
+/*
+ * A rebuilt library moves every track; load again and find the current one
+ * by path. Both read the card, so they run outside the lock and the result
+ * is only put in if nothing replaced the queue meanwhile.
+ */
+static void queue_refresh(void)
+{
+    char playlist[AUDIO_PATH_MAX];
+    char path[AUDIO_PATH_MAX];
+    queue_build_t b = { 0 };
+
+    xSemaphoreTake(q_lock, portMAX_DELAY);
+    uint32_t gen = audio_library_generation();
+    uint32_t serial = q_serial;
+    bool stale = q_gen != gen;
+    snprintf(playlist, sizeof(playlist), "%s", q_ids ? q_playlist : "");
+    snprintf(path, sizeof(path), "%s", q_path);
+    xSemaphoreGive(q_lock);
+
+    if (!stale) {
+        return;
+    }
+    bool listed = playlist[0] && queue_parse(playlist, &b) && b.count;
+    int32_t index = audio_library_find(path);
+
+    xSemaphoreTake(q_lock, portMAX_DELAY);
+    if (q_serial != serial) {
+        xSemaphoreGive(q_lock);
+        free(b.ids);
+        return;
+    }
+    q_serial++;
+    q_gen = gen;
+
+    if (playlist[0]) {
+        free(q_ids);
+        q_ids = NULL;
+        q_count = 0;
+        if (listed) {
+            q_ids = b.ids;
+            q_count = b.count;
+            b.ids = NULL;
+        } else {
+            ESP_LOGW(TAG, "%s is gone, queueing the library", playlist);
+            q_playlist[0] = '\0';
+        }
+    }
+
+    uint32_t len = queue_len();
+    bool found = false;
+    if (index >= 0) {
+        // The same track may be listed twice, take the nearest one on
+        for (uint32_t i = 0; i < len && !found; i++) {
+            uint32_t pos = (q_pos + i) % len;
+            if (queue_id(pos) == (uint32_t)index) {
+                q_pos = pos;
+                found = true;
+            }
+        }
+    }
+    if (!found && q_pos >= len) {
+        q_pos = 0;
+    }
+    xSemaphoreGive(q_lock);
+    free(b.ids);
+}
+
+bool audio_queue_init(void)
+{
+    q_lock = xSemaphoreCreateMutex();
+    return q_lock != NULL;
+}
+
+bool audio_queue_library(uint32_t index)
+{
+    if (!q_lock || index >= audio_library_count()) {
+        return false;
+    }
+
+    xSemaphoreTake(q_lock, portMAX_DELAY);
+    free(q_ids);
+    q_ids = NULL;
+    q_count = 0;
+    q_pos = index;
+    q_gen = audio_library_generation();
+    q_serial++;
+    q_playlist[0] = '\0';
+    bool ok = audio_library_path(index, q_path, sizeof(q_path));
+    xSemaphoreGive(q_lock);
+
+    return ok;
+}
+
+bool audio_queue_load(const char *playlist)
+{
+    queue_build_t b = { 0 };
+    int64_t t0 = esp_timer_get_time();
+    uint32_t gen = audio_library_generation();
+
+    if (!q_lock) {
+        return false;
+    }
+
+    // Parsed outside the lock, next and previous keep working meanwhile
+    if (!queue_parse(playlist, &b) || b.count == 0) {
+        ESP_LOGW(TAG, "Nothing to play in %s", playlist);
+        free(b.ids);
+        return false;
+    }
+    ESP_LOGI(TAG, "%s: %lu of %lu tracks queued in %lld ms, %u bytes", playlist,
+             (unsigned long)b.count, (unsigned long)b.lines,
+             (esp_timer_get_time() - t0) / 1000, (unsigned)(b.cap * sizeof(uint32_t)));
+
+    xSemaphoreTake(q_lock, portMAX_DELAY);
+    free(q_ids);
+    q_ids = b.ids;
+    q_count = b.count;
+    q_pos = 0;
+    q_gen = gen;
+    q_serial++;
+    snprintf(q_playlist, sizeof(q_playlist), "%s", playlist);
+    if (!audio_library_path(q_ids[0], q_path, sizeof(q_path))) {
+        q_path[0] = '\0';
+    }
+    xSemaphoreGive(q_lock);
+
+    return true;
+}
+
+uint32_t audio_queue_count(void)
+{
+    return q_lock ? queue_len() : 0;
+}
+
+static bool queue_path(int32_t step, bool move, char *path, size_t len)
+{
+    char buf[AUDIO_PATH_MAX];
+    bool ok = false;
+
+    if (!q_lock) {
+        return false;
+    }
+
+    queue_refresh();
+    xSemaphoreTake(q_lock, portMAX_DELAY);
+    int64_t pos = (int64_t)q_pos + step;
+    if (pos >= 0 && pos < queue_len()) {
+        ok = audio_library_path(queue_id(pos), buf, sizeof(buf));
+    }
+    if (ok && move) {
+        q_pos = pos;
+        snprintf(q_path, sizeof(q_path), "%s", buf);
+    }
+    xSemaphoreGive(q_lock);
+
+    if (ok) {
+        snprintf(path, len, "%s", buf);
+    }
+    return ok;
+}
+
+bool audio_queue_step(int32_t step, char *path, size_t len)
+{
+    return queue_path(step, true, path, len);
+}
+
+bool audio_queue_peek(int32_t step, char *path, size_t len)
+{
+    return queue_path(step, false, path, len);
+}
+
+static bool find_visit(const char *path, const struct stat *st, void *arg)
+{
+    queue_find_t *f = arg;
+    const char *ext = strrchr(path, '.');
+
+    if (!ext || (strcasecmp(ext, ".m3u") && strcasecmp(ext, ".m3u8"))) {
+        return true;
+    }
+    if (f->n--) {
+        return true;
+    }
+    snprintf(f->path, f->len, "%s", path);
+    return false;
+}
+
+bool audio_queue_playlist(uint32_t n, char *path, size_t len)
+{
+    queue_find_t f = { .n = n, .path = path, .len = len };
+
+    // Stops early once it is found
+    return !sd_fs_walk(AUDIO_QUEUE_PLAYLIST_DIR, find_visit, &f);
+}
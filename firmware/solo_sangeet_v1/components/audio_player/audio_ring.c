@@ -0,0 +1,156 @@
+#include <string.h>
+#include "audio_ring.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+static const char *TAG = "RING";
+
+bool audio_ring_init(audio_ring_t *rb, uint32_t size, uint32_t slack)
+{
+    if (size == 0 || (size & (size - 1)) != 0 || slack > size) {
+        ESP_LOGE(TAG, "Ring size must be a power of two (%lu)", (unsigned long)size);
+        return false;
+    }
+
+    // Internal RAM: the consumer runs in the BT stack's timing-critical path
+    rb->buf = heap_caps_aligned_alloc(AUDIO_RING_ALIGN, size + slack,
+                                      MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!rb->buf) {
+        ESP_LOGE(TAG, "Failed to allocate %lu byte ring", (unsigned long)(size + slack));
+        return false;
+    }
+
+    rb->size = size;
+    rb->slack = slack;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->flush_head = 0;
+    rb->flush_req = 0;
+    rb->flush_done = 0;
+    rb->waiter = NULL;
+    rb->wake_level = 0;
+    rb->wake_armed = 0;
+    return true;
+}
+
+uint8_t *audio_ring_acquire(audio_ring_t *rb, uint32_t len)
+{
+    if (len > rb->slack || audio_ring_free(rb) < len) {
+        return NULL;
+    }
+    return rb->buf + (rb->head & (rb->size - 1));
+}
+
+void audio_ring_commit(audio_ring_t *rb, uint32_t len)
+{
+    uint32_t head = rb->head;
+    uint32_t off = head & (rb->size - 1);
+
+    // Fold whatever landed in the slack back to the start of the ring
+    if (off + len > rb->size) {
+        memcpy(rb->buf, rb->buf + rb->size, off + len - rb->size);
+    }
+
+    __atomic_store_n(&rb->head, head + len, __ATOMIC_RELEASE);
+}
+
+uint32_t audio_ring_read(audio_ring_t *rb, uint8_t *dst, uint32_t len)
+{
+    // Load head before the flush counter: a flush is always published before
+    // the data that follows it, so we can never see that data without the flush
+    uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    uint32_t req = __atomic_load_n(&rb->flush_req, __ATOMIC_ACQUIRE);
+    uint32_t tail = rb->tail;
+
+    if (req != rb->flush_done) {
+        uint32_t flush_head = __atomic_load_n(&rb->flush_head, __ATOMIC_ACQUIRE);
+        rb->flush_done = req;
+        if ((int32_t)(flush_head - tail) > 0) {
+            tail = flush_head;
+        }
+        if ((int32_t)(tail - head) > 0) {
+            head = tail;    // flushed past our snapshot of head
+        }
+    }
+
+    uint32_t avail = head - tail;
+    uint32_t off = tail & (rb->size - 1);
+
+    if (len > avail) {
+        len = avail;
+    }
+
+    uint32_t first = rb->size - off;
+    if (first >= len) {
+        memcpy(dst, rb->buf + off, len);
+    } else {
+        memcpy(dst, rb->buf + off, first);
+        memcpy(dst + first, rb->buf, len - first);
+    }
+
+    __atomic_store_n(&rb->tail, tail + len, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in audio_ring_wait_below(): either we see the
+    // producer armed, or it sees our new tail
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rb->wake_armed, __ATOMIC_RELAXED) &&
+        head - (tail + len) <= rb->wake_level &&
+        __atomic_exchange_n(&rb->wake_armed, 0, __ATOMIC_ACQUIRE)) {
+        xTaskNotifyGive(rb->waiter);
+    }
+    return len;
+}
+
+bool audio_ring_peek(const audio_ring_t *rb, uint8_t *dst, uint32_t len)
+{
+    uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+
+    if (head - tail < len) {
+        return false;
+    }
+
+    uint32_t off = tail & (rb->size - 1);
+    uint32_t first = rb->size - off;
+    if (first >= len) {
+        memcpy(dst, rb->buf + off, len);
+    } else {
+        memcpy(dst, rb->buf + off, first);
+        memcpy(dst + first, rb->buf, len - first);
+    }
+
+    /*
+     * Byte tail+k sits where tail+k+size will be written. The producer
+     * fills a span before it publishes head, so it may be up to slack
+     * bytes past head; and it may write anywhere up to the consumer's tail
+     * plus size, which moves on while we copy. The copy is whole only if
+     * neither reaches tail+size.
+     */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t head_now = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) + rb->slack;
+    uint32_t tail_now = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE) + rb->size;
+    uint32_t reach = (int32_t)(head_now - tail_now) < 0 ? head_now : tail_now;
+    return reach - tail <= rb->size;
+}
+
+void audio_ring_flush(audio_ring_t *rb)
+{
+    __atomic_store_n(&rb->flush_head, rb->head, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&rb->flush_req, 1, __ATOMIC_RELEASE);
+}
+
+bool audio_ring_wait_below(audio_ring_t *rb, uint32_t level, TickType_t timeout)
+{
+    rb->waiter = xTaskGetCurrentTaskHandle();
+    rb->wake_level = level;
+    __atomic_store_n(&rb->wake_armed, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (audio_ring_fill(rb) > level) {
+        ulTaskNotifyTake(pdTRUE, timeout);
+    }
+
+    __atomic_store_n(&rb->wake_armed, 0, __ATOMIC_RELAXED);
+    return audio_ring_fill(rb) <= level;
+}
@@ -0,0 +1,248 @@
+#include <math.h>
+#include <string.h>
+#include "audio_spectrum.h"
+#include "audio_player.h"
+
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "SPECTRUM";
+
+#define FFT_N       AUDIO_SPECTRUM_FFT_SIZE
+#define FFT_HALF    (FFT_N / 2)
+#define LEVEL_MAX   100
+
+// Tables, built once
+static int16_t s_window[FFT_N];             // Hann, Q15
+static int16_t s_cos[FFT_HALF], s_sin[FFT_HALF];
+static uint16_t s_band_edge[AUDIO_SPECTRUM_BANDS + 1];
+static float s_full_scale;                  // bin power of a 0 dBFS sine
+
+// Work buffers, only touched by the spectrum task
+static int16_t s_tap[FFT_N * 2];
+static int16_t s_re[FFT_N], s_im[FFT_N];
+static audio_spectrum_t s_levels;
+
+// Double buffer: slot seq & 1 holds the latest levels. A slot is only
+// rewritten two publishes on, and s_writing goes up before it is touched
+static audio_spectrum_t s_slots[2];
+static uint32_t s_writing;
+static uint32_t s_published;
+
+static uint64_t s_cycles;
+static uint32_t s_frames;
+
+static void tables_init(void)
+{
+    for (int i = 0; i < FFT_N; i++) {
+        s_window[i] = (int16_t)(32767 * 0.5f * (1 - cosf(2 * (float)M_PI * i / (FFT_N - 1))));
+    }
+    for (int i = 0; i < FFT_HALF; i++) {
+        s_cos[i] = (int16_t)lroundf(32767 * cosf(2 * (float)M_PI * i / FFT_N));
+        s_sin[i] = (int16_t)lroundf(32767 * sinf(2 * (float)M_PI * i / FFT_N));
+    }
+
+    // Log spaced edges over bins 1..FFT_HALF, at least one bin per band
+    s_band_edge[0] = 1;
+    for (int b = 1; b <= AUDIO_SPECTRUM_BANDS; b++) {
+        uint16_t e = (uint16_t)lroundf(powf(FFT_HALF, (float)b / AUDIO_SPECTRUM_BANDS));
+        s_band_edge[b] = e > s_band_edge[b - 1] ? e : s_band_edge[b - 1] + 1;
+    }
+    s_band_edge[AUDIO_SPECTRUM_BANDS] = FFT_HALF;
+
+    // Hann halves a sine's peak bin, the FFT scales by 1/N: A/4 per side
+    float peak = 32767.0f / 4;
+    s_full_scale = peak * peak;
+}
+
+// In-place radix-2 DIT, halving every stage so Q15 never overflows
+static void fft_q15(int16_t *re, int16_t *im)
+{
+    for (uint32_t i = 1, j = 0; i < FFT_N; i++) {
+        uint32_t bit = FFT_N >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (uint32_t len = 2; len <= FFT_N; len <<= 1) {
+        uint32_t half = len / 2;
+        uint32_t step = FFT_N / len;
+        for (uint32_t i = 0; i < FFT_N; i += len) {
+            for (uint32_t k = 0; k < half; k++) {
+                int32_t c = s_cos[k * step], s = s_sin[k * step];
+                int16_t *ar = &re[i + k], *ai = &im[i + k];
+                int16_t *br = &re[i + k + half], *bi = &im[i + k + half];
+                // (br + j bi) * e^{-j theta}
+                int32_t tr = (*br * c + *bi * s) >> 15;
+                int32_t ti = (*bi * c - *br * s) >> 15;
+                int32_t xr = *ar, xi = *ai;
+                *ar = (int16_t)((xr + tr) >> 1);
+                *ai = (int16_t)((xi + ti) >> 1);
+                *br = (int16_t)((xr - tr) >> 1);
+                *bi = (int16_t)((xi - ti) >> 1);
+            }
+        }
+    }
+}
+
+// Power ratio to full scale -> 0..LEVEL_MAX over AUDIO_SPECTRUM_RANGE_DB
+static uint8_t level_from_power(float ratio)
+{
+    if (ratio <= 0) {
+        return 0;
+    }
+    float db = 10 * log10f(ratio) + AUDIO_SPECTRUM_RANGE_DB;
+    if (db <= 0) {
+        return 0;
+    }
+    return db >= AUDIO_SPECTRUM_RANGE_DB ? LEVEL_MAX : (uint8_t)(db * LEVEL_MAX / AUDIO_SPECTRUM_RANGE_DB);
+}
+
+// Bars jump up and fall back slowly, so they read well at 30 Hz
+static void level_update(uint8_t *level, uint8_t now)
+{
+    if (now >= *level) {
+        *level = now;
+    } else {
+        *level = *level > now + AUDIO_SPECTRUM_FALL ? *level - AUDIO_SPECTRUM_FALL : now;
+    }
+}
+
+static void spectrum_compute(bool have_audio)
+{
+    uint8_t bands[AUDIO_SPECTRUM_BANDS] = { 0 };
+    uint8_t vu[2] = { 0 };
+
+    if (have_audio) {
+        int64_t sq[2] = { 0 };
+
+        for (int i = 0; i < FFT_N; i++) {
+            int32_t l = s_tap[2 * i], r = s_tap[2 * i + 1];
+            sq[0] += l * l;
+            sq[1] += r * r;
+            s_re[i] = (int16_t)((((l + r) >> 1) * s_window[i]) >> 15);
+            s_im[i] = 0;
+        }
+        // RMS of a full scale sine is 1/sqrt(2)
+        for (int c = 0; c < 2; c++) {
+            vu[c] = level_from_power((float)sq[c] / FFT_N / (32767.0f * 32767.0f / 2));
+        }
+
+        fft_q15(s_re, s_im);
+
+        for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+            int32_t peak = 0;
+            for (int k = s_band_edge[b]; k < s_band_edge[b + 1]; k++) {
+                int32_t p = s_re[k] * s_re[k] + s_im[k] * s_im[k];
+                if (p > peak) {
+                    peak = p;
+                }
+            }
+            bands[b] = level_from_power(peak / s_full_scale);
+        }
+    }
+
+    for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+        level_update(&s_levels.band[b], bands[b]);
+    }
+    level_update(&s_levels.vu[0], vu[0]);
+    level_update(&s_levels.vu[1], vu[1]);
+}
+
+static void spectrum_publish(void)
+{
+    uint32_t seq = s_published + 1;
+
+    // Readers still copying this slot from seq - 2 see the bump and retry
+    __atomic_store_n(&s_writing, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s_levels.seq = seq;
+    s_slots[seq & 1] = s_levels;
+    __atomic_store_n(&s_published, seq, __ATOMIC_RELEASE);
+}
+
+static void audio_spectrum_task(void *arg)
+{
+    TickType_t wake = xTaskGetTickCount();
+    bool idle = true;
+
+    while (1) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(AUDIO_SPECTRUM_PERIOD_MS));
+
+        bool have_audio = audio_player_is_playing() &&
+                          audio_ring_peek(&audio_ring, (uint8_t *)s_tap, sizeof(s_tap));
+
+        // Nothing playing and the bars have settled: nothing to publish
+        if (!have_audio && idle) {
+            continue;
+        }
+
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        spectrum_compute(have_audio);
+        if (have_audio) {
+            s_cycles += esp_cpu_get_cycle_count() - t0;
+            s_frames++;
+        }
+
+        idle = !have_audio;
+        for (int b = 0; idle && b < AUDIO_SPECTRUM_BANDS; b++) {
+            idle = s_levels.band[b] == 0;
+        }
+        idle = idle && s_levels.vu[0] == 0 && s_levels.vu[1] == 0;
+
+        spectrum_publish();
+    }
+}
+
+bool audio_spectrum_init(void)
+{
+    tables_init();
+
+    if (xTaskCreate(audio_spectrum_task, "audio_spectrum", 3072, NULL, 2, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start spectrum task");
+        return false;
+    }
+    return true;
+}
+
+bool audio_spectrum_get(audio_spectrum_t *out)
+{
+    uint32_t seq;
+    audio_spectrum_t copy;
+
+    do {
+        seq = __atomic_load_n(&s_published, __ATOMIC_ACQUIRE);
+        if (seq == out->seq) {
+            return false;
+        }
+        copy = s_slots[seq & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // Torn if the writer has started on seq + 2, which reuses this slot
+    } while (__atomic_load_n(&s_writing, __ATOMIC_RELAXED) - seq >= 2);
+
+    *out = copy;
+    return true;
+}
+
+void audio_spectrum_report(void)
+{
+    if (s_frames == 0) {
+        return;
+    }
+
+    uint32_t per_frame = s_cycles / s_frames;
+    uint64_t budget = (uint64_t)CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000 * AUDIO_SPECTRUM_PERIOD_MS;
+
+    ESP_LOGI(TAG, "%lu updates: %lu cycles each, %lu.%lu%% of one core",
+             (unsigned long)s_frames, (unsigned long)per_frame,
+             (unsigned long)(per_frame * 100 / budget),
+             (unsigned long)(per_frame * 1000 / budget % 10));
+}
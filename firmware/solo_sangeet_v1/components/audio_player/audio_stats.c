@@ -0,0 +1,86 @@
+#include <string.h>
+#include "audio_stats.h"
+
+#if AUDIO_STATS_ENABLE
+
+#include "esp_log.h"
+
+static const char *TAG = "ASTATS";
+
+audio_stats_t audio_stats;
+
+static void audio_stats_timer_cb(void *arg)
+{
+    audio_stats_dump();
+}
+
+void audio_stats_init(void)
+{
+    if (AUDIO_STATS_DUMP_MS == 0) {
+        return;
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = audio_stats_timer_cb,
+        .name = "audio_stats",
+    };
+    esp_timer_handle_t timer;
+
+    if (esp_timer_create(&args, &timer) != ESP_OK ||
+        esp_timer_start_periodic(timer, (uint64_t)AUDIO_STATS_DUMP_MS * 1000) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start stats timer");
+    }
+}
+
+void audio_stats_get(audio_stats_t *out)
+{
+    memcpy(out, &audio_stats, sizeof(*out));
+}
+
+void audio_stats_reset(void)
+{
+    // Writers may race with this; a count or two landing in the old totals is fine
+    memset(&audio_stats, 0, sizeof(audio_stats));
+}
+
+static void dump_hist(const char *name, const uint32_t *bins, int n)
+{
+    char line[128];
+    int len = 0;
+
+    for (int i = 0; i < n && len < (int)sizeof(line); i++) {
+        len += snprintf(line + len, sizeof(line) - len, " %lu", (unsigned long)bins[i]);
+    }
+    ESP_LOGI(TAG, "  %s:%s", name, line);
+}
+
+void audio_stats_dump(void)
+{
+    audio_stats_t s;
+
+    audio_stats_get(&s);
+
+    ESP_LOGI(TAG, "cb %lu, underruns %lu, short %llu B (max %lu), max gap %lu us",
+             (unsigned long)s.callbacks, (unsigned long)s.underruns,
+             (unsigned long long)s.bytes_short, (unsigned long)s.max_short,
+             (unsigned long)s.max_interval_us);
+    dump_hist("fill/8", s.fill_hist, AUDIO_STATS_FILL_BINS);
+    dump_hist("gap log2 ms", s.interval_hist, AUDIO_STATS_LOG2_BINS);
+
+    ESP_LOGI(TAG, "reads %lu, %llu B, max %lu us, ring full waits %lu",
+             (unsigned long)s.reads, (unsigned long long)s.read_bytes,
+             (unsigned long)s.max_read_us, (unsigned long)s.ring_full_waits);
+    dump_hist("read log2 100us", s.read_hist, AUDIO_STATS_LOG2_BINS);
+
+    // Cost per second of audio played, comparable between builds and runs
+    uint64_t played_ms = s.bytes_out * 1000 / AUDIO_STATS_BYTES_PER_SEC;
+    if (played_ms) {
+        uint64_t cpu_us = s.busy_us > s.read_us ? s.busy_us - s.read_us : 0;
+        ESP_LOGI(TAG, "%llu ms played, reader CPU %llu us/s, SD %llu us/s",
+                 (unsigned long long)played_ms,
+                 (unsigned long long)(cpu_us * 1000 / played_ms),
+                 (unsigned long long)(s.read_us * 1000 / played_ms));
+    }
+}
+
+#endif // AUDIO_STATS_ENABLE
@@ -0,0 +1,549 @@
+#include <string.h>
+#include "flac_decoder.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "FLAC";
+
+#define FLAC_META_STREAMINFO    0
+#define FLAC_STREAMINFO_SIZE    34
+#define FLAC_MAX_RESYNC_BYTES   (64 * 1024)
+
+enum {
+    FLAC_CH_INDEPENDENT_MAX = 7,
+    FLAC_CH_LEFT_SIDE = 8,
+    FLAC_CH_SIDE_RIGHT = 9,
+    FLAC_CH_MID_SIDE = 10,
+};
+
+/* ---------------- bit reader ---------------- */
+
+// CRC-16, polynomial 0x8005, MSB first
+static const uint16_t crc16_tab[256] = {
+    0x0000, 0x8005, 0x800f, 0x000a, 0x801b, 0x001e, 0x0014, 0x8011,
+    0x8033, 0x0036, 0x003c, 0x8039, 0x0028, 0x802d, 0x8027, 0x0022,
+    0x8063, 0x0066, 0x006c, 0x8069, 0x0078, 0x807d, 0x8077, 0x0072,
+    0x0050, 0x8055, 0x805f, 0x005a, 0x804b, 0x004e, 0x0044, 0x8041,
+    0x80c3, 0x00c6, 0x00cc, 0x80c9, 0x00d8, 0x80dd, 0x80d7, 0x00d2,
+    0x00f0, 0x80f5, 0x80ff, 0x00fa, 0x80eb, 0x00ee, 0x00e4, 0x80e1,
+    0x00a0, 0x80a5, 0x80af, 0x00aa, 0x80bb, 0x00be, 0x00b4, 0x80b1,
+    0x8093, 0x0096, 0x009c, 0x8099, 0x0088, 0x808d, 0x8087, 0x0082,
+    0x8183, 0x0186, 0x018c, 0x8189, 0x0198, 0x819d, 0x8197, 0x0192,
+    0x01b0, 0x81b5, 0x81bf, 0x01ba, 0x81ab, 0x01ae, 0x01a4, 0x81a1,
+    0x01e0, 0x81e5, 0x81ef, 0x01ea, 0x81fb, 0x01fe, 0x01f4, 0x81f1,
+    0x81d3, 0x01d6, 0x01dc, 0x81d9, 0x01c8, 0x81cd, 0x81c7, 0x01c2,
+    0x0140, 0x8145, 0x814f, 0x014a, 0x815b, 0x015e, 0x0154, 0x8151,
+    0x8173, 0x0176, 0x017c, 0x8179, 0x0168, 0x816d, 0x8167, 0x0162,
+    0x8123, 0x0126, 0x012c, 0x8129, 0x0138, 0x813d, 0x8137, 0x0132,
+    0x0110, 0x8115, 0x811f, 0x011a, 0x810b, 0x010e, 0x0104, 0x8101,
+    0x8303, 0x0306, 0x030c, 0x8309, 0x0318, 0x831d, 0x8317, 0x0312,
+    0x0330, 0x8335, 0x833f, 0x033a, 0x832b, 0x032e, 0x0324, 0x8321,
+    0x0360, 0x8365, 0x836f, 0x036a, 0x837b, 0x037e, 0x0374, 0x8371,
+    0x8353, 0x0356, 0x035c, 0x8359, 0x0348, 0x834d, 0x8347, 0x0342,
+    0x03c0, 0x83c5, 0x83cf, 0x03ca, 0x83db, 0x03de, 0x03d4, 0x83d1,
+    0x83f3, 0x03f6, 0x03fc, 0x83f9, 0x03e8, 0x83ed, 0x83e7, 0x03e2,
+    0x83a3, 0x03a6, 0x03ac, 0x83a9, 0x03b8, 0x83bd, 0x83b7, 0x03b2,
+    0x0390, 0x8395, 0x839f, 0x039a, 0x838b, 0x038e, 0x0384, 0x8381,
+    0x0280, 0x8285, 0x828f, 0x028a, 0x829b, 0x029e, 0x0294, 0x8291,
+    0x82b3, 0x02b6, 0x02bc, 0x82b9, 0x02a8, 0x82ad, 0x82a7, 0x02a2,
+    0x82e3, 0x02e6, 0x02ec, 0x82e9, 0x02f8, 0x82fd, 0x82f7, 0x02f2,
+    0x02d0, 0x82d5, 0x82df, 0x02da, 0x82cb, 0x02ce, 0x02c4, 0x82c1,
+    0x8243, 0x0246, 0x024c, 0x8249, 0x0258, 0x825d, 0x8257, 0x0252,
+    0x0270, 0x8275, 0x827f, 0x027a, 0x826b, 0x026e, 0x0264, 0x8261,
+    0x0220, 0x8225, 0x822f, 0x022a, 0x823b, 0x023e, 0x0234, 0x8231,
+    0x8213, 0x0216, 0x021c, 0x8219, 0x0208, 0x820d, 0x8207, 0x0202,
+};
+
+static inline uint16_t crc16_byte(uint16_t crc, uint8_t b)
+{
+    return (uint16_t)(crc << 8) ^ crc16_tab[(crc >> 8) ^ b];
+}
+
+/*
+ * Bytes enter the cache only as bits are asked for, so whatever has been
+ * fetched is consumed up to the last partial byte, and the CRC of the
+ * frame can be kept per byte fetched.
+ */
+static inline uint8_t br_next_byte(flac_decoder_t *dec)
+{
+    if (dec->in_pos >= dec->in_len) {
+        dec->in_len = dec->eof ? 0 : fread(dec->inbuf, 1, sizeof(dec->inbuf), dec->fp);
+        dec->in_pos = 0;
+        if (dec->in_len == 0) {
+            dec->eof = true;
+            return 0;
+        }
+    }
+    uint8_t b = dec->inbuf[dec->in_pos++];
+    dec->crc16 = crc16_byte(dec->crc16, b);
+    return b;
+}
+
+// n <= 32
+static inline uint32_t br_read(flac_decoder_t *dec, int n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    while (dec->cache_bits < n) {
+        dec->cache = (dec->cache << 8) | br_next_byte(dec);
+        dec->cache_bits += 8;
+    }
+    dec->cache_bits -= n;
+    return (uint32_t)(dec->cache >> dec->cache_bits) & (0xFFFFFFFFu >> (32 - n));
+}
+
+static inline int32_t br_read_signed(flac_decoder_t *dec, int n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    uint32_t v = br_read(dec, n);
+    // sign extend from n bits
+    return (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+static inline uint32_t br_read_unary(flac_decoder_t *dec)
+{
+    uint32_t q = 0;
+
+    for (;;) {
+        uint64_t v = dec->cache_bits ? dec->cache & ((1ULL << dec->cache_bits) - 1) : 0;
+        if (v) {
+            int hb = 63 - __builtin_clzll(v);
+            q += dec->cache_bits - 1 - hb;
+            dec->cache_bits = hb;
+            return q;
+        }
+        q += dec->cache_bits;
+        if (dec->eof) {
+            dec->cache_bits = 0;
+            return q;
+        }
+        dec->cache = br_next_byte(dec);
+        dec->cache_bits = 8;
+    }
+}
+
+static inline void br_align(flac_decoder_t *dec)
+{
+    dec->cache_bits -= dec->cache_bits % 8;
+}
+
+/* ---------------- metadata ---------------- */
+
+bool flac_decoder_open(flac_decoder_t *dec, FILE *fp)
+{
+    uint8_t hdr[4];
+    uint8_t si[FLAC_STREAMINFO_SIZE];
+    bool have_info = false;
+    bool last = false;
+
+    dec->fp = fp;
+    dec->in_pos = dec->in_len = 0;
+    dec->cache = 0;
+    dec->cache_bits = 0;
+    dec->eof = false;
+    dec->block_size = dec->block_pos = 0;
+
+    if (fread(hdr, 1, 4, fp) != 4 || memcmp(hdr, "fLaC", 4) != 0) {
+        ESP_LOGE(TAG, "Missing fLaC marker");
+        return false;
+    }
+
+    while (!last) {
+        if (fread(hdr, 1, 4, fp) != 4) {
+            return false;
+        }
+        last = hdr[0] & 0x80;
+        uint8_t type = hdr[0] & 0x7f;
+        uint32_t size = ((uint32_t)hdr[1] << 16) | ((uint32_t)hdr[2] << 8) | hdr[3];
+
+        if (type == FLAC_META_STREAMINFO && size >= FLAC_STREAMINFO_SIZE) {
+            if (fread(si, 1, sizeof(si), fp) != sizeof(si)) {
+                return false;
+            }
+            dec->max_block_size = ((uint16_t)si[2] << 8) | si[3];
+            dec->sample_rate = ((uint32_t)si[10] << 12) | ((uint32_t)si[11] << 4) | (si[12] >> 4);
+            dec->channels = ((si[12] >> 1) & 0x07) + 1;
+            dec->bits_per_sample = (((si[12] & 0x01) << 4) | (si[13] >> 4)) + 1;
+            dec->total_samples = ((uint64_t)(si[13] & 0x0f) << 32) | ((uint32_t)si[14] << 24) |
+                                 ((uint32_t)si[15] << 16) | ((uint32_t)si[16] << 8) | si[17];
+            size -= sizeof(si);
+            have_info = true;
+        }
+
+        // Everything else (seektable, vorbis comment, picture, ...) is skipped
+        if (size && fseek(fp, size, SEEK_CUR) != 0) {
+            return false;
+        }
+    }
+
+    if (!have_info) {
+        ESP_LOGE(TAG, "Missing STREAMINFO");
+        return false;
+    }
+    dec->data_start = ftell(fp);
+
+    if (dec->max_block_size > FLAC_MAX_BLOCK_SIZE || dec->channels > FLAC_MAX_CHANNELS ||
+        dec->bits_per_sample < 8 || dec->bits_per_sample > 24) {
+        ESP_LOGE(TAG, "Unsupported stream: block %u, %u ch, %u bit",
+                 dec->max_block_size, dec->channels, dec->bits_per_sample);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%lu Hz, %u ch, %u bit, max block %u, %llu samples",
+             (unsigned long)dec->sample_rate, dec->channels, dec->bits_per_sample,
+             dec->max_block_size, (unsigned long long)dec->total_samples);
+    return true;
+}
+
+/* ---------------- frames ---------------- */
+
+static bool flac_read_utf8(flac_decoder_t *dec)
+{
+    uint32_t b = br_read(dec, 8);
+    int extra = 0;
+
+    if (!(b & 0x80)) {
+        return true;
+    }
+    while (b & (0x40 >> extra)) {
+        extra++;
+    }
+    if (extra == 0 || extra > 6) {
+        return false;
+    }
+    // frame/sample number is not needed for linear playback
+    while (extra--) {
+        if ((br_read(dec, 8) & 0xC0) != 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find the next frame sync code at a byte boundary
+static bool flac_sync(flac_decoder_t *dec)
+{
+    br_align(dec);
+
+    uint32_t prev = br_read(dec, 8);
+    for (int i = 0; i < FLAC_MAX_RESYNC_BYTES && !dec->eof; i++) {
+        uint32_t cur = br_read(dec, 8);
+        if (prev == 0xFF && (cur & 0xFE) == 0xF8) {
+            dec->crc16 = crc16_byte(crc16_byte(0, 0xFF), cur);
+            return true;
+        }
+        prev = cur;
+    }
+    return false;
+}
+
+static bool flac_read_residual(flac_decoder_t *dec, int32_t *out, uint32_t block_size, int order)
+{
+    uint32_t method = br_read(dec, 2);
+    if (method > 1) {
+        return false;
+    }
+    int param_bits = method ? 5 : 4;
+    uint32_t escape = method ? 31 : 15;
+    int part_order = br_read(dec, 4);
+    uint32_t parts = 1u << part_order;
+    uint32_t part_size = block_size >> part_order;
+
+    if (part_size < (uint32_t)order && part_order) {
+        return false;
+    }
+
+    int32_t *p = out + order;
+    for (uint32_t part = 0; part < parts; part++) {
+        uint32_t n = part == 0 ? part_size - order : part_size;
+        uint32_t k = br_read(dec, param_bits);
+
+        if (k == escape) {
+            int bits = br_read(dec, 5);
+            for (uint32_t i = 0; i < n; i++) {
+                *p++ = br_read_signed(dec, bits);
+            }
+            continue;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t v = (br_read_unary(dec) << k) | br_read(dec, k);
+            // zigzag decode
+            *p++ = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        }
+    }
+
+    return !dec->eof;
+}
+
+static void flac_restore_fixed(int32_t *s, uint32_t n, int order)
+{
+    switch (order) {
+    case 1:
+        for (uint32_t i = 1; i < n; i++) s[i] += s[i - 1];
+        break;
+    case 2:
+        for (uint32_t i = 2; i < n; i++) s[i] += 2 * s[i - 1] - s[i - 2];
+        break;
+    case 3:
+        for (uint32_t i = 3; i < n; i++) s[i] += 3 * s[i - 1] - 3 * s[i - 2] + s[i - 3];
+        break;
+    case 4:
+        for (uint32_t i = 4; i < n; i++) s[i] += 4 * s[i - 1] - 6 * s[i - 2] + 4 * s[i - 3] - s[i - 4];
+        break;
+    default:
+        break;
+    }
+}
+
+static void flac_restore_lpc(int32_t *s, uint32_t n, const int32_t *coefs, int order, int shift)
+{
+    for (uint32_t i = order; i < n; i++) {
+        int64_t sum = 0;
+        for (int j = 0; j < order; j++) {
+            sum += (int64_t)coefs[j] * s[i - 1 - j];
+        }
+        s[i] += (int32_t)(sum >> shift);
+    }
+}
+
+static bool flac_read_subframe(flac_decoder_t *dec, int32_t *s, int bps)
+{
+    if (br_read(dec, 1) != 0) {
+        return false;
+    }
+    uint32_t type = br_read(dec, 6);
+    int wasted = 0;
+    if (br_read(dec, 1)) {
+        wasted = br_read_unary(dec) + 1;
+        bps -= wasted;
+    }
+    if (bps <= 0) {
+        return false;
+    }
+
+    uint32_t n = dec->block_size;
+
+    if (type == 0) {
+        // CONSTANT
+        int32_t v = br_read_signed(dec, bps);
+        for (uint32_t i = 0; i < n; i++) {
+            s[i] = v;
+        }
+    } else if (type == 1) {
+        // VERBATIM
+        for (uint32_t i = 0; i < n; i++) {
+            s[i] = br_read_signed(dec, bps);
+        }
+    } else if (type >= 8 && type <= 12) {
+        // FIXED
+        int order = type - 8;
+        if ((uint32_t)order > n) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            s[i] = br_read_signed(dec, bps);
+        }
+        if (!flac_read_residual(dec, s, n, order)) {
+            return false;
+        }
+        flac_restore_fixed(s, n, order);
+    } else if (type >= 32) {
+        // LPC
+        int order = type - 31;
+        int32_t coefs[FLAC_MAX_LPC_ORDER];
+        if ((uint32_t)order > n) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            s[i] = br_read_signed(dec, bps);
+        }
+        int precision = br_read(dec, 4) + 1;
+        if (precision == 16) {
+            return false;
+        }
+        int shift = br_read_signed(dec, 5);
+        if (shift < 0) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            coefs[i] = br_read_signed(dec, precision);
+        }
+        if (!flac_read_residual(dec, s, n, order)) {
+            return false;
+        }
+        flac_restore_lpc(s, n, coefs, order, shift);
+    } else {
+        return false;
+    }
+
+    if (wasted) {
+        for (uint32_t i = 0; i < n; i++) {
+            s[i] *= 1 << wasted;
+        }
+    }
+    return true;
+}
+
+static bool flac_decode_frame(flac_decoder_t *dec)
+{
+    static const uint8_t sample_size_tab[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+
+    if (!flac_sync(dec)) {
+        return false;
+    }
+
+    uint32_t bs_code = br_read(dec, 4);
+    uint32_t sr_code = br_read(dec, 4);
+    uint32_t ch_code = br_read(dec, 4);
+    uint32_t ss_code = br_read(dec, 3);
+    br_read(dec, 1);
+
+    if (!flac_read_utf8(dec)) {
+        return false;
+    }
+
+    uint32_t bs;
+    if (bs_code == 1) {
+        bs = 192;
+    } else if (bs_code >= 2 && bs_code <= 5) {
+        bs = 576u << (bs_code - 2);
+    } else if (bs_code == 6) {
+        bs = br_read(dec, 8) + 1;
+    } else if (bs_code == 7) {
+        bs = br_read(dec, 16) + 1;
+    } else if (bs_code >= 8) {
+        bs = 256u << (bs_code - 8);
+    } else {
+        return false;
+    }
+
+    // Sample rate comes from STREAMINFO; just consume the extra bytes
+    if (sr_code == 12) {
+        br_read(dec, 8);
+    } else if (sr_code == 13 || sr_code == 14) {
+        br_read(dec, 16);
+    } else if (sr_code == 15) {
+        return false;
+    }
+
+    br_read(dec, 8);    // header CRC-8
+
+    int bps = ss_code ? sample_size_tab[ss_code] : dec->bits_per_sample;
+    int channels = ch_code <= FLAC_CH_INDEPENDENT_MAX ? (int)ch_code + 1 : 2;
+
+    if (bs > FLAC_MAX_BLOCK_SIZE || channels > FLAC_MAX_CHANNELS ||
+        ch_code > FLAC_CH_MID_SIDE || bps == 0 || bps > 24) {
+        ESP_LOGW(TAG, "Bad frame header: bs %lu, ch %lu, bps %d",
+                 (unsigned long)bs, (unsigned long)ch_code, bps);
+        return false;
+    }
+
+    dec->block_size = bs;
+    dec->block_bps = bps;
+    dec->block_channels = channels;
+
+    for (int ch = 0; ch < channels; ch++) {
+        // The side channel carries one extra bit
+        int sub_bps = bps;
+        if ((ch_code == FLAC_CH_LEFT_SIDE && ch == 1) ||
+            (ch_code == FLAC_CH_SIDE_RIGHT && ch == 0) ||
+            (ch_code == FLAC_CH_MID_SIDE && ch == 1)) {
+            sub_bps++;
+        }
+        if (!flac_read_subframe(dec, dec->samples[ch], sub_bps)) {
+            return false;
+        }
+    }
+
+    int32_t *a = dec->samples[0];
+    int32_t *b = dec->samples[1];
+    switch (ch_code) {
+    case FLAC_CH_LEFT_SIDE:
+        for (uint32_t i = 0; i < bs; i++) b[i] = a[i] - b[i];
+        break;
+    case FLAC_CH_SIDE_RIGHT:
+        for (uint32_t i = 0; i < bs; i++) a[i] += b[i];
+        break;
+    case FLAC_CH_MID_SIDE:
+        for (uint32_t i = 0; i < bs; i++) {
+            int32_t side = b[i];
+            int32_t mid = a[i] * 2 | (side & 1);
+            a[i] = (mid + side) >> 1;
+            b[i] = (mid - side) >> 1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // A damaged frame is dropped rather than played as noise
+    br_align(dec);
+    uint16_t crc = dec->crc16;
+    if (br_read(dec, 16) != crc) {
+        ESP_LOGW(TAG, "Frame CRC mismatch");
+        return false;
+    }
+
+    dec->block_pos = 0;
+    return true;
+}
+
+static inline int16_t flac_to_s16(int32_t v, int bps)
+{
+    return (int16_t)(bps >= 16 ? v >> (bps - 16) : v * (1 << (16 - bps)));
+}
+
+size_t flac_decoder_read(flac_decoder_t *dec, uint8_t *out, size_t len)
+{
+    int16_t *pcm = (int16_t *)out;
+    size_t frames = len / 4;
+    size_t done = 0;
+
+    while (done < frames) {
+        if (dec->block_pos >= dec->block_size) {
+            if (dec->eof && dec->in_pos >= dec->in_len && dec->cache_bits < 8) {
+                break;
+            }
+            if (!flac_decode_frame(dec)) {
+                if (!dec->eof) {
+                    ESP_LOGW(TAG, "Frame decode failed, resyncing");
+                    dec->block_size = dec->block_pos = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        const int bps = dec->block_bps;
+        const int32_t *l = dec->samples[0];
+        const int32_t *r = dec->samples[dec->block_channels > 1 ? 1 : 0];
+        size_t n = dec->block_size - dec->block_pos;
+        if (n > frames - done) {
+            n = frames - done;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            uint32_t pos = dec->block_pos + i;
+            pcm[2 * (done + i)]     = flac_to_s16(l[pos], bps);
+            pcm[2 * (done + i) + 1] = flac_to_s16(r[pos], bps);
+        }
+        dec->block_pos += n;
+        done += n;
+    }
+
+    return done * 4;
+}
+
+void flac_decoder_seek(flac_decoder_t *dec, uint32_t offset)
+{
+    fseek(dec->fp, offset, SEEK_SET);
+    dec->in_pos = dec->in_len = 0;
+    dec->cache = 0;
+    dec->cache_bits = 0;
+    dec->eof = false;
+    dec->block_size = dec->block_pos = 0;
+}
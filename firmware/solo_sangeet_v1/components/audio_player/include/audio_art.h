@@ -0,0 +1,46 @@
+#ifndef AUDIO_ART_H
+#define AUDIO_ART_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lvgl.h"
+
+#define AUDIO_ART_DIR           "/sdcard/.art"
+#define AUDIO_ART_LARGE         96      // now playing, behind the spectrum
+#define AUDIO_ART_SMALL         40      // home page row
+#define AUDIO_ART_CACHE_ENTRIES 128     // pictures kept, about 22 KB each on the card
+#define AUDIO_ART_MAX_SIDE      4096    // larger JPEGs are left alone
+#define AUDIO_ART_QUEUE_LEN     4
+#define AUDIO_ART_FLUSH_MS      10000   // LRU order is written back at most this often
+#define AUDIO_ART_HEAP_RESERVE  (24 * 1024)  // left for everyone else while decoding
+#define AUDIO_ART_RETRY_MS      30000   // back-off when memory is short
+
+/*
+ * Album art thumbnail cache on the card.
+ *
+ * The library stores an id for each track's embedded picture (APIC / FLAC
+ * PICTURE, see media_tags_read()). An idle-priority task walks the library,
+ * decodes each picture not cached yet with the ROM JPEG decoder, centre
+ * crops it and writes one LVGL image binary (header + RGB565 pixels) per
+ * size to AUDIO_ART_DIR. Tracks sharing a picture share the files. Showing
+ * art is then a single sequential read, nothing is decoded on the LVGL
+ * task.
+ *
+ * At most AUDIO_ART_CACHE_ENTRIES pictures are kept. The walk only fills
+ * free slots; a picture asked for by audio_art_load() evicts the least
+ * recently shown one. Only baseline JPEG is supported, PNG art is skipped.
+ */
+bool audio_art_init(void);
+
+/*
+ * Thumbnail of size (AUDIO_ART_LARGE / _SMALL) for the picture id of the
+ * track at path. False if it is not cached; it is then queued for
+ * extraction and can be asked for again shortly. Free with
+ * audio_art_release().
+ */
+bool audio_art_load(uint32_t id, uint16_t size, const char *path, lv_image_dsc_t *dsc);
+void audio_art_release(lv_image_dsc_t *dsc);
+
+#endif // AUDIO_ART_H
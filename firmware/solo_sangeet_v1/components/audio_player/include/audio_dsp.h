@@ -0,0 +1,94 @@
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AUDIO_DSP_BLOCK_FRAMES  256     // frames processed per stage pass
+#define AUDIO_DSP_EQ_BANDS      5
+#define AUDIO_DSP_EQ_MAX_DB     12
+#define AUDIO_DSP_RAMP_FRAMES   1024    // ~23 ms gain ramp at 44.1 kHz
+#define AUDIO_DSP_DEFAULT_VOLUME 100
+#define AUDIO_DSP_TRACK_MAX_DB  6       // loudness normalisation boost limit
+#define AUDIO_DSP_TRACK_MIN_DB  (-24)
+#define AUDIO_DSP_LIMIT_CEILING 29205   // limiter output peak, -1 dBFS
+#define AUDIO_DSP_CPU_BUDGET_PCT 15     // whole chain, share of one core at CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+typedef enum {
+    AUDIO_DSP_STAGE_GAIN = 0,
+    AUDIO_DSP_STAGE_EQ,
+    AUDIO_DSP_STAGE_LIMITER,
+    AUDIO_DSP_STAGE_COUNT,
+} audio_dsp_stage_t;
+
+// One peaking biquad, Direct Form I, Q28 coefficients with error feedback
+typedef struct {
+    int32_t b0, b1, b2, a1, a2;
+    int32_t x1[2], x2[2];
+    int32_t y1[2], y2[2];
+    uint32_t err[2];
+} audio_biquad_t;
+
+/*
+ * Effect chain for interleaved 16-bit stereo at a fixed rate:
+ * gain (volume x track gain, with ramps) -> 5-band peaking EQ -> peak limiter.
+ *
+ * Runs on the reader task in blocks of AUDIO_DSP_BLOCK_FRAMES through an
+ * int32 work buffer, so stages keep headroom and only the limiter
+ * saturates back to 16 bits. Setters may be called from any task: they
+ * only store targets, the coefficients are rebuilt on the next block.
+ * Flat EQ bands are bypassed and cost nothing.
+ */
+typedef struct {
+    uint32_t sample_rate;
+    // gain, Q30 so small ramp steps do not round away
+    volatile uint8_t volume;
+    volatile int32_t gain_target;
+    volatile int32_t track_gain;        // Q28, loudness normalisation
+    int32_t gain;
+    int32_t gain_goal;                  // target the current ramp heads to
+    int32_t gain_step;
+    uint32_t ramp_left;
+    // EQ
+    volatile int8_t eq_db[AUDIO_DSP_EQ_BANDS];
+    volatile uint32_t eq_version;
+    uint32_t eq_applied;
+    uint8_t eq_active;                  // bitmask of non-flat bands
+    audio_biquad_t eq[AUDIO_DSP_EQ_BANDS];
+    // limiter gain reduction, Q15
+    int32_t lim_gain;
+    int32_t work[AUDIO_DSP_BLOCK_FRAMES * 2];
+    // per-stage cost, for checking the chain against the reader budget
+    uint64_t cycles[AUDIO_DSP_STAGE_COUNT];
+    uint32_t blocks;
+    uint32_t frames;
+} audio_dsp_t;
+
+void audio_dsp_init(audio_dsp_t *dsp, uint32_t sample_rate);
+
+/* Volume 0..100, ramped over AUDIO_DSP_RAMP_FRAMES */
+void audio_dsp_set_volume(audio_dsp_t *dsp, uint8_t percent);
+uint8_t audio_dsp_get_volume(const audio_dsp_t *dsp);
+
+/* Per-track gain in 1/100 dB on top of the volume, ramped like it */
+void audio_dsp_set_track_gain(audio_dsp_t *dsp, int16_t centi_db);
+
+/* Band gain in dB, clamped to +-AUDIO_DSP_EQ_MAX_DB */
+void audio_dsp_set_eq(audio_dsp_t *dsp, uint8_t band, int8_t db);
+
+/* Process frames of interleaved stereo in place */
+void audio_dsp_process(audio_dsp_t *dsp, int16_t *pcm, size_t frames);
+
+/* Drop filter and limiter history, e.g. after a seek */
+void audio_dsp_reset(audio_dsp_t *dsp);
+
+/* Cycles spent on the audio processed so far, in 1/1000 of one core */
+uint32_t audio_dsp_load_permille(const audio_dsp_t *dsp);
+
+/* Log average cycles per block for each stage, warn over AUDIO_DSP_CPU_BUDGET_PCT */
+void audio_dsp_report(const audio_dsp_t *dsp);
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,59 @@
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// FAT allocation unit, must match allocation_unit_size in sd_fs_init()
+#define AUDIO_FILE_CLUSTER      (16 * 1024)
+
+// PSRAM track cache, only built with CONFIG_SPIRAM
+#define AUDIO_FILE_MAX_OPEN     4                   // files the cache can track
+#define AUDIO_FILE_BURST        (4 * AUDIO_FILE_CLUSTER)    // loaded per audio_file_load_step()
+#define AUDIO_FILE_HEAD_BYTES   (256 * 1024)        // preloaded from the next track
+#define AUDIO_FILE_PSRAM_KEEP   (512 * 1024)        // PSRAM left free for everyone else
+
+// SD latency injection for dropout testing, all 0 in normal builds
+#define AUDIO_FILE_INJECT_DELAY_MS      0   // random 0..N ms added to every read
+#define AUDIO_FILE_INJECT_STALL_MS      0   // one long stall, like a card's internal GC...
+#define AUDIO_FILE_INJECT_STALL_EVERY   0   // ...every N reads
+
+/*
+ * Track files for the reader task.
+ *
+ * Returns an ordinary FILE (so the parsers and decoders keep using
+ * fread/fseek/ftell) whose reads are served from one cluster-sized cache.
+ * The cache is refilled with reads that start on a cluster boundary of the
+ * file and cover whole clusters, so each refill is a single contiguous
+ * multi-block SD transfer. Reads of a whole aligned cluster or more go
+ * straight into the caller's buffer.
+ *
+ * The cache is shared by every file opened here; only the reader task may
+ * read them, and whichever file reads last owns it.
+ */
+bool audio_file_init(void);
+
+FILE *audio_file_open(const char *path);
+
+/*
+ * PSRAM track cache.
+ *
+ * audio_file_cache() reserves external RAM for the whole file (whole) or
+ * for its first AUDIO_FILE_HEAD_BYTES, keeping whatever is already loaded;
+ * a head cache can later be grown into a whole one. audio_file_load_step()
+ * then fills it front to back, AUDIO_FILE_BURST per call, through the
+ * cluster cache. Reads below the loaded mark come from PSRAM, everything
+ * else still streams from the card, so a track that is fully loaded leaves
+ * the SD bus idle until the next one.
+ *
+ * Without PSRAM (or when it is too full) audio_file_cache() returns false
+ * and the file simply keeps streaming.
+ */
+bool audio_file_cache(FILE *fp, bool whole);
+
+/* Load the next burst of fp's cache; false once there is nothing left to load */
+bool audio_file_load_step(FILE *fp);
+
+#endif // AUDIO_FILE_H
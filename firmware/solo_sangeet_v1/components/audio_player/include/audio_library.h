@@ -0,0 +1,69 @@
+#ifndef AUDIO_LIBRARY_H
+#define AUDIO_LIBRARY_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef AUDIO_LIBRARY_PATH
+#define AUDIO_LIBRARY_PATH          "/sdcard/.library"
+#endif
+#define AUDIO_LIBRARY_MAX_TRACKS    2048    // the build sorts 16 bytes a track in RAM
+#define AUDIO_LIBRARY_MAX_DIRS      256
+#define AUDIO_LIBRARY_DIR_POOL      (8 * 1024)  // directory names kept while building
+#define AUDIO_LIBRARY_PAGE_SIZE     512     // index read granularity
+#define AUDIO_LIBRARY_PAGES         4       // cached pages, a lookup touches about three
+#define AUDIO_LIBRARY_TEXT_MAX      64
+#define AUDIO_LIBRARY_HEAP_RESERVE  (24 * 1024)  // left for everyone else while building
+#define AUDIO_LIBRARY_RETRY_MS      30000   // back-off when memory is short
+
+/*
+ * Media library index on the card.
+ *
+ * A header, then one fixed-size record per track sorted by directory and
+ * file name (case-insensitive, so the list reads in folder order and a
+ * path lookup is a binary search), then a directory table, then a string
+ * table. Title, artist, album and duration come from the file's tags
+ * (media_tags_read()) when it is indexed, so nothing parses tags at play
+ * time. Directory names, artists and albums are interned: all tracks of
+ * an album point at one copy.
+ *
+ * Nothing but the header is read at boot. Every access goes through a
+ * cache of AUDIO_LIBRARY_PAGES pages, so the index costs the same few KB
+ * of RAM however large the library is. The index on the card is used
+ * right away and an idle-priority task walks the card once per boot and
+ * on audio_library_rescan(). The directory table keeps a stamp of each
+ * folder's entries (count, names, sizes, dates); a folder whose stamp
+ * still matches has its records copied from the old index instead of
+ * being listed again. When nothing changed the index is left alone,
+ * otherwise the new one replaces it in a single rename.
+ */
+typedef struct {
+    char title[AUDIO_LIBRARY_TEXT_MAX];     // file name without extension if untagged
+    char artist[AUDIO_LIBRARY_TEXT_MAX];    // empty if unknown
+    char album[AUDIO_LIBRARY_TEXT_MAX];
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t duration_ms;                   // 0 if unknown
+    uint32_t art;                           // picture id for audio_art_load(), 0 if none
+} audio_library_track_t;
+
+bool audio_library_init(void);
+
+uint32_t audio_library_count(void);
+
+/* Bumped whenever a rebuilt index is swapped in, indexes before it are stale */
+uint32_t audio_library_generation(void);
+
+bool audio_library_get(uint32_t index, audio_library_track_t *out);
+bool audio_library_path(uint32_t index, char *buf, size_t len);
+
+/* Index of path, -1 if it is not in the library */
+int32_t audio_library_find(const char *path);
+
+/* Walk the card again and rebuild the index */
+void audio_library_rescan(void);
+
+#endif // AUDIO_LIBRARY_H
@@ -0,0 +1,48 @@
+#ifndef AUDIO_LOUDNESS_H
+#define AUDIO_LOUDNESS_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AUDIO_LOUDNESS_TARGET       (-18)   // LUFS every track is brought to
+#define AUDIO_LOUDNESS_CEILING      (-1)    // dBTP the gain may push a peak to
+#define AUDIO_LOUDNESS_DB_PATH      "/sdcard/.loudness"
+#define AUDIO_LOUDNESS_BATCH        16      // results merged into the sidecar at once
+#define AUDIO_LOUDNESS_SCAN_FILL    (AUDIO_RINGBUF_SIZE * 3 / 4)  // scanner waits below this
+#define AUDIO_LOUDNESS_HEAP_RESERVE (24 * 1024)  // left for everyone else while scanning
+#define AUDIO_LOUDNESS_RETRY_MS     30000   // back-off when memory is short
+#define AUDIO_LOUDNESS_UNKNOWN      INT16_MIN
+
+/*
+ * Background loudness scan.
+ *
+ * An idle-priority task walks the card and decodes every track it has no
+ * result for, measuring BS.1770 / EBU R128 integrated loudness (K-weighted,
+ * 400 ms blocks, -70 LUFS absolute and -10 LU relative gates) and true
+ * peak (4x oversampled). Results go to a sidecar file sorted by path hash,
+ * with size and mtime to notice a changed file, so lookups are a binary
+ * search on the card and nothing stays in RAM.
+ *
+ * While a track is playing the scanner only decodes with the ring above
+ * AUDIO_LOUDNESS_SCAN_FILL, so it never competes with the reader for the
+ * card when the output is short of data.
+ */
+typedef struct {
+    int16_t lufs;                   // integrated loudness, 1/100 LU
+    int16_t peak;                   // true peak, 1/100 dBTP
+} audio_loudness_t;
+
+bool audio_loudness_init(void);
+
+/* Stored result for path, false if it was not scanned or has changed since */
+bool audio_loudness_lookup(const char *path, audio_loudness_t *out);
+
+/* Gain in 1/100 dB bringing a track to the target without clipping its peak */
+int16_t audio_loudness_gain(const audio_loudness_t *l);
+
+/* Walk the card again, e.g. after files were added */
+void audio_loudness_rescan(void);
+
+#endif // AUDIO_LOUDNESS_H
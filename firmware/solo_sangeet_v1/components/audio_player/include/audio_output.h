@@ -0,0 +1,53 @@
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// I2S DAC wiring (PCM5102 style: BCK, LRCK, DIN; MCLK unused)
+#define AUDIO_I2S_PIN_BCK       26
+#define AUDIO_I2S_PIN_WS        25
+#define AUDIO_I2S_PIN_DOUT      22
+#define AUDIO_I2S_DMA_DESC      6       // DMA descriptors in the chain
+#define AUDIO_I2S_DMA_FRAMES    256     // frames per descriptor, ~5.8 ms at 44.1 kHz
+
+// Virtual A2DP clock, for chasing dropouts on a board with no sink or speaker
+#define AUDIO_SIM_ENABLE        0       // 1: start on the simulated output
+#define AUDIO_SIM_TICK_MS       20      // how often the simulated stack pulls
+#define AUDIO_SIM_JITTER_MS     0       // extra random delay per pull, 0..N
+#define AUDIO_SIM_SBC_FRAMES    128     // PCM frames per SBC frame, pulls are whole frames
+
+typedef enum {
+    AUDIO_OUTPUT_BT = 0,        // A2DP source, pulled by the BT stack
+    AUDIO_OUTPUT_I2S,           // local DAC, pulled by the I2S DMA
+    AUDIO_OUTPUT_SIM,           // discarded on a simulated A2DP clock
+} audio_output_t;
+
+/*
+ * Output sinks for the PCM in the audio ring.
+ *
+ * Exactly one output drains the ring. A2DP pulls through
+ * audio_output_bt_read() from its data callback. The I2S output has its
+ * own task that pulls the same stream and blocks in i2s_channel_write()
+ * until the DMA descriptors have room, so the DAC clock paces it. The
+ * output that is not selected gets silence and leaves the ring alone.
+ *
+ * With AUDIO_SIM_ENABLE a third output drains the ring the way the A2DP
+ * stack would: every AUDIO_SIM_TICK_MS (plus up to AUDIO_SIM_JITTER_MS)
+ * it pulls the whole SBC frames a 44.1 kHz clock owes since the last pull
+ * and throws them away. Underruns, callback gaps, play latency and reader
+ * CPU time then show up in audio_stats as they would over the air.
+ */
+bool audio_output_init(void);
+
+/* Switch outputs at runtime; the ring carries on where the old one stopped */
+void audio_output_set(audio_output_t out);
+
+audio_output_t audio_output_get(void);
+
+/* A2DP data callback: ring data while BT is the output, silence otherwise */
+int32_t audio_output_bt_read(uint8_t *data, int32_t len);
+
+#endif // AUDIO_OUTPUT_H
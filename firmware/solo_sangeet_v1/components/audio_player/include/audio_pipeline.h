@@ -0,0 +1,123 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AUDIO_PIPE_POOL_BUFS    2       // preallocated blocks, at most 8
+#define AUDIO_PIPE_MAX_ELEMENTS 6
+
+/*
+ * Source -> elements -> sink, all on the reader task.
+ *
+ * Data moves in audio_buf_t blocks of interleaved 16-bit stereo. Every
+ * block comes either from a pool allocated once in audio_pipeline_init()
+ * or straight from the sink (a span of the output ring), so steady-state
+ * streaming never allocates. When a block already has the sink's rate it
+ * is borrowed from the sink and the whole chain runs in place; the sink
+ * then only commits it.
+ *
+ * Elements work in place and pass the block on with audio_pipeline_emit(),
+ * or take new blocks with audio_pipeline_get_buf() (e.g. a resampler) and
+ * emit those. A borrowed block must reach the sink before the next one is
+ * borrowed, so only elements that change the rate may produce new blocks.
+ * An element that holds output of its own (a resampler) may stop part way
+ * through a block when the sink aborts; it keeps the rest and hands it on
+ * from resume(), which runs before the next block is read, so nothing is
+ * dropped.
+ *
+ * Nothing here depends on FreeRTOS or ESP-IDF; elements can be driven on a
+ * host with a memory source and sink.
+ */
+
+typedef struct audio_pipeline audio_pipeline_t;
+typedef struct audio_element audio_element_t;
+
+typedef struct {
+    int16_t *pcm;
+    uint32_t frames;        // valid stereo frames
+    uint32_t capacity;      // frames that fit
+    uint32_t rate;          // 0 while the source does not know yet
+    bool borrowed;          // memory belongs to the sink
+    uint8_t slot;           // pool slot, if not borrowed
+} audio_buf_t;
+
+typedef enum {
+    AUDIO_PIPE_OK = 0,
+    AUDIO_PIPE_EOS,         // source is done
+    AUDIO_PIPE_ABORT,       // sink or element gave up, e.g. a command is waiting
+} audio_pipe_status_t;
+
+typedef struct {
+    const char *name;
+    // Rate of the next block, 0 if unknown
+    uint32_t (*rate)(void *ctx);
+    // Fill buf->pcm (up to capacity), set frames and rate; false at end of stream
+    bool (*read)(void *ctx, audio_buf_t *buf);
+    void *ctx;
+} audio_source_t;
+
+struct audio_element {
+    const char *name;
+    // Consume buf, hand the result on with audio_pipeline_emit()
+    audio_pipe_status_t (*process)(audio_element_t *el, audio_buf_t *buf);
+    // Drop history (seek, new track), may be NULL
+    void (*reset)(audio_element_t *el);
+    // Emit output left from an aborted block; rate is the next block's, 0 at the end
+    // of the stream, and history held for another rate is flushed out first. May be NULL
+    audio_pipe_status_t (*resume)(audio_element_t *el, uint32_t rate);
+    void *ctx;
+    // set by audio_pipeline_add()
+    audio_pipeline_t *pipe;
+    uint8_t index;
+};
+
+typedef struct {
+    const char *name;
+    uint32_t rate;
+    // bytes of contiguous space, NULL to abort the current block
+    uint8_t *(*acquire)(void *ctx, uint32_t bytes);
+    void (*commit)(void *ctx, uint32_t bytes);
+    void *ctx;
+} audio_sink_t;
+
+struct audio_pipeline {
+    const audio_source_t *source;
+    audio_element_t *elements[AUDIO_PIPE_MAX_ELEMENTS];
+    uint8_t count;
+    const audio_sink_t *sink;
+    int16_t *pool;
+    uint32_t buf_frames;
+    uint8_t pool_free;      // bitmask of free slots
+};
+
+/* Allocate the pool: AUDIO_PIPE_POOL_BUFS blocks of buf_bytes each */
+bool audio_pipeline_init(audio_pipeline_t *p, uint32_t buf_bytes);
+
+void audio_pipeline_set_source(audio_pipeline_t *p, const audio_source_t *source);
+void audio_pipeline_set_sink(audio_pipeline_t *p, const audio_sink_t *sink);
+
+/* Append an element to the chain */
+bool audio_pipeline_add(audio_pipeline_t *p, audio_element_t *el);
+
+/* Let elements finish an aborted block, then pull one block from the source and push it through */
+audio_pipe_status_t audio_pipeline_run(audio_pipeline_t *p);
+
+/* End of stream with nothing to follow: elements hand on what they still hold */
+audio_pipe_status_t audio_pipeline_finish(audio_pipeline_t *p);
+
+/* Element: pass buf to the element after el, or to the sink */
+audio_pipe_status_t audio_pipeline_emit(audio_element_t *el, audio_buf_t *buf);
+
+/* Element: a free block for data at rate; false if none (or the sink aborted) */
+bool audio_pipeline_get_buf(audio_pipeline_t *p, audio_buf_t *buf, uint32_t rate);
+
+/* Return a block from audio_pipeline_get_buf(); borrowed blocks need nothing */
+void audio_pipeline_put_buf(audio_pipeline_t *p, audio_buf_t *buf);
+
+/* Reset every element */
+void audio_pipeline_reset(audio_pipeline_t *p);
+
+#endif // AUDIO_PIPELINE_H
@@ -7,9 +7,10 @@
 #include "freertos/FreeRTOS.h"
 #include "esp_log.h"
 #include "freertos/task.h"
-#include "freertos/ringbuf.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "lvgl.h"
+#include "audio_ring.h"
 
 extern EventGroupHandle_t audio_evt_grp;
 
@@ -17,11 +18,16 @@ extern EventGroupHandle_t audio_evt_grp;
 #define EVT_USER_PLAY       (1 << 1)
 #define EVT_AUDIO_PLAYING   (1 << 2)
 
-#define AUDIO_RINGBUF_SIZE   (32 * 1024)   // or even 64 KB
-#define AUDIO_READ_CHUNK    (2048)         // or 4096
-#define WAV_HEADER_SIZE    44
+#define AUDIO_RINGBUF_SIZE   (32 * 1024)   // tune from audio_stats fill/underrun counts
+#define AUDIO_READ_CHUNK    (2048)         // tune from audio_stats read latency
+#define AUDIO_SAMPLE_RATE   44100          // A2DP SBC rate, other sources are resampled
+#define AUDIO_RESAMPLER_QUALITY  RESAMPLER_TAPS_16   // RESAMPLER_LINEAR / _TAPS_16 / _TAPS_32
+#define AUDIO_PATH_MAX      256
+#define AUDIO_RING_LOW_WATER (AUDIO_RINGBUF_SIZE / 2)  // reader sleeps until the fill drops here
+#define AUDIO_RING_WAIT_MS  1000           // longest single sleep, in case the consumer stops
+#define AUDIO_QUEUE_LEN     8              // tracks queued for gapless playback
 
-extern RingbufHandle_t audio_rb;
+extern audio_ring_t audio_ring;
 extern QueueHandle_t audio_cmd_q;
 extern const char *current_file;
 
@@ -34,8 +40,47 @@ typedef enum {
     AUDIO_CMD_EOF,
     AUDIO_CMD_BT_CONNECTED,
     AUDIO_CMD_BT_DISCONNECTED,
+    AUDIO_CMD_TRACK_CHANGED,    // reader moved on to the next queued track
+    AUDIO_CMD_NEXT,             // skip to the next queued track
+    AUDIO_CMD_PREV,             // previous queued track, or back to the start of this one
+    AUDIO_CMD_OPEN,             // play current_file from the start, whatever the state
+    AUDIO_CMD_PLAYLIST,         // queue the playlist given to audio_player_play_playlist()
+    AUDIO_CMD_VOLUME,           // level from audio_player_set_volume()/audio_player_remote_volume()
+    AUDIO_CMD_FILE,             // make the file given to audio_player_play_file() current_file, then OPEN
+    AUDIO_CMD_VOLUME_UP,        // one BT_AVRC_VOL_STEP, from a headset key
+    AUDIO_CMD_VOLUME_DOWN,
 } audio_cmd_t;
 
+// Source formats handled by the reader
+typedef enum {
+    AUDIO_CODEC_WAV = 0,
+    AUDIO_CODEC_MP3,
+    AUDIO_CODEC_FLAC,
+} audio_codec_t;
+
+// Commands for the long-lived reader task
+typedef enum {
+    AUDIO_READER_CMD_OPEN,
+    AUDIO_READER_CMD_SEEK,
+    AUDIO_READER_CMD_PAUSE,
+    AUDIO_READER_CMD_RESUME,
+    AUDIO_READER_CMD_CLOSE,
+    AUDIO_READER_CMD_ENQUEUE,
+    AUDIO_READER_CMD_SKIP,
+} audio_reader_cmd_t;
+
+typedef struct {
+    audio_reader_cmd_t cmd;
+    uint32_t arg;                   // SEEK: position in ms
+    char path[AUDIO_PATH_MAX];      // OPEN/ENQUEUE: file to play
+} audio_reader_msg_t;
+
+typedef enum {
+    AUDIO_READER_IDLE,
+    AUDIO_READER_STREAMING,
+    AUDIO_READER_PAUSED,
+} audio_reader_state_t;
+
 // Audio Player States
 typedef enum {
     AUDIO_STATE_IDLE,
@@ -48,10 +93,38 @@ void log_mem(const char *tag);
 
 void audio_player_init(void);
 bool audio_player_start(const char *path);
+bool audio_player_play_file(const char *path);  // make path current_file and play it
+bool audio_player_play_playlist(const char *path);  // queue an M3U/M3U8 and play its first track
+bool audio_player_cmd(audio_cmd_t cmd);         // from the UI, never blocks
+uint32_t audio_player_track_serial(void);       // changes with current_file
 void audio_player_stop(void);
+void audio_player_pause(void);
+void audio_player_resume(void);
+bool audio_player_seek(uint32_t ms);
+uint32_t audio_player_get_position_ms(void);
+uint32_t audio_player_get_duration_ms(void);
+bool audio_player_enqueue(const char *path);
+bool audio_player_skip(void);                   // drop the rest of the track for the next queued one
+void audio_player_set_volume(uint8_t percent);   // applied by the control task; never blocks
+uint8_t audio_player_get_volume(void);
+void audio_player_set_eq(uint8_t band, int8_t db);
 bool audio_player_is_playing(void);
+bool audio_player_is_paused(void);
+audio_state_t audio_player_get_state(void);     // control task state
+audio_codec_t audio_codec_from_path(const char *path);
+bool audio_path_is_track(const char *path);     // .wav/.mp3/.flac
+
+// Play latency trace, the consumer marks the first audible block
+extern volatile bool audio_trace_armed;
+void audio_trace_first_audio(void);
+
+// Command from a remote control, timestamped for the button-to-action log; never blocks
+bool audio_player_remote_cmd(audio_cmd_t cmd);
+// Volume set on the BT peer, applied by the control task; never blocks
+bool audio_player_remote_volume(uint8_t percent);
 
-// int32_t audio_player_read(uint8_t *data, int32_t len);
+// Output side: len bytes of 44.1 kHz stereo for the sink, silence when idle or short
+int32_t audio_player_read(uint8_t *data, int32_t len);
 void audio_reader_task(void *arg);
 void audio_control_task(void *arg);
 
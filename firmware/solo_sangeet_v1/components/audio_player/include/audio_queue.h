@@ -0,0 +1,53 @@
+#ifndef AUDIO_QUEUE_H
+#define AUDIO_QUEUE_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AUDIO_QUEUE_PLAYLIST_DIR    "/sdcard/Playlists"
+#define AUDIO_QUEUE_MAX_ENTRIES     8192    // 4 bytes each
+#define AUDIO_QUEUE_RESTART_MS      3000    // previous restarts the track past this point
+#define AUDIO_QUEUE_HEAP_RESERVE    (24 * 1024)  // left for everyone else while loading
+
+/*
+ * Play queue: what comes before and after current_file.
+ *
+ * Entries are library indexes (audio_library_find()), 4 bytes a track,
+ * paths are read from the library index as they are needed. Picking a
+ * track from the library queues the whole library in order, which costs
+ * nothing; an M3U/M3U8 playlist is read once into an array of indexes.
+ * Playlist lines may be relative to the playlist's folder or absolute on
+ * the card, with '/' or '\'; #EXT lines, URLs and tracks that are not in
+ * the library are skipped. The first lines are searched for one by one;
+ * past that the library is read once into a table of path hashes, so a
+ * long or shuffled list costs one pass over the index, not a search per
+ * line.
+ *
+ * Indexes go stale when the library is rebuilt; the queue notices the new
+ * generation, reads its playlist again and finds its position by path. That
+ * happens outside the queue's lock, so a pick made meanwhile does not wait
+ * for it, and wins over it.
+ */
+bool audio_queue_init(void);
+
+/* The whole library in order, from index */
+bool audio_queue_library(uint32_t index);
+
+/* Entries of an M3U/M3U8 file, from the first; false if none are in the library */
+bool audio_queue_load(const char *playlist);
+
+uint32_t audio_queue_count(void);
+
+/* Move step entries (-1, 0, 1) and give the new current entry's path; false past either end */
+bool audio_queue_step(int32_t step, char *path, size_t len);
+
+/* Path step entries from the current one, the queue stays where it is */
+bool audio_queue_peek(int32_t step, char *path, size_t len);
+
+/* n-th .m3u/.m3u8 under AUDIO_QUEUE_PLAYLIST_DIR, false past the last */
+bool audio_queue_playlist(uint32_t n, char *path, size_t len);
+
+#endif // AUDIO_QUEUE_H
@@ -0,0 +1,86 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define AUDIO_RING_ALIGN    32      // keep head/tail and data on separate cache lines
+
+/*
+ * Lock-free single-producer / single-consumer byte ring for PCM.
+ *
+ * Producer (reader task) asks for a contiguous writable span, decodes or
+ * freads straight into it, then commits. The buffer carries `slack` bytes
+ * past its end so a span never has to wrap; on commit the part that ran
+ * into the slack is folded back to the start.
+ *
+ * Consumer (A2DP data callback) copies exactly once into its output. No
+ * locks: only acquire/release loads and stores of the two free-running
+ * indices. Its one FreeRTOS call is a task notification, made only when the
+ * producer is sleeping in audio_ring_wait_below() and the fill has dropped
+ * to the level it asked for.
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;          // power of two
+    uint32_t slack;         // largest span the producer may acquire
+    __attribute__((aligned(AUDIO_RING_ALIGN))) uint32_t head;   // written by producer only
+    __attribute__((aligned(AUDIO_RING_ALIGN))) uint32_t tail;   // written by consumer only
+    // flush request from the producer, applied by the consumer on its next read
+    uint32_t flush_head;
+    uint32_t flush_req;
+    uint32_t flush_done;
+    // low-watermark wakeup, armed by the producer, fired once by the consumer
+    TaskHandle_t waiter;
+    uint32_t wake_level;
+    uint32_t wake_armed;
+} audio_ring_t;
+
+bool audio_ring_init(audio_ring_t *rb, uint32_t size, uint32_t slack);
+
+/* Producer: pointer to len contiguous free bytes, NULL if not enough room yet */
+uint8_t *audio_ring_acquire(audio_ring_t *rb, uint32_t len);
+
+/* Producer: publish len bytes written into the last acquired span */
+void audio_ring_commit(audio_ring_t *rb, uint32_t len);
+
+/* Consumer: copy up to len bytes into dst, returns bytes copied */
+uint32_t audio_ring_read(audio_ring_t *rb, uint8_t *dst, uint32_t len);
+
+/*
+ * Observer (any third task): copy len bytes starting at the consumer's
+ * position without consuming them. Returns false if there is not that much
+ * queued, or if the producer may have overwritten part of it meanwhile.
+ */
+bool audio_ring_peek(const audio_ring_t *rb, uint8_t *dst, uint32_t len);
+
+/*
+ * Producer: drop everything committed so far. The consumer applies it
+ * before its next copy, so no byte written before the flush is ever read.
+ */
+void audio_ring_flush(audio_ring_t *rb);
+
+/*
+ * Producer: sleep until the fill drops to level bytes or less, or timeout.
+ * Returns true if the ring is at or below level. Any other notification of
+ * the calling task also ends the wait early.
+ */
+bool audio_ring_wait_below(audio_ring_t *rb, uint32_t level, TickType_t timeout);
+
+static inline uint32_t audio_ring_fill(const audio_ring_t *rb)
+{
+    return __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t audio_ring_free(const audio_ring_t *rb)
+{
+    return rb->size - audio_ring_fill(rb);
+}
+
+#endif // AUDIO_RING_H
@@ -0,0 +1,41 @@
+#ifndef AUDIO_SPECTRUM_H
+#define AUDIO_SPECTRUM_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AUDIO_SPECTRUM_FFT_LOG2     9       // 512 point FFT, ~86 Hz per bin
+#define AUDIO_SPECTRUM_FFT_SIZE     (1 << AUDIO_SPECTRUM_FFT_LOG2)
+#define AUDIO_SPECTRUM_BANDS        16      // log spaced, ~86 Hz to 22 kHz
+#define AUDIO_SPECTRUM_PERIOD_MS    34      // under 30 updates a second
+#define AUDIO_SPECTRUM_RANGE_DB     60      // levels span -60..0 dBFS
+#define AUDIO_SPECTRUM_FALL         4       // level units a bar drops per update
+
+/*
+ * Level meter and spectrum for the now-playing screen.
+ *
+ * A low-priority task wakes every AUDIO_SPECTRUM_PERIOD_MS, copies the next
+ * AUDIO_SPECTRUM_FFT_SIZE frames about to be played out of the ring (see
+ * audio_ring_peek(), nothing is consumed and the A2DP callback is not
+ * involved), and runs a Hann-windowed Q15 radix-2 FFT on the mono mix.
+ * Bins are folded into AUDIO_SPECTRUM_BANDS peak levels plus per-channel
+ * RMS, all scaled 0..100, and published through a double buffer the UI
+ * reads without locking.
+ */
+typedef struct {
+    uint8_t band[AUDIO_SPECTRUM_BANDS];
+    uint8_t vu[2];                  // RMS left/right
+    uint32_t seq;                   // bumped on every publish
+} audio_spectrum_t;
+
+bool audio_spectrum_init(void);
+
+/* Latest levels into out; false if nothing newer than out->seq */
+bool audio_spectrum_get(audio_spectrum_t *out);
+
+/* Log the average cost of one update */
+void audio_spectrum_report(void);
+
+#endif // AUDIO_SPECTRUM_H
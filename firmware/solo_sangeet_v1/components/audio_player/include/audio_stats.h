@@ -0,0 +1,138 @@
+#ifndef AUDIO_STATS_H
+#define AUDIO_STATS_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_timer.h"
+
+// Set to 0 to compile every hook below out of the audio path
+#define AUDIO_STATS_ENABLE      1
+#define AUDIO_STATS_DUMP_MS     10000   // periodic UART dump, 0 = only on request
+
+#define AUDIO_STATS_FILL_BINS   8       // ring fill at callback, in eighths of the ring
+#define AUDIO_STATS_LOG2_BINS   12      // power-of-two buckets
+#define AUDIO_STATS_BYTES_PER_SEC   (44100 * 4)     // consumer side: 44.1 kHz stereo s16
+
+/*
+ * Data path telemetry, for sizing AUDIO_RINGBUF_SIZE / AUDIO_READ_CHUNK.
+ *
+ * Consumer fields are written only by the A2DP data callback, producer
+ * fields only by the reader task, so plain stores are enough; readers get
+ * a snapshot that may straddle one update.
+ *
+ * log2 histograms: bin 0 counts 0-1 units, bin n counts [2^n, 2^(n+1)),
+ * the last bin everything above.
+ */
+typedef struct {
+    // consumer: bt_app_a2d_data_cb
+    uint32_t callbacks;
+    uint64_t bytes_out;                     // delivered, i.e. audio actually played
+    uint32_t underruns;                     // callbacks that got less than asked
+    uint64_t bytes_short;
+    uint32_t max_short;
+    uint32_t fill_hist[AUDIO_STATS_FILL_BINS];
+    uint32_t interval_hist[AUDIO_STATS_LOG2_BINS];  // ms between callbacks
+    uint32_t max_interval_us;
+    int64_t last_cb_us;
+    // producer: reader task
+    uint32_t reads;
+    uint32_t read_hist[AUDIO_STATS_LOG2_BINS];      // SD read latency in 100 us units
+    uint32_t max_read_us;
+    uint64_t read_bytes;
+    uint64_t read_us;
+    uint64_t busy_us;                       // producing blocks, sleeps on the ring excluded
+    uint32_t ring_full_waits;               // producer found no room and slept
+} audio_stats_t;
+
+#if AUDIO_STATS_ENABLE
+
+extern audio_stats_t audio_stats;
+
+static inline uint32_t audio_stats_log2_bin(uint32_t v)
+{
+    uint32_t bin = v ? 31 - __builtin_clz(v) : 0;
+    return bin < AUDIO_STATS_LOG2_BINS ? bin : AUDIO_STATS_LOG2_BINS - 1;
+}
+
+/* Consumer: fill before the read, bytes asked for and bytes delivered */
+static inline void audio_stats_consumer(uint32_t fill, uint32_t ring_size, uint32_t want, uint32_t got)
+{
+    int64_t now = esp_timer_get_time();
+    audio_stats_t *s = &audio_stats;
+
+    if (s->last_cb_us) {
+        uint32_t dt = now - s->last_cb_us;
+        s->interval_hist[audio_stats_log2_bin(dt / 1000)]++;
+        if (dt > s->max_interval_us) {
+            s->max_interval_us = dt;
+        }
+    }
+    s->last_cb_us = now;
+
+    uint32_t bin = (uint64_t)fill * AUDIO_STATS_FILL_BINS / ring_size;
+    s->fill_hist[bin < AUDIO_STATS_FILL_BINS ? bin : AUDIO_STATS_FILL_BINS - 1]++;
+
+    s->bytes_out += got;
+    if (got < want) {
+        s->underruns++;
+        s->bytes_short += want - got;
+        if (want - got > s->max_short) {
+            s->max_short = want - got;
+        }
+    }
+    s->callbacks++;
+}
+
+/* Producer: one SD read of bytes that took us */
+static inline void audio_stats_read(uint32_t us, uint32_t bytes)
+{
+    audio_stats_t *s = &audio_stats;
+
+    s->read_hist[audio_stats_log2_bin(us / 100)]++;
+    if (us > s->max_read_us) {
+        s->max_read_us = us;
+    }
+    s->read_bytes += bytes;
+    s->read_us += us;
+    s->reads++;
+}
+
+/* Producer: time spent on one pipeline pass, including its SD reads */
+static inline void audio_stats_busy(uint32_t us)
+{
+    audio_stats.busy_us += us;
+}
+
+static inline void audio_stats_ring_full(void)
+{
+    audio_stats.ring_full_waits++;
+}
+
+/* Start the periodic dump (AUDIO_STATS_DUMP_MS) */
+void audio_stats_init(void);
+
+/* Copy the current counters */
+void audio_stats_get(audio_stats_t *out);
+
+void audio_stats_reset(void);
+
+/* Log counters and histograms over UART */
+void audio_stats_dump(void);
+
+#else
+
+static inline void audio_stats_consumer(uint32_t fill, uint32_t ring_size, uint32_t want, uint32_t got) {}
+static inline void audio_stats_read(uint32_t us, uint32_t bytes) {}
+static inline void audio_stats_busy(uint32_t us) {}
+static inline void audio_stats_ring_full(void) {}
+static inline void audio_stats_init(void) {}
+static inline void audio_stats_get(audio_stats_t *out) { *out = (audio_stats_t){ 0 }; }
+static inline void audio_stats_reset(void) {}
+static inline void audio_stats_dump(void) {}
+
+#endif // AUDIO_STATS_ENABLE
+
+#endif // AUDIO_STATS_H
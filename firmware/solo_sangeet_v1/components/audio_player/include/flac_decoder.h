@@ -0,0 +1,61 @@
+#ifndef FLAC_DECODER_H
+#define FLAC_DECODER_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Streamable subset limit for <= 48 kHz; larger files are rejected at open
+#define FLAC_MAX_BLOCK_SIZE     4608
+#define FLAC_MAX_CHANNELS       2
+#define FLAC_MAX_LPC_ORDER      32
+#define FLAC_INBUF_SIZE         2048
+
+/*
+ * Streaming FLAC decoder stage.
+ * Working memory is fixed at sizeof(flac_decoder_t) (~39 KB): one decoded
+ * block per channel plus a small refill buffer, independent of file size.
+ * Output is pulled in arbitrary sized pieces so it can be written straight
+ * into the ring buffer's producer side.
+ */
+typedef struct {
+    FILE *fp;
+    // bit reader
+    uint8_t inbuf[FLAC_INBUF_SIZE];
+    size_t in_pos;
+    size_t in_len;
+    uint64_t cache;
+    int cache_bits;
+    bool eof;
+    uint16_t crc16;             // of the frame so far, from its sync code
+    // STREAMINFO
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint16_t max_block_size;
+    uint64_t total_samples;
+    uint32_t data_start;        // offset of the first frame
+    // current decoded block
+    uint32_t block_size;
+    uint32_t block_pos;
+    uint8_t block_bps;
+    uint8_t block_channels;
+    int32_t samples[FLAC_MAX_CHANNELS][FLAC_MAX_BLOCK_SIZE];
+} flac_decoder_t;
+
+/* Parse the "fLaC" marker and metadata blocks, leave fp at the first frame */
+bool flac_decoder_open(flac_decoder_t *dec, FILE *fp);
+
+/*
+ * Fill up to len bytes of out with interleaved 16-bit stereo, decoding
+ * frames as needed. Returns bytes written (multiple of 4), 0 at end of stream.
+ */
+size_t flac_decoder_read(flac_decoder_t *dec, uint8_t *out, size_t len);
+
+/* Continue decoding from the frame starting at offset */
+void flac_decoder_seek(flac_decoder_t *dec, uint32_t offset);
+
+#endif // FLAC_DECODER_H
@@ -0,0 +1,76 @@
+#ifndef MP3_DECODER_H
+#define MP3_DECODER_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mp3dec.h"
+
+// Largest frame: MPEG-1 Layer III, 1152 samples per channel
+#define MP3_MAX_FRAME_SAMPLES   1152
+#define MP3_PCM_BUF_BYTES       (MP3_MAX_FRAME_SAMPLES * 2 * sizeof(int16_t))
+// Two max-size main data blocks so a frame never straddles a refill
+#define MP3_INBUF_SIZE          (MAINBUF_SIZE * 2)
+
+#define MP3_HEADER_SIZE         4
+
+// Fields of one MPEG audio frame header
+typedef struct {
+    uint32_t frame_len;         // bytes, including the header
+    uint32_t samples;           // per channel
+    uint32_t sample_rate;
+    uint32_t bitrate;           // bits per second
+    uint8_t channels;
+} mp3_header_t;
+
+/*
+ * MP3 decoder stage (Helix fixed-point decoder, integer only).
+ * All state lives in this context: the Helix tables are allocated once by
+ * mp3_decoder_init() and nothing is allocated per frame.
+ */
+typedef struct {
+    HMP3Decoder hmp3;
+    uint8_t inbuf[MP3_INBUF_SIZE];
+    uint8_t *read_ptr;
+    int bytes_left;
+    bool eof;
+    MP3FrameInfo info;
+    uint32_t data_start;        // offset of the first frame, after any ID3v2 tag
+    // decode cost, for checking against the A2DP callback budget
+    uint64_t cycles;
+    uint32_t frames;
+} mp3_decoder_t;
+
+bool mp3_decoder_init(mp3_decoder_t *dec);
+
+/* Release the Helix tables */
+void mp3_decoder_deinit(mp3_decoder_t *dec);
+
+/* Reset stream state and skip an ID3v2 tag at the current file position */
+void mp3_decoder_open(mp3_decoder_t *dec, FILE *fp);
+
+/*
+ * Decode one frame into pcm as interleaved 16-bit stereo (mono is duplicated).
+ * pcm must hold MP3_PCM_BUF_BYTES. Returns output bytes, 0 at end of stream.
+ */
+size_t mp3_decoder_decode(mp3_decoder_t *dec, FILE *fp, int16_t *pcm);
+
+/*
+ * Continue decoding from the frame at offset. Frames whose bit reservoir
+ * lies before the seek point come out as silence, so sample counts stay exact.
+ */
+void mp3_decoder_seek(mp3_decoder_t *dec, FILE *fp, uint32_t offset);
+
+/* Parse a Layer III frame header, false if h is not one */
+bool mp3_parse_header(const uint8_t *h, mp3_header_t *out);
+
+/*
+ * Log average decode cost per frame for the current stream, and its share
+ * of one core at CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ. Helix only builds for the
+ * target, so this is where the cycles-per-frame figure is measured.
+ */
+void mp3_decoder_report(const mp3_decoder_t *dec);
+
+#endif // MP3_DECODER_H
@@ -0,0 +1,73 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RESAMPLER_MAX_TAPS      32
+#define RESAMPLER_PHASES        64
+#define RESAMPLER_BLOCK_FRAMES  1152    // input frames buffered per write, one MP3 frame
+
+/*
+ * Quality tiers. Work per output stereo frame is taps x 2 Q14 MACs plus one
+ * coefficient interpolation per tap (none for LINEAR). From 48 kHz, 1 kHz
+ * tone SNR and how far a 23 kHz tone folds back (host_test/test_resampler):
+ *   LINEAR   -  2 taps,  4 MACs                      56 dB, unfiltered
+ *   TAPS_16  - 16 taps, 32 MACs + 16 interpolations  81 dB, -16 dB
+ *   TAPS_32  - 32 taps, 64 MACs + 32 interpolations  78 dB, -38 dB
+ * resampler_report() logs the measured cycles per output frame on target.
+ */
+typedef enum {
+    RESAMPLER_LINEAR = 0,
+    RESAMPLER_TAPS_16,
+    RESAMPLER_TAPS_32,
+} resampler_quality_t;
+
+/*
+ * Fixed-point polyphase sample-rate converter for interleaved 16-bit stereo.
+ * Runs in block mode on the reader task: write() input, then read() output
+ * until it returns 0. All state is in the struct, nothing is allocated.
+ */
+typedef struct {
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint16_t taps;
+    uint64_t step;          // input frames per output frame, Q32
+    uint64_t pos;           // read position in buf, Q32
+    uint32_t buf_frames;
+    int16_t buf[(RESAMPLER_MAX_TAPS + RESAMPLER_BLOCK_FRAMES) * 2];
+    int16_t coefs[RESAMPLER_PHASES + 1][RESAMPLER_MAX_TAPS];   // Q14
+    // conversion cost, for checking against the reader budget
+    uint64_t cycles;
+    uint32_t frames_out;
+} resampler_t;
+
+void resampler_init(resampler_t *rs, uint32_t in_rate, uint32_t out_rate,
+                    resampler_quality_t quality);
+
+/* Drop buffered history, e.g. after a seek */
+void resampler_reset(resampler_t *rs);
+
+/* Queue up to frames input frames, returns the number accepted */
+size_t resampler_write(resampler_t *rs, const int16_t *in, size_t frames);
+
+/*
+ * End of input: queue the silence that carries the filter past the last
+ * frame written, so read() gives every output frame up to it. Read until
+ * it returns 0, then init() or reset() before new input.
+ */
+void resampler_flush(resampler_t *rs);
+
+/* Produce up to max_frames output frames, returns the number written */
+size_t resampler_read(resampler_t *rs, int16_t *out, size_t max_frames);
+
+/* True if read() has output without more input */
+bool resampler_ready(const resampler_t *rs);
+
+/* Log average conversion cost per output frame */
+void resampler_report(const resampler_t *rs);
+
+#endif // RESAMPLER_H
@@ -0,0 +1,100 @@
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SEEK_INDEX_MAX_POINTS   2048    // 8 KB; 44.1 kHz MP3 gets a point every 0.31 s up to 10 min
+#define SEEK_INDEX_SCAN_BUF     2048
+#define SEEK_INDEX_STEP_READS   4       // scan reads per background step
+#ifndef SEEK_INDEX_DIR
+#define SEEK_INDEX_DIR          "/sdcard/.seek"
+#endif
+
+typedef enum {
+    SEEK_INDEX_MP3 = 0,
+    SEEK_INDEX_FLAC,
+} seek_index_kind_t;
+
+// First sample of a frame and the byte offset the frame starts at
+typedef struct {
+    uint32_t sample;
+    uint32_t offset;
+} seek_point_t;
+
+/*
+ * Seek table for compressed tracks (PCM offsets are computed directly).
+ *
+ * Built once by walking frame headers with a second, unbuffered FILE, a few
+ * reads per step while the reader would otherwise sleep on a full ring, and
+ * then saved to SEEK_INDEX_DIR under a hash of the path; the track's size
+ * and mtime in the header tell a stale table. A build that stops on a read
+ * error is dropped, never saved.
+ *
+ * Every frame but the last has the same number of samples, so only byte
+ * offsets are kept, of every `group`-th frame: point k starts at sample
+ * k * group * frame_samples. A seek lands at most one group short of its
+ * target. When the table fills, every other point is dropped and the group
+ * doubles, so any track length fits in fixed memory. A stream whose frames
+ * differ in length (variable block size FLAC) gets no table; its seeks go by
+ * the byte ratio, see seek_index_probe().
+ */
+typedef struct {
+    seek_index_kind_t kind;
+    bool complete;
+    bool failed;                // read error or uneven frames, nothing to save
+    uint32_t sample_rate;
+    uint32_t total_samples;
+    uint32_t frame_samples;
+    uint32_t group;             // frames per point
+    uint32_t count;
+    uint32_t offsets[SEEK_INDEX_MAX_POINTS];
+    // build state
+    FILE *fp;
+    uint32_t file_size;
+    uint32_t mtime;
+    uint32_t pos;               // next frame / sync search offset
+    uint32_t next_sample;
+    uint32_t frames;            // frames walked so far
+    bool short_frame;           // a frame shorter than frame_samples, only the last may be
+    uint32_t flac_block;        // fixed block size of a FLAC stream, from its first frame
+    uint32_t buf_start;
+    uint32_t buf_len;
+    uint8_t buf[SEEK_INDEX_SCAN_BUF];
+    // first frame at or after probe_offset, see seek_index_probe()
+    uint32_t probe_offset;
+    uint32_t probe_sample;
+    bool probe_pending;
+    bool probe_found;
+    char cache_path[32];
+} seek_index_t;
+
+/*
+ * Load the cached table for path or start building one from data_start
+ * (first frame). sample_rate may be 0 for MP3, it is taken from the frames.
+ */
+bool seek_index_open(seek_index_t *idx, const char *path, seek_index_kind_t kind,
+                     uint32_t data_start, uint32_t sample_rate);
+
+/* Advance the build by a few reads; returns true while work is left */
+bool seek_index_step(seek_index_t *idx);
+
+/* Last point at or before sample, at most one group before it; false if the table is empty */
+bool seek_index_lookup(const seek_index_t *idx, uint32_t sample, seek_point_t *out);
+
+/*
+ * Ask the build to note the first sample of the first frame at or after
+ * offset when it gets there, for a seek that had to guess the offset.
+ */
+void seek_index_probe(seek_index_t *idx, uint32_t offset);
+
+/* First sample of the probed frame; false until the build has reached it */
+bool seek_index_probed(const seek_index_t *idx, uint32_t *sample);
+
+/* Abandon an unfinished build */
+void seek_index_close(seek_index_t *idx);
+
+#endif // SEEK_INDEX_H
@@ -0,0 +1,54 @@
+#ifndef WAV_PARSER_H
+#define WAV_PARSER_H
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// WAVE format tags (fmt chunk wFormatTag)
+#define WAV_FMT_PCM          0x0001
+#define WAV_FMT_IEEE_FLOAT   0x0003
+#define WAV_FMT_EXTENSIBLE   0xFFFE
+
+// Output layout expected by the A2DP source: interleaved 16-bit stereo
+#define PCM_OUT_FRAME_BYTES  4
+
+typedef struct {
+    uint16_t format;            // WAV_FMT_PCM or WAV_FMT_IEEE_FLOAT (extensible resolved)
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;   // container bits per sample (8/16/24/32)
+    uint16_t block_align;       // bytes per input frame
+    uint32_t data_offset;       // file offset of first sample in "data"
+    uint32_t data_size;         // size of "data" chunk in bytes
+} wav_info_t;
+
+/*
+ * Walk the RIFF chunk list of an open file and locate "fmt " and "data".
+ * Unknown chunks (LIST/INFO, fact, cue, ...) are skipped with fseek.
+ * On success the file is positioned at data_offset.
+ */
+bool wav_parse_header(FILE *fp, wav_info_t *info);
+
+/*
+ * Number of input bytes (whole frames) that may be read into a buffer of
+ * buf_size bytes so that the in-place conversion below still fits.
+ */
+size_t pcm_input_bytes_for(const wav_info_t *info, size_t buf_size);
+
+/*
+ * Convert in_bytes of raw PCM in buf to interleaved 16-bit stereo, in place.
+ * buf must be at least pcm_output_bytes(info, in_bytes) long.
+ * Returns the number of output bytes.
+ */
+size_t pcm_to_s16_stereo(const wav_info_t *info, uint8_t *buf, size_t in_bytes);
+
+static inline size_t pcm_output_bytes(const wav_info_t *info, size_t in_bytes)
+{
+    return (in_bytes / info->block_align) * PCM_OUT_FRAME_BYTES;
+}
+
+#endif // WAV_PARSER_H
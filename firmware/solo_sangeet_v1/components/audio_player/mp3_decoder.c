@@ -0,0 +1,218 @@
+#include <string.h>
+#include "mp3_decoder.h"
+
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "MP3";
+
+#define ID3V2_HEADER_SIZE   10
+#define MP3_MAX_RESYNC      64
+
+// kbps for MPEG-1 and MPEG-2/2.5 Layer III, index 0 (free format) unsupported
+static const uint16_t s_bitrate_tab[2][15] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+};
+static const uint16_t s_samprate_tab[3] = { 44100, 48000, 32000 };
+
+bool mp3_parse_header(const uint8_t *h, mp3_header_t *out)
+{
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+
+    uint8_t version = (h[1] >> 3) & 0x03;    // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5
+    uint8_t layer = (h[1] >> 1) & 0x03;      // 1 = Layer III
+    uint8_t br_idx = h[2] >> 4;
+    uint8_t sr_idx = (h[2] >> 2) & 0x03;
+    uint8_t padding = (h[2] >> 1) & 0x01;
+
+    if (version == 1 || layer != 1 || br_idx == 0 || br_idx == 15 || sr_idx == 3) {
+        return false;
+    }
+
+    bool mpeg1 = version == 3;
+    uint32_t rate = s_samprate_tab[sr_idx] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    uint32_t bitrate = s_bitrate_tab[mpeg1 ? 0 : 1][br_idx] * 1000;
+
+    out->sample_rate = rate;
+    out->bitrate = bitrate;
+    out->samples = mpeg1 ? 1152 : 576;
+    out->frame_len = (mpeg1 ? 144 : 72) * bitrate / rate + padding;
+    out->channels = (h[3] >> 6) == 3 ? 1 : 2;
+    return true;
+}
+
+bool mp3_decoder_init(mp3_decoder_t *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+
+    // Helix allocates its ~23 KB of tables here, once
+    dec->hmp3 = MP3InitDecoder();
+    if (!dec->hmp3) {
+        ESP_LOGE(TAG, "Failed to allocate MP3 decoder");
+        return false;
+    }
+    return true;
+}
+
+void mp3_decoder_deinit(mp3_decoder_t *dec)
+{
+    if (dec->hmp3) {
+        MP3FreeDecoder(dec->hmp3);
+        dec->hmp3 = NULL;
+    }
+}
+
+static void mp3_refill(mp3_decoder_t *dec, FILE *fp)
+{
+    if (dec->eof) {
+        return;
+    }
+
+    if (dec->bytes_left > 0 && dec->read_ptr != dec->inbuf) {
+        memmove(dec->inbuf, dec->read_ptr, dec->bytes_left);
+    }
+    dec->read_ptr = dec->inbuf;
+
+    size_t n = fread(dec->inbuf + dec->bytes_left, 1,
+                     sizeof(dec->inbuf) - dec->bytes_left, fp);
+    if (n == 0) {
+        dec->eof = true;
+    }
+    dec->bytes_left += n;
+}
+
+void mp3_decoder_open(mp3_decoder_t *dec, FILE *fp)
+{
+    uint8_t hdr[ID3V2_HEADER_SIZE];
+
+    dec->read_ptr = dec->inbuf;
+    dec->bytes_left = 0;
+    dec->eof = false;
+    dec->cycles = 0;
+    dec->frames = 0;
+    memset(&dec->info, 0, sizeof(dec->info));
+
+    long start = ftell(fp);
+    if (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && memcmp(hdr, "ID3", 3) == 0) {
+        // Syncsafe size, excludes the header and optional footer
+        uint32_t size = ((uint32_t)(hdr[6] & 0x7f) << 21) | ((uint32_t)(hdr[7] & 0x7f) << 14) |
+                        ((uint32_t)(hdr[8] & 0x7f) << 7) | (hdr[9] & 0x7f);
+        if (hdr[5] & 0x10) {
+            size += ID3V2_HEADER_SIZE;
+        }
+        ESP_LOGI(TAG, "Skipping ID3v2 tag (%lu bytes)", (unsigned long)size);
+        fseek(fp, size, SEEK_CUR);
+    } else {
+        fseek(fp, start, SEEK_SET);
+    }
+    dec->data_start = ftell(fp);
+}
+
+void mp3_decoder_seek(mp3_decoder_t *dec, FILE *fp, uint32_t offset)
+{
+    fseek(fp, offset, SEEK_SET);
+    dec->read_ptr = dec->inbuf;
+    dec->bytes_left = 0;
+    dec->eof = false;
+}
+
+size_t mp3_decoder_decode(mp3_decoder_t *dec, FILE *fp, int16_t *pcm)
+{
+    for (int tries = 0; tries < MP3_MAX_RESYNC; tries++) {
+
+        if (dec->bytes_left < MAINBUF_SIZE) {
+            mp3_refill(dec, fp);
+        }
+        if (dec->bytes_left == 0) {
+            return 0;
+        }
+
+        int offset = MP3FindSyncWord(dec->read_ptr, dec->bytes_left);
+        if (offset < 0) {
+            // No sync in buffer, keep the last byte in case it starts one
+            dec->read_ptr += dec->bytes_left - 1;
+            dec->bytes_left = 1;
+            if (dec->eof) {
+                return 0;
+            }
+            continue;
+        }
+        dec->read_ptr += offset;
+        dec->bytes_left -= offset;
+
+        mp3_header_t hdr;
+        bool have_hdr = dec->bytes_left >= MP3_HEADER_SIZE && mp3_parse_header(dec->read_ptr, &hdr);
+
+        uint32_t start = esp_cpu_get_cycle_count();
+        int err = MP3Decode(dec->hmp3, &dec->read_ptr, &dec->bytes_left, pcm, 0);
+        uint32_t spent = esp_cpu_get_cycle_count() - start;
+
+        if (err == ERR_MP3_NONE) {
+            MP3GetLastFrameInfo(dec->hmp3, &dec->info);
+            dec->cycles += spent;
+            dec->frames++;
+
+            size_t samples = dec->info.outputSamps;
+            if (dec->info.nChans == 1) {
+                // Expand to stereo, backward so we don't overwrite unread samples
+                for (size_t i = samples; i-- > 0;) {
+                    pcm[2 * i] = pcm[2 * i + 1] = pcm[i];
+                }
+                samples *= 2;
+            }
+            return samples * sizeof(int16_t);
+        }
+
+        if (err == ERR_MP3_MAINDATA_UNDERFLOW && have_hdr) {
+            // Reservoir starts before a seek point: the frame is consumed, keep its duration
+            memset(pcm, 0, hdr.samples * 2 * sizeof(int16_t));
+            return hdr.samples * 2 * sizeof(int16_t);
+        }
+
+        if (err == ERR_MP3_INDATA_UNDERFLOW || err == ERR_MP3_MAINDATA_UNDERFLOW) {
+            if (dec->eof) {
+                return 0;
+            }
+            mp3_refill(dec, fp);
+            continue;
+        }
+
+        // Corrupt frame: step past this sync word and look for the next one
+        ESP_LOGW(TAG, "Decode error %d, resyncing", err);
+        if (dec->bytes_left > 0) {
+            dec->read_ptr++;
+            dec->bytes_left--;
+        }
+    }
+
+    ESP_LOGE(TAG, "Lost sync, giving up on stream");
+    return 0;
+}
+
+void mp3_decoder_report(const mp3_decoder_t *dec)
+{
+    if (dec->frames == 0) {
+        return;
+    }
+
+    uint32_t per_frame = dec->cycles / dec->frames;
+    // Cycles one frame's worth of playback gives the core
+    uint64_t budget = 0;
+    if (dec->info.samprate && dec->info.nChans) {
+        budget = (uint64_t)dec->info.outputSamps / dec->info.nChans *
+                 CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000 / dec->info.samprate;
+    }
+
+    ESP_LOGI(TAG, "%lu frames, %lu Hz, %d ch, %d kbps, avg %lu cycles/frame",
+             (unsigned long)dec->frames, (unsigned long)dec->info.samprate,
+             dec->info.nChans, dec->info.bitrate / 1000, (unsigned long)per_frame);
+    if (budget) {
+        ESP_LOGI(TAG, "Decode load %lu.%lu%% of one core",
+                 (unsigned long)(per_frame * 100 / budget),
+                 (unsigned long)(per_frame * 1000 / budget % 10));
+    }
+}
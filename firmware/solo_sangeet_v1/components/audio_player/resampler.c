@@ -0,0 +1,174 @@
+#include <math.h>
+#include <string.h>
+#include "resampler.h"
+
+#include "esp_log.h"
+#include "esp_cpu.h"
+
+static const char *TAG = "SRC";
+
+#define Q14_ONE         (1 << 14)
+#define RS_FRAC_BITS    32
+#define RS_FRAC_MASK    ((1ULL << RS_FRAC_BITS) - 1)
+#define RS_PHASE_BITS   6       // log2(RESAMPLER_PHASES)
+
+static const uint8_t s_taps[] = {
+    [RESAMPLER_LINEAR]  = 2,
+    [RESAMPLER_TAPS_16] = 16,
+    [RESAMPLER_TAPS_32] = 32,
+};
+
+// Blackman windowed sinc, one row per phase; built once per stream in float
+static void resampler_build_table(resampler_t *rs)
+{
+    const int taps = rs->taps;
+    const int half = taps / 2;
+    // Anti-alias: cut below the lower of the two Nyquist rates
+    const double fc = (rs->out_rate < rs->in_rate ?
+                       (double)rs->out_rate / rs->in_rate : 1.0) * 0.91;
+
+    for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+        double frac = (double)p / RESAMPLER_PHASES;
+        double h[RESAMPLER_MAX_TAPS];
+        double sum = 0;
+
+        for (int k = 0; k < taps; k++) {
+            double t = k - half + 1 - frac;
+            double x = M_PI * fc * t;
+            double sinc = t == 0 ? 1.0 : sin(x) / x;
+            double w = 0.42 + 0.5 * cos(M_PI * t / half) + 0.08 * cos(2 * M_PI * t / half);
+            h[k] = fabs(t) >= half ? 0 : sinc * w;
+            sum += h[k];
+        }
+        // Unity DC gain on every phase, exactly: rounding is made up on the centre tap
+        int32_t q14_sum = 0;
+        for (int k = 0; k < taps; k++) {
+            rs->coefs[p][k] = (int16_t)lrint(h[k] / sum * Q14_ONE);
+            q14_sum += rs->coefs[p][k];
+        }
+        rs->coefs[p][p < RESAMPLER_PHASES / 2 ? half - 1 : half] += Q14_ONE - q14_sum;
+    }
+}
+
+void resampler_reset(resampler_t *rs)
+{
+    // Prime with zeros so the first output is centred on input frame 0
+    rs->buf_frames = rs->taps / 2 - 1;
+    memset(rs->buf, 0, rs->buf_frames * 2 * sizeof(int16_t));
+    rs->pos = (uint64_t)rs->buf_frames << RS_FRAC_BITS;
+}
+
+void resampler_init(resampler_t *rs, uint32_t in_rate, uint32_t out_rate,
+                    resampler_quality_t quality)
+{
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->taps = s_taps[quality];
+    rs->step = ((uint64_t)in_rate << RS_FRAC_BITS) / out_rate;
+    rs->cycles = 0;
+    rs->frames_out = 0;
+
+    if (quality != RESAMPLER_LINEAR) {
+        resampler_build_table(rs);
+    }
+    resampler_reset(rs);
+
+    ESP_LOGI(TAG, "%lu -> %lu Hz, %u taps", (unsigned long)in_rate,
+             (unsigned long)out_rate, rs->taps);
+}
+
+size_t resampler_write(resampler_t *rs, const int16_t *in, size_t frames)
+{
+    // Discard history the filter can no longer reach
+    uint32_t first = (uint32_t)(rs->pos >> RS_FRAC_BITS) - (rs->taps / 2 - 1);
+    if (first > 0 && first <= rs->buf_frames) {
+        memmove(rs->buf, rs->buf + first * 2, (rs->buf_frames - first) * 2 * sizeof(int16_t));
+        rs->buf_frames -= first;
+        rs->pos -= (uint64_t)first << RS_FRAC_BITS;
+    }
+
+    size_t space = RESAMPLER_MAX_TAPS + RESAMPLER_BLOCK_FRAMES - rs->buf_frames;
+    if (frames > space) {
+        frames = space;
+    }
+    memcpy(rs->buf + rs->buf_frames * 2, in, frames * 2 * sizeof(int16_t));
+    rs->buf_frames += frames;
+    return frames;
+}
+
+void resampler_flush(resampler_t *rs)
+{
+    static const int16_t zeros[RESAMPLER_MAX_TAPS];
+
+    resampler_write(rs, zeros, rs->taps / 2);
+}
+
+static inline int16_t sat16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : (int16_t)v);
+}
+
+size_t resampler_read(resampler_t *rs, int16_t *out, size_t max_frames)
+{
+    const int taps = rs->taps;
+    const int half = taps / 2;
+    size_t n = 0;
+    uint32_t start = esp_cpu_get_cycle_count();
+
+    while (n < max_frames) {
+        uint32_t idx = (uint32_t)(rs->pos >> RS_FRAC_BITS);
+        if (idx + half >= rs->buf_frames) {
+            break;      // need more input
+        }
+        uint32_t frac = (uint32_t)(rs->pos & RS_FRAC_MASK);
+        const int16_t *x = rs->buf + (idx - half + 1) * 2;
+        int32_t l, r;
+
+        if (taps == 2) {
+            // Q15 fraction
+            int32_t f = frac >> 17;
+            l = x[0] + (((x[2] - x[0]) * f) >> 15);
+            r = x[1] + (((x[3] - x[1]) * f) >> 15);
+        } else {
+            // Interpolate between the two nearest phases
+            uint32_t ph = frac >> (RS_FRAC_BITS - RS_PHASE_BITS);
+            int32_t pf = (frac >> (RS_FRAC_BITS - RS_PHASE_BITS - 15)) & 0x7fff;
+            const int16_t *c0 = rs->coefs[ph];
+            const int16_t *c1 = rs->coefs[ph + 1];
+            int32_t al = 0, ar = 0;
+
+            for (int k = 0; k < taps; k++) {
+                int32_t c = c0[k] + (((c1[k] - c0[k]) * pf + (1 << 14)) >> 15);
+                al += c * x[2 * k];
+                ar += c * x[2 * k + 1];
+            }
+            l = (al + (Q14_ONE >> 1)) >> 14;
+            r = (ar + (Q14_ONE >> 1)) >> 14;
+        }
+
+        out[2 * n] = sat16(l);
+        out[2 * n + 1] = sat16(r);
+        n++;
+        rs->pos += rs->step;
+    }
+
+    rs->cycles += esp_cpu_get_cycle_count() - start;
+    rs->frames_out += n;
+    return n;
+}
+
+bool resampler_ready(const resampler_t *rs)
+{
+    return (uint32_t)(rs->pos >> RS_FRAC_BITS) + rs->taps / 2 < rs->buf_frames;
+}
+
+void resampler_report(const resampler_t *rs)
+{
+    if (rs->frames_out == 0) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "%lu frames out, %u taps, avg %lu cycles/frame",
+             (unsigned long)rs->frames_out, rs->taps,
+             (unsigned long)(rs->cycles / rs->frames_out));
+}
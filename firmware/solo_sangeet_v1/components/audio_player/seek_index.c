@@ -0,0 +1,439 @@
+#include <string.h>
+#include <sys/stat.h>
+#include "seek_index.h"
+#include "mp3_decoder.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "SEEKIDX";
+
+#define SEEK_INDEX_MAGIC        0x33584453      // "SDX3"
+#define SEEK_INDEX_SPACING_DIV  10              // initial group: about 1/10 s
+#define FLAC_MAX_HEADER         16
+
+// On-SD layout: this header followed by count frame offsets
+typedef struct {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t file_size;
+    uint32_t mtime;
+    uint32_t sample_rate;
+    uint32_t total_samples;
+    uint32_t frame_samples;
+    uint32_t group;
+    uint32_t count;
+} seek_index_file_t;
+
+static bool seek_index_load(seek_index_t *idx)
+{
+    FILE *fp = fopen(idx->cache_path, "rb");
+    seek_index_file_t hdr;
+    bool ok = false;
+
+    if (!fp) {
+        return false;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == SEEK_INDEX_MAGIC &&
+        hdr.kind == idx->kind && hdr.file_size == idx->file_size &&
+        hdr.mtime == idx->mtime && hdr.frame_samples && hdr.group &&
+        hdr.count > 0 && hdr.count <= SEEK_INDEX_MAX_POINTS) {
+        ok = fread(idx->offsets, sizeof(uint32_t), hdr.count, fp) == hdr.count;
+    }
+    fclose(fp);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Ignoring stale index %s", idx->cache_path);
+        return false;
+    }
+
+    idx->sample_rate = hdr.sample_rate;
+    idx->total_samples = hdr.total_samples;
+    idx->frame_samples = hdr.frame_samples;
+    idx->group = hdr.group;
+    idx->count = hdr.count;
+    idx->complete = true;
+    return true;
+}
+
+static void seek_index_save(const seek_index_t *idx)
+{
+    if (!idx->cache_path[0] || idx->count == 0) {
+        return;
+    }
+
+    FILE *fp = fopen(idx->cache_path, "wb");
+    if (!fp) {
+        // First table on this card
+        mkdir(SEEK_INDEX_DIR, 0775);
+        fp = fopen(idx->cache_path, "wb");
+    }
+    if (!fp) {
+        ESP_LOGW(TAG, "Cannot write %s", idx->cache_path);
+        return;
+    }
+
+    seek_index_file_t hdr = {
+        .magic = SEEK_INDEX_MAGIC,
+        .kind = idx->kind,
+        .file_size = idx->file_size,
+        .mtime = idx->mtime,
+        .sample_rate = idx->sample_rate,
+        .total_samples = idx->total_samples,
+        .frame_samples = idx->frame_samples,
+        .group = idx->group,
+        .count = idx->count,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(idx->offsets, sizeof(uint32_t), idx->count, fp) == idx->count;
+    if (fclose(fp) != 0 || !ok) {
+        // Half a table must not look like a whole one next time
+        ESP_LOGW(TAG, "Cannot write %s", idx->cache_path);
+        remove(idx->cache_path);
+    }
+}
+
+// Tables live apart from the tracks so the music folders stay as they are
+static void seek_index_name(seek_index_t *idx, const char *path)
+{
+    uint32_t h = 2166136261u;
+
+    while (*path) {
+        h = (h ^ (uint8_t)*path++) * 16777619u;
+    }
+    snprintf(idx->cache_path, sizeof(idx->cache_path), "%s/%08lx", SEEK_INDEX_DIR,
+             (unsigned long)h);
+}
+
+bool seek_index_open(seek_index_t *idx, const char *path, seek_index_kind_t kind,
+                     uint32_t data_start, uint32_t sample_rate)
+{
+    struct stat st;
+
+    seek_index_close(idx);
+
+    idx->kind = kind;
+    idx->complete = false;
+    idx->failed = false;
+    idx->sample_rate = sample_rate;
+    idx->total_samples = 0;
+    idx->frame_samples = 0;
+    idx->group = 0;
+    idx->count = 0;
+    idx->pos = data_start;
+    idx->next_sample = 0;
+    idx->frames = 0;
+    idx->short_frame = false;
+    idx->flac_block = 0;
+    idx->buf_start = 0;
+    idx->buf_len = 0;
+    idx->probe_pending = false;
+    idx->probe_found = false;
+    idx->cache_path[0] = '\0';
+
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    idx->file_size = st.st_size;
+    idx->mtime = (uint32_t)st.st_mtime;
+
+    seek_index_name(idx, path);
+    if (seek_index_load(idx)) {
+        ESP_LOGI(TAG, "Loaded %lu points from %s", (unsigned long)idx->count, idx->cache_path);
+        return true;
+    }
+
+    idx->fp = fopen(path, "rb");
+    if (!idx->fp) {
+        return false;
+    }
+    // Scan reads go straight to FATFS into idx->buf
+    setvbuf(idx->fp, NULL, _IONBF, 0);
+    return true;
+}
+
+void seek_index_close(seek_index_t *idx)
+{
+    if (idx->fp) {
+        fclose(idx->fp);
+        idx->fp = NULL;
+    }
+}
+
+// Pointer to need bytes at off, reading a new window if necessary; NULL past
+// the end of the file, or with failed set if the card would not read
+static const uint8_t *scan_window(seek_index_t *idx, uint32_t off, uint32_t need, int *reads)
+{
+    if (off >= idx->buf_start && off + need <= idx->buf_start + idx->buf_len) {
+        return idx->buf + (off - idx->buf_start);
+    }
+    if (off + need > idx->file_size) {
+        return NULL;
+    }
+
+    (*reads)++;
+    if (fseek(idx->fp, off, SEEK_SET) != 0) {
+        idx->failed = true;
+        return NULL;
+    }
+    idx->buf_start = off;
+    idx->buf_len = fread(idx->buf, 1, sizeof(idx->buf), idx->fp);
+    if (idx->buf_len < need) {
+        idx->failed = true;
+        return NULL;
+    }
+    return idx->buf;
+}
+
+// One more frame of samples at offset, a point at each group's first
+static void seek_index_add(seek_index_t *idx, uint32_t samples, uint32_t offset)
+{
+    if (idx->probe_pending && offset >= idx->probe_offset) {
+        idx->probe_sample = idx->next_sample;
+        idx->probe_pending = false;
+        idx->probe_found = true;
+    }
+
+    if (!idx->frame_samples) {
+        idx->frame_samples = samples;
+        idx->group = idx->sample_rate / SEEK_INDEX_SPACING_DIV / samples;
+        idx->group = idx->group ? idx->group : 1;
+    }
+    // Offsets alone only work if frames are all the same length but the last
+    if (idx->short_frame || samples > idx->frame_samples) {
+        ESP_LOGW(TAG, "Frames of %lu and %lu samples, no index",
+                 (unsigned long)idx->frame_samples, (unsigned long)samples);
+        idx->failed = true;
+        return;
+    }
+    idx->short_frame = samples < idx->frame_samples;
+
+    if (idx->frames % idx->group == 0) {
+        if (idx->count == SEEK_INDEX_MAX_POINTS) {
+            // Halve the resolution instead of growing; frames is a multiple
+            // of the new group too, as the table holds an even count
+            for (uint32_t i = 0; i < idx->count / 2; i++) {
+                idx->offsets[i] = idx->offsets[2 * i];
+            }
+            idx->count /= 2;
+            idx->group *= 2;
+        }
+        if (idx->frames % idx->group == 0) {
+            idx->offsets[idx->count++] = offset;
+        }
+    }
+    idx->frames++;
+}
+
+// Walk frame headers; each header gives the offset of the next one
+static bool scan_mp3(seek_index_t *idx, int *reads)
+{
+    mp3_header_t hdr, next;
+
+    while (*reads < SEEK_INDEX_STEP_READS && !idx->failed) {
+        const uint8_t *p = scan_window(idx, idx->pos, MP3_HEADER_SIZE, reads);
+        if (!p) {
+            return false;
+        }
+
+        bool ok = mp3_parse_header(p, &hdr) &&
+                  (!idx->sample_rate || hdr.sample_rate == idx->sample_rate);
+        if (ok) {
+            // A sync pattern inside junk is only believed if another frame
+            // (or the ID3v1 tag, or the end of file) follows
+            const uint8_t *q = scan_window(idx, idx->pos + hdr.frame_len, MP3_HEADER_SIZE, reads);
+            if (idx->failed) {
+                return false;
+            }
+            ok = !q || mp3_parse_header(q, &next) || memcmp(q, "TAG", 3) == 0;
+        }
+        if (!ok) {
+            idx->pos++;     // junk or trailing tag, look for the next sync
+            continue;
+        }
+
+        if (!idx->sample_rate) {
+            idx->sample_rate = hdr.sample_rate;
+        }
+        seek_index_add(idx, hdr.samples, idx->pos);
+        idx->next_sample += hdr.samples;
+        idx->pos += hdr.frame_len;
+    }
+    return !idx->failed;
+}
+
+static uint8_t flac_crc8(const uint8_t *p, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Validate a frame header at p (CRC-8 included) and return its first sample
+static bool flac_parse_header(seek_index_t *idx, const uint8_t *p, uint32_t *sample,
+                              uint32_t *block, uint32_t *len)
+{
+    uint8_t bs_code = p[2] >> 4;
+    uint8_t sr_code = p[2] & 0x0f;
+    uint8_t ch_code = p[3] >> 4;
+    uint8_t ss_code = (p[3] >> 1) & 0x07;
+
+    if (bs_code == 0 || sr_code == 15 || ch_code > 10 || ss_code == 3 || (p[3] & 0x01)) {
+        return false;
+    }
+
+    // UTF-8 style coded frame or sample number
+    uint64_t num = p[4];
+    int i = 5;
+    if (num & 0x80) {
+        int extra = 0;
+        while (extra < 7 && (p[4] & (0x40 >> extra))) {
+            extra++;
+        }
+        if (extra == 0 || extra > 6) {
+            return false;
+        }
+        num &= 0x3f >> extra;
+        while (extra--) {
+            if ((p[i] & 0xC0) != 0x80) {
+                return false;
+            }
+            num = (num << 6) | (p[i++] & 0x3f);
+        }
+    }
+
+    uint32_t bs = 0;
+    if (bs_code == 1) {
+        bs = 192;
+    } else if (bs_code <= 5) {
+        bs = 576u << (bs_code - 2);
+    } else if (bs_code == 6) {
+        bs = p[i++] + 1;
+    } else if (bs_code == 7) {
+        bs = ((uint32_t)p[i] << 8 | p[i + 1]) + 1;
+        i += 2;
+    } else {
+        bs = 256u << (bs_code - 8);
+    }
+
+    if (sr_code == 12) {
+        i++;
+    } else if (sr_code == 13 || sr_code == 14) {
+        i += 2;
+    }
+
+    if (flac_crc8(p, i) != p[i]) {
+        return false;
+    }
+
+    if (p[1] & 0x01) {
+        *sample = (uint32_t)num;                // variable blocksize: sample number
+    } else {
+        if (!idx->flac_block) {
+            idx->flac_block = bs;
+        }
+        *sample = (uint32_t)num * idx->flac_block;
+    }
+    *block = bs;
+    *len = i + 1;
+    return true;
+}
+
+// Frames are not length-prefixed: search for sync codes with a valid header CRC
+static bool scan_flac(seek_index_t *idx, int *reads)
+{
+    while (*reads < SEEK_INDEX_STEP_READS && !idx->failed) {
+        const uint8_t *p = scan_window(idx, idx->pos, FLAC_MAX_HEADER, reads);
+        if (!p) {
+            return false;
+        }
+
+        size_t avail = idx->buf_start + idx->buf_len - idx->pos - (FLAC_MAX_HEADER - 1);
+        const uint8_t *ff = memchr(p, 0xFF, avail);
+        if (!ff) {
+            idx->pos += avail;
+            continue;
+        }
+        idx->pos += ff - p;
+
+        // An 8-bit CRC alone lets through 1 in 256 sync patterns in audio
+        // data; a real frame also starts exactly where the previous one ended
+        uint32_t sample, len, bs;
+        if ((ff[1] & 0xFE) == 0xF8 && flac_parse_header(idx, ff, &sample, &bs, &len) &&
+            sample == idx->next_sample) {
+            seek_index_add(idx, bs, idx->pos);
+            idx->next_sample = sample + bs;
+            idx->pos += len;
+        } else {
+            idx->pos++;
+        }
+    }
+    return !idx->failed;
+}
+
+bool seek_index_step(seek_index_t *idx)
+{
+    if (idx->complete || !idx->fp) {
+        return false;
+    }
+
+    int reads = 0;
+    bool more = idx->kind == SEEK_INDEX_MP3 ? scan_mp3(idx, &reads) : scan_flac(idx, &reads);
+    if (more) {
+        return true;
+    }
+    seek_index_close(idx);
+
+    // The table so far still serves seeks before next_sample, the rest go
+    // by the byte ratio; the next open of the track builds it again
+    if (idx->failed) {
+        ESP_LOGW(TAG, "Index stopped at offset %lu", (unsigned long)idx->pos);
+        return false;
+    }
+
+    idx->total_samples = idx->next_sample;
+    idx->complete = true;
+
+    ESP_LOGI(TAG, "Indexed %lu points, %lu frames apart", (unsigned long)idx->count,
+             (unsigned long)idx->group);
+    seek_index_save(idx);
+    return false;
+}
+
+void seek_index_probe(seek_index_t *idx, uint32_t offset)
+{
+    idx->probe_offset = offset;
+    idx->probe_pending = true;
+    idx->probe_found = false;
+}
+
+bool seek_index_probed(const seek_index_t *idx, uint32_t *sample)
+{
+    if (!idx->probe_found) {
+        return false;
+    }
+    *sample = idx->probe_sample;
+    return true;
+}
+
+bool seek_index_lookup(const seek_index_t *idx, uint32_t sample, seek_point_t *out)
+{
+    if (idx->count == 0) {
+        return false;
+    }
+
+    uint32_t span = idx->group * idx->frame_samples;
+    uint32_t k = sample / span;
+    if (k >= idx->count) {
+        k = idx->count - 1;
+    }
+    out->sample = k * span;
+    out->offset = idx->offsets[k];
+    return true;
+}
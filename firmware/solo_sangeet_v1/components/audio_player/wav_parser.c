@@ -0,0 +1,219 @@
+#include <string.h>
+#include "wav_parser.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "WAV";
+
+#define WAV_FMT_MIN_SIZE    16
+#define WAV_FMT_EXT_SIZE    40
+
+static inline uint16_t rd_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t rd_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool wav_parse_fmt(const uint8_t *fmt, uint32_t size, wav_info_t *info)
+{
+    info->format          = rd_le16(&fmt[0]);
+    info->channels        = rd_le16(&fmt[2]);
+    info->sample_rate     = rd_le32(&fmt[4]);
+    info->block_align     = rd_le16(&fmt[12]);
+    info->bits_per_sample = rd_le16(&fmt[14]);
+
+    // WAVE_FORMAT_EXTENSIBLE: real format is the first 2 bytes of the SubFormat GUID
+    if (info->format == WAV_FMT_EXTENSIBLE) {
+        if (size < WAV_FMT_EXT_SIZE) {
+            ESP_LOGE(TAG, "Truncated extensible fmt chunk");
+            return false;
+        }
+        info->format = rd_le16(&fmt[24]);
+    }
+
+    if (info->format != WAV_FMT_PCM && info->format != WAV_FMT_IEEE_FLOAT) {
+        ESP_LOGE(TAG, "Unsupported format tag 0x%04x", info->format);
+        return false;
+    }
+
+    if (info->channels == 0 || info->sample_rate == 0) {
+        ESP_LOGE(TAG, "Invalid channels/rate: %u/%lu",
+                 info->channels, (unsigned long)info->sample_rate);
+        return false;
+    }
+
+    switch (info->bits_per_sample) {
+    case 8:
+    case 16:
+    case 24:
+        if (info->format == WAV_FMT_IEEE_FLOAT) {
+            ESP_LOGE(TAG, "Unsupported float width: %u", info->bits_per_sample);
+            return false;
+        }
+        break;
+    case 32:
+        break;
+    default:
+        ESP_LOGE(TAG, "Unsupported bits per sample: %u", info->bits_per_sample);
+        return false;
+    }
+
+    if (info->block_align != info->channels * (info->bits_per_sample / 8)) {
+        ESP_LOGE(TAG, "Unexpected block align %u", info->block_align);
+        return false;
+    }
+
+    return true;
+}
+
+bool wav_parse_header(FILE *fp, wav_info_t *info)
+{
+    uint8_t hdr[12];
+    uint8_t fmt[WAV_FMT_EXT_SIZE];
+    bool have_fmt = false;
+    bool have_data = false;
+
+    memset(info, 0, sizeof(*info));
+
+    if (fread(hdr, 1, 12, fp) != 12 ||
+        memcmp(&hdr[0], "RIFF", 4) != 0 ||
+        memcmp(&hdr[8], "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "Not a RIFF/WAVE file");
+        return false;
+    }
+
+    // Walk the chunk list; fmt and data may appear in any order
+    while (!(have_fmt && have_data)) {
+        if (fread(hdr, 1, 8, fp) != 8) {
+            break;
+        }
+
+        uint32_t size = rd_le32(&hdr[4]);
+        long body = ftell(fp);
+
+        if (memcmp(hdr, "fmt ", 4) == 0) {
+            if (size < WAV_FMT_MIN_SIZE) {
+                ESP_LOGE(TAG, "fmt chunk too small (%lu)", (unsigned long)size);
+                return false;
+            }
+            uint32_t n = size < sizeof(fmt) ? size : sizeof(fmt);
+            if (fread(fmt, 1, n, fp) != n || !wav_parse_fmt(fmt, n, info)) {
+                return false;
+            }
+            have_fmt = true;
+        } else if (memcmp(hdr, "data", 4) == 0) {
+            info->data_offset = (uint32_t)body;
+            info->data_size = size;
+
+            // Streaming writers leave the size at 0 or 0xFFFFFFFF; trust the file length
+            if (fseek(fp, 0, SEEK_END) == 0) {
+                long end = ftell(fp);
+                if (end > body && (size == 0 || (uint32_t)(end - body) < size)) {
+                    info->data_size = (uint32_t)(end - body);
+                }
+            }
+            have_data = true;
+        } else {
+            ESP_LOGD(TAG, "Skipping chunk %.4s (%lu bytes)", (const char *)hdr, (unsigned long)size);
+        }
+
+        // Chunks are word aligned
+        if (fseek(fp, body + size + (size & 1), SEEK_SET) != 0) {
+            break;
+        }
+    }
+
+    if (!have_fmt || !have_data) {
+        ESP_LOGE(TAG, "Missing %s chunk", have_fmt ? "data" : "fmt ");
+        return false;
+    }
+
+    // Never hand out a partial trailing frame
+    info->data_size -= info->data_size % info->block_align;
+
+    ESP_LOGI(TAG, "fmt 0x%04x, %u ch, %lu Hz, %u bit, data %lu bytes @ %lu",
+             info->format, info->channels, (unsigned long)info->sample_rate,
+             info->bits_per_sample, (unsigned long)info->data_size,
+             (unsigned long)info->data_offset);
+
+    return fseek(fp, info->data_offset, SEEK_SET) == 0;
+}
+
+size_t pcm_input_bytes_for(const wav_info_t *info, size_t buf_size)
+{
+    size_t frame = info->block_align > PCM_OUT_FRAME_BYTES ?
+                   info->block_align : PCM_OUT_FRAME_BYTES;
+
+    return (buf_size / frame) * info->block_align;
+}
+
+static inline int16_t pcm_sample_s16(const wav_info_t *info, const uint8_t *p)
+{
+    switch (info->bits_per_sample) {
+    case 8:
+        return (int16_t)((p[0] - 128) * 256);
+    case 16:
+        return (int16_t)rd_le16(p);
+    case 24:
+        return (int16_t)rd_le16(&p[1]);
+    default:
+        if (info->format == WAV_FMT_IEEE_FLOAT) {
+            float f;
+            memcpy(&f, p, sizeof(f));
+            // NaN or out of range would make the cast undefined
+            if (f != f) {
+                return 0;
+            }
+            if (f >= 1.0f) {
+                return INT16_MAX;
+            }
+            if (f <= -1.0f) {
+                return INT16_MIN;
+            }
+            return (int16_t)(f * 32767.0f);
+        }
+        return (int16_t)rd_le16(&p[2]);
+    }
+}
+
+static inline void pcm_convert_frame(const wav_info_t *info, const uint8_t *in,
+                                     int16_t *out, size_t bps)
+{
+    // Read both samples before writing, the frames may overlap
+    int16_t l = pcm_sample_s16(info, in);
+    int16_t r = info->channels > 1 ? pcm_sample_s16(info, in + bps) : l;
+
+    out[0] = l;
+    out[1] = r;
+}
+
+size_t pcm_to_s16_stereo(const wav_info_t *info, uint8_t *buf, size_t in_bytes)
+{
+    const size_t ba = info->block_align;
+    const size_t bps = info->bits_per_sample / 8;
+    const size_t frames = in_bytes / ba;
+
+    // Already in the output layout
+    if (info->format == WAV_FMT_PCM && info->bits_per_sample == 16 && info->channels == 2) {
+        return frames * PCM_OUT_FRAME_BYTES;
+    }
+
+    if (ba >= PCM_OUT_FRAME_BYTES) {
+        // Output shrinks or stays: walk forward
+        for (size_t i = 0; i < frames; i++) {
+            pcm_convert_frame(info, buf + i * ba, (int16_t *)(buf + i * PCM_OUT_FRAME_BYTES), bps);
+        }
+    } else {
+        // Output grows (8-bit, 16-bit mono): walk backward
+        for (size_t i = frames; i-- > 0;) {
+            pcm_convert_frame(info, buf + i * ba, (int16_t *)(buf + i * PCM_OUT_FRAME_BYTES), bps);
+        }
+    }
+
+    return frames * PCM_OUT_FRAME_BYTES;
+}
@@ -1,7 +1,9 @@
 #include <stdio.h>
+#include "esp_timer.h"
 #include "bt_manager.h"
 #include "ui_manager.h"
 #include "audio_player.h"
+#include "audio_output.h"
 
 // Global variables shared with UI
 bt_scan_device_t s_bt_scan_list[MAX_BT_DEVICES];
@@ -12,6 +14,7 @@ int s_bt_scan_count = 0;
 /* log tags */
 #define BT_AV_TAG             "BT_AV"
 #define BT_RC_CT_TAG          "RC_CT"
+#define BT_RC_TG_TAG          "RC_TG"
 
 /* device name */
 #define LOCAL_DEVICE_NAME     "SOLO_SANGEET"
@@ -19,10 +22,15 @@ int s_bt_scan_count = 0;
 /* AVRCP used transaction label */
 #define APP_RC_CT_TL_GET_CAPS            (0)
 #define APP_RC_CT_TL_RN_VOLUME_CHANGE    (1)
+#define APP_RC_CT_TL_SET_ABS_VOLUME      (2)
 
 enum {
     BT_APP_STACK_UP_EVT   = 0x0000,    /* event for stack up */
     BT_APP_HEART_BEAT_EVT = 0xff00,    /* event for heart beat */
+    BT_APP_MEDIA_START_EVT,            /* player wants audio */
+    BT_APP_MEDIA_IDLE_EVT,             /* player paused or stopped */
+    BT_APP_MEDIA_SUSPEND_EVT,          /* idle long enough to suspend the stream */
+    BT_APP_MEDIA_RETRY_EVT,            /* try a refused stream start again */
 };
 
 /* A2DP global states */
@@ -66,9 +74,21 @@ static int32_t bt_app_a2d_data_cb(uint8_t *data, int32_t len);
 /* callback function for AVRCP controller */
 static void bt_app_rc_ct_cb(esp_avrc_ct_cb_event_t event, esp_avrc_ct_cb_param_t *param);
 
+/* callback function for AVRCP target, runs in the BT stack task */
+static void bt_app_rc_tg_cb(esp_avrc_tg_cb_event_t event, esp_avrc_tg_cb_param_t *param);
+
+/* play position notification period */
+static void bt_avrc_pos_timeout(TimerHandle_t arg);
+
 /* handler for heart beat timer */
 static void bt_app_a2d_heart_beat(TimerHandle_t arg);
 
+/* handler for media idle timer */
+static void bt_app_media_idle_timeout(TimerHandle_t arg);
+
+/* handler for media start retry timer */
+static void bt_app_media_retry_timeout(TimerHandle_t arg);
+
 /* A2DP application state machine */
 static void bt_app_av_sm_hdlr(uint16_t event, void *param);
 
@@ -81,6 +101,9 @@ static void bt_app_av_state_connecting_hdlr(uint16_t event, void *param);
 static void bt_app_av_state_connected_hdlr(uint16_t event, void *param);
 static void bt_app_av_state_disconnecting_hdlr(uint16_t event, void *param);
 
+/* A2DP media session, sub state machine of the connected state */
+static void bt_app_av_media_proc(uint16_t event, void *param);
+
 /*********************************
  * STATIC VARIABLE DEFINITIONS
  ********************************/
@@ -89,11 +112,20 @@ static esp_bd_addr_t s_peer_bda = {0};                        /* Bluetooth Devic
 static uint8_t s_peer_bdname[ESP_BT_GAP_MAX_BDNAME_LEN + 1];  /* Bluetooth Device Name of peer device*/
 static int s_a2d_state = APP_AV_STATE_IDLE;                   /* A2DP global state */
 static int s_media_state = APP_AV_MEDIA_STATE_IDLE;           /* sub states of APP_AV_STATE_CONNECTED */
-static int s_intv_cnt = 0;                                    /* count of heart beat intervals */
 static int s_connecting_intv = 0;                             /* count of heart beat intervals for connecting */
 static uint32_t s_pkt_cnt = 0;                                /* count of packets */
 static esp_avrc_rn_evt_cap_mask_t s_avrc_peer_rn_cap;         /* AVRC target notification event capability bit mask */
-static TimerHandle_t s_tmr;                                   /* handle of heart beat timer */
+static TimerHandle_t s_tmr;                                   /* handle of heart beat timer, drives reconnects */
+static TimerHandle_t s_media_tmr;                             /* one-shot, suspends an idle stream */
+static TimerHandle_t s_media_retry_tmr;                       /* one-shot, retries a refused stream start */
+static bool s_media_want = false;                             /* player is playing */
+static int64_t s_play_req_us = 0;                             /* when play was pressed, for time to stream */
+static int64_t s_stream_on_us = 0;                            /* stream start time, 0 while suspended */
+static int64_t s_stream_total_us = 0;                         /* radio time spent streaming */
+static volatile int32_t s_preroll_bytes = 0;                  /* silence still to send before the ring */
+static volatile bool s_avrc_abs_vol = false;                  /* sink renders the volume itself */
+static uint32_t s_avrc_tg_ntf = 0;                            /* bit per notification the peer registered */
+static TimerHandle_t s_avrc_pos_tmr;                          /* one-shot, play position interval */
 
 // static const char remote_device_name[] = "MI Portable Bluetooth Speaker";
 
@@ -482,8 +514,27 @@ static void bt_av_hdl_stack_evt(uint16_t event, void *p_param)
         esp_avrc_ct_init();
         esp_avrc_ct_register_callback(bt_app_rc_ct_cb);
 
+        /* target role: headset keys, absolute volume, player notifications */
+        s_avrc_pos_tmr = xTimerCreate("avrcPosTmr", pdMS_TO_TICKS(BT_AVRC_POS_MIN_S * 1000),
+                                      pdFALSE, NULL, bt_avrc_pos_timeout);
+        esp_avrc_tg_init();
+        esp_avrc_tg_register_callback(bt_app_rc_tg_cb);
+
+        esp_avrc_psth_bit_mask_t cmd_set = {0};
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_PLAY);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_PAUSE);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_STOP);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_FORWARD);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_BACKWARD);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_VOL_UP);
+        esp_avrc_psth_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &cmd_set, ESP_AVRC_PT_CMD_VOL_DOWN);
+        esp_avrc_tg_set_psth_cmd_filter(ESP_AVRC_PSTH_FILTER_SUPPORTED_CMD, &cmd_set);
+
         esp_avrc_rn_evt_cap_mask_t evt_set = {0};
         esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &evt_set, ESP_AVRC_RN_VOLUME_CHANGE);
+        esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &evt_set, ESP_AVRC_RN_PLAY_STATUS_CHANGE);
+        esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &evt_set, ESP_AVRC_RN_TRACK_CHANGE);
+        esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_SET, &evt_set, ESP_AVRC_RN_PLAY_POS_CHANGED);
         ESP_ERROR_CHECK(esp_avrc_tg_set_rn_evt_cap(&evt_set));
 
         esp_a2d_source_init();
@@ -498,13 +549,19 @@ static void bt_av_hdl_stack_evt(uint16_t event, void *p_param)
         s_a2d_state = APP_AV_STATE_DISCOVERING;
         esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10, 0);
 
-        /* create and start heart beat timer */
+        /* create and start heart beat timer, it only retries lost connections */
         do {
             int tmr_id = 0;
             s_tmr = xTimerCreate("connTmr", (10000 / portTICK_PERIOD_MS),
                                  pdTRUE, (void *) &tmr_id, bt_app_a2d_heart_beat);
             xTimerStart(s_tmr, portMAX_DELAY);
         } while (0);
+
+        /* media idle timer, armed when the player stops wanting audio */
+        s_media_tmr = xTimerCreate("mediaTmr", pdMS_TO_TICKS(BT_MEDIA_IDLE_SUSPEND_MS),
+                                   pdFALSE, NULL, bt_app_media_idle_timeout);
+        s_media_retry_tmr = xTimerCreate("mediaRetryTmr", pdMS_TO_TICKS(BT_MEDIA_RETRY_MS),
+                                         pdFALSE, NULL, bt_app_media_retry_timeout);
         break;
     }
     /* other */
@@ -520,45 +577,86 @@ static void bt_app_a2d_cb(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param)
     bt_app_work_dispatch(bt_app_av_sm_hdlr, event, param, sizeof(esp_a2d_cb_param_t), NULL);
 }
 
-/* generate some random noise to simulate source audio */
+/* PCM for the SBC encoder, only called while the stream is started */
 static int32_t bt_app_a2d_data_cb(uint8_t *data, int32_t len)
-{    
+{
     if (data == NULL || len < 0) {
         return 0;
     }
-     
-    if (!audio_player_is_playing()) {
+
+    if (s_preroll_bytes > 0) {
         memset(data, 0, len);
+        s_preroll_bytes -= len;
         return len;
     }
-    
-    size_t item_size;
-    uint8_t *item = (uint8_t *) xRingbufferReceiveUpTo(audio_rb, &item_size, 0, len);
+    return audio_output_bt_read(data, len);
+}
 
-    if (!item) {
-        memset(data, 0, len);   // silence
-        return len;
-    }
+static void bt_app_a2d_heart_beat(TimerHandle_t arg)
+{
+    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_HEART_BEAT_EVT, NULL, 0, NULL);
+}
 
-    memcpy(data, item, item_size);
-    vRingbufferReturnItem(audio_rb, item);
+static void bt_app_media_idle_timeout(TimerHandle_t arg)
+{
+    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_MEDIA_SUSPEND_EVT, NULL, 0, NULL);
+}
+
+static void bt_app_media_retry_timeout(TimerHandle_t arg)
+{
+    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_MEDIA_RETRY_EVT, NULL, 0, NULL);
+}
 
-    if (item_size < len) {
-        memset(data + item_size, 0, len - item_size);
+void bt_media_start(void)
+{
+    if (!s_bt_app_task_queue) {
+        return;     /* stack not up */
     }
-    
-    return len;
+    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_MEDIA_START_EVT, NULL, 0, NULL);
 }
 
-static void bt_app_a2d_heart_beat(TimerHandle_t arg)
+void bt_media_idle(void)
 {
-    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_HEART_BEAT_EVT, NULL, 0, NULL);
+    if (!s_bt_app_task_queue) {
+        return;
+    }
+    bt_app_work_dispatch(bt_app_av_sm_hdlr, BT_APP_MEDIA_IDLE_EVT, NULL, 0, NULL);
+}
+
+/* stream up or down: pre-roll, time to audio and radio-on accounting */
+static void bt_app_stream_state(bool started)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (started && !s_stream_on_us) {
+        s_stream_on_us = now;
+        s_preroll_bytes = BT_MEDIA_PREROLL_MS * AUDIO_SAMPLE_RATE / 1000 * 4;
+        if (s_play_req_us) {
+            ESP_LOGI(BT_AV_TAG, "a2dp streaming %lld ms after play", (now - s_play_req_us) / 1000);
+            s_play_req_us = 0;
+        }
+    } else if (!started && s_stream_on_us) {
+        s_stream_total_us += now - s_stream_on_us;
+        ESP_LOGI(BT_AV_TAG, "a2dp stream stopped after %lld ms, streaming %lld of %lld s since boot",
+                 (now - s_stream_on_us) / 1000, s_stream_total_us / 1000000, now / 1000000);
+        s_stream_on_us = 0;
+    }
 }
 
 static void bt_app_av_sm_hdlr(uint16_t event, void *param)
 {
     ESP_LOGI(BT_AV_TAG, "%s state: %d, event: 0x%x", __func__, s_a2d_state, event);
 
+    /* player state is kept whatever the link does, a later connection picks it up */
+    if (event == BT_APP_MEDIA_START_EVT) {
+        s_media_want = true;
+        if (!s_stream_on_us) {
+            s_play_req_us = esp_timer_get_time();
+        }
+    } else if (event == BT_APP_MEDIA_IDLE_EVT) {
+        s_media_want = false;
+    }
+
     /* select handler according to different states */
     switch (s_a2d_state) {
     case APP_AV_STATE_DISCOVERING:
@@ -593,6 +691,10 @@ static void bt_app_av_state_unconnected_hdlr(uint16_t event, void *param)
     case ESP_A2D_AUDIO_STATE_EVT:
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+    case BT_APP_MEDIA_START_EVT:
+    case BT_APP_MEDIA_IDLE_EVT:
+    case BT_APP_MEDIA_SUSPEND_EVT:
+    case BT_APP_MEDIA_RETRY_EVT:
         break;
     case BT_APP_HEART_BEAT_EVT: {
         uint8_t *bda = s_peer_bda;
@@ -628,6 +730,10 @@ static void bt_app_av_state_connecting_hdlr(uint16_t event, void *param)
             // ui_set_bt(true);    // Update UI, BT Connected.
             s_a2d_state =  APP_AV_STATE_CONNECTED;
             s_media_state = APP_AV_MEDIA_STATE_IDLE;
+            if (s_media_want) {
+                /* play was pressed before the link came up */
+                bt_app_av_media_proc(BT_APP_MEDIA_START_EVT, NULL);
+            }
         } else if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
             s_a2d_state =  APP_AV_STATE_UNCONNECTED;
         }
@@ -636,6 +742,10 @@ static void bt_app_av_state_connecting_hdlr(uint16_t event, void *param)
     case ESP_A2D_AUDIO_STATE_EVT:
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+    case BT_APP_MEDIA_START_EVT:
+    case BT_APP_MEDIA_IDLE_EVT:
+    case BT_APP_MEDIA_SUSPEND_EVT:
+    case BT_APP_MEDIA_RETRY_EVT:
         break;
     case BT_APP_HEART_BEAT_EVT:
         /**
@@ -658,22 +768,36 @@ static void bt_app_av_state_connecting_hdlr(uint16_t event, void *param)
     }
 }
 
+/* ask whether the stream can start; tried again later if it cannot */
+static void bt_app_media_check(void)
+{
+    ESP_LOGI(BT_AV_TAG, "a2dp media ready checking ...");
+    if (esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY) != ESP_OK) {
+        xTimerReset(s_media_retry_tmr, 0);
+    }
+}
+
 static void bt_app_av_media_proc(uint16_t event, void *param)
 {
     esp_a2d_cb_param_t *a2d = NULL;
 
     switch (s_media_state) {
     case APP_AV_MEDIA_STATE_IDLE: {
-        if (event == BT_APP_HEART_BEAT_EVT) {
-            ESP_LOGI(BT_AV_TAG, "a2dp media ready checking ...");
-            esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+        if (event == BT_APP_MEDIA_START_EVT ||
+                ((event == BT_APP_MEDIA_RETRY_EVT || event == BT_APP_HEART_BEAT_EVT) && s_media_want)) {
+            bt_app_media_check();
         } else if (event == ESP_A2D_MEDIA_CTRL_ACK_EVT) {
             a2d = (esp_a2d_cb_param_t *)(param);
-            if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY &&
-                    a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
+            if (a2d->media_ctrl_stat.cmd != ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY || !s_media_want) {
+                break;
+            }
+            if (a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
                 ESP_LOGI(BT_AV_TAG, "a2dp media ready, starting ...");
                 esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_START);
                 s_media_state = APP_AV_MEDIA_STATE_STARTING;
+            } else {
+                ESP_LOGW(BT_AV_TAG, "a2dp media not ready, retrying in %d ms", BT_MEDIA_RETRY_MS);
+                xTimerReset(s_media_retry_tmr, 0);
             }
         }
         break;
@@ -684,25 +808,32 @@ static void bt_app_av_media_proc(uint16_t event, void *param)
             if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_START &&
                     a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
                 ESP_LOGI(BT_AV_TAG, "a2dp media start successfully.");
-                s_intv_cnt = 0;
                 s_media_state = APP_AV_MEDIA_STATE_STARTED;
+                /* paused again while the start was in flight */
+                if (!s_media_want) {
+                    xTimerReset(s_media_tmr, 0);
+                }
             } else {
                 /* not started successfully, transfer to idle state */
                 ESP_LOGI(BT_AV_TAG, "a2dp media start failed.");
                 s_media_state = APP_AV_MEDIA_STATE_IDLE;
+                if (s_media_want) {
+                    xTimerReset(s_media_retry_tmr, 0);
+                }
             }
         }
         break;
     }
     case APP_AV_MEDIA_STATE_STARTED: {
-        if (event == BT_APP_HEART_BEAT_EVT) {
-            /* stop media after 10 heart beat intervals */
-            if (++s_intv_cnt >= 10) {
-                ESP_LOGI(BT_AV_TAG, "a2dp media suspending...");
-                esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
-                s_media_state = APP_AV_MEDIA_STATE_STOPPING;
-                s_intv_cnt = 0;
-            }
+        if (event == BT_APP_MEDIA_START_EVT) {
+            xTimerStop(s_media_tmr, 0);
+        } else if (event == BT_APP_MEDIA_IDLE_EVT) {
+            /* keep streaming silence for a while, a quick resume needs no restart */
+            xTimerReset(s_media_tmr, 0);
+        } else if (event == BT_APP_MEDIA_SUSPEND_EVT && !s_media_want) {
+            ESP_LOGI(BT_AV_TAG, "a2dp media idle, suspending...");
+            esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
+            s_media_state = APP_AV_MEDIA_STATE_STOPPING;
         }
         break;
     }
@@ -711,13 +842,18 @@ static void bt_app_av_media_proc(uint16_t event, void *param)
             a2d = (esp_a2d_cb_param_t *)(param);
             if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_SUSPEND &&
                     a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
-                ESP_LOGI(BT_AV_TAG, "a2dp media suspend successfully, disconnecting...");
+                ESP_LOGI(BT_AV_TAG, "a2dp media suspend successfully.");
                 s_media_state = APP_AV_MEDIA_STATE_IDLE;
-                esp_a2d_source_disconnect(s_peer_bda);
-                s_a2d_state = APP_AV_STATE_DISCONNECTING;
+                /* play pressed while suspending: start over */
+                if (s_media_want) {
+                    bt_app_av_media_proc(BT_APP_MEDIA_START_EVT, NULL);
+                }
             } else {
-                ESP_LOGI(BT_AV_TAG, "a2dp media suspending...");
-                esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
+                ESP_LOGI(BT_AV_TAG, "a2dp media suspend failed.");
+                s_media_state = APP_AV_MEDIA_STATE_STARTED;
+                if (!s_media_want) {
+                    xTimerReset(s_media_tmr, 0);
+                }
             }
         }
         break;
@@ -739,6 +875,9 @@ static void bt_app_av_state_connected_hdlr(uint16_t event, void *param)
         if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
             ESP_LOGI(BT_AV_TAG, "a2dp disconnected");
             s_a2d_state = APP_AV_STATE_UNCONNECTED;
+            xTimerStop(s_media_tmr, 0);
+            xTimerStop(s_media_retry_tmr, 0);
+            bt_app_stream_state(false);
         }
         break;
     }
@@ -748,16 +887,33 @@ static void bt_app_av_state_connected_hdlr(uint16_t event, void *param)
             s_pkt_cnt = 0;
             ESP_LOGI("BT", "A2DP streaming started");
         }
-        // else if (a2d->audio_stat.state == ESP_A2D_AUDIO_STATE_STOPPED) {
-        //     ESP_LOGI("BT", "A2DP streaming stopped");
-        // }
+        /* also covers a suspend from the sink side */
+        bool started = a2d->audio_stat.state == ESP_A2D_AUDIO_STATE_STARTED;
+        bt_app_stream_state(started);
+        /* the sink moved the stream itself: follow it, so the next play starts it again */
+        if (!started && s_media_state == APP_AV_MEDIA_STATE_STARTED) {
+            ESP_LOGI(BT_AV_TAG, "a2dp media suspended by the sink");
+            xTimerStop(s_media_tmr, 0);
+            s_media_state = APP_AV_MEDIA_STATE_IDLE;
+        } else if (started && s_media_state == APP_AV_MEDIA_STATE_IDLE) {
+            ESP_LOGI(BT_AV_TAG, "a2dp media started by the sink");
+            s_media_state = APP_AV_MEDIA_STATE_STARTED;
+            if (!s_media_want) {
+                xTimerReset(s_media_tmr, 0);
+            }
+        }
         break;
     }
     case ESP_A2D_AUDIO_CFG_EVT:
         // not supposed to occur for A2DP source
         break;
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+    case BT_APP_MEDIA_START_EVT:
+    case BT_APP_MEDIA_IDLE_EVT:
+    case BT_APP_MEDIA_SUSPEND_EVT:
+    case BT_APP_MEDIA_RETRY_EVT:
     case BT_APP_HEART_BEAT_EVT: {
+        /* the heart beat backs up the retry timer while a start is wanted */
         bt_app_av_media_proc(event, param);
         break;
     }
@@ -792,6 +948,10 @@ static void bt_app_av_state_disconnecting_hdlr(uint16_t event, void *param)
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
     case BT_APP_HEART_BEAT_EVT:
+    case BT_APP_MEDIA_START_EVT:
+    case BT_APP_MEDIA_IDLE_EVT:
+    case BT_APP_MEDIA_SUSPEND_EVT:
+    case BT_APP_MEDIA_RETRY_EVT:
         break;
     case ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT: {
         a2d = (esp_a2d_cb_param_t *)(param);
@@ -839,9 +999,9 @@ void bt_av_notify_evt_handler(uint8_t event_id, esp_avrc_rn_param_t *event_param
     switch (event_id) {
     /* when volume changed locally on target, this event comes */
     case ESP_AVRC_RN_VOLUME_CHANGE: {
+        /* the sink's own buttons moved it: the player follows, then keep listening */
         ESP_LOGI(BT_RC_CT_TAG, "Volume changed: %d", event_parameter->volume);
-        ESP_LOGI(BT_RC_CT_TAG, "Set absolute volume: volume %d", event_parameter->volume + 5);
-        esp_avrc_ct_send_set_absolute_volume_cmd(APP_RC_CT_TL_RN_VOLUME_CHANGE, event_parameter->volume + 5);
+        audio_player_remote_volume(event_parameter->volume * 100 / 0x7f);
         bt_av_volume_changed();
         break;
     }
@@ -868,6 +1028,11 @@ static void bt_av_hdl_avrc_ct_evt(uint16_t event, void *p_param)
             esp_avrc_ct_send_get_rn_capabilities_cmd(APP_RC_CT_TL_GET_CAPS);
         } else {
             s_avrc_peer_rn_cap.bits = 0;
+            if (s_avrc_abs_vol) {
+                /* the player takes the volume back */
+                s_avrc_abs_vol = false;
+                audio_player_remote_volume(audio_player_get_volume());
+            }
         }
         break;
     }
@@ -900,12 +1065,20 @@ static void bt_av_hdl_avrc_ct_evt(uint16_t event, void *p_param)
                  rc->get_rn_caps_rsp.evt_set.bits);
         s_avrc_peer_rn_cap.bits = rc->get_rn_caps_rsp.evt_set.bits;
 
+        /* a sink that reports volume changes takes absolute volume: start it at ours */
+        s_avrc_abs_vol = esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_TEST, &s_avrc_peer_rn_cap,
+                                                            ESP_AVRC_RN_VOLUME_CHANGE);
+        if (s_avrc_abs_vol) {
+            bt_avrc_set_volume(audio_player_get_volume());
+        }
         bt_av_volume_changed();
         break;
     }
     /* when set absolute volume responded, this event comes */
     case ESP_AVRC_CT_SET_ABSOLUTE_VOLUME_RSP_EVT: {
         ESP_LOGI(BT_RC_CT_TAG, "Set absolute volume response: volume %d", rc->set_volume_rsp.volume);
+        /* the level the sink actually took, it may round or clamp */
+        audio_player_remote_volume(rc->set_volume_rsp.volume * 100 / 0x7f);
         break;
     }
     /* other */
@@ -916,6 +1089,165 @@ static void bt_av_hdl_avrc_ct_evt(uint16_t event, void *p_param)
     }
 }
 
+/* current value of a notification the peer registered for */
+static void bt_avrc_tg_send(uint8_t event_id, esp_avrc_rn_rsp_t rsp)
+{
+    esp_avrc_rn_param_t p;
+    audio_state_t state = audio_player_get_state();
+
+    memset(&p, 0, sizeof(p));
+    switch (event_id) {
+    case ESP_AVRC_RN_VOLUME_CHANGE:
+        p.volume = audio_player_get_volume() * 0x7f / 100;
+        break;
+    case ESP_AVRC_RN_PLAY_STATUS_CHANGE:
+        p.playback = state == AUDIO_STATE_PLAYING ? ESP_AVRC_PLAYBACK_PLAYING :
+                     state == AUDIO_STATE_PAUSED ? ESP_AVRC_PLAYBACK_PAUSED : ESP_AVRC_PLAYBACK_STOPPED;
+        break;
+    case ESP_AVRC_RN_TRACK_CHANGE:
+        /* no browsing, so 0 means "a track is selected", all ones means none */
+        memset(p.elm_id, state == AUDIO_STATE_PLAYING || state == AUDIO_STATE_PAUSED ? 0x00 : 0xff,
+               sizeof(p.elm_id));
+        break;
+    case ESP_AVRC_RN_PLAY_POS_CHANGED:
+        p.play_pos = state == AUDIO_STATE_PLAYING || state == AUDIO_STATE_PAUSED ?
+                     audio_player_get_position_ms() : 0xffffffff;
+        break;
+    default:
+        return;
+    }
+    esp_avrc_tg_send_rn_rsp(event_id, rsp, &p);
+}
+
+/* CHANGED completes a registration; the peer registers again if it still cares */
+static void bt_avrc_tg_changed(uint8_t event_id)
+{
+    uint32_t bit = 1u << event_id;
+
+    if (__atomic_fetch_and(&s_avrc_tg_ntf, ~bit, __ATOMIC_ACQ_REL) & bit) {
+        bt_avrc_tg_send(event_id, ESP_AVRC_RN_RSP_CHANGED);
+    }
+}
+
+static void bt_avrc_pos_timeout(TimerHandle_t arg)
+{
+    bt_avrc_tg_changed(ESP_AVRC_RN_PLAY_POS_CHANGED);
+}
+
+void bt_avrc_notify_play_status(void)
+{
+    bt_avrc_tg_changed(ESP_AVRC_RN_PLAY_STATUS_CHANGE);
+    bt_avrc_tg_changed(ESP_AVRC_RN_PLAY_POS_CHANGED);
+}
+
+void bt_avrc_notify_track(void)
+{
+    bt_avrc_tg_changed(ESP_AVRC_RN_TRACK_CHANGE);
+    bt_avrc_tg_changed(ESP_AVRC_RN_PLAY_POS_CHANGED);
+}
+
+void bt_avrc_notify_volume(void)
+{
+    bt_avrc_tg_changed(ESP_AVRC_RN_VOLUME_CHANGE);
+}
+
+bool bt_avrc_abs_volume(void)
+{
+    return s_avrc_abs_vol;
+}
+
+bool bt_avrc_set_volume(uint8_t percent)
+{
+    if (!s_avrc_abs_vol) {
+        return false;
+    }
+    return esp_avrc_ct_send_set_absolute_volume_cmd(APP_RC_CT_TL_SET_ABS_VOLUME,
+                                                    percent * 0x7f / 100) == ESP_OK;
+}
+
+/* headset key press into a player command */
+static void bt_avrc_tg_key(uint8_t key_code)
+{
+    audio_cmd_t cmd;
+
+    switch (key_code) {
+    case ESP_AVRC_PT_CMD_PLAY:
+        cmd = AUDIO_CMD_PLAY;
+        break;
+    case ESP_AVRC_PT_CMD_PAUSE:
+    case ESP_AVRC_PT_CMD_STOP:
+        /* stop keeps the position, like pause, so play picks up where it was */
+        cmd = AUDIO_CMD_PAUSE;
+        break;
+    case ESP_AVRC_PT_CMD_FORWARD:
+        cmd = AUDIO_CMD_NEXT;
+        break;
+    case ESP_AVRC_PT_CMD_BACKWARD:
+        cmd = AUDIO_CMD_PREV;
+        break;
+    case ESP_AVRC_PT_CMD_VOL_UP:
+        /* the control task steps from the level it has, presses are not lost */
+        cmd = AUDIO_CMD_VOLUME_UP;
+        break;
+    case ESP_AVRC_PT_CMD_VOL_DOWN:
+        cmd = AUDIO_CMD_VOLUME_DOWN;
+        break;
+    default:
+        ESP_LOGW(BT_RC_TG_TAG, "Unhandled key 0x%x", key_code);
+        return;
+    }
+    audio_player_remote_cmd(cmd);
+}
+
+/*
+ * Handled in place rather than through bt_app_work_dispatch: every event
+ * here is a few stores and a queue send, so there is nothing to copy and
+ * no malloc between the key press and the player.
+ */
+static void bt_app_rc_tg_cb(esp_avrc_tg_cb_event_t event, esp_avrc_tg_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_AVRC_TG_CONNECTION_STATE_EVT: {
+        ESP_LOGI(BT_RC_TG_TAG, "AVRC TG conn_state: %d", param->conn_stat.connected);
+        if (!param->conn_stat.connected) {
+            __atomic_store_n(&s_avrc_tg_ntf, 0, __ATOMIC_RELEASE);
+            xTimerStop(s_avrc_pos_tmr, 0);
+        }
+        break;
+    }
+    case ESP_AVRC_TG_PASSTHROUGH_CMD_EVT: {
+        if (param->psth_cmd.key_state == ESP_AVRC_PT_CMD_STATE_PRESSED) {
+            bt_avrc_tg_key(param->psth_cmd.key_code);
+        }
+        break;
+    }
+    case ESP_AVRC_TG_SET_ABSOLUTE_VOLUME_CMD_EVT: {
+        audio_player_remote_volume(param->set_abs_vol.volume * 100 / 0x7f);
+        break;
+    }
+    case ESP_AVRC_TG_REGISTER_NOTIFICATION_EVT: {
+        uint8_t event_id = param->reg_ntf.event_id;
+
+        __atomic_fetch_or(&s_avrc_tg_ntf, 1u << event_id, __ATOMIC_ACQ_REL);
+        bt_avrc_tg_send(event_id, ESP_AVRC_RN_RSP_INTERIM);
+
+        if (event_id == ESP_AVRC_RN_PLAY_POS_CHANGED) {
+            uint32_t sec = param->reg_ntf.event_parameter;
+            xTimerChangePeriod(s_avrc_pos_tmr,
+                               pdMS_TO_TICKS((sec < BT_AVRC_POS_MIN_S ? BT_AVRC_POS_MIN_S : sec) * 1000), 0);
+        }
+        break;
+    }
+    case ESP_AVRC_TG_REMOTE_FEATURES_EVT: {
+        ESP_LOGI(BT_RC_TG_TAG, "AVRC remote features %"PRIx32", CT features %x",
+                 param->rmt_feats.feat_mask, param->rmt_feats.ct_feat_flag);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 /*********************************
  * MAIN ENTRY POINT
  ********************************/
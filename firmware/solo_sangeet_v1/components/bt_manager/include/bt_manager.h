@@ -36,6 +36,15 @@ typedef enum {
 #define MAX_BT_DEVICES 10
 #define BT_NAME_LEN    32
 
+// A2DP media session, driven by the player
+#define BT_MEDIA_IDLE_SUSPEND_MS    5000    // paused/stopped this long: suspend the stream
+#define BT_MEDIA_PREROLL_MS         60      // silence sent first so the sink is awake for the music
+#define BT_MEDIA_RETRY_MS           1000    // a refused stream start is tried again after this
+
+// AVRCP target: headset buttons and volume
+#define BT_AVRC_VOL_STEP            5       // percent per VOL_UP/VOL_DOWN press
+#define BT_AVRC_POS_MIN_S           1       // fastest play position update we answer
+
 typedef struct {
     esp_bd_addr_t bda;
     char name[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
@@ -106,4 +115,30 @@ void bt_audio_task(void);
 
 void bt_user_select_device(int index);
 
+/*
+ * Player state for the A2DP media session. Play starts the stream (or
+ * keeps it) right away; idle suspends it once the player has been paused
+ * or stopped for BT_MEDIA_IDLE_SUSPEND_MS. The link stays up either way.
+ */
+void bt_media_start(void);
+void bt_media_idle(void);
+
+/*
+ * AVRCP target. Passthrough keys from the headset become audio_cmd_q
+ * messages and absolute volume drives the player volume; both are handled
+ * in the BT callback with no allocation. The player reports back through
+ * these, which answer whatever notifications the peer registered.
+ */
+void bt_avrc_notify_play_status(void);
+void bt_avrc_notify_track(void);
+void bt_avrc_notify_volume(void);
+
+/*
+ * AVRCP controller absolute volume. When the sink reports volume changes it
+ * renders the level itself: local changes go to it with set_volume(), its
+ * own changes come back through audio_player_remote_volume().
+ */
+bool bt_avrc_abs_volume(void);
+bool bt_avrc_set_volume(uint8_t percent);
+
 #endif /* __BT_MANAGER_H__ */
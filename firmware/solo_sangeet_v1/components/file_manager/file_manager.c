@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include "file_manager.h"
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
 // #include "sd_test_io.h"
@@ -19,7 +22,8 @@
 
 static const char *TAG = "example";
 
-#define MOUNT_POINT "/sdcard"
+#define MOUNT_POINT SD_MOUNT_POINT
+#define WALK_PATH_MAX 256
 
 const char* names[] = {"CLK ", "MOSI", "MISO", "CS  "};
 const int pins[] = {SD_PIN_NUM_CLK,
@@ -70,67 +74,183 @@ static esp_err_t s_example_read_file(const char *path)
     return ESP_OK;
 }
 
-static void list_files(const char *path, int level)
+typedef struct {
+    char path[WALK_PATH_MAX];           // as the VFS sees it
+    char ff_path[WALK_PATH_MAX];        // the same directory for FATFS
+    FILINFO fno;                        // shared by every level, only used between reads
+    sd_dir_cb_t dir_cb;
+    sd_walk_cb_t cb;
+    void *arg;
+} walk_t;
+
+static uint32_t walk_entry_hash(const FILINFO *fno)
+{
+    uint32_t h = 2166136261u;
+
+    for (const char *p = fno->fname; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    h = (h ^ (uint32_t)fno->fsize) * 16777619u;
+    return (h ^ ((uint32_t)fno->fdate << 16 | fno->ftime)) * 16777619u;
+}
+
+// Same conversion as the VFS stat(), so st_mtime matches either way
+static time_t walk_mtime(uint16_t fdate, uint16_t ftime)
+{
+    struct tm tm = {
+        .tm_mday = fdate & 0x1f,
+        .tm_mon = ((fdate >> 5) & 0xf) - 1,
+        .tm_year = (fdate >> 9) + 80,
+        .tm_sec = (ftime & 0x1f) * 2,
+        .tm_min = (ftime >> 5) & 0x3f,
+        .tm_hour = ftime >> 11,
+    };
+    return mktime(&tm);
+}
+
+static bool walk_dir(walk_t *w, size_t len, size_t ff_len, int depth, uint32_t dir_time)
 {
-    FRESULT res;
     FF_DIR dir;
-    FILINFO fno;
+    bool files = true;
+    bool more = true;
 
-    res = f_opendir(&dir, path);
-    if (res != FR_OK) {
-        ESP_LOGE(TAG, "f_opendir failed (%d): %s", res, path);
-        return;
+    if (f_opendir(&dir, w->ff_path) != FR_OK) {
+        return true;
     }
 
-    while (true) {
-        res = f_readdir(&dir, &fno);
-        if (res != FR_OK || fno.fname[0] == 0) {
-            break;  // End of directory
+    if (w->dir_cb) {
+        sd_dir_stamp_t stamp = { .time = dir_time };
+
+        while (f_readdir(&dir, &w->fno) == FR_OK && w->fno.fname[0]) {
+            if (w->fno.fname[0] != '.') {
+                stamp.sum += walk_entry_hash(&w->fno);
+                stamp.entries++;
+            }
         }
+        f_readdir(&dir, NULL);          // rewind
+        files = w->dir_cb(w->path, &stamp, w->arg);
+    }
 
-        // Skip . and ..
-        if (strcmp(fno.fname, ".") == 0 ||
-            strcmp(fno.fname, "..") == 0) {
+    while (more && f_readdir(&dir, &w->fno) == FR_OK && w->fno.fname[0]) {
+        bool is_dir = w->fno.fattrib & AM_DIR;
+
+        if (w->fno.fname[0] == '.' || (!is_dir && !files)) {
+            continue;
+        }
+        // One pair of path buffers for the whole walk, each level appends its name
+        int n = snprintf(w->path + len, WALK_PATH_MAX - len, "/%s", w->fno.fname);
+        int m = snprintf(w->ff_path + ff_len, WALK_PATH_MAX - ff_len, "/%s", w->fno.fname);
+        if (n < 0 || m < 0 || len + n >= WALK_PATH_MAX || ff_len + m >= WALK_PATH_MAX) {
             continue;
         }
 
-        for (int i = 0; i < level; i++) {
-            printf("  ");
+        if (is_dir) {
+            if (depth < SD_WALK_MAX_DEPTH) {
+                uint32_t time = (uint32_t)w->fno.fdate << 16 | w->fno.ftime;
+                more = walk_dir(w, len + n, ff_len + m, depth + 1, time);
+            }
+        } else {
+            struct stat st = {
+                .st_mode = S_IFREG,
+                .st_size = w->fno.fsize,
+                .st_mtime = walk_mtime(w->fno.fdate, w->fno.ftime),
+            };
+            more = w->cb(w->path, &st, w->arg);
         }
+    }
+    w->path[len] = '\0';
+    w->ff_path[ff_len] = '\0';
+
+    f_closedir(&dir);
+    return more;
+}
+
+bool sd_fs_walk_dirs(const char *dir, sd_dir_cb_t dir_cb, sd_walk_cb_t cb, void *arg)
+{
+    size_t mount_len = strlen(MOUNT_POINT);
+    size_t len = strlen(dir);
+
+    if (strncmp(dir, MOUNT_POINT, mount_len) != 0 || (dir[mount_len] && dir[mount_len] != '/')) {
+        ESP_LOGE(TAG, "Not on the card: %s", dir);
+        return true;
+    }
 
-        // if (fno.fattrib & AM_DIR) {
-        //     printf("[DIR ] %s\n", fno.fname);
+    walk_t *w = malloc(sizeof(walk_t));
+    if (!w) {
+        ESP_LOGE(TAG, "No memory to walk %s", dir);
+        return true;
+    }
+    w->dir_cb = dir_cb;
+    w->cb = cb;
+    w->arg = arg;
+
+    // "/sdcard/x" is "0:/x" to FATFS, "/sdcard" is "0:"
+    int ff_len = snprintf(w->ff_path, sizeof(w->ff_path), SD_FATFS_DRIVE "%s", dir + mount_len);
+    bool more = true;
+    if (len < sizeof(w->path) && ff_len < (int)sizeof(w->ff_path)) {
+        memcpy(w->path, dir, len + 1);
+        more = walk_dir(w, len, ff_len, 0, 0);
+    }
 
-        //     char full_path[256];
-        //     snprintf(full_path, sizeof(full_path),
-        //              "%s/%s", path, fno.fname);
+    free(w);
+    return more;
+}
+
+bool sd_fs_walk(const char *dir, sd_walk_cb_t cb, void *arg)
+{
+    return sd_fs_walk_dirs(dir, NULL, cb, arg);
+}
 
-        //     list_files(full_path, level + 1);
-        // } else {
-        //     printf("[FILE] %s (%lu bytes)\n",
-        //            fno.fname, fno.fsize);
-        // }
+static bool text_is_utf8(const uint8_t *s)
+{
+    while (*s) {
+        int more = *s < 0x80 ? 0 : *s < 0xC2 ? -1 : *s < 0xE0 ? 1 : *s < 0xF5 ? 2 + (*s >= 0xF0) : -1;
 
-        if (strstr(fno.fname, ".wav") || strstr(fno.fname, ".WAV")) {
-            // audio file
-            ESP_LOGI(TAG, "Found wav audio file: %s", fno.fname);
+        if (more < 0) {
+            return false;
         }
-        
-        /*
-        if (strstr(fno.fname, ".mp3") || strstr(fno.fname, ".MP3")) {
-            // audio file
-            ESP_LOGI(TAG, "Found mp3 audio file: %s", fno.fname);
+        for (s++; more; more--, s++) {
+            if ((*s & 0xC0) != 0x80) {
+                return false;
+            }
         }
+    }
+    return true;
+}
 
-        if (strstr(fno.fname, ".txt") || strstr(fno.fname, ".TXT")) {
-            // text file
-            ESP_LOGI(TAG, "Found text file: %s", fno.fname);
+bool sd_path_from_text(const char *src, char *dst, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    bool utf8 = text_is_utf8(s);
+    size_t n = 0;
+
+    while (*s) {
+        uint32_t uni = *s++;
+
+        if (uni >= 0x80 && utf8) {
+            int more = uni >= 0xF0 ? 3 : uni >= 0xE0 ? 2 : 1;
+            uni &= 0x3F >> more;
+            while (more--) {
+                uni = uni << 6 | (*s++ & 0x3F);
+            }
         }
-        */
-        
+        if (uni >= 0x80) {
+            uni = ff_uni2oem(uni, FF_CODE_PAGE);
+            if (!uni) {
+                return false;
+            }
+        }
+        // Double-byte code pages give two bytes
+        if (n + 1 + (uni > 0xFF) >= len) {
+            return false;
+        }
+        if (uni > 0xFF) {
+            dst[n++] = uni >> 8;
+        }
+        dst[n++] = uni;
     }
-
-    f_closedir(&dir);
+    dst[n] = '\0';
+    return true;
 }
 
 void sd_fs_init(void)
@@ -146,7 +266,7 @@ void sd_fs_init(void)
 // #else
 // #endif // EXAMPLE_FORMAT_IF_MOUNT_FAILED
         .format_if_mount_failed = false,
-        .max_files = 5,
+        .max_files = 8,     // track, next track, seek index, library files, scanner
         .allocation_unit_size = 16 * 1024
     };
     sdmmc_card_t *card;
@@ -209,9 +329,7 @@ void sd_fs_init(void)
 
     // Use POSIX and C standard library functions to work with files.
 
-    ESP_LOGI(TAG, "Listing files:");
-    // list_files(mount_point, 0);
-    list_files("0:/", 0);
+    // Tracks are listed by the media library index, not walked at every boot
 
     /*
     // First create a file.
@@ -2,6 +2,15 @@
 #define FILE_MANAGER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifndef SD_MOUNT_POINT
+#define SD_MOUNT_POINT      "/sdcard"
+#endif
+#define SD_FATFS_DRIVE      "0:"        // FATFS name of the card, the only volume mounted
+#define SD_WALK_MAX_DEPTH   4           // directory levels below the start
 
 typedef struct {
     const char** names;
@@ -11,4 +20,43 @@ typedef struct {
 // void check_sd_card_pins(pin_configuration_t *config, const int pin_count);
 void sd_fs_init(void);
 
+// Called for each regular file; return false to stop the walk
+typedef bool (*sd_walk_cb_t)(const char *path, const struct stat *st, void *arg);
+
+/*
+ * Fingerprint of a directory's contents. FAT does not touch a directory's
+ * own timestamp when files inside it change, so its entries are folded in.
+ */
+typedef struct {
+    uint32_t time;                      // FAT date << 16 | time of the directory, 0 for the root
+    uint32_t sum;                       // over entry names, sizes and timestamps
+    uint16_t entries;
+} sd_dir_stamp_t;
+
+// Called for each directory before its files; return false to skip the files
+typedef bool (*sd_dir_cb_t)(const char *dir, const sd_dir_stamp_t *stamp, void *arg);
+
+/*
+ * Depth-first visit of every regular file under dir, which must be on the
+ * card. Hidden entries (leading '.') are skipped. Size and mtime come from
+ * the directory entry, no file is stat()ed. Returns false if cb stopped
+ * the walk.
+ */
+bool sd_fs_walk(const char *dir, sd_walk_cb_t cb, void *arg);
+
+/*
+ * As sd_fs_walk(), asking dir_cb first for each directory. Subdirectories
+ * are walked either way, so an unchanged directory costs one read of its
+ * entries.
+ */
+bool sd_fs_walk_dirs(const char *dir, sd_dir_cb_t dir_cb, sd_walk_cb_t cb, void *arg);
+
+/*
+ * Card path for a name written as text (playlists). FATFS here takes names
+ * in its OEM code page, not UTF-8. Text that is not valid UTF-8 is read as
+ * Latin-1. False if a character has no equivalent on the card or dst is
+ * too short.
+ */
+bool sd_path_from_text(const char *src, char *dst, size_t len);
+
 #endif //FILE_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef MEDIA_TAGS_H
+#define MEDIA_TAGS_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MEDIA_TAGS_TEXT_MAX     64      // UTF-8 bytes kept per field, cut on a character
+#define MEDIA_TAGS_FIELD_MAX    256     // bytes of one frame or comment read, the rest is skipped
+#define MEDIA_TAGS_SYNC_SEARCH  4096    // bytes searched for the first MP3 frame
+
+/*
+ * Title, artist, album and duration of a track, read from
+ *  - ID3v2.2/2.3/2.4 (MP3, or in front of FLAC, or an "id3 " chunk in WAV),
+ *    ID3v1 at the end of an MP3 as a fallback,
+ *  - Vorbis comments (FLAC),
+ *  - RIFF LIST/INFO (WAV).
+ * Only the header of each frame, block or chunk is read; the ones not
+ * wanted (lyrics, ...) are stepped over with fseek(), so a 1 MB APIC
+ * costs the same as none. Embedded pictures (APIC/PIC, FLAC PICTURE) are
+ * located, not read: the front cover if there is one, else the first.
+ * Memory use is one FIELD_MAX buffer on the stack.
+ *
+ * Every field goes through the same conversion: UTF-16 is transcoded,
+ * anything else is taken as UTF-8 if it is valid UTF-8 and as Latin-1 if
+ * not, so mislabelled tags still come out readable.
+ */
+typedef struct {
+    char title[MEDIA_TAGS_TEXT_MAX];    // empty if not tagged
+    char artist[MEDIA_TAGS_TEXT_MAX];   // falls back to the album artist
+    char album[MEDIA_TAGS_TEXT_MAX];
+    uint32_t duration_ms;               // 0 if unknown
+    uint32_t art_offset;                // embedded picture in the file, art_size 0 if none
+    uint32_t art_size;
+    uint32_t art_id;                    // the same for the same picture in other files
+} media_tags_t;
+
+// False if the file cannot be opened; fields the file does not carry are left empty
+bool media_tags_read(const char *path, media_tags_t *out);
+
+#endif // MEDIA_TAGS_H
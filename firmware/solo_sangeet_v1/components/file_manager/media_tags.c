@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "media_tags.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "TAGS";
+
+#define ID3_HEADER_LEN      10
+#define ID3_MAX_CHAIN       4       // tags stacked in front of the audio
+#define ID3V1_LEN           128
+#define FLAC_MAX_BLOCKS     64
+#define FLAC_STREAMINFO     0
+#define FLAC_VORBIS_COMMENT 4
+#define FLAC_PICTURE        6
+#define PIC_FRONT_COVER     3       // APIC / FLAC picture type
+#define ART_ID_TAIL         64      // picture bytes hashed into art_id, from its end
+
+// Text encodings as numbered by ID3v2
+enum {
+    TAG_ENC_LATIN1 = 0,     // or UTF-8 from a tagger that did not say so
+    TAG_ENC_UTF16,          // with BOM
+    TAG_ENC_UTF16BE,
+    TAG_ENC_UTF8,
+};
+
+typedef struct {
+    FILE *fp;
+    uint32_t size;
+    media_tags_t *out;
+    char band[MEDIA_TAGS_TEXT_MAX];     // album artist, for files without an artist
+    uint8_t art_type;                   // picture type of out->art_offset
+    uint8_t buf[MEDIA_TAGS_FIELD_MAX];
+} tag_ctx_t;
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+// ID3 sizes carry 7 bits a byte, UINT32_MAX if one is not
+static uint32_t syncsafe(const uint8_t *p)
+{
+    if ((p[0] | p[1] | p[2] | p[3]) & 0x80) {
+        return UINT32_MAX;
+    }
+    return (uint32_t)p[0] << 21 | p[1] << 14 | p[2] << 7 | p[3];
+}
+
+static bool tag_read(tag_ctx_t *c, uint32_t off, void *dst, size_t len)
+{
+    return (uint64_t)off + len <= c->size && fseek(c->fp, off, SEEK_SET) == 0 &&
+           fread(dst, 1, len, c->fp) == len;
+}
+
+/* ---- text ---- */
+
+// Append cp as UTF-8, false once the field is full
+static bool text_put(char *dst, size_t *n, uint32_t cp)
+{
+    char u[4];
+    size_t len;
+
+    if (cp < 0x20 || cp == 0x7F) {
+        cp = ' ';               // tabs, line breaks and stray controls
+    }
+    if (cp < 0x80) {
+        u[0] = cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        u[0] = 0xC0 | cp >> 6;
+        u[1] = 0x80 | (cp & 0x3F);
+        len = 2;
+    } else if (cp < 0x10000) {
+        u[0] = 0xE0 | cp >> 12;
+        u[1] = 0x80 | (cp >> 6 & 0x3F);
+        u[2] = 0x80 | (cp & 0x3F);
+        len = 3;
+    } else {
+        u[0] = 0xF0 | cp >> 18;
+        u[1] = 0x80 | (cp >> 12 & 0x3F);
+        u[2] = 0x80 | (cp >> 6 & 0x3F);
+        u[3] = 0x80 | (cp & 0x3F);
+        len = 4;
+    }
+
+    if (*n + len >= MEDIA_TAGS_TEXT_MAX) {
+        return false;
+    }
+    memcpy(dst + *n, u, len);
+    *n += len;
+    return true;
+}
+
+// Length of the UTF-8 sequence at s, 0 if it is not a valid one
+static size_t utf8_seq(const uint8_t *s, size_t len, uint32_t *cp)
+{
+    static const uint32_t min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    size_t n = s[0] < 0x80 ? 1 : (s[0] & 0xE0) == 0xC0 ? 2 : (s[0] & 0xF0) == 0xE0 ? 3 :
+               (s[0] & 0xF8) == 0xF0 ? 4 : 0;
+
+    if (n == 0 || n > len) {
+        return 0;
+    }
+    uint32_t v = n == 1 ? s[0] : s[0] & (0x7F >> n);
+    for (size_t i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        v = v << 6 | (s[i] & 0x3F);
+    }
+    if (v < min[n] || v > 0x10FFFF || (v >= 0xD800 && v < 0xE000)) {
+        return 0;
+    }
+    *cp = v;
+    return n;
+}
+
+static void text_utf16(char *dst, size_t *n, const uint8_t *src, size_t len, bool be)
+{
+    if (len >= 2 && ((src[0] == 0xFF && src[1] == 0xFE) || (src[0] == 0xFE && src[1] == 0xFF))) {
+        be = src[0] == 0xFE;
+        src += 2;
+        len -= 2;
+    }
+
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint32_t cp = be ? src[i] << 8 | src[i + 1] : src[i + 1] << 8 | src[i];
+        if (cp == 0) {
+            break;              // end of the first value
+        }
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < len) {
+            uint32_t lo = be ? src[i + 2] << 8 | src[i + 3] : src[i + 3] << 8 | src[i + 2];
+            if (lo >= 0xDC00 && lo < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i += 2;
+            }
+        }
+        if (cp >= 0xD800 && cp < 0xE000) {
+            cp = '?';           // unpaired surrogate
+        }
+        if (!text_put(dst, n, cp)) {
+            break;
+        }
+    }
+}
+
+// The one conversion every format goes through; the first value found for a field wins
+static void tag_text(char *dst, const uint8_t *src, size_t len, int enc)
+{
+    size_t n = 0;
+
+    if (*dst) {
+        return;
+    }
+
+    if (enc == TAG_ENC_UTF16 || enc == TAG_ENC_UTF16BE) {
+        text_utf16(dst, &n, src, len, enc == TAG_ENC_UTF16BE);
+    } else {
+        uint32_t cp;
+        size_t step;
+        bool utf8 = true;
+
+        // NUL ends the first value; text that is not valid UTF-8 is Latin-1
+        len = strnlen((const char *)src, len);
+        for (size_t i = 0; i < len && utf8; i += step) {
+            step = utf8_seq(src + i, len - i, &cp);
+            utf8 = step > 0;
+        }
+        for (size_t i = 0; i < len; i += step) {
+            step = utf8 ? utf8_seq(src + i, len - i, &cp) : 1;
+            if (!utf8) {
+                cp = src[i];
+            }
+            if (!text_put(dst, &n, cp)) {
+                break;
+            }
+        }
+    }
+
+    while (n && dst[n - 1] == ' ') {
+        n--;
+    }
+    dst[n] = '\0';
+    size_t lead = strspn(dst, " ");
+    memmove(dst, dst + lead, n - lead + 1);
+}
+
+// Keep the picture unless a front cover is already known
+static void tag_art(tag_ctx_t *c, uint8_t type, uint32_t off, uint32_t size)
+{
+    if (size == 0 || (c->out->art_size && (c->art_type == PIC_FRONT_COVER || type != PIC_FRONT_COVER))) {
+        return;
+    }
+    c->out->art_offset = off;
+    c->out->art_size = size;
+    c->art_type = type;
+}
+
+// Size and the last bytes of the picture; the start is the same JPEG header for many files
+static uint32_t tag_art_id(tag_ctx_t *c)
+{
+    uint32_t n = c->out->art_size < ART_ID_TAIL ? c->out->art_size : ART_ID_TAIL;
+    uint32_t h = 2166136261u ^ c->out->art_size;
+
+    if (!tag_read(c, c->out->art_offset + c->out->art_size - n, c->buf, n)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        h = (h ^ c->buf[i]) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+/* ---- ID3 ---- */
+
+// Field a text frame fills, NULL for frames that are stepped over
+static char *id3_field(tag_ctx_t *c, const uint8_t *id, uint8_t ver)
+{
+    static const char ids[][2][5] = {       // v2.2, v2.3/2.4
+        { "TT2", "TIT2" }, { "TP1", "TPE1" }, { "TAL", "TALB" }, { "TP2", "TPE2" },
+    };
+    char *fields[] = { c->out->title, c->out->artist, c->out->album, c->band };
+
+    for (int i = 0; i < 4; i++) {
+        if (memcmp(id, ids[i][ver > 2], ver > 2 ? 4 : 3) == 0) {
+            return fields[i];
+        }
+    }
+    return NULL;
+}
+
+// Undo unsynchronisation: the writer put 0x00 after every 0xFF
+static size_t id3_unsync(uint8_t *p, size_t len)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = p[i];
+        p[n++] = b;
+        if (b == 0xFF && i + 1 < len && p[i + 1] == 0x00) {
+            i++;
+        }
+    }
+    return n;
+}
+
+// APIC: encoding, MIME type (PIC: three-letter format), picture type, description, data
+static void id3_picture(tag_ctx_t *c, uint32_t data, uint32_t size, uint8_t ver)
+{
+    uint8_t *b = c->buf;
+    size_t n = size < sizeof(c->buf) ? size : sizeof(c->buf);
+    size_t i = 1;
+
+    if (n < 4 || !tag_read(c, data, b, n)) {
+        return;
+    }
+    if (ver == 2) {
+        i += 3;
+    } else {
+        i += strnlen((const char *)b + i, n - i) + 1;
+    }
+    if (i >= n) {
+        return;
+    }
+    uint8_t type = b[i++];
+
+    // The description ends in a NUL of its own encoding
+    if (b[0] == TAG_ENC_UTF16 || b[0] == TAG_ENC_UTF16BE) {
+        while (i + 1 < n && (b[i] || b[i + 1])) {
+            i += 2;
+        }
+        i += 2;
+    } else {
+        i += strnlen((const char *)b + i, n - i) + 1;
+    }
+    if (i > n || i >= size) {
+        return;                 // description longer than the buffer
+    }
+    tag_art(c, type, data + i, size - i);
+}
+
+// ID3v2 tag at off; returns the offset after it, off if there is none
+static uint32_t id3v2_parse(tag_ctx_t *c, uint32_t off)
+{
+    uint8_t h[ID3_HEADER_LEN];
+
+    if (!tag_read(c, off, h, sizeof(h)) || memcmp(h, "ID3", 3) != 0 || syncsafe(h + 6) == UINT32_MAX) {
+        return off;
+    }
+
+    uint8_t ver = h[3];
+    uint8_t flags = h[5];
+    uint64_t end = (uint64_t)off + ID3_HEADER_LEN + syncsafe(h + 6) +
+                   (ver == 4 && (flags & 0x10) ? ID3_HEADER_LEN : 0);
+    if (end > c->size) {
+        end = c->size;
+    }
+
+    // Before 2.4 unsynchronisation covers the frame headers too, and 2.2 compression is undefined
+    if (ver < 2 || ver > 4 || (ver < 4 && (flags & 0x80)) || (ver == 2 && (flags & 0x40))) {
+        return end;
+    }
+
+    uint32_t pos = off + ID3_HEADER_LEN;
+    if (ver > 2 && (flags & 0x40)) {
+        // Extended header: its size excludes itself in 2.3, includes it in 2.4
+        uint8_t e[4];
+        if (!tag_read(c, pos, e, sizeof(e))) {
+            return end;
+        }
+        uint64_t ext = ver == 3 ? 4 + (uint64_t)be32(e) : syncsafe(e);
+        if (ext > end - pos) {
+            return end;
+        }
+        pos += ext;
+    }
+
+    size_t hdr_len = ver == 2 ? 6 : 10;
+    uint8_t f[10];
+    while (pos + hdr_len <= end && tag_read(c, pos, f, hdr_len)) {
+        if (f[0] == 0) {
+            break;              // padding
+        }
+
+        uint32_t size = ver == 2 ? (uint32_t)f[3] << 16 | f[4] << 8 | f[5] :
+                        ver == 3 ? be32(f + 4) : syncsafe(f + 4);
+        uint32_t data = pos + hdr_len;
+        if (size > end - data) {
+            break;
+        }
+        pos = data + size;
+
+        bool pic = memcmp(f, ver == 2 ? "PIC" : "APIC", ver == 2 ? 3 : 4) == 0;
+        char *dst = pic ? NULL : id3_field(c, f, ver);
+        uint8_t fflags = ver == 2 ? 0 : f[9];
+        if ((!dst && !pic) || (ver == 3 && (fflags & 0xC0)) || (ver == 4 && (fflags & 0x0C))) {
+            continue;           // not wanted, or compressed / encrypted
+        }
+        if (ver == 4 && (fflags & 0x01)) {
+            // Data length indicator
+            if (size < 4) {
+                continue;
+            }
+            data += 4;
+            size -= 4;
+        }
+        bool unsync = ver == 4 && ((fflags & 0x02) || (flags & 0x80));
+
+        if (pic) {
+            // The picture is decoded straight from the file, so only one stored as is will do
+            if (!unsync) {
+                id3_picture(c, data, size, ver);
+            }
+            continue;
+        }
+
+        size_t n = size < sizeof(c->buf) ? size : sizeof(c->buf);
+        if (n < 2 || !tag_read(c, data, c->buf, n)) {
+            continue;
+        }
+        if (unsync) {
+            n = id3_unsync(c->buf, n);
+        }
+        if (c->buf[0] <= TAG_ENC_UTF8) {
+            tag_text(dst, c->buf + 1, n - 1, c->buf[0]);
+        }
+    }
+    return end;
+}
+
+static bool id3v1_parse(tag_ctx_t *c)
+{
+    uint8_t *t = c->buf;
+
+    if (c->size < ID3V1_LEN || !tag_read(c, c->size - ID3V1_LEN, t, ID3V1_LEN) || memcmp(t, "TAG", 3) != 0) {
+        return false;
+    }
+    tag_text(c->out->title, t + 3, 30, TAG_ENC_LATIN1);
+    tag_text(c->out->artist, t + 33, 30, TAG_ENC_LATIN1);
+    tag_text(c->out->album, t + 63, 30, TAG_ENC_LATIN1);
+    return true;
+}
+
+/* ---- MP3 ---- */
+
+static const uint16_t mp3_kbps[2][16] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },   // MPEG-1
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },       // MPEG-2/2.5
+};
+static const uint16_t mp3_rate[3] = { 44100, 48000, 32000 };
+
+// Frame count from a Xing/Info or VBRI header, else the first frame's bitrate over the audio
+static void mp3_duration(tag_ctx_t *c, uint32_t off, uint32_t end)
+{
+    uint8_t *b = c->buf;
+
+    for (uint32_t pos = off; pos < off + MEDIA_TAGS_SYNC_SEARCH && end - pos >= 4; ) {
+        size_t n = end - pos < sizeof(c->buf) ? end - pos : sizeof(c->buf);
+        if (!tag_read(c, pos, b, n)) {
+            return;
+        }
+
+        for (size_t i = 0; i + 4 <= n; i++) {
+            uint32_t h = be32(b + i);
+            int ver = h >> 19 & 3;      // 3: MPEG-1, 2: MPEG-2, 0: MPEG-2.5
+            int br = h >> 12 & 15;
+            int sr = h >> 10 & 3;
+            if ((h & 0xFFE00000) != 0xFFE00000 || ver == 1 || (h >> 17 & 3) != 1 ||
+                br == 0 || br == 15 || sr == 3) {
+                continue;
+            }
+
+            bool mpeg1 = ver == 3;
+            bool mono = (h >> 6 & 3) == 3;
+            uint32_t rate = mp3_rate[sr] >> (mpeg1 ? 0 : ver == 2 ? 1 : 2);
+            uint32_t frame = pos + i;
+            uint32_t frames = 0;
+            uint8_t x[18];
+
+            // Xing/Info follows the side info, VBRI sits 32 bytes in
+            uint32_t xing = frame + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+            if (tag_read(c, xing, x, 12) && (!memcmp(x, "Xing", 4) || !memcmp(x, "Info", 4))) {
+                frames = be32(x + 4) & 1 ? be32(x + 8) : 0;
+            } else if (tag_read(c, frame + 36, x, 18) && !memcmp(x, "VBRI", 4)) {
+                frames = be32(x + 14);
+            }
+
+            if (frames) {
+                c->out->duration_ms = (uint64_t)frames * (mpeg1 ? 1152 : 576) * 1000 / rate;
+            } else {
+                c->out->duration_ms = (uint64_t)(end - frame) * 8 / mp3_kbps[!mpeg1][br];
+            }
+            return;
+        }
+        pos += n - 3;           // a header may straddle two reads
+    }
+}
+
+/* ---- FLAC / Vorbis comments ---- */
+
+static void vorbis_parse(tag_ctx_t *c, uint32_t pos, uint32_t end)
+{
+    static const char *const keys[] = { "TITLE=", "ARTIST=", "ALBUM=", "ALBUMARTIST=" };
+    char *fields[] = { c->out->title, c->out->artist, c->out->album, c->band };
+    uint8_t n4[4];
+
+    // Vendor string, then the comment count
+    if (end - pos < 4 || !tag_read(c, pos, n4, 4) || le32(n4) > end - pos - 4) {
+        return;
+    }
+    pos += 4 + le32(n4);
+    if (end - pos < 4 || !tag_read(c, pos, n4, 4)) {
+        return;
+    }
+    uint32_t count = le32(n4);
+    pos += 4;
+
+    for (uint32_t i = 0; i < count && end - pos >= 4 && tag_read(c, pos, n4, 4); i++) {
+        uint32_t len = le32(n4);
+        uint32_t data = pos + 4;
+        if (len > end - data) {
+            return;
+        }
+        pos = data + len;
+
+        size_t n = len < sizeof(c->buf) ? len : sizeof(c->buf);
+        if (!tag_read(c, data, c->buf, n)) {
+            return;
+        }
+        for (int k = 0; k < 4; k++) {
+            size_t kl = strlen(keys[k]);
+            if (n > kl && strncasecmp((const char *)c->buf, keys[k], kl) == 0) {
+                tag_text(fields[k], c->buf + kl, n - kl, TAG_ENC_UTF8);
+                break;
+            }
+        }
+    }
+}
+
+// Picture type, MIME type, description, width/height/depth/colours, then the data
+static void flac_picture(tag_ctx_t *c, uint32_t pos, uint32_t end)
+{
+    uint8_t h[8];
+
+    if (end - pos < 8 || !tag_read(c, pos, h, sizeof(h)) || be32(h + 4) > end - pos - 8) {
+        return;
+    }
+    uint8_t type = be32(h) > 0xFF ? 0 : be32(h);
+    pos += 8 + be32(h + 4);
+
+    if (end - pos < 4 || !tag_read(c, pos, h, 4) || be32(h) > end - pos - 4) {
+        return;
+    }
+    pos += 4 + be32(h);
+
+    if (end - pos < 20 || !tag_read(c, pos + 16, h, 4) || be32(h) > end - pos - 20) {
+        return;
+    }
+    tag_art(c, type, pos + 20, be32(h));
+}
+
+static bool flac_parse(tag_ctx_t *c, uint32_t off)
+{
+    uint8_t h[4];
+
+    if (!tag_read(c, off, h, sizeof(h)) || memcmp(h, "fLaC", 4) != 0) {
+        return false;
+    }
+
+    uint32_t pos = off + 4;
+    for (int i = 0; i < FLAC_MAX_BLOCKS && tag_read(c, pos, h, sizeof(h)); i++) {
+        uint32_t len = (uint32_t)h[1] << 16 | h[2] << 8 | h[3];
+        uint32_t data = pos + 4;
+        int type = h[0] & 0x7F;
+        if (len > c->size - data) {
+            break;
+        }
+
+        if (type == FLAC_STREAMINFO && len >= 18 && tag_read(c, data, c->buf, 18)) {
+            const uint8_t *s = c->buf;
+            uint32_t rate = (uint32_t)s[10] << 12 | s[11] << 4 | s[12] >> 4;
+            uint64_t total = (uint64_t)(s[13] & 0x0F) << 32 | be32(s + 14);
+            if (rate) {
+                c->out->duration_ms = total * 1000 / rate;
+            }
+        } else if (type == FLAC_VORBIS_COMMENT) {
+            vorbis_parse(c, data, data + len);
+        } else if (type == FLAC_PICTURE) {
+            flac_picture(c, data, data + len);
+        }
+
+        if (h[0] & 0x80) {
+            break;              // last metadata block
+        }
+        pos = data + len;
+    }
+    return true;
+}
+
+/* ---- WAV ---- */
+
+static void wav_info(tag_ctx_t *c, uint32_t pos, uint32_t end)
+{
+    static const char ids[][5] = { "INAM", "IART", "IPRD" };
+    char *fields[] = { c->out->title, c->out->artist, c->out->album };
+    uint8_t h[8];
+
+    if (end - pos < 4 || !tag_read(c, pos, h, 4) || memcmp(h, "INFO", 4) != 0) {
+        return;
+    }
+
+    for (pos += 4; pos <= end && end - pos >= 8 && tag_read(c, pos, h, sizeof(h)); ) {
+        uint32_t len = le32(h + 4);
+        uint32_t data = pos + 8;
+        if (len > end - data) {
+            return;
+        }
+        for (int k = 0; k < 3; k++) {
+            size_t n = len < sizeof(c->buf) ? len : sizeof(c->buf);
+            if (memcmp(h, ids[k], 4) == 0 && tag_read(c, data, c->buf, n)) {
+                tag_text(fields[k], c->buf, n, TAG_ENC_LATIN1);
+            }
+        }
+        pos = data + len + (len & 1);
+    }
+}
+
+static bool wav_parse(tag_ctx_t *c)
+{
+    uint8_t h[12];
+    uint32_t byte_rate = 0;
+    uint32_t data_len = 0;
+
+    if (!tag_read(c, 0, h, sizeof(h)) || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    for (uint32_t pos = 12; c->size - pos >= 8 && tag_read(c, pos, h, 8); ) {
+        uint32_t len = le32(h + 4);
+        uint32_t data = pos + 8;
+        uint32_t avail = c->size - data;
+
+        if (!memcmp(h, "fmt ", 4) && len >= 16 && tag_read(c, data, c->buf, 16)) {
+            byte_rate = le32(c->buf + 8);
+        } else if (!memcmp(h, "data", 4)) {
+            data_len = len < avail ? len : avail;   // streaming writers leave 0xFFFFFFFF
+        } else if (!memcmp(h, "LIST", 4)) {
+            wav_info(c, data, data + (len < avail ? len : avail));
+        } else if (!memcmp(h, "id3 ", 4) || !memcmp(h, "ID3 ", 4)) {
+            id3v2_parse(c, data);
+        }
+
+        if (len >= avail) {
+            break;
+        }
+        pos = data + len + (len & 1);
+    }
+
+    if (byte_rate) {
+        c->out->duration_ms = (uint64_t)data_len * 1000 / byte_rate;
+    }
+    return true;
+}
+
+bool media_tags_read(const char *path, media_tags_t *out)
+{
+    tag_ctx_t c = { .out = out };
+
+    memset(out, 0, sizeof(*out));
+    c.fp = fopen(path, "rb");
+    if (!c.fp) {
+        ESP_LOGW(TAG, "Failed to open %s", path);
+        return false;
+    }
+    // Reads are small and scattered, FATFS keeps the sector they come from
+    setvbuf(c.fp, NULL, _IONBF, 0);
+
+    if (fseek(c.fp, 0, SEEK_END) == 0) {
+        long size = ftell(c.fp);
+        c.size = size > 0 ? (uint32_t)size : 0;
+    }
+
+    if (!wav_parse(&c)) {
+        // ID3v2 in front of MP3, and of some FLAC files
+        uint32_t off = 0;
+        for (int i = 0; i < ID3_MAX_CHAIN; i++) {
+            uint32_t next = id3v2_parse(&c, off);
+            if (next == off) {
+                break;
+            }
+            off = next;
+        }
+
+        if (!flac_parse(&c, off)) {
+            uint32_t end = id3v1_parse(&c) ? c.size - ID3V1_LEN : c.size;
+            if (off < end) {
+                mp3_duration(&c, off, end);
+            }
+        }
+    }
+
+    if (!out->artist[0]) {
+        memcpy(out->artist, c.band, sizeof(c.band));
+    }
+    if (out->art_size) {
+        out->art_id = tag_art_id(&c);
+    }
+    fclose(c.fp);
+    return true;
+}
@@ -2,6 +2,11 @@
 #include "ui_manager.h"
 
 #include "audio_player.h"
+#include "audio_output.h"
+#include "audio_spectrum.h"
+#include "audio_library.h"
+#include "audio_art.h"
+#include "audio_queue.h"
 #include "bt_manager.h"
 
 static const char *TAG = "AUDIO_UI";
@@ -19,10 +24,36 @@ static lv_obj_t * label_bt;
 static lv_obj_t * page_home;
 static lv_obj_t * page_options;
 static lv_obj_t * page_bt;
+static lv_obj_t * page_library;
 static lv_obj_t * music_scr;
 
 // BT List
 lv_obj_t * bt_list;
+
+// Library list, a window of LIBRARY_ROWS tracks at a time
+static lv_obj_t * library_list;
+static uint32_t library_first = 0;
+static uint32_t library_gen = 0;    // index generation the list was filled from
+
+#define LIBRARY_ROWS        16
+#define LIBRARY_POLL_MS     1000    // picks up a finished index build
+#define LIBRARY_PLAYLISTS   8       // listed above the tracks
+
+// Album art, one thumbnail for each place it is shown
+typedef struct {
+    lv_obj_t *img;
+    uint16_t size;
+    uint32_t shown;                 // picture id on screen, 0 for none
+    uint8_t cur;                    // dsc on screen, the other one takes the next picture
+    lv_image_dsc_t dsc[2];
+} ui_art_t;
+
+static ui_art_t art_music = { .size = AUDIO_ART_LARGE };
+static ui_art_t art_home = { .size = AUDIO_ART_SMALL };
+static uint32_t art_want = 0;       // picture of current_file
+static uint32_t title_serial = 0;   // audio_player_track_serial() the title is for
+
+#define TRACK_POLL_MS       500     // picks up queue track changes and extracted thumbnails
 /* ------------------ Audio Player UI ------------------ */
 // UI Styles
 lv_style_t style_bg;
@@ -36,9 +67,17 @@ static lv_obj_t *btn_play;
 static lv_obj_t *icon_play;
 static lv_obj_t *btn_next;
 static lv_obj_t *btn_prev;
+static lv_obj_t *spectrum_bars[AUDIO_SPECTRUM_BANDS + 2];     // bands, then VU left/right
 
 static bool is_playing = false;
 
+#define PROGRESS_RANGE      1000    // slider steps over the whole track
+#define PROGRESS_PERIOD_MS  500
+#define SPECTRUM_BAR_W      8
+#define SPECTRUM_BAR_GAP    3
+#define SPECTRUM_VU_GAP     8       // extra space between the bands and the VU pair
+#define SPECTRUM_H          60
+
 // Global function declarations
 void audio_player_page_create(lv_obj_t * scr);
 void create_bottom_nav(lv_obj_t * parent);
@@ -158,11 +197,153 @@ static void player_btn_event_cb(lv_event_t *e)
         /* later: call player_play() / player_pause() */
     }
     else if(btn == btn_next) {
-        /* later: player_next() */
+        audio_player_cmd(AUDIO_CMD_NEXT);
     }
     else if(btn == btn_prev) {
-        /* later: player_prev() */
+        audio_player_cmd(AUDIO_CMD_PREV);
+    }
+}
+
+static void art_show(ui_art_t *a)
+{
+    if (!a->img || a->shown == art_want) {
+        return;
+    }
+
+    lv_image_dsc_t *next = &a->dsc[!a->cur];
+    bool loaded = art_want && audio_art_load(art_want, a->size, current_file, next);
+    if (!loaded && !a->shown) {
+        return;                     // nothing on screen, nothing to show yet
+    }
+
+    if (loaded) {
+        lv_image_set_src(a->img, next);
+        lv_obj_clear_flag(a->img, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        // The last track's picture until this one is extracted would be wrong
+        lv_obj_add_flag(a->img, LV_OBJ_FLAG_HIDDEN);
+    }
+    audio_art_release(&a->dsc[a->cur]);
+    a->cur ^= loaded;
+    a->shown = loaded ? art_want : 0;
+}
+
+// Tags and art of current_file from the library index, its file name until it is indexed
+static void music_title_update(void)
+{
+    static audio_library_track_t track;     // too big for the LVGL task stack
+    uint32_t serial = audio_player_track_serial();  // before current_file is read
+    int32_t index = audio_library_find(current_file);
+    bool found = index >= 0 && audio_library_get(index, &track);
+
+    title_serial = serial;
+    art_want = found ? track.art : 0;
+    art_show(&art_music);
+    art_show(&art_home);
+
+    if (!label_title) {
+        return;
+    }
+    if (!found) {
+        const char *name = strrchr(current_file, '/');
+        lv_label_set_text(label_title, name ? name + 1 : current_file);
+    } else if (track.artist[0]) {
+        lv_label_set_text_fmt(label_title, "%s - %s", track.artist, track.title);
+    } else {
+        lv_label_set_text(label_title, track.title);
+    }
+}
+
+static void track_timer_cb(lv_timer_t *t)
+{
+    LV_UNUSED(t);
+
+    // The control task moved on to another queue entry
+    if (title_serial != audio_player_track_serial()) {
+        music_title_update();
+        return;
+    }
+    art_show(&art_music);
+    art_show(&art_home);
+}
+
+static void progress_timer_cb(lv_timer_t *t)
+{
+    static audio_state_t last_state = AUDIO_STATE_IDLE;
+    LV_UNUSED(t);
+
+    // Follow play/pause coming from elsewhere, e.g. headset buttons
+    audio_state_t state = audio_player_get_state();
+    if (state != last_state) {
+        last_state = state;
+        is_playing = state == AUDIO_STATE_PLAYING;
+        lv_label_set_text(icon_play, is_playing ? LV_SYMBOL_PAUSE : LV_SYMBOL_PLAY);
+    }
+
+    // Leave the knob alone while it is being dragged
+    if (lv_obj_has_state(bar_progress, LV_STATE_PRESSED)) {
+        return;
+    }
+
+    uint32_t dur = audio_player_get_duration_ms();
+    uint32_t pos = audio_player_get_position_ms();
+    lv_slider_set_value(bar_progress, dur ? (uint64_t)pos * PROGRESS_RANGE / dur : 0, LV_ANIM_OFF);
+}
+
+static void progress_seek_cb(lv_event_t *e)
+{
+    uint32_t dur = audio_player_get_duration_ms();
+    int val = lv_slider_get_value(lv_event_get_target(e));
+
+    if (dur) {
+        ESP_LOGI(TAG, "Seek: %d/%d", val, PROGRESS_RANGE);
+        audio_player_seek((uint64_t)val * dur / PROGRESS_RANGE);
+    }
+}
+
+static void spectrum_timer_cb(lv_timer_t *t)
+{
+    static audio_spectrum_t spec;
+    LV_UNUSED(t);
+
+    if (!audio_spectrum_get(&spec)) {
+        return;
+    }
+    // lv_bar_set_value() ignores unchanged values, so only moving bars redraw
+    for (int i = 0; i < AUDIO_SPECTRUM_BANDS; i++) {
+        lv_bar_set_value(spectrum_bars[i], spec.band[i], LV_ANIM_OFF);
+    }
+    lv_bar_set_value(spectrum_bars[AUDIO_SPECTRUM_BANDS], spec.vu[0], LV_ANIM_OFF);
+    lv_bar_set_value(spectrum_bars[AUDIO_SPECTRUM_BANDS + 1], spec.vu[1], LV_ANIM_OFF);
+}
+
+static void spectrum_create(lv_obj_t * scr)
+{
+    int count = AUDIO_SPECTRUM_BANDS + 2;
+    int width = count * (SPECTRUM_BAR_W + SPECTRUM_BAR_GAP) - SPECTRUM_BAR_GAP + SPECTRUM_VU_GAP;
+
+    lv_obj_t *cont = lv_obj_create(scr);
+    lv_obj_remove_style_all(cont);
+    lv_obj_set_size(cont, width, SPECTRUM_H);
+    lv_obj_align(cont, LV_ALIGN_CENTER, 0, -50);
+    lv_obj_clear_flag(cont, LV_OBJ_FLAG_SCROLLABLE | LV_OBJ_FLAG_CLICKABLE);
+
+    for (int i = 0; i < count; i++) {
+        lv_obj_t *bar = lv_bar_create(cont);
+        int x = i * (SPECTRUM_BAR_W + SPECTRUM_BAR_GAP) + (i >= AUDIO_SPECTRUM_BANDS ? SPECTRUM_VU_GAP : 0);
+
+        lv_obj_set_size(bar, SPECTRUM_BAR_W, SPECTRUM_H);
+        lv_obj_set_pos(bar, x, 0);
+        lv_bar_set_range(bar, 0, 100);
+        lv_obj_set_style_radius(bar, 0, LV_PART_MAIN);
+        lv_obj_set_style_radius(bar, 0, LV_PART_INDICATOR);
+        lv_obj_set_style_bg_opa(bar, LV_OPA_10, LV_PART_MAIN);
+        lv_obj_set_style_bg_color(bar, lv_color_hex(i < AUDIO_SPECTRUM_BANDS ? 0x00C0FF : 0x40FF40),
+                                  LV_PART_INDICATOR);
+        spectrum_bars[i] = bar;
     }
+
+    lv_timer_create(spectrum_timer_cb, AUDIO_SPECTRUM_PERIOD_MS, NULL);
 }
 
 /* ------------------ Event callbacks ------------------ */
@@ -174,17 +355,30 @@ void audio_player_page_create(lv_obj_t * scr)
     lv_obj_add_style(scr, &style_bg, 0);
     lv_scr_load(scr);
 
+    /* Album art, the spectrum draws over it */
+    art_music.img = lv_image_create(scr);
+    lv_obj_align(art_music.img, LV_ALIGN_CENTER, 0, -52);
+    lv_obj_add_flag(art_music.img, LV_OBJ_FLAG_HIDDEN);
+
     /* Track title */
     label_title = lv_label_create(scr);
-    lv_label_set_text(label_title, "Solo Sangeet");
     lv_obj_add_style(label_title, &style_title, 0);
+    lv_obj_set_width(label_title, LV_PCT(90));
+    lv_label_set_long_mode(label_title, LV_LABEL_LONG_SCROLL_CIRCULAR);
+    lv_obj_set_style_text_align(label_title, LV_TEXT_ALIGN_CENTER, 0);
     lv_obj_align(label_title, LV_ALIGN_TOP_MID, 0, 12);
+    music_title_update();
+
+    /* Spectrum and VU meter */
+    spectrum_create(scr);
 
-    /* Progress bar */
-    bar_progress = lv_bar_create(scr);
+    /* Progress bar, drag to seek */
+    bar_progress = lv_slider_create(scr);
     lv_obj_set_size(bar_progress, 200, 6);
-    lv_bar_set_range(bar_progress, 0, 100);
+    lv_slider_set_range(bar_progress, 0, PROGRESS_RANGE);
     lv_obj_align(bar_progress, LV_ALIGN_CENTER, 0, 0);
+    lv_obj_add_event_cb(bar_progress, progress_seek_cb, LV_EVENT_RELEASED, NULL);
+    lv_timer_create(progress_timer_cb, PROGRESS_PERIOD_MS, NULL);
 
     /* --- PREV button --- */
     btn_prev = lv_btn_create(scr);
@@ -258,7 +452,13 @@ static void volume_cb(lv_event_t * e)
 {
     int val = lv_slider_get_value(lv_event_get_target(e));
     ESP_LOGI(TAG, "Volume: %d", val);
-    // audio_set_volume(val);
+    audio_player_set_volume(val);
+}
+
+static void output_cb(lv_event_t * e)
+{
+    bool local = lv_obj_has_state(lv_event_get_target(e), LV_STATE_CHECKED);
+    audio_output_set(local ? AUDIO_OUTPUT_I2S : AUDIO_OUTPUT_BT);
 }
 
 // Top status bar UI Callbacks
@@ -315,9 +515,21 @@ static lv_obj_t * create_home_page(lv_obj_t * menu)
     lv_obj_t * music_label = lv_label_create(cont_music);
     lv_label_set_text(music_label, "Music Player");
     ui_cont_label_apply_theme(music_label);
+    art_home.img = lv_image_create(cont_music);
+    lv_obj_add_flag(art_home.img, LV_OBJ_FLAG_IGNORE_LAYOUT | LV_OBJ_FLAG_HIDDEN);
+    lv_obj_align(art_home.img, LV_ALIGN_RIGHT_MID, 0, 0);
     lv_obj_add_flag(cont_music, LV_OBJ_FLAG_CLICKABLE);
     lv_obj_add_event_cb(cont_music, music_open_cb, LV_EVENT_PRESSED, NULL);
 
+    /* Library */
+    lv_obj_t * cont_lib = lv_menu_cont_create(section);
+    ui_cont_apply_theme(cont_lib);
+    menu_item_make_touch_friendly(cont_lib);
+    lv_obj_t * lib_label = lv_label_create(cont_lib);
+    lv_label_set_text(lib_label, "Library  " LV_SYMBOL_LIST);
+    ui_cont_label_apply_theme(lib_label);
+    lv_menu_set_load_page_event(menu, cont_lib, page_library);
+
     return page;
 }
 
@@ -355,11 +567,27 @@ static lv_obj_t * create_options_page(lv_obj_t * menu)
 
     lv_obj_t * slider_vol = lv_slider_create(cont_vol);
     lv_slider_set_range(slider_vol, 0, 100);
-    lv_slider_set_value(slider_vol, 50, LV_ANIM_OFF);
+    lv_slider_set_value(slider_vol, audio_player_get_volume(), LV_ANIM_OFF);
     lv_obj_set_width(slider_vol, LV_PCT(80));
     // Setup Callback
     lv_obj_add_event_cb(slider_vol, volume_cb, LV_EVENT_VALUE_CHANGED, NULL);
 
+    /* ---------- Output ---------- */
+    lv_obj_t * cont_out = lv_menu_cont_create(section);
+    ui_cont_apply_theme(cont_out);
+    menu_item_vertical(cont_out);
+
+    lv_obj_t * lbl_out = lv_label_create(cont_out);
+    lv_label_set_text(lbl_out, "Local Output (I2S)");
+    lv_obj_set_style_text_align(lbl_out, LV_TEXT_ALIGN_CENTER, 0);
+    ui_cont_label_apply_theme(lbl_out);
+
+    lv_obj_t * sw_out = lv_switch_create(cont_out);
+    if (audio_output_get() == AUDIO_OUTPUT_I2S) {
+        lv_obj_add_state(sw_out, LV_STATE_CHECKED);
+    }
+    lv_obj_add_event_cb(sw_out, output_cb, LV_EVENT_VALUE_CHANGED, NULL);
+
     return page;
 }
 
@@ -409,6 +637,120 @@ static lv_obj_t * create_bt_page(lv_obj_t * menu)
     return page;
 }
 
+static void library_fill(void);
+
+static void library_track_cb(lv_event_t *e)
+{
+    uint32_t index = (uint32_t)(uintptr_t)lv_event_get_user_data(e);
+    char path[AUDIO_PATH_MAX];
+
+    if (!audio_library_path(index, path, sizeof(path))) {
+        return;
+    }
+    ESP_LOGI(TAG, "Library pick %lu: %s", (unsigned long)index, path);
+    // Next and previous go on through the library from here
+    audio_queue_library(index);
+    audio_player_play_file(path);
+
+    music_open_cb(e);
+    music_title_update();
+}
+
+static void library_playlist_cb(lv_event_t *e)
+{
+    uint32_t n = (uint32_t)(uintptr_t)lv_event_get_user_data(e);
+    char path[AUDIO_PATH_MAX];
+
+    if (!audio_queue_playlist(n, path, sizeof(path))) {
+        return;
+    }
+    ESP_LOGI(TAG, "Playlist pick: %s", path);
+    // The title follows once the control task has loaded it
+    audio_player_play_playlist(path);
+
+    music_open_cb(e);
+}
+
+static void library_page_cb(lv_event_t *e)
+{
+    int32_t step = (int32_t)(intptr_t)lv_event_get_user_data(e);
+
+    library_first = (int32_t)library_first + step < 0 ? 0 : library_first + step;
+    library_fill();
+}
+
+static void library_fill(void)
+{
+    static audio_library_track_t track;     // too big for the LVGL task stack
+    uint32_t count = audio_library_count();
+
+    library_gen = audio_library_generation();
+    lv_obj_clean(library_list);
+
+    if (count == 0) {
+        lv_list_add_text(library_list, "No tracks yet, scanning card...");
+        return;
+    }
+    if (library_first >= count) {
+        library_first = 0;
+    }
+
+    if (library_first) {
+        lv_obj_t *btn = lv_list_add_button(library_list, LV_SYMBOL_UP, "Previous");
+        lv_obj_add_event_cb(btn, library_page_cb, LV_EVENT_CLICKED, (void *)(intptr_t)-LIBRARY_ROWS);
+        ui_list_item_apply_theme(btn);
+    } else {
+        char path[AUDIO_PATH_MAX];
+
+        for (uint32_t n = 0; n < LIBRARY_PLAYLISTS && audio_queue_playlist(n, path, sizeof(path)); n++) {
+            lv_obj_t *btn = lv_list_add_button(library_list, LV_SYMBOL_LIST, strrchr(path, '/') + 1);
+            lv_obj_add_event_cb(btn, library_playlist_cb, LV_EVENT_CLICKED, (void *)(uintptr_t)n);
+            ui_list_item_apply_theme(btn);
+        }
+    }
+
+    uint32_t end = library_first + LIBRARY_ROWS < count ? library_first + LIBRARY_ROWS : count;
+    for (uint32_t i = library_first; i < end; i++) {
+        if (!audio_library_get(i, &track)) {
+            break;
+        }
+        lv_obj_t *btn = lv_list_add_button(library_list, LV_SYMBOL_AUDIO, track.title);
+        lv_obj_add_event_cb(btn, library_track_cb, LV_EVENT_CLICKED, (void *)(uintptr_t)i);
+        ui_list_item_apply_theme(btn);
+    }
+
+    if (end < count) {
+        lv_obj_t *btn = lv_list_add_button(library_list, LV_SYMBOL_DOWN, "More");
+        lv_obj_add_event_cb(btn, library_page_cb, LV_EVENT_CLICKED, (void *)(intptr_t)LIBRARY_ROWS);
+        ui_list_item_apply_theme(btn);
+    }
+}
+
+static void library_timer_cb(lv_timer_t *t)
+{
+    LV_UNUSED(t);
+
+    // A rebuilt index moves every track, start again from the top
+    if (library_gen != audio_library_generation()) {
+        library_first = 0;
+        library_fill();
+        music_title_update();
+    }
+}
+
+static lv_obj_t * create_library_page(lv_obj_t * menu)
+{
+    lv_obj_t * page = lv_menu_page_create(menu, "Library");
+
+    library_list = lv_list_create(page);
+    lv_obj_set_size(library_list, LV_PCT(100), LV_PCT(100));
+    ui_list_apply_theme(library_list);
+
+    library_fill();
+    lv_timer_create(library_timer_cb, LIBRARY_POLL_MS, NULL);
+    return page;
+}
+
 static void nav_back_cb(lv_event_t * e)
 {
     LV_UNUSED(e);
@@ -542,6 +884,7 @@ void audio_player_ui_init(lv_disp_t *disp)
 
     // Create pages
     page_bt      = create_bt_page(menu);
+    page_library = create_library_page(menu);
     page_home    = create_home_page(menu);
     page_options = create_options_page(menu);
 
@@ -551,4 +894,6 @@ void audio_player_ui_init(lv_disp_t *disp)
     // Nav bar + Status bar
     create_bottom_nav(menu_scr);
     create_top_status_bar(menu_scr);
+
+    lv_timer_create(track_timer_cb, TRACK_POLL_MS, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,491 @@
+/*
+ * Host playback simulator.
+ *
+ * Runs the firmware's reader half (WAV or FLAC source -> resampler ->
+ * audio ring, through audio_pipeline) on one thread against a virtual
+ * A2DP clock on another, which pulls whole SBC frames every tick the way
+ * the BT stack does. SD latency and clock jitter can be injected, and the
+ * clock can run faster than real time. The pulled audio goes to a WAV file.
+ *
+ * With -v the clock is a virtual tick counter instead: each tick waits until
+ * the reader has done everything due by then, and the reader is charged
+ * only the SD latency, so a run gives the same result on any host.
+ *
+ * Reports underruns, start latency, ring depth and reader CPU time per
+ * second of audio. Exits 2 on underruns, 3 if the output length is off.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_output.h"
+#include "audio_pipeline.h"
+#include "audio_ring.h"
+#include "flac_decoder.h"
+#include "resampler.h"
+#include "wav_parser.h"
+
+// The firmware's values, see audio_player.h
+#define SIM_SAMPLE_RATE     44100
+#define SIM_RING_SIZE       (32 * 1024)
+#define SIM_RING_LOW_WATER  (SIM_RING_SIZE / 2)
+#define SIM_BUF_BYTES       4608
+#define SIM_SPEED_MAX       100
+
+typedef enum {
+    READER_RUNNING,
+    READER_WAIT_SD,         // until the clock reaches reader_us
+    READER_WAIT_RING,       // until the ring drains below low water
+    READER_DONE,
+} reader_state_t;
+
+typedef struct {
+    // options
+    uint32_t tick_ms;
+    uint32_t jitter_ms;
+    uint32_t sd_latency_us;
+    uint32_t speed;
+    resampler_quality_t quality;
+    bool virtual_time;
+    // virtual time, under vt_lock
+    int64_t clock_us;
+    int64_t reader_us;
+    reader_state_t state;
+    // source
+    FILE *fp;
+    bool flac;
+    wav_info_t wav;
+    uint32_t wav_left;
+    flac_decoder_t *dec;
+    uint32_t rate;
+    uint64_t frames_in;
+    // reader
+    resampler_t rs;
+    bool rs_ready;
+    bool rs_tail;
+    volatile bool done;
+    double cpu_s;
+} sim_t;
+
+static sim_t sim;
+static audio_ring_t ring;
+static audio_pipeline_t pipeline;
+static pthread_mutex_t vt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vt_cond = PTHREAD_COND_INITIALIZER;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(int64_t us)
+{
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+
+    while (us > 0 && nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+// Virtual time: the reader blocks in the given state while the clock advances
+static void reader_wait(reader_state_t state)
+{
+    pthread_mutex_lock(&vt_lock);
+    sim.state = state;
+    pthread_cond_broadcast(&vt_cond);
+    while ((state == READER_WAIT_SD && sim.clock_us < sim.reader_us) ||
+           (state == READER_WAIT_RING && audio_ring_fill(&ring) >= SIM_RING_LOW_WATER)) {
+        pthread_cond_wait(&vt_cond, &vt_lock);
+    }
+    // A reader that sat on a full ring picks up at the current tick
+    if (state == READER_WAIT_RING && sim.reader_us < sim.clock_us) {
+        sim.reader_us = sim.clock_us;
+    }
+    sim.state = READER_RUNNING;
+    pthread_mutex_unlock(&vt_lock);
+}
+
+// Virtual time: nothing more is due from the reader at the current tick
+static bool reader_settled(void)
+{
+    switch (sim.state) {
+    case READER_WAIT_SD:   return sim.reader_us > sim.clock_us;
+    case READER_WAIT_RING: return audio_ring_fill(&ring) >= SIM_RING_LOW_WATER;
+    case READER_DONE:      return true;
+    default:               return false;
+    }
+}
+
+/* ---------------- source: WAV or FLAC file ---------------- */
+
+static uint32_t file_rate(void *ctx)
+{
+    return sim.rate;
+}
+
+static bool file_read(void *ctx, audio_buf_t *buf)
+{
+    size_t bytes;
+
+    // What the SD card would cost, scaled with the clock
+    if (sim.virtual_time) {
+        pthread_mutex_lock(&vt_lock);
+        sim.reader_us += sim.sd_latency_us;
+        pthread_mutex_unlock(&vt_lock);
+        reader_wait(READER_WAIT_SD);
+    } else if (sim.sd_latency_us) {
+        sleep_us(sim.sd_latency_us / sim.speed);
+    }
+
+    if (sim.flac) {
+        bytes = flac_decoder_read(sim.dec, (uint8_t *)buf->pcm, buf->capacity * 4);
+    } else {
+        size_t want = pcm_input_bytes_for(&sim.wav, buf->capacity * 4);
+        if (want > sim.wav_left) {
+            want = sim.wav_left - sim.wav_left % sim.wav.block_align;
+        }
+        size_t got = fread(buf->pcm, 1, want, sim.fp);
+        got -= got % sim.wav.block_align;
+        sim.wav_left -= got;
+        bytes = pcm_to_s16_stereo(&sim.wav, (uint8_t *)buf->pcm, got);
+    }
+
+    buf->frames = bytes / 4;
+    buf->rate = sim.rate;
+    sim.frames_in += buf->frames;
+    return bytes != 0;
+}
+
+static const audio_source_t file_source = {
+    .name = "file",
+    .rate = file_rate,
+    .read = file_read,
+};
+
+static bool source_open(const char *path)
+{
+    uint8_t magic[4];
+
+    sim.fp = fopen(path, "rb");
+    if (!sim.fp) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    sim.flac = fread(magic, 1, 4, sim.fp) == 4 && memcmp(magic, "fLaC", 4) == 0;
+    rewind(sim.fp);
+
+    if (sim.flac) {
+        sim.dec = malloc(sizeof(flac_decoder_t));
+        if (!sim.dec || !flac_decoder_open(sim.dec, sim.fp)) {
+            fprintf(stderr, "Not a FLAC stream: %s\n", path);
+            return false;
+        }
+        sim.rate = sim.dec->sample_rate;
+    } else {
+        if (!wav_parse_header(sim.fp, &sim.wav)) {
+            fprintf(stderr, "Not a WAV file: %s\n", path);
+            return false;
+        }
+        sim.rate = sim.wav.sample_rate;
+        sim.wav_left = sim.wav.data_size;
+    }
+    return true;
+}
+
+/* ---------------- resampler element, as in audio_player.c ---------------- */
+
+static audio_pipe_status_t resample_drain(audio_element_t *el)
+{
+    while (resampler_ready(&sim.rs)) {
+        audio_buf_t out;
+
+        if (!audio_pipeline_get_buf(el->pipe, &out, SIM_SAMPLE_RATE)) {
+            return AUDIO_PIPE_ABORT;
+        }
+        out.frames = resampler_read(&sim.rs, out.pcm, out.capacity);
+
+        audio_pipe_status_t status = audio_pipeline_emit(el, &out);
+        audio_pipeline_put_buf(el->pipe, &out);
+        if (status != AUDIO_PIPE_OK) {
+            return status;
+        }
+    }
+    return AUDIO_PIPE_OK;
+}
+
+static audio_pipe_status_t resample_process(audio_element_t *el, audio_buf_t *buf)
+{
+    if (buf->rate == SIM_SAMPLE_RATE) {
+        return audio_pipeline_emit(el, buf);
+    }
+    if (!sim.rs_ready) {
+        resampler_init(&sim.rs, buf->rate, SIM_SAMPLE_RATE, sim.quality);
+        sim.rs_ready = true;
+    }
+    resampler_write(&sim.rs, buf->pcm, buf->frames);
+    sim.rs_tail = true;
+    return resample_drain(el);
+}
+
+static audio_pipe_status_t resample_resume(audio_element_t *el, uint32_t rate)
+{
+    if (!sim.rs_ready) {
+        return AUDIO_PIPE_OK;
+    }
+    if (rate != sim.rs.in_rate && sim.rs_tail) {
+        resampler_flush(&sim.rs);
+        sim.rs_tail = false;
+    }
+
+    audio_pipe_status_t status = resample_drain(el);
+    if (status == AUDIO_PIPE_OK && rate != sim.rs.in_rate) {
+        sim.rs_ready = false;
+    }
+    return status;
+}
+
+static audio_element_t resample_element = {
+    .name = "resample", .process = resample_process, .resume = resample_resume,
+};
+
+/* ---------------- sink: the audio ring ---------------- */
+
+static uint8_t *ring_sink_acquire(void *ctx, uint32_t bytes)
+{
+    uint8_t *span;
+
+    // The firmware reader sleeps on a full ring until it drains to low water
+    while ((span = audio_ring_acquire(&ring, bytes)) == NULL) {
+        if (sim.virtual_time) {
+            reader_wait(READER_WAIT_RING);
+        } else {
+            audio_ring_wait_below(&ring, SIM_RING_LOW_WATER, pdMS_TO_TICKS(1000));
+        }
+    }
+    return span;
+}
+
+static void ring_sink_commit(void *ctx, uint32_t bytes)
+{
+    audio_ring_commit(&ring, bytes);
+}
+
+static const audio_sink_t ring_sink = {
+    .name = "ring",
+    .rate = SIM_SAMPLE_RATE,
+    .acquire = ring_sink_acquire,
+    .commit = ring_sink_commit,
+};
+
+static void *reader_task(void *arg)
+{
+    struct timespec cpu;
+
+    while (audio_pipeline_run(&pipeline) != AUDIO_PIPE_EOS) {
+    }
+    audio_pipeline_finish(&pipeline);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    sim.cpu_s = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    __atomic_store_n(&sim.done, true, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&vt_lock);
+    sim.state = READER_DONE;
+    pthread_cond_broadcast(&vt_cond);
+    pthread_mutex_unlock(&vt_lock);
+    return NULL;
+}
+
+/* ---------------- output WAV ---------------- */
+
+static void wav_write_header(FILE *fp, uint32_t rate, uint32_t frames)
+{
+    uint32_t data = frames * 4;
+    uint8_t h[44] = "RIFF____WAVEfmt ____________________data____";
+
+    #define PUT32(o, v) do { uint32_t v_ = (v); h[o] = v_; h[o + 1] = v_ >> 8; h[o + 2] = v_ >> 16; h[o + 3] = v_ >> 24; } while (0)
+    PUT32(4, 36 + data);
+    PUT32(16, 16);
+    PUT32(20, 1 | 2 << 16);                 // PCM, stereo
+    PUT32(24, rate);
+    PUT32(28, rate * 4);
+    PUT32(32, 4 | 16 << 16);                // block align, bits
+    PUT32(40, data);
+    #undef PUT32
+
+    rewind(fp);
+    fwrite(h, 1, sizeof(h), fp);
+}
+
+// 1 kHz left, 440 Hz right, at half scale
+static int make_tone(uint32_t rate, uint32_t seconds, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    uint32_t frames = rate * seconds;
+
+    if (!fp) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        return 1;
+    }
+    wav_write_header(fp, rate, frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        int16_t s[2] = {
+            (int16_t)lrint(16384 * sin(2 * M_PI * 1000 * i / rate)),
+            (int16_t)lrint(16384 * sin(2 * M_PI * 440 * i / rate)),
+        };
+        fwrite(s, sizeof(s), 1, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* ---------------- virtual A2DP clock ---------------- */
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: audio_sim [-t tick_ms] [-j jitter_ms] [-l sd_latency_us] [-x speed | -v] [-q 0..2]\n"
+            "                 in.wav|in.flac [out.wav]\n"
+            "       audio_sim --tone rate seconds out.wav\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    if (argc == 5 && strcmp(argv[1], "--tone") == 0) {
+        return make_tone(atoi(argv[2]), atoi(argv[3]), argv[4]);
+    }
+
+    sim.tick_ms = AUDIO_SIM_TICK_MS;
+    sim.jitter_ms = AUDIO_SIM_JITTER_MS;
+    sim.speed = 1;
+    sim.quality = RESAMPLER_TAPS_16;
+    while ((opt = getopt(argc, argv, "t:j:l:x:q:v")) != -1) {
+        switch (opt) {
+        case 't': sim.tick_ms = atoi(optarg); break;
+        case 'j': sim.jitter_ms = atoi(optarg); break;
+        case 'l': sim.sd_latency_us = atoi(optarg); break;
+        case 'x': sim.speed = atoi(optarg); break;
+        case 'q': sim.quality = (resampler_quality_t)atoi(optarg); break;
+        case 'v': sim.virtual_time = true; break;
+        default: usage(); return 1;
+        }
+    }
+    if (optind >= argc || sim.tick_ms == 0 || sim.speed == 0 || sim.speed > SIM_SPEED_MAX ||
+        sim.quality > RESAMPLER_TAPS_32) {
+        usage();
+        return 1;
+    }
+
+    FILE *out = NULL;
+    if (optind + 1 < argc && !(out = fopen(argv[optind + 1], "wb"))) {
+        fprintf(stderr, "Cannot create %s\n", argv[optind + 1]);
+        return 1;
+    }
+    if (!source_open(argv[optind]) || !audio_ring_init(&ring, SIM_RING_SIZE, SIM_BUF_BYTES) ||
+        !audio_pipeline_init(&pipeline, SIM_BUF_BYTES)) {
+        return 1;
+    }
+    if (out) {
+        wav_write_header(out, SIM_SAMPLE_RATE, 0);
+    }
+    audio_pipeline_set_source(&pipeline, &file_source);
+    audio_pipeline_add(&pipeline, &resample_element);
+    audio_pipeline_set_sink(&pipeline, &ring_sink);
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_task, NULL);
+
+    // Virtual time advances by the real time slept, times speed, or by whole ticks with -v
+    static uint8_t pull[(AUDIO_SIM_SBC_FRAMES * 64) * 4];
+    uint64_t owed_us = 0, sent_frames = 0, out_frames = 0;
+    uint64_t underruns = 0, short_frames = 0, pulls = 0, depth_sum = 0;
+    uint32_t depth_max = 0;
+    int64_t first_audio_us = -1;
+    int64_t t0 = now_us(), last = t0;
+
+    srand(1);
+    while (!__atomic_load_n(&sim.done, __ATOMIC_ACQUIRE) || audio_ring_fill(&ring)) {
+        uint32_t jitter = sim.jitter_ms ? rand() % (sim.jitter_ms + 1) : 0;
+        if (sim.virtual_time) {
+            pthread_mutex_lock(&vt_lock);
+            sim.clock_us += (int64_t)(sim.tick_ms + jitter) * 1000;
+            pthread_cond_broadcast(&vt_cond);
+            while (!reader_settled()) {
+                pthread_cond_wait(&vt_cond, &vt_lock);
+            }
+            owed_us = sim.clock_us;
+            pthread_mutex_unlock(&vt_lock);
+        } else {
+            sleep_us((int64_t)(sim.tick_ms + jitter) * 1000 / sim.speed);
+
+            int64_t t = now_us();
+            owed_us += (uint64_t)(t - last) * sim.speed;
+            last = t;
+        }
+
+        // Whole SBC frames the 44.1 kHz clock owes since the start
+        uint64_t due = owed_us * SIM_SAMPLE_RATE / 1000000;
+        due -= due % AUDIO_SIM_SBC_FRAMES;
+        uint32_t frames = due - sent_frames;
+        if (frames > sizeof(pull) / 4) {
+            frames = sizeof(pull) / 4;
+        }
+        sent_frames = due;
+
+        uint32_t fill = audio_ring_fill(&ring);
+        depth_sum += fill;
+        depth_max = fill > depth_max ? fill : depth_max;
+        pulls++;
+
+        uint32_t got = audio_ring_read(&ring, pull, frames * 4) / 4;
+        if (got && first_audio_us < 0) {
+            first_audio_us = (int64_t)owed_us;
+        }
+        // Short before the first audio is start-up; after it is a dropout
+        if (got < frames && first_audio_us >= 0 && !__atomic_load_n(&sim.done, __ATOMIC_ACQUIRE)) {
+            underruns++;
+            short_frames += frames - got;
+        }
+        if (out && got) {
+            fwrite(pull, 4, got, out);
+        }
+        out_frames += got;
+    }
+    pthread_join(reader, NULL);
+
+    if (out) {
+        wav_write_header(out, SIM_SAMPLE_RATE, out_frames);
+        fclose(out);
+    }
+
+    double audio_s = (double)out_frames / SIM_SAMPLE_RATE;
+    // Every output frame up to the last input frame, give or take the rounding of the step
+    uint64_t expect = (sim.frames_in * SIM_SAMPLE_RATE + sim.rate - 1) / sim.rate;
+    uint64_t slack = sim.rate == SIM_SAMPLE_RATE ? 0 : 1;
+
+    printf("source      %u Hz %s, %llu frames\n", (unsigned)sim.rate, sim.flac ? "FLAC" : "WAV",
+           (unsigned long long)sim.frames_in);
+    printf("output      %llu frames (%.2f s), expected %llu\n", (unsigned long long)out_frames,
+           audio_s, (unsigned long long)expect);
+    printf("underruns   %llu (%llu frames short)\n", (unsigned long long)underruns,
+           (unsigned long long)short_frames);
+    printf("start       %.1f ms to first audio\n", first_audio_us / 1000.0);
+    printf("ring depth  avg %.1f ms, max %.1f ms\n",
+           pulls ? depth_sum / 4.0 / pulls * 1000 / SIM_SAMPLE_RATE : 0,
+           depth_max / 4.0 * 1000 / SIM_SAMPLE_RATE);
+    printf("reader cpu  %.2f ms per second of audio\n", audio_s > 0 ? sim.cpu_s * 1000 / audio_s : 0);
+
+    if (underruns) {
+        return 2;
+    }
+    return out_frames + slack < expect || out_frames > expect + slack ? 3 : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef BT_MANAGER_H
+#define BT_MANAGER_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BT_AVRC_VOL_STEP            5       // as in the real header
+
+// Host stand-in: the calls the audio component makes into bt_manager, defined by each test
+void bt_media_start(void);
+void bt_media_idle(void);
+void bt_avrc_notify_play_status(void);
+void bt_avrc_notify_track(void);
+void bt_avrc_notify_volume(void);
+bool bt_avrc_abs_volume(void);
+bool bt_avrc_set_volume(uint8_t percent);
+
+#endif // BT_MANAGER_H
@@ -0,0 +1,71 @@
+#ifndef I2S_STD_H
+#define I2S_STD_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+ * Host stand-in for the I2S standard-mode driver, as far as audio_output.c
+ * uses it. There is no DAC: a channel writes what it is given to the file
+ * set with i2s_host_capture(), and each write takes as long as the DMA
+ * would need to play it, divided by the capture speed.
+ */
+typedef struct host_i2s_chan *i2s_chan_handle_t;
+
+typedef enum { I2S_NUM_0 } i2s_port_t;
+typedef enum { I2S_ROLE_MASTER } i2s_role_t;
+typedef enum { I2S_DATA_BIT_WIDTH_16BIT = 16 } i2s_data_bit_width_t;
+typedef enum { I2S_SLOT_MODE_MONO = 1, I2S_SLOT_MODE_STEREO = 2 } i2s_slot_mode_t;
+
+#define I2S_GPIO_UNUSED     (-1)
+
+typedef struct {
+    i2s_port_t id;
+    i2s_role_t role;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    bool auto_clear;
+} i2s_chan_config_t;
+
+typedef struct {
+    uint32_t sample_rate_hz;
+} i2s_std_clk_config_t;
+
+typedef struct {
+    i2s_data_bit_width_t data_bit_width;
+    i2s_slot_mode_t slot_mode;
+} i2s_std_slot_config_t;
+
+typedef struct {
+    int mclk, bclk, ws, dout, din;
+} i2s_std_gpio_config_t;
+
+typedef struct {
+    i2s_std_clk_config_t clk_cfg;
+    i2s_std_slot_config_t slot_cfg;
+    i2s_std_gpio_config_t gpio_cfg;
+} i2s_std_config_t;
+
+#define I2S_CHANNEL_DEFAULT_CONFIG(num, r) { .id = (num), .role = (r), .dma_desc_num = 6, .dma_frame_num = 240 }
+#define I2S_STD_CLK_DEFAULT_CONFIG(rate) { .sample_rate_hz = (rate) }
+#define I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bits, mode) { .data_bit_width = (bits), .slot_mode = (mode) }
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *cfg, i2s_chan_handle_t *tx, i2s_chan_handle_t *rx);
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t chan, const i2s_std_config_t *cfg);
+esp_err_t i2s_del_channel(i2s_chan_handle_t chan);
+esp_err_t i2s_channel_enable(i2s_chan_handle_t chan);
+esp_err_t i2s_channel_disable(i2s_chan_handle_t chan);
+esp_err_t i2s_channel_write(i2s_chan_handle_t chan, const void *src, size_t size,
+                            size_t *written, TickType_t timeout);
+
+// Host only: where channel output goes, and how much faster than real time it plays
+bool i2s_host_capture(const char *path, uint32_t speed);
+// Host only: a channel is enabled; the capture file is flushed when it is disabled
+bool i2s_host_running(void);
+
+#endif // I2S_STD_H
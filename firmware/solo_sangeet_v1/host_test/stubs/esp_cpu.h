@@ -0,0 +1,18 @@
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Host stand-in: nanoseconds, so "cycles" in reports read as ns
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+#endif // ESP_CPU_H
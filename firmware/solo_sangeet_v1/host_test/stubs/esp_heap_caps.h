@@ -0,0 +1,49 @@
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DMA          (1 << 3)
+#define MALLOC_CAP_8BIT         (1 << 2)
+#define MALLOC_CAP_INTERNAL     (1 << 11)
+#define MALLOC_CAP_SPIRAM       (1 << 10)
+
+// Host stand-in: one heap, caps ignored, reported as HOST_HEAP_FREE free
+#define HOST_HEAP_FREE          ((size_t)64 << 20)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+static inline void *heap_caps_realloc(void *p, size_t size, uint32_t caps)
+{
+    return realloc(p, size);
+}
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    void *p = NULL;
+
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+static inline void heap_caps_free(void *p)
+{
+    free(p);
+}
+
+static inline size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return HOST_HEAP_FREE;
+}
+
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return HOST_HEAP_FREE;
+}
+
+#endif // ESP_HEAP_CAPS_H
@@ -0,0 +1,24 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in: errors and warnings to stderr, the rest only with HOST_LOG_VERBOSE
+#ifdef HOST_LOG_VERBOSE
+#define HOST_LOG_INFO   1
+#else
+#define HOST_LOG_INFO   0
+#endif
+
+#define HOST_LOG(level, tag, fmt, ...) \
+    fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do { if (HOST_LOG_INFO) HOST_LOG("I", tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { if (0) HOST_LOG("D", tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { if (0) HOST_LOG("V", tag, fmt, ##__VA_ARGS__); } while (0)
+
+#endif // ESP_LOG_H
@@ -0,0 +1,15 @@
+#ifndef ESP_RANDOM_H
+#define ESP_RANDOM_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Host stand-in: repeatable from srand()
+static inline uint32_t esp_random(void)
+{
+    return (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+#endif // ESP_RANDOM_H
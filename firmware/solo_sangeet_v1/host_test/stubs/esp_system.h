@@ -0,0 +1,14 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in: no heap accounting, reports read as zero
+static inline uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+#endif // ESP_SYSTEM_H
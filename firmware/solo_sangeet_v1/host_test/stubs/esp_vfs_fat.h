@@ -0,0 +1,55 @@
+#ifndef ESP_VFS_FAT_H
+#define ESP_VFS_FAT_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+// Host stand-in: enough for sd_fs_init() to compile, mounting always fails
+typedef struct {
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+typedef struct {
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct {
+    int gpio_cs;
+    int host_id;
+} sdspi_device_config_t;
+
+#define SPI3_HOST                       2
+#define SPI_DMA_CH2                     2
+#define SDSPI_HOST_DEFAULT()            ((sdmmc_host_t){ .max_freq_khz = 20000 })
+#define SDSPI_DEVICE_CONFIG_DEFAULT()   ((sdspi_device_config_t){ .gpio_cs = -1 })
+
+static inline esp_err_t spi_bus_initialize(int host, const spi_bus_config_t *cfg, int dma)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_vfs_fat_sdspi_mount(const char *base, const sdmmc_host_t *host,
+                                                const sdspi_device_config_t *slot,
+                                                const esp_vfs_fat_sdmmc_mount_config_t *cfg,
+                                                sdmmc_card_t **card)
+{
+    return ESP_FAIL;
+}
+
+#endif // ESP_VFS_FAT_H
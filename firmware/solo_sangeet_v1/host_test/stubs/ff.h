@@ -0,0 +1,50 @@
+#ifndef FF_H
+#define FF_H
+
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in: the card is a directory, see ff_host.c
+typedef uint16_t WCHAR;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_NO_PATH = 5,
+    FR_INVALID_OBJECT = 9,
+} FRESULT;
+
+#define AM_DIR          0x10
+#define FF_CODE_PAGE    437
+#define FF_MAX_LFN      255
+
+typedef struct {
+    DWORD fsize;
+    WORD fdate;
+    WORD ftime;
+    uint8_t fattrib;
+    char fname[FF_MAX_LFN + 1];
+} FILINFO;
+
+typedef struct {
+    void *dir;                          // DIR * of the host directory
+    char path[512];
+} FF_DIR;
+
+FRESULT f_opendir(FF_DIR *dp, const char *path);
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno);    // fno NULL rewinds
+FRESULT f_closedir(FF_DIR *dp);
+WCHAR ff_uni2oem(DWORD uni, WORD cp);
+
+// Directories opened and entries read since the last reset, the cost of a walk
+typedef struct {
+    uint32_t dirs_opened;
+    uint32_t entries_read;
+} ff_host_stats_t;
+
+extern ff_host_stats_t ff_host_stats;
+
+#endif // FF_H
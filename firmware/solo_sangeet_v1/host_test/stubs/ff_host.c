@@ -0,0 +1,87 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "ff.h"
+#include "file_manager.h"
+
+ff_host_stats_t ff_host_stats;
+
+// "0:/x" is SD_MOUNT_POINT "/x" on the host
+FRESULT f_opendir(FF_DIR *dp, const char *path)
+{
+    size_t drive = strlen(SD_FATFS_DRIVE);
+
+    if (strncmp(path, SD_FATFS_DRIVE, drive) != 0) {
+        return FR_NO_PATH;
+    }
+    int n = snprintf(dp->path, sizeof(dp->path), "%s%s", SD_MOUNT_POINT, path + drive);
+    if (n < 0 || n >= (int)sizeof(dp->path)) {
+        return FR_NO_PATH;
+    }
+    dp->dir = opendir(dp->path);
+    if (!dp->dir) {
+        return FR_NO_PATH;
+    }
+    ff_host_stats.dirs_opened++;
+    return FR_OK;
+}
+
+// FAT keeps local time in two words, two second resolution
+static void fat_time(time_t t, WORD *fdate, WORD *ftime)
+{
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    *fdate = (WORD)((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday);
+    *ftime = (WORD)(tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+}
+
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno)
+{
+    char path[sizeof(dp->path) + FF_MAX_LFN + 2];
+    struct dirent *de;
+    struct stat st;
+
+    if (!dp->dir) {
+        return FR_INVALID_OBJECT;
+    }
+    if (!fno) {
+        rewinddir(dp->dir);
+        return FR_OK;
+    }
+    // FATFS has no "." and ".." in the root and a walk skips them elsewhere
+    do {
+        de = readdir(dp->dir);
+    } while (de && (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")));
+    if (!de) {
+        fno->fname[0] = '\0';
+        return FR_OK;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dp->path, de->d_name);
+    if (stat(path, &st) != 0) {
+        return FR_DISK_ERR;
+    }
+    ff_host_stats.entries_read++;
+    snprintf(fno->fname, sizeof(fno->fname), "%s", de->d_name);
+    fno->fsize = S_ISDIR(st.st_mode) ? 0 : (DWORD)st.st_size;
+    fno->fattrib = S_ISDIR(st.st_mode) ? AM_DIR : 0;
+    fat_time(st.st_mtime, &fno->fdate, &fno->ftime);
+    return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR *dp)
+{
+    if (dp->dir) {
+        closedir(dp->dir);
+        dp->dir = NULL;
+    }
+    return FR_OK;
+}
+
+// No code page tables on the host, only ASCII converts
+WCHAR ff_uni2oem(DWORD uni, WORD cp)
+{
+    return uni < 0x80 ? (WCHAR)uni : 0;
+}
@@ -0,0 +1,21 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in: a tick is a millisecond, tasks are pthreads
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#define configASSERT(x)     do { if (!(x)) __builtin_trap(); } while (0)
+
+#endif // FREERTOS_H
@@ -0,0 +1,11 @@
+#ifndef FREERTOS_EVENT_GROUPS_H
+#define FREERTOS_EVENT_GROUPS_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in: the audio headers only name the handle type
+typedef struct host_event_group *EventGroupHandle_t;
+
+#endif // FREERTOS_EVENT_GROUPS_H
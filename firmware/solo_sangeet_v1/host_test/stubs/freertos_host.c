@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+// Task notification value with a condition variable, one per thread
+struct host_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t value;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+// Threads not made by xTaskCreate(), such as main(), get one of their own
+static __thread struct host_task self = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+static __thread struct host_task *current;
+
+static void *task_entry(void *arg)
+{
+    current = arg;
+    current->fn(current->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                       UBaseType_t prio, TaskHandle_t *handle)
+{
+    struct host_task *task = calloc(1, sizeof(*task));
+    pthread_t thread;
+
+    if (!task) {
+        return pdFALSE;
+    }
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    task->fn = fn;
+    task->arg = arg;
+    // Known to the creator before the task runs, as on the target
+    if (handle) {
+        *handle = task;
+    }
+    if (pthread_create(&thread, NULL, task_entry, task) != 0) {
+        free(task);
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current ? current : &self;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->value++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+// Absolute CLOCK_REALTIME time ticks from now, for pthread_cond_timedwait()
+static struct timespec deadline(TickType_t ticks)
+{
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ticks / 1000;
+    until.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    return until;
+}
+
+// One wait on cond, false once the deadline has passed; lock held
+static bool wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+                       const struct timespec *until)
+{
+    if (ticks == 0) {
+        return false;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, until) == 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task *t = xTaskGetCurrentTaskHandle();
+    struct timespec until = deadline(ticks);
+    uint32_t value;
+
+    pthread_mutex_lock(&t->lock);
+    while (t->value == 0 && wait_until(&t->cond, &t->lock, ticks, &until)) {
+    }
+    value = t->value;
+    if (value) {
+        t->value = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000 };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *prev, TickType_t period)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    *prev += period;
+    if ((int32_t)(*prev - now) > 0) {
+        vTaskDelay(*prev - now);
+    }
+}
+
+// Fixed-size items copied in and out of a ring, as the FreeRTOS queue does
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t len;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q) + (size_t)len * item_size);
+
+    if (!q) {
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    q->len = len;
+    q->item_size = item_size;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    struct timespec until = deadline(ticks);
+    BaseType_t sent = pdFALSE;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->len && wait_until(&q->changed, &q->lock, ticks, &until)) {
+    }
+    if (q->count < q->len) {
+        UBaseType_t tail = (q->head + q->count) % q->len;
+        memcpy(q->items + (size_t)tail * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_broadcast(&q->changed);
+        sent = pdTRUE;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return sent;
+}
+
+// Only for queues of length one, as on the target
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    memcpy(q->items + (size_t)q->head * q->item_size, item, q->item_size);
+    q->count = 1;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    struct timespec until = deadline(ticks);
+    BaseType_t got = pdFALSE;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && wait_until(&q->changed, &q->lock, ticks, &until)) {
+    }
+    if (q->count) {
+        memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->len;
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+        got = pdTRUE;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&q->lock);
+    count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+struct host_mutex {
+    pthread_mutex_t lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct host_mutex *m = calloc(1, sizeof(*m));
+
+    if (m) {
+        pthread_mutex_init(&m->lock, NULL);
+    }
+    return m;
+}
+
+// Callers here only ever wait forever
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
@@ -0,0 +1,31 @@
+#include <stddef.h>
+#include "mp3dec.h"
+
+// Helix is target-only: on the host an MP3 decoder never comes up
+HMP3Decoder MP3InitDecoder(void)
+{
+    return NULL;
+}
+
+void MP3FreeDecoder(HMP3Decoder hMP3Decoder)
+{
+}
+
+int MP3FindSyncWord(unsigned char *buf, int nBytes)
+{
+    for (int i = 0; i + 1 < nBytes; i++) {
+        if (buf[i] == 0xff && (buf[i + 1] & 0xe0) == 0xe0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int MP3Decode(HMP3Decoder hMP3Decoder, unsigned char **inbuf, int *bytesLeft, short *outbuf, int useSize)
+{
+    return ERR_MP3_INDATA_UNDERFLOW;
+}
+
+void MP3GetLastFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo)
+{
+}
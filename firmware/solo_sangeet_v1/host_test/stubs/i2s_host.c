@@ -0,0 +1,105 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "driver/i2s_std.h"
+
+// The one TX channel audio_output.c makes, playing into a file
+struct host_i2s_chan {
+    uint32_t rate;
+    uint32_t frame_bytes;
+    volatile bool enabled;
+    int64_t due_ns;             // when the DMA would have played everything written
+};
+
+static FILE *capture;
+static uint32_t capture_speed = 1;
+static struct host_i2s_chan *running;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool i2s_host_capture(const char *path, uint32_t speed)
+{
+    if (capture) {
+        fclose(capture);
+    }
+    capture = fopen(path, "wb");
+    capture_speed = speed ? speed : 1;
+    return capture != NULL;
+}
+
+bool i2s_host_running(void)
+{
+    return __atomic_load_n(&running, __ATOMIC_ACQUIRE) != NULL;
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *cfg, i2s_chan_handle_t *tx, i2s_chan_handle_t *rx)
+{
+    *tx = calloc(1, sizeof(**tx));
+    return *tx ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t chan, const i2s_std_config_t *cfg)
+{
+    chan->rate = cfg->clk_cfg.sample_rate_hz;
+    chan->frame_bytes = cfg->slot_cfg.data_bit_width / 8 * cfg->slot_cfg.slot_mode;
+    return chan->rate && chan->frame_bytes ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t chan)
+{
+    free(chan);
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t chan)
+{
+    if (chan->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    chan->enabled = true;
+    chan->due_ns = now_ns();
+    __atomic_store_n(&running, chan, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t chan)
+{
+    if (!chan->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    chan->enabled = false;
+    if (capture) {
+        fflush(capture);
+    }
+    __atomic_store_n(&running, NULL, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t chan, const void *src, size_t size,
+                            size_t *written, TickType_t timeout)
+{
+    if (!chan->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (capture) {
+        fwrite(src, 1, size, capture);
+    }
+
+    // Blocks until the DMA would have room, at the capture speed
+    chan->due_ns += (int64_t)size / chan->frame_bytes * 1000000000 / chan->rate / capture_speed;
+    int64_t wait = chan->due_ns - now_ns();
+    if (wait > 0) {
+        struct timespec ts = { .tv_sec = wait / 1000000000, .tv_nsec = wait % 1000000000 };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+    *written = size;
+    return ESP_OK;
+}
@@ -0,0 +1,9 @@
+#ifndef LVGL_H
+#define LVGL_H
+
+#pragma once
+
+// Host stand-in: the audio headers only pass LVGL types by pointer
+typedef struct lv_image_dsc_t lv_image_dsc_t;
+
+#endif // LVGL_H
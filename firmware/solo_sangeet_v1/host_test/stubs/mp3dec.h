@@ -0,0 +1,33 @@
+#ifndef MP3DEC_H
+#define MP3DEC_H
+
+#pragma once
+
+// Host stand-in: the Helix API mp3_decoder.c uses, see helix_host.c
+typedef void *HMP3Decoder;
+
+#define MAINBUF_SIZE    1940
+
+enum {
+    ERR_MP3_NONE = 0,
+    ERR_MP3_INDATA_UNDERFLOW = -1,
+    ERR_MP3_MAINDATA_UNDERFLOW = -2,
+};
+
+typedef struct {
+    int bitrate;
+    int nChans;
+    int samprate;
+    int bitsPerSample;
+    int outputSamps;
+    int layer;
+    int version;
+} MP3FrameInfo;
+
+HMP3Decoder MP3InitDecoder(void);
+void MP3FreeDecoder(HMP3Decoder hMP3Decoder);
+int MP3FindSyncWord(unsigned char *buf, int nBytes);
+int MP3Decode(HMP3Decoder hMP3Decoder, unsigned char **inbuf, int *bytesLeft, short *outbuf, int useSize);
+void MP3GetLastFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo);
+
+#endif // MP3DEC_H
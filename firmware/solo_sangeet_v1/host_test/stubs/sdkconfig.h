@@ -0,0 +1,9 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#pragma once
+
+// Host stand-in: esp_cpu_get_cycle_count() counts nanoseconds, a 1 GHz "core"
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ     1000
+
+#endif // SDKCONFIG_H
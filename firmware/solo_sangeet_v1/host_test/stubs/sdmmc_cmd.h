@@ -0,0 +1,17 @@
+#ifndef SDMMC_CMD_H
+#define SDMMC_CMD_H
+
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in: nothing is mounted, the card is a directory
+typedef struct {
+    int unused;
+} sdmmc_card_t;
+
+static inline void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+}
+
+#endif // SDMMC_CMD_H
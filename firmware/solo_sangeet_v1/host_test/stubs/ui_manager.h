@@ -0,0 +1,9 @@
+#ifndef UI_MANAGER_H
+#define UI_MANAGER_H
+
+#pragma once
+
+// Host stand-in: the one call the audio component makes into the UI, defined by each test
+void ui_reset_play_button(void);
+
+#endif // UI_MANAGER_H
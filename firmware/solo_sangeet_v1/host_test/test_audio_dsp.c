@@ -0,0 +1,238 @@
+/*
+ * audio_dsp: EQ response against the analytic cascade over a sine sweep,
+ * band centre gains, the limiter ceiling and release, and the chain's
+ * cost against AUDIO_DSP_CPU_BUDGET_PCT.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "audio_dsp.h"
+#include "sdkconfig.h"
+#include "test_util.h"
+
+#define RATE            44100
+#define SETTLE_FRAMES   8192        // filter start-up left out of a measurement
+#define MEASURE_FRAMES  32768
+#define BENCH_SECONDS   10
+#define TOL_DB          0.2
+
+static const double band_freq[AUDIO_DSP_EQ_BANDS] = { 60, 250, 1000, 4000, 12000 };
+
+static audio_dsp_t dsp;
+static int16_t buf[(SETTLE_FRAMES + MEASURE_FRAMES) * 2];
+
+static void dsp_setup(const int8_t *db)
+{
+    audio_dsp_init(&dsp, RATE);
+    for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+        audio_dsp_set_eq(&dsp, b, db[b]);
+    }
+}
+
+static void sine(int16_t *dst, size_t frames, double freq, double amp, size_t phase)
+{
+    for (size_t i = 0; i < frames; i++) {
+        dst[2 * i] = dst[2 * i + 1] = (int16_t)lrint(amp * sin(2 * M_PI * freq * (i + phase) / RATE));
+    }
+}
+
+// Through the chain in pipeline-sized blocks
+static void process(int16_t *pcm, size_t frames)
+{
+    for (size_t i = 0; i < frames; i += 1152) {
+        audio_dsp_process(&dsp, pcm + 2 * i, frames - i < 1152 ? frames - i : 1152);
+    }
+}
+
+static double rms(const int16_t *pcm, size_t frames)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < frames * 2; i++) {
+        sum += (double)pcm[i] * pcm[i];
+    }
+    return sqrt(sum / (frames * 2));
+}
+
+// Gain of a sine through the chain, settled, in dB
+static double measure_db(double freq, double amp)
+{
+    size_t frames = SETTLE_FRAMES + MEASURE_FRAMES;
+
+    sine(buf, frames, freq, amp, 0);
+    double in = rms(buf + 2 * SETTLE_FRAMES, MEASURE_FRAMES);
+    process(buf, frames);
+    return 20 * log10(rms(buf + 2 * SETTLE_FRAMES, MEASURE_FRAMES) / in);
+}
+
+// RBJ peaking response of the cascade, in double, as the design intends it
+static double expected_db(const int8_t *db, double freq)
+{
+    double total = 0;
+
+    for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+        if (db[b] == 0) {
+            continue;
+        }
+        double A = pow(10, db[b] / 40.0);
+        double w0 = 2 * M_PI * band_freq[b] / RATE;
+        double alpha = sin(w0) / 2;
+        double b0 = 1 + alpha * A, b1 = -2 * cos(w0), b2 = 1 - alpha * A;
+        double a0 = 1 + alpha / A, a1 = b1, a2 = 1 - alpha / A;
+        double w = 2 * M_PI * freq / RATE;
+        // |B(e^jw)| / |A(e^jw)|
+        double nr = b0 + b1 * cos(w) + b2 * cos(2 * w), ni = -b1 * sin(w) - b2 * sin(2 * w);
+        double dr = a0 + a1 * cos(w) + a2 * cos(2 * w), di = -a1 * sin(w) - a2 * sin(2 * w);
+        total += 10 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+    }
+    return total;
+}
+
+static void test_flat(void)
+{
+    static const int8_t flat[AUDIO_DSP_EQ_BANDS] = { 0 };
+    static int16_t ref[4096 * 2];
+
+    // Full volume, no EQ, under the ceiling: bit exact
+    dsp_setup(flat);
+    for (size_t i = 0; i < 4096 * 2; i++) {
+        ref[i] = buf[i] = (int16_t)(rand() % 40000 - 20000);
+    }
+    process(buf, 4096);
+    size_t diff = 0;
+    for (size_t i = 0; i < 4096 * 2; i++) {
+        diff += buf[i] != ref[i];
+    }
+    CHECK_EQ(diff, 0);
+}
+
+static void test_sweep(void)
+{
+    static const int8_t settings[][AUDIO_DSP_EQ_BANDS] = {
+        { 6, -4, 3, -6, 5 },
+        { -12, 12, -12, 12, -12 },
+    };
+    double worst = 0;
+
+    for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+        // Third octaves, 20 Hz to 20 kHz
+        for (double f = 20; f < 20500; f *= pow(2, 1 / 3.0)) {
+            dsp_setup(settings[s]);
+            double got = measure_db(f, 2000);
+            double want = expected_db(settings[s], f);
+            if (fabs(got - want) > worst) {
+                worst = fabs(got - want);
+            }
+            if (fabs(got - want) > TOL_DB) {
+                fprintf(stderr, "setting %zu, %.0f Hz: %+.2f dB, expected %+.2f dB\n", s, f, got, want);
+                test_failures++;
+            }
+        }
+    }
+    printf("EQ sweep: worst error %.3f dB\n", worst);
+}
+
+static void test_band_centres(void)
+{
+    for (int b = 0; b < AUDIO_DSP_EQ_BANDS; b++) {
+        for (int db = -AUDIO_DSP_EQ_MAX_DB; db <= AUDIO_DSP_EQ_MAX_DB; db += 2 * AUDIO_DSP_EQ_MAX_DB) {
+            int8_t set[AUDIO_DSP_EQ_BANDS] = { 0 };
+
+            set[b] = (int8_t)db;
+            dsp_setup(set);
+            double got = measure_db(band_freq[b], 2000);
+            printf("band %5.0f Hz at %+3d dB: %+6.2f dB\n", band_freq[b], db, got);
+            CHECK(fabs(got - db) < TOL_DB);
+        }
+    }
+
+    // Out of range settings clamp to the maximum
+    int8_t set[AUDIO_DSP_EQ_BANDS] = { 0, 0, 40, 0, 0 };
+    dsp_setup(set);
+    CHECK(fabs(measure_db(1000, 2000) - AUDIO_DSP_EQ_MAX_DB) < TOL_DB);
+}
+
+static void test_limiter(void)
+{
+    static const int8_t boost[AUDIO_DSP_EQ_BANDS] = { 0, 0, AUDIO_DSP_EQ_MAX_DB, 0, 0 };
+    size_t frames = SETTLE_FRAMES + MEASURE_FRAMES;
+    int peak = 0;
+
+    // Half scale boosted by 12 dB runs into the ceiling, never past it
+    dsp_setup(boost);
+    sine(buf, frames, 1000, 16384, 0);
+    process(buf, frames);
+    for (size_t i = SETTLE_FRAMES * 2; i < frames * 2; i++) {
+        peak = abs(buf[i]) > peak ? abs(buf[i]) : peak;
+    }
+    for (size_t i = 0; i < frames * 2; i++) {
+        if (abs(buf[i]) > AUDIO_DSP_LIMIT_CEILING + 1) {
+            CHECK(!"sample over the ceiling");
+            break;
+        }
+    }
+    printf("limiter: peak %d, ceiling %d\n", peak, AUDIO_DSP_LIMIT_CEILING);
+    CHECK(peak > AUDIO_DSP_LIMIT_CEILING * 95 / 100);
+
+    // Quiet again: the gain reduction releases and the boost is back
+    double got = measure_db(1000, 2000);
+    CHECK(fabs(got - AUDIO_DSP_EQ_MAX_DB) < 0.5);
+}
+
+static void test_volume_ramp(void)
+{
+    static const int8_t flat[AUDIO_DSP_EQ_BANDS] = { 0 };
+    size_t frames = AUDIO_DSP_RAMP_FRAMES * 2;
+
+    // Half volume is a quarter of the level, reached over one ramp without a step
+    dsp_setup(flat);
+    audio_dsp_set_volume(&dsp, 50);
+    for (size_t i = 0; i < frames; i++) {
+        buf[2 * i] = buf[2 * i + 1] = 16384;
+    }
+    process(buf, frames);
+    int max_step = 0;
+    for (size_t i = 1; i < frames; i++) {
+        int step = abs(buf[2 * i] - buf[2 * i - 2]);
+        max_step = step > max_step ? step : max_step;
+    }
+    CHECK(max_step <= 16384 / AUDIO_DSP_RAMP_FRAMES + 1);
+    CHECK(abs(buf[2 * (frames - 1)] - 4096) <= 1);
+    CHECK_EQ(audio_dsp_get_volume(&dsp), 50);
+}
+
+static void bench(void)
+{
+    static const int8_t all[AUDIO_DSP_EQ_BANDS] = { 6, -4, 3, -6, 5 };
+    static int16_t block[1152 * 2];
+
+    dsp_setup(all);
+    for (size_t i = 0; i < 1152 * 2; i++) {
+        block[i] = (int16_t)(rand() % 20000 - 10000);
+    }
+    for (uint32_t n = 0; n < BENCH_SECONDS * RATE / 1152; n++) {
+        audio_dsp_process(&dsp, block, 1152);
+    }
+
+    uint32_t load = audio_dsp_load_permille(&dsp);
+    printf("5 bands: gain %.0f, eq %.0f, limiter %.0f ns/block of %d frames\n",
+           (double)dsp.cycles[AUDIO_DSP_STAGE_GAIN] / dsp.blocks,
+           (double)dsp.cycles[AUDIO_DSP_STAGE_EQ] / dsp.blocks,
+           (double)dsp.cycles[AUDIO_DSP_STAGE_LIMITER] / dsp.blocks, AUDIO_DSP_BLOCK_FRAMES);
+    printf("chain load %u.%u%% of a %d MHz core, budget %d%%\n", (unsigned)(load / 10),
+           (unsigned)(load % 10), CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, AUDIO_DSP_CPU_BUDGET_PCT);
+    CHECK(load > 0);
+    CHECK(load <= AUDIO_DSP_CPU_BUDGET_PCT * 10);
+}
+
+int main(void)
+{
+    srand(1);
+    test_flat();
+    test_sweep();
+    test_band_centres();
+    test_limiter();
+    test_volume_ramp();
+    bench();
+    return TEST_RESULT();
+}
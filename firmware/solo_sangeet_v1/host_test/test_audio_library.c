@@ -0,0 +1,251 @@
+/*
+ * audio_library: full and incremental builds over a card tree of tagged
+ * MP3s, walked by the real file_manager through a FATFS stand-in backed by
+ * a host directory (stubs/ff_host.c).
+ *
+ * Each scan is timed and its SD work counted: directories opened, entries
+ * read, and the directories and files whose tags were read. An unchanged
+ * card must not open a track, a changed album only its own.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../components/audio_player/audio_library.c"
+#include "ff.h"
+#include "test_util.h"
+
+#define ARTISTS         30
+#define ALBUMS          4           // per artist
+#define TRACKS          12          // per album, 1,440 in all
+#define CARD_DIRS       (1 + ARTISTS + ARTISTS * ALBUMS)
+#define CARD_TRACKS     (ARTISTS * ALBUMS * TRACKS)
+#define MP3_FRAMES      8
+
+/* ---------------- what audio_library.c takes from audio_player ---------------- */
+
+audio_ring_t audio_ring;
+
+bool audio_player_is_playing(void)
+{
+    return false;
+}
+
+bool audio_path_is_track(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+
+    return dot && (!strcasecmp(dot, ".mp3") || !strcasecmp(dot, ".flac") || !strcasecmp(dot, ".wav"));
+}
+
+// Tag reads are the file opens of a scan; the directories they fall in are the ones read
+static uint32_t tags_read, tag_dirs;
+static char tag_dir[AUDIO_PATH_MAX];
+
+bool __real_media_tags_read(const char *path, media_tags_t *out);
+
+bool __wrap_media_tags_read(const char *path, media_tags_t *out)
+{
+    size_t len = strrchr(path, '/') - path;
+
+    if (strlen(tag_dir) != len || strncmp(tag_dir, path, len) != 0) {
+        snprintf(tag_dir, sizeof(tag_dir), "%.*s", (int)len, path);
+        tag_dirs++;
+    }
+    tags_read++;
+    return __real_media_tags_read(path, out);
+}
+
+/* ---------------- the card ---------------- */
+
+static void put_be32(FILE *fp, uint32_t v, bool syncsafe)
+{
+    int shift = syncsafe ? 7 : 8;
+
+    for (int i = 3; i >= 0; i--) {
+        fputc((v >> (shift * i)) & (syncsafe ? 0x7f : 0xff), fp);
+    }
+}
+
+static void id3_text(FILE *fp, const char *id, const char *text)
+{
+    fputs(id, fp);
+    put_be32(fp, strlen(text) + 1, false);
+    fputc(0, fp);
+    fputc(0, fp);
+    fputc(0, fp);               // ISO-8859-1
+    fputs(text, fp);
+}
+
+// ID3v2.3 title, artist and album, then a few 32 kbit/s frames
+static bool write_track(const char *path, const char *title, const char *artist, const char *album)
+{
+    static const uint8_t hdr[4] = { 0xFF, 0xFB, 0x10, 0xC4 };
+    uint8_t frame[104] = { 0 };
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp) {
+        return false;
+    }
+    fputs("ID3\x03", fp);
+    fputc(0, fp);
+    fputc(0, fp);
+    put_be32(fp, 3 * 11 + strlen(title) + strlen(artist) + strlen(album), true);
+    id3_text(fp, "TIT2", title);
+    id3_text(fp, "TPE1", artist);
+    id3_text(fp, "TALB", album);
+    memcpy(frame, hdr, sizeof(hdr));
+    for (int i = 0; i < MP3_FRAMES; i++) {
+        fwrite(frame, 1, sizeof(frame), fp);
+    }
+    return fclose(fp) == 0;
+}
+
+static void album_path(char *buf, size_t len, int artist, int album)
+{
+    snprintf(buf, len, SD_MOUNT_POINT "/Artist %02d/Album %d", artist, album);
+}
+
+static void track_path(char *buf, size_t len, int artist, int album, int track)
+{
+    snprintf(buf, len, SD_MOUNT_POINT "/Artist %02d/Album %d/%02d Track.mp3", artist, album, track);
+}
+
+static bool write_album_track(int artist, int album, int track)
+{
+    char path[AUDIO_PATH_MAX], title[32], name[32], record[32];
+
+    track_path(path, sizeof(path), artist, album, track);
+    snprintf(title, sizeof(title), "Song %d-%d-%d", artist, album, track);
+    snprintf(name, sizeof(name), "Artist %d", artist);
+    snprintf(record, sizeof(record), "Album %d-%d", artist, album);
+    return write_track(path, title, name, record);
+}
+
+static bool make_card(void)
+{
+    char path[AUDIO_PATH_MAX];
+    bool ok = system("rm -rf " SD_MOUNT_POINT) == 0 && mkdir(SD_MOUNT_POINT, 0755) == 0;
+
+    for (int a = 0; ok && a < ARTISTS; a++) {
+        snprintf(path, sizeof(path), SD_MOUNT_POINT "/Artist %02d", a);
+        ok = mkdir(path, 0755) == 0;
+        for (int b = 0; ok && b < ALBUMS; b++) {
+            album_path(path, sizeof(path), a, b);
+            ok = mkdir(path, 0755) == 0;
+            for (int t = 0; ok && t < TRACKS; t++) {
+                ok = write_album_track(a, b, t);
+            }
+            // Not a track, listed in the stamp but never opened
+            strcat(path, "/cover.jpg");
+            ok = ok && write_track(path, "", "", "");
+        }
+    }
+    return ok;
+}
+
+/* ---------------- helpers ---------------- */
+
+typedef struct {
+    double ms;
+    ff_host_stats_t ff;
+    uint32_t dirs;              // directories whose tags were read
+    uint32_t tags;
+} scan_t;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static scan_t scan(const char *what)
+{
+    scan_t s;
+
+    memset(&ff_host_stats, 0, sizeof(ff_host_stats));
+    tags_read = tag_dirs = 0;
+    tag_dir[0] = '\0';
+    double t0 = now_ms();
+    CHECK(build_pass());
+    s.ms = now_ms() - t0;
+    s.ff = ff_host_stats;
+    s.dirs = tag_dirs;
+    s.tags = tags_read;
+    printf("%-20s %7.2f ms, %u dirs opened, %u entries, %u dirs read, %u tags read\n", what, s.ms,
+           (unsigned)s.ff.dirs_opened, (unsigned)s.ff.entries_read, (unsigned)s.dirs, (unsigned)s.tags);
+    return s;
+}
+
+static bool has_track(int artist, int album, int track)
+{
+    char path[AUDIO_PATH_MAX], title[32];
+    audio_library_track_t t;
+    int32_t i;
+
+    track_path(path, sizeof(path), artist, album, track);
+    snprintf(title, sizeof(title), "Song %d-%d-%d", artist, album, track);
+    i = audio_library_find(path);
+    return i >= 0 && audio_library_get(i, &t) && strcmp(t.title, title) == 0;
+}
+
+/* ---------------- tests ---------------- */
+
+int main(void)
+{
+    CHECK(make_card());
+    remove(AUDIO_LIBRARY_PATH);
+    // The scanner task is not started, each pass is run here
+    lib_lock = xSemaphoreCreateMutex();
+
+    // Every directory read, every track opened once
+    scan_t full = scan("Full scan:");
+    CHECK_EQ(audio_library_count(), CARD_TRACKS);
+    CHECK_EQ(s_dirs, CARD_DIRS);
+    CHECK_EQ(full.ff.dirs_opened, CARD_DIRS);
+    CHECK_EQ(full.dirs, ARTISTS * ALBUMS);
+    CHECK_EQ(full.tags, CARD_TRACKS);
+    CHECK(has_track(0, 0, 0));
+    CHECK(has_track(ARTISTS - 1, ALBUMS - 1, TRACKS - 1));
+    uint32_t gen = audio_library_generation();
+
+    // Nothing changed: the walk lists directories, no track is opened, the index stays
+    scan_t same = scan("Unchanged card:");
+    CHECK_EQ(same.ff.dirs_opened, CARD_DIRS);
+    CHECK_EQ(same.dirs, 0);
+    CHECK_EQ(same.tags, 0);
+    CHECK_EQ(audio_library_generation(), gen);
+    CHECK_EQ(audio_library_count(), CARD_TRACKS);
+
+    // A track added to one album: only that album is read again
+    CHECK(write_album_track(7, 2, TRACKS));
+    scan_t one = scan("One album changed:");
+    CHECK_EQ(one.dirs, 1);
+    CHECK_EQ(one.tags, TRACKS + 1);
+    CHECK_EQ(audio_library_generation(), gen + 1);
+    CHECK_EQ(audio_library_count(), CARD_TRACKS + 1);
+    CHECK(has_track(7, 2, TRACKS));
+    CHECK(has_track(7, 1, 0));
+    CHECK(has_track(ARTISTS - 1, ALBUMS - 1, TRACKS - 1));
+
+    // An album removed: nothing to read, its tracks go
+    CHECK(system("rm -rf '" SD_MOUNT_POINT "/Artist 03/Album 0'") == 0);
+    scan_t gone = scan("One album removed:");
+    CHECK_EQ(gone.tags, 0);
+    CHECK_EQ(audio_library_generation(), gen + 2);
+    CHECK_EQ(audio_library_count(), CARD_TRACKS + 1 - TRACKS);
+    CHECK(!has_track(3, 0, 0));
+    CHECK(has_track(3, 1, 0));
+
+    // Against a full rebuild of the same card
+    remove(AUDIO_LIBRARY_PATH);
+    s_dirs = 0;
+    scan_t again = scan("Full rebuild:");
+    CHECK_EQ(again.tags, CARD_TRACKS + 1 - TRACKS);
+    printf("Incremental scan opened %u of %u tracks, %.1fx faster than a full one\n",
+           (unsigned)one.tags, (unsigned)again.tags, again.ms / (one.ms > 0 ? one.ms : 1e-3));
+    return TEST_RESULT();
+}
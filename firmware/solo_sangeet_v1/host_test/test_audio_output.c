@@ -0,0 +1,149 @@
+/*
+ * audio_output: BT and I2S sharing the one consumer side of the ring.
+ *
+ * The player's read is replaced by a counter, one number per frame. The
+ * test pulls the BT side itself, the way the A2DP data callback would, and
+ * the I2S task plays into a capture file through the host I2S stand-in.
+ * Across switches every frame must reach exactly one output, in order,
+ * and the output that is not selected must only get silence.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_output.h"
+#include "audio_player.h"
+#include "bt_manager.h"
+#include "driver/i2s_std.h"
+#include "test_util.h"
+
+#define CAPTURE         "aout_i2s.raw"
+#define SPEED           20          // I2S plays at 20x real time
+#define PULL_FRAMES     512         // one A2DP callback's worth
+#define I2S_RUN_FRAMES  (AUDIO_SAMPLE_RATE / 2)
+
+static uint32_t next_frame = 1;     // 0 would read as silence
+static int media_start, media_idle, volume_sets;
+
+/* ---------------- what audio_output.c calls ---------------- */
+
+int32_t audio_player_read(uint8_t *data, int32_t len)
+{
+    uint16_t *p = (uint16_t *)data;
+
+    for (int32_t i = 0; i < len / 4; i++, next_frame++) {
+        p[2 * i] = next_frame & 0xffff;
+        p[2 * i + 1] = next_frame >> 16;
+    }
+    return len;
+}
+
+bool audio_player_is_playing(void) { return true; }
+uint8_t audio_player_get_volume(void) { return 80; }
+void audio_player_set_volume(uint8_t percent) { volume_sets++; }
+
+void bt_media_start(void) { media_start++; }
+void bt_media_idle(void) { media_idle++; }
+void bt_avrc_notify_play_status(void) {}
+void bt_avrc_notify_track(void) {}
+void bt_avrc_notify_volume(void) {}
+bool bt_avrc_abs_volume(void) { return false; }
+bool bt_avrc_set_volume(uint8_t percent) { return true; }
+
+/* ---------------- helpers ---------------- */
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t frame_at(const uint16_t *pcm, size_t i)
+{
+    return pcm[2 * i] | (uint32_t)pcm[2 * i + 1] << 16;
+}
+
+// Pull one callback's worth over BT; the first frame number, 0 if it was silence
+static uint32_t bt_pull(void)
+{
+    static uint16_t pcm[PULL_FRAMES * 2];
+    uint32_t first;
+
+    CHECK_EQ(audio_output_bt_read((uint8_t *)pcm, sizeof(pcm)), sizeof(pcm));
+    first = frame_at(pcm, 0);
+    for (size_t i = 0; i < PULL_FRAMES; i++) {
+        uint32_t want = first ? first + i : 0;
+        if (frame_at(pcm, i) != want) {
+            fprintf(stderr, "BT frame %zu: %u, expected %u\n", i, (unsigned)frame_at(pcm, i),
+                    (unsigned)want);
+            test_failures++;
+            break;
+        }
+    }
+    return first;
+}
+
+// Wait for a condition the I2S task brings about, 2 s at most
+#define WAIT_FOR(cond) do { \
+        for (int w_ = 0; w_ < 2000 && !(cond); w_++) sleep_ms(1); \
+        CHECK(cond); \
+    } while (0)
+
+int main(void)
+{
+    CHECK(i2s_host_capture(CAPTURE, SPEED));
+    CHECK(audio_output_init());
+    CHECK_EQ(audio_output_get(), AUDIO_OUTPUT_BT);
+
+    // BT first: a straight run from frame 1, the I2S task idle
+    uint32_t expect = 1;
+    for (int i = 0; i < 8; i++) {
+        CHECK_EQ(bt_pull(), expect);
+        expect += PULL_FRAMES;
+    }
+    CHECK(!i2s_host_running());
+
+    // To I2S: BT stream suspended, the sink volume re-applied, BT gets silence
+    audio_output_set(AUDIO_OUTPUT_I2S);
+    CHECK_EQ(audio_output_get(), AUDIO_OUTPUT_I2S);
+    CHECK_EQ(media_idle, 1);
+    CHECK_EQ(volume_sets, 1);
+    WAIT_FOR(i2s_host_running());
+    uint32_t i2s_from = expect;
+    WAIT_FOR(__atomic_load_n(&next_frame, __ATOMIC_RELAXED) > i2s_from + I2S_RUN_FRAMES);
+    for (int i = 0; i < 4; i++) {
+        CHECK_EQ(bt_pull(), 0);
+    }
+
+    // An output that was not built stays off
+    audio_output_set(AUDIO_OUTPUT_SIM);
+    CHECK_EQ(audio_output_get(), AUDIO_OUTPUT_I2S);
+
+    // Back to BT: the stream restarts and picks up where I2S left off
+    audio_output_set(AUDIO_OUTPUT_BT);
+    CHECK_EQ(media_start, 1);
+    WAIT_FOR(!i2s_host_running());
+    uint32_t resume = bt_pull();
+    CHECK(resume > i2s_from + I2S_RUN_FRAMES);
+
+    // The capture holds exactly the frames in between, in order
+    FILE *fp = fopen(CAPTURE, "rb");
+    CHECK(fp != NULL);
+    if (fp) {
+        static uint16_t got[AUDIO_SAMPLE_RATE * 4 * 2];
+        size_t n = fread(got, 4, sizeof(got) / 4, fp);
+        fclose(fp);
+
+        printf("I2S played %zu frames, BT resumed at frame %u\n", n, (unsigned)resume);
+        CHECK_EQ(n, resume - i2s_from);
+        for (size_t i = 0; i < n; i++) {
+            if (frame_at(got, i) != i2s_from + i) {
+                fprintf(stderr, "I2S frame %zu: %u, expected %u\n", i,
+                        (unsigned)frame_at(got, i), (unsigned)(i2s_from + i));
+                test_failures++;
+                break;
+            }
+        }
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,365 @@
+/*
+ * audio_pipeline with a memory source and sink, as audio_pipeline.h says it
+ * can be driven: blocks at the sink rate run in place in borrowed sink
+ * memory, others come from the pool; a rate-changing element that holds
+ * output loses nothing when the sink aborts part way, and what it still
+ * holds at a rate change or at the end comes out through resume().
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_pipeline.h"
+#include "test_util.h"
+
+#define SINK_RATE       44100
+#define BUF_FRAMES      256
+#define OUT_MAX         (64 * 1024)
+
+// Source: segments of counting frames, one rate each
+typedef struct {
+    uint32_t rate;
+    uint32_t frames;
+} segment_t;
+
+static const segment_t segments[] = {
+    { 44100, 3000 }, { 22050, 1001 }, { 22050, 700 }, { 44100, 500 }, { 22050, 333 },
+};
+#define SEGMENTS (sizeof(segments) / sizeof(segments[0]))
+
+static struct {
+    uint32_t seg;
+    uint32_t pos;       // frame in the segment
+    uint32_t value;     // next frame's value
+} src;
+
+static uint32_t src_rate(void *ctx)
+{
+    return src.seg < SEGMENTS ? segments[src.seg].rate : 0;
+}
+
+static bool src_read(void *ctx, audio_buf_t *buf)
+{
+    if (src.seg == SEGMENTS) {
+        return false;
+    }
+    const segment_t *s = &segments[src.seg];
+    uint32_t n = s->frames - src.pos < buf->capacity ? s->frames - src.pos : buf->capacity;
+
+    for (uint32_t i = 0; i < n; i++, src.value++) {
+        buf->pcm[2 * i] = (int16_t)src.value;
+        buf->pcm[2 * i + 1] = (int16_t)~src.value;
+    }
+    buf->frames = n;
+    buf->rate = s->rate;
+    if ((src.pos += n) == s->frames) {
+        src.seg++;
+        src.pos = 0;
+    }
+    return true;
+}
+
+static const audio_source_t source = { .name = "memory", .rate = src_rate, .read = src_read };
+
+// Sink: a flat array, refusing space now and then like a ring with a command waiting
+static struct {
+    int16_t pcm[OUT_MAX * 2];
+    uint32_t frames;
+    unsigned seed;
+    int abort_one_in;   // 0: never
+    uint32_t aborts;
+    bool outstanding;
+} sink;
+
+static uint8_t *sink_acquire(void *ctx, uint32_t bytes)
+{
+    if (sink.abort_one_in && rand_r(&sink.seed) % sink.abort_one_in == 0) {
+        sink.aborts++;
+        return NULL;
+    }
+    if (sink.frames + bytes / 4 > OUT_MAX) {
+        return NULL;
+    }
+    sink.outstanding = true;
+    return (uint8_t *)(sink.pcm + 2 * sink.frames);
+}
+
+static void sink_commit(void *ctx, uint32_t bytes)
+{
+    CHECK(sink.outstanding);
+    sink.outstanding = false;
+    sink.frames += bytes / 4;
+}
+
+static const audio_sink_t memsink = {
+    .name = "memory", .rate = SINK_RATE, .acquire = sink_acquire, .commit = sink_commit,
+};
+
+/* ---------------- elements ---------------- */
+
+// In place: counts the blocks it sees, by where their memory comes from
+typedef struct {
+    uint32_t borrowed;
+    uint32_t pooled;
+    uint32_t resets;
+} probe_t;
+
+static audio_pipe_status_t probe_process(audio_element_t *el, audio_buf_t *buf)
+{
+    probe_t *p = el->ctx;
+
+    if (buf->borrowed) {
+        p->borrowed++;
+        CHECK_EQ(buf->rate, SINK_RATE);
+    } else {
+        p->pooled++;
+    }
+    return audio_pipeline_emit(el, buf);
+}
+
+static void probe_reset(audio_element_t *el)
+{
+    ((probe_t *)el->ctx)->resets++;
+}
+
+// Inverts every sample in place, so the test sees the chain ran over the data
+static audio_pipe_status_t invert_process(audio_element_t *el, audio_buf_t *buf)
+{
+    for (uint32_t i = 0; i < buf->frames * 2; i++) {
+        buf->pcm[i] = ~buf->pcm[i];
+    }
+    return audio_pipeline_emit(el, buf);
+}
+
+/*
+ * 22.05 -> 44.1 kHz by repeating frames, built like the player's resampler:
+ * it writes into blocks of its own, keeps what an abort leaves, and holds
+ * the last input frame back as its filter history, which only goes out
+ * before a block at another rate or at the end.
+ */
+static struct {
+    int16_t pending[BUF_FRAMES * 4 * 2];    // output frames not yet handed on
+    uint32_t count;
+    uint32_t done;
+    int16_t held[2];
+    bool have_held;
+    uint32_t rate;
+} up;
+
+static audio_pipe_status_t up_drain(audio_element_t *el)
+{
+    while (up.done < up.count) {
+        audio_buf_t out;
+
+        if (!audio_pipeline_get_buf(el->pipe, &out, SINK_RATE)) {
+            return AUDIO_PIPE_ABORT;
+        }
+        CHECK(out.borrowed);
+        uint32_t n = up.count - up.done < out.capacity ? up.count - up.done : out.capacity;
+        memcpy(out.pcm, up.pending + 2 * up.done, n * 4);
+        out.frames = n;
+
+        audio_pipe_status_t status = audio_pipeline_emit(el, &out);
+        audio_pipeline_put_buf(el->pipe, &out);
+        if (status != AUDIO_PIPE_OK) {
+            return status;
+        }
+        up.done += n;
+    }
+    up.count = up.done = 0;
+    return AUDIO_PIPE_OK;
+}
+
+static void up_queue(const int16_t *frame)
+{
+    for (int k = 0; k < 2; k++) {
+        memcpy(up.pending + 2 * up.count++, frame, 4);
+    }
+}
+
+static audio_pipe_status_t up_process(audio_element_t *el, audio_buf_t *buf)
+{
+    if (buf->rate == SINK_RATE) {
+        return audio_pipeline_emit(el, buf);
+    }
+    CHECK(!buf->borrowed);
+    CHECK_EQ(up.count, 0);      // resume() emptied it
+    up.rate = buf->rate;
+
+    for (uint32_t i = 0; i < buf->frames; i++) {
+        if (up.have_held) {
+            up_queue(up.held);
+        }
+        memcpy(up.held, buf->pcm + 2 * i, 4);
+        up.have_held = true;
+    }
+    return up_drain(el);
+}
+
+static audio_pipe_status_t up_resume(audio_element_t *el, uint32_t rate)
+{
+    if (!up.rate) {
+        return AUDIO_PIPE_OK;
+    }
+    if (rate != up.rate && up.have_held) {
+        up_queue(up.held);
+        up.have_held = false;
+    }
+    audio_pipe_status_t status = up_drain(el);
+    if (status == AUDIO_PIPE_OK && rate != up.rate) {
+        up.rate = 0;
+    }
+    return status;
+}
+
+static void up_reset(audio_element_t *el)
+{
+    up.count = up.done = 0;
+    up.have_held = false;
+}
+
+/* ---------------- tests ---------------- */
+
+static probe_t probe_in, probe_out;
+static audio_element_t el_probe_in = {
+    .name = "probe in", .process = probe_process, .reset = probe_reset, .ctx = &probe_in,
+};
+static audio_element_t el_up = {
+    .name = "up", .process = up_process, .reset = up_reset, .resume = up_resume,
+};
+static audio_element_t el_invert = { .name = "invert", .process = invert_process };
+static audio_element_t el_probe_out = {
+    .name = "probe out", .process = probe_process, .reset = probe_reset, .ctx = &probe_out,
+};
+
+static void start(int abort_one_in)
+{
+    memset(&src, 0, sizeof(src));
+    memset(&up, 0, sizeof(up));
+    memset(&probe_in, 0, sizeof(probe_in));
+    memset(&probe_out, 0, sizeof(probe_out));
+    sink.frames = sink.aborts = 0;
+    sink.outstanding = false;
+    sink.seed = 7;
+    sink.abort_one_in = abort_one_in;
+}
+
+// Every frame of the source once, doubled at 22.05 kHz, inverted, in order
+static bool output_matches(void)
+{
+    uint32_t value = 0, o = 0;
+
+    for (size_t s = 0; s < SEGMENTS; s++) {
+        for (uint32_t i = 0; i < segments[s].frames; i++, value++) {
+            for (int k = 0; k < (segments[s].rate == SINK_RATE ? 1 : 2); k++, o++) {
+                if (o >= sink.frames || sink.pcm[2 * o] != (int16_t)~value ||
+                    sink.pcm[2 * o + 1] != (int16_t)value) {
+                    fprintf(stderr, "output frame %u of %u: %d, expected %d\n", o,
+                            sink.frames, o < sink.frames ? ~sink.pcm[2 * o] : 0, (int16_t)value);
+                    return false;
+                }
+            }
+        }
+    }
+    CHECK_EQ(sink.frames, o);
+    return sink.frames == o;
+}
+
+static void test_stream(int abort_one_in)
+{
+    audio_pipeline_t p;
+    audio_pipe_status_t status;
+    uint32_t runs = 0;
+
+    CHECK(audio_pipeline_init(&p, BUF_FRAMES * 4));
+    audio_pipeline_set_source(&p, &source);
+    audio_pipeline_add(&p, &el_probe_in);
+    audio_pipeline_add(&p, &el_up);
+    audio_pipeline_add(&p, &el_invert);
+    audio_pipeline_add(&p, &el_probe_out);
+    audio_pipeline_set_sink(&p, &memsink);
+    start(abort_one_in);
+
+    // As the reader does: an abort means handle the command, then carry on
+    while ((status = audio_pipeline_run(&p)) != AUDIO_PIPE_EOS && runs++ < 100000) {
+    }
+    while (audio_pipeline_finish(&p) != AUDIO_PIPE_OK && runs++ < 100000) {
+    }
+
+    CHECK(output_matches());
+    CHECK_EQ(p.pool_free, (1u << AUDIO_PIPE_POOL_BUFS) - 1);
+    // Sink-rate blocks ran in place; 22.05 kHz ones came from the pool and left borrowed
+    CHECK(probe_in.borrowed > 0 && probe_in.pooled > 0);
+    CHECK_EQ(probe_out.pooled, 0);
+    if (abort_one_in) {
+        CHECK(sink.aborts > 0);
+    }
+    printf("aborts 1 in %d: %u runs, %u aborts, %u frames out, in: %u borrowed %u pooled\n",
+           abort_one_in, runs, sink.aborts, sink.frames, probe_in.borrowed, probe_in.pooled);
+
+    audio_pipeline_reset(&p);
+    CHECK_EQ(probe_in.resets, 1);
+    CHECK_EQ(probe_out.resets, 1);
+    free(p.pool);
+}
+
+static void test_pool(void)
+{
+    audio_pipeline_t p;
+    audio_buf_t bufs[AUDIO_PIPE_POOL_BUFS + 1];
+
+    CHECK(audio_pipeline_init(&p, BUF_FRAMES * 4));
+    audio_pipeline_set_source(&p, &source);
+    audio_pipeline_set_sink(&p, &memsink);
+    start(0);
+
+    // Other rates take pool blocks until there are none
+    for (int i = 0; i < AUDIO_PIPE_POOL_BUFS; i++) {
+        CHECK(audio_pipeline_get_buf(&p, &bufs[i], 22050));
+        CHECK(!bufs[i].borrowed);
+        CHECK_EQ(bufs[i].capacity, BUF_FRAMES);
+    }
+    CHECK(!audio_pipeline_get_buf(&p, &bufs[AUDIO_PIPE_POOL_BUFS], 22050));
+    CHECK(bufs[0].pcm != bufs[1].pcm);
+
+    // The sink rate does not need one, and a refusing sink aborts it
+    CHECK(audio_pipeline_get_buf(&p, &bufs[AUDIO_PIPE_POOL_BUFS], SINK_RATE));
+    CHECK(bufs[AUDIO_PIPE_POOL_BUFS].borrowed);
+    CHECK(bufs[AUDIO_PIPE_POOL_BUFS].pcm == sink.pcm);
+    audio_pipeline_put_buf(&p, &bufs[AUDIO_PIPE_POOL_BUFS]);
+    sink.abort_one_in = 1;
+    CHECK(!audio_pipeline_get_buf(&p, &bufs[AUDIO_PIPE_POOL_BUFS], SINK_RATE));
+    sink.abort_one_in = 0;
+
+    audio_pipeline_put_buf(&p, &bufs[1]);
+    CHECK(audio_pipeline_get_buf(&p, &bufs[2], 22050));
+    CHECK(bufs[2].pcm == bufs[1].pcm);
+    audio_pipeline_put_buf(&p, &bufs[0]);
+    audio_pipeline_put_buf(&p, &bufs[2]);
+    CHECK_EQ(p.pool_free, (1u << AUDIO_PIPE_POOL_BUFS) - 1);
+
+    // No elements: every block goes straight to the sink as it is
+    uint32_t total = 0;
+    while (audio_pipeline_run(&p) != AUDIO_PIPE_EOS) {
+    }
+    for (size_t s = 0; s < SEGMENTS; s++) {
+        total += segments[s].frames;
+    }
+    CHECK_EQ(sink.frames, total);
+    for (uint32_t i = 0; i < sink.frames; i++) {
+        if (sink.pcm[2 * i] != (int16_t)i || sink.pcm[2 * i + 1] != (int16_t)~i) {
+            CHECK(!"source frames in order");
+            break;
+        }
+    }
+    CHECK_EQ(p.pool_free, (1u << AUDIO_PIPE_POOL_BUFS) - 1);
+    free(p.pool);
+}
+
+int main(void)
+{
+    test_stream(0);
+    test_stream(3);
+    test_stream(2);
+    test_pool();
+    return TEST_RESULT();
+}
@@ -0,0 +1,461 @@
+/*
+ * audio_player: the control task's state machine driven through its command
+ * queue, with the reader, pipeline and ring underneath and the I2S output
+ * playing into a capture file.
+ *
+ * Every frame of a fixture track carries its track number and frame index,
+ * so the capture shows which frames were heard, in what order. The library,
+ * queue, loudness and UI are replaced by the stand-ins below; file opens are
+ * counted by wrapping audio_file_open() (-Wl,--wrap).
+ *
+ * The runs are checked against the capture at the end, in the order played:
+ * A with a pause in it, A again up to a stop, A and B back to back, B
+ * picked on its own, then A and B with a missing file between them.
+ * Volume, last, is checked against the sink stand-in with BT as the output.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_player.h"
+#include "audio_output.h"
+#include "audio_file.h"
+#include "audio_loudness.h"
+#include "audio_library.h"
+#include "audio_art.h"
+#include "audio_queue.h"
+#include "audio_spectrum.h"
+#include "audio_stats.h"
+#include "file_manager.h"
+#include "ui_manager.h"
+#include "bt_manager.h"
+#include "driver/i2s_std.h"
+#include "esp_timer.h"
+#include "test_util.h"
+
+#define CAPTURE         "aplayer_i2s.raw"
+#define SPEED           4           // I2S plays at 4x real time
+#define TRACK_A         "aplayer_a.wav"
+#define TRACK_B         "aplayer_b.wav"
+#define TRACK_MISSING   "aplayer_missing.wav"
+#define A_FRAMES        (AUDIO_SAMPLE_RATE * 2 + 77)    // neither ends on a block boundary
+#define B_FRAMES        (AUDIO_SAMPLE_RATE + 333)
+
+static int opens;
+static FILE *last_fp;
+static int ui_resets;
+static uint32_t stopped_ms;         // position of the track stopped while paused
+static int64_t b_gain_us = -1;      // when B's gain was first looked up
+
+/* ---------------- what audio_player.c calls ---------------- */
+
+FILE *__real_audio_file_open(const char *path);
+
+FILE *__wrap_audio_file_open(const char *path)
+{
+    FILE *fp = __real_audio_file_open(path);
+
+    if (fp) {
+        __atomic_store_n(&last_fp, fp, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&opens, 1, __ATOMIC_RELEASE);
+    }
+    return fp;
+}
+
+// The play queue: a fixed list of paths and a cursor
+static const char *queue_paths[4];
+static int queue_len, queue_pos;
+
+bool audio_queue_init(void) { return true; }
+bool audio_queue_library(uint32_t index) { queue_pos = index; return queue_len > 0; }
+bool audio_queue_load(const char *playlist) { return false; }
+uint32_t audio_queue_count(void) { return queue_len; }
+
+bool audio_queue_peek(int32_t step, char *path, size_t len)
+{
+    int pos = queue_pos + step;
+
+    if (pos < 0 || pos >= queue_len) {
+        return false;
+    }
+    snprintf(path, len, "%s", queue_paths[pos]);
+    return true;
+}
+
+bool audio_queue_step(int32_t step, char *path, size_t len)
+{
+    if (!audio_queue_peek(step, path, len)) {
+        return false;
+    }
+    queue_pos += step;
+    return true;
+}
+
+void sd_fs_init(void) {}
+bool audio_loudness_init(void) { return true; }
+int16_t audio_loudness_gain(const audio_loudness_t *l) { return 0; }
+bool audio_library_init(void) { return true; }
+bool audio_art_init(void) { return true; }
+bool audio_spectrum_init(void) { return true; }
+void audio_spectrum_report(void) {}
+void ui_reset_play_button(void) { __atomic_add_fetch(&ui_resets, 1, __ATOMIC_RELEASE); }
+
+// Unscanned, as far as the player can tell; notes when B's gain is asked for
+bool audio_loudness_lookup(const char *path, audio_loudness_t *out)
+{
+    int64_t unset = -1;
+
+    if (strcmp(path, TRACK_B) == 0) {
+        __atomic_compare_exchange_n(&b_gain_us, &unset, esp_timer_get_time(), false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    return false;
+}
+
+void bt_media_start(void) {}
+void bt_media_idle(void) {}
+void bt_avrc_notify_play_status(void) {}
+void bt_avrc_notify_track(void) {}
+void bt_avrc_notify_volume(void) {}
+
+// An absolute-volume sink, once test_volume() turns it on
+static bool sink_abs;
+static int sink_sets, sink_sets_off_task;
+static uint8_t sink_volume;
+static pthread_t main_thread;
+
+bool bt_avrc_abs_volume(void) { return sink_abs; }
+
+bool bt_avrc_set_volume(uint8_t percent)
+{
+    sink_volume = percent;
+    sink_sets_off_task += pthread_equal(pthread_self(), main_thread);
+    __atomic_add_fetch(&sink_sets, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* ---------------- helpers ---------------- */
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+// Wait for a condition the player tasks bring about, 5 s at most
+#define WAIT_FOR(cond) do { \
+        for (int w_ = 0; w_ < 5000 && !(cond); w_++) sleep_ms(1); \
+        CHECK(cond); \
+    } while (0)
+
+static void put_le(FILE *fp, uint32_t v, int n)
+{
+    for (int i = 0; i < n; i++) {
+        fputc(v >> (8 * i) & 0xff, fp);
+    }
+}
+
+// Left is the low 14 bits of the frame index, right the track and the rest;
+// well under the limiter ceiling, so the DSP passes it bit exact
+static uint32_t frame_word(int track, uint32_t n)
+{
+    return (n & 0x3fff) | (uint32_t)(track << 10 | n >> 14) << 16;
+}
+
+static bool write_track(const char *path, int track, uint32_t frames)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp) {
+        return false;
+    }
+    fwrite("RIFF", 1, 4, fp);
+    put_le(fp, 36 + frames * 4, 4);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    put_le(fp, 16, 4);
+    put_le(fp, 1, 2);                       // PCM
+    put_le(fp, 2, 2);
+    put_le(fp, AUDIO_SAMPLE_RATE, 4);
+    put_le(fp, AUDIO_SAMPLE_RATE * 4, 4);
+    put_le(fp, 4, 2);
+    put_le(fp, 16, 2);
+    fwrite("data", 1, 4, fp);
+    put_le(fp, frames * 4, 4);
+    for (uint32_t n = 0; n < frames; n++) {
+        put_le(fp, frame_word(track, n), 4);
+    }
+    return fclose(fp) == 0;
+}
+
+static int load(int *v)
+{
+    return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+}
+
+// Everything the I2S output played, silence included
+static uint32_t *capture_frames(size_t *count)
+{
+    FILE *fp = fopen(CAPTURE, "rb");
+    uint32_t *words = NULL;
+    size_t n = 0, cap = 0;
+    uint32_t w;
+
+    while (fp && fread(&w, 4, 1, fp) == 1) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 65536;
+            words = realloc(words, cap * sizeof(*words));
+        }
+        words[n++] = w;
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    *count = n;
+    return words;
+}
+
+static void skip_silence(const uint32_t *words, size_t count, size_t *at)
+{
+    while (*at < count && words[*at] == 0) {
+        (*at)++;
+    }
+}
+
+// Frames from words[*at] on are the track from its start, with silence in
+// between only if gaps; how many matched
+static size_t match_run(const uint32_t *words, size_t count, size_t *at, int track, uint32_t frames,
+                        bool gaps)
+{
+    size_t n = 0;
+
+    while (*at < count && n < frames) {
+        if (gaps && words[*at] == 0) {
+            (*at)++;
+        } else if (words[*at] == frame_word(track, n)) {
+            (*at)++;
+            n++;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+/* ---------------- tests ---------------- */
+
+static void test_pause_resume(void)
+{
+    // Play, then pause once the ring has filled and some of it has been heard
+    audio_player_cmd(AUDIO_CMD_PLAY);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    WAIT_FOR(audio_player_get_position_ms() > 300);
+    CHECK_EQ(load(&opens), 1);
+
+    audio_player_cmd(AUDIO_CMD_PAUSE);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PAUSED);
+    CHECK(audio_player_is_paused());
+    CHECK(!audio_player_is_playing());
+
+    // Ring contents, file offset and position all hold while paused
+    sleep_ms(50);
+    uint32_t fill = audio_ring_fill(&audio_ring);
+    long offset = ftell(last_fp);
+    uint32_t pos = audio_player_get_position_ms();
+    sleep_ms(200);
+    printf("paused at %u ms: ring %u bytes, file offset %ld\n", (unsigned)pos, (unsigned)fill, offset);
+    CHECK(fill > 0);
+    CHECK_EQ(audio_ring_fill(&audio_ring), fill);
+    CHECK_EQ(ftell(last_fp), offset);
+    CHECK_EQ(audio_player_get_position_ms(), pos);
+
+    // Resume carries on from the same file, through to the end of the track
+    audio_player_cmd(AUDIO_CMD_PLAY);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    CHECK(!audio_player_is_paused());
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_STOPPED);
+    CHECK_EQ(load(&opens), 1);
+    CHECK_EQ(load(&ui_resets), 1);
+
+    // The tail still in the ring plays out after the stop
+    WAIT_FOR(!audio_player_is_playing());
+}
+
+static void test_stop_while_paused(void)
+{
+    // PLAY after the end starts the track again from a fresh open
+    audio_player_cmd(AUDIO_CMD_PLAY);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    WAIT_FOR(audio_player_get_position_ms() > 100);
+    CHECK_EQ(load(&opens), 2);
+
+    audio_player_cmd(AUDIO_CMD_PAUSE);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PAUSED);
+    sleep_ms(50);
+    stopped_ms = audio_player_get_position_ms();
+
+    // STOP drops what was buffered, check_capture() sees none of it
+    audio_player_cmd(AUDIO_CMD_STOP);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_STOPPED);
+    sleep_ms(200);
+    CHECK(!audio_player_is_playing());
+    CHECK_EQ(load(&opens), 2);
+}
+
+static void test_gapless(void)
+{
+    uint32_t serial = audio_player_track_serial();
+
+    // B is queued behind A when A starts
+    queue_paths[1] = TRACK_B;
+    queue_len = 2;
+    int64_t start = esp_timer_get_time();
+    audio_player_cmd(AUDIO_CMD_PLAY);
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    WAIT_FOR(audio_player_get_position_ms() > 200);
+    uint32_t underruns = audio_stats.underruns;
+
+    // The reader switches on its own, the control task follows
+    WAIT_FOR(audio_player_track_serial() != serial);
+    CHECK(strcmp(current_file, TRACK_B) == 0);
+    WAIT_FOR(audio_player_get_position_ms() > 200);
+    CHECK_EQ(audio_stats.underruns, underruns);
+
+    // B's gain came with its prefetch early in A, no sidecar read at the switch
+    int64_t gain_us = __atomic_load_n(&b_gain_us, __ATOMIC_ACQUIRE);
+    printf("B's gain looked up %lld ms into A\n", (long long)(gain_us - start) / 1000);
+    CHECK(gain_us >= start);
+    CHECK(gain_us - start < (int64_t)A_FRAMES * 1000000 / AUDIO_SAMPLE_RATE / SPEED / 2);
+
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_STOPPED);
+    WAIT_FOR(!audio_player_is_playing());
+    CHECK_EQ(load(&opens), 4);
+}
+
+static void test_pick(void)
+{
+    uint32_t serial = audio_player_track_serial();
+
+    // The control task makes it current_file, not the caller
+    CHECK(audio_player_play_file(TRACK_B));
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    CHECK(strcmp(current_file, TRACK_B) == 0);
+    CHECK_EQ(audio_player_track_serial(), serial + 1);
+
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_STOPPED);
+    WAIT_FOR(!audio_player_is_playing());
+    CHECK_EQ(load(&opens), 5);
+}
+
+static void test_open_after_eof(void)
+{
+    // Nothing opens behind A, so the reader stops at its end; the control
+    // task skips the missing file and opens B while A's tail still plays
+    queue_paths[0] = TRACK_A;
+    queue_paths[1] = TRACK_MISSING;
+    queue_paths[2] = TRACK_B;
+    queue_len = 3;
+    queue_pos = 0;
+    CHECK(audio_player_play_file(TRACK_A));
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_PLAYING);
+    WAIT_FOR(strcmp(current_file, TRACK_B) == 0);
+
+    WAIT_FOR(audio_player_get_state() == AUDIO_STATE_STOPPED);
+    WAIT_FOR(!audio_player_is_playing());
+    CHECK_EQ(load(&opens), 7);
+}
+
+static void test_volume(void)
+{
+    sink_abs = true;
+
+    // The caller only posts it; the control task applies it and tells the sink
+    audio_player_set_volume(40);
+    WAIT_FOR(audio_player_get_volume() == 40);
+    CHECK_EQ(load(&sink_sets), 1);
+    CHECK_EQ(sink_volume, 40);
+
+    // Headset keys step from the level the control task has, none lost
+    for (int i = 0; i < 3; i++) {
+        CHECK(audio_player_remote_cmd(AUDIO_CMD_VOLUME_UP));
+    }
+    WAIT_FOR(audio_player_get_volume() == 40 + 3 * BT_AVRC_VOL_STEP);
+    WAIT_FOR(load(&sink_sets) == 4);
+    CHECK_EQ(sink_volume, 40 + 3 * BT_AVRC_VOL_STEP);
+
+    // A level from the sink is not sent back to it
+    CHECK(audio_player_remote_volume(30));
+    WAIT_FOR(audio_player_get_volume() == 30);
+    CHECK_EQ(load(&sink_sets), 4);
+    CHECK_EQ(sink_sets_off_task, 0);
+}
+
+static void check_capture(void)
+{
+    size_t count, at = 0;
+    uint32_t *words = capture_frames(&count);
+
+    // The whole track once, nothing lost or repeated across the pause
+    skip_silence(words, count, &at);
+    size_t paused = match_run(words, count, &at, 1, A_FRAMES, true);
+    CHECK_EQ(paused, A_FRAMES);
+
+    // The start of it again, up to where it was stopped
+    skip_silence(words, count, &at);
+    size_t stopped = match_run(words, count, &at, 1, A_FRAMES, false);
+    size_t want = (uint64_t)stopped_ms * AUDIO_SAMPLE_RATE / 1000;
+    CHECK(stopped + AUDIO_SAMPLE_RATE / 1000 >= want && stopped <= want + AUDIO_SAMPLE_RATE / 1000);
+
+    // A then B, every frame of both and not one frame of silence between
+    skip_silence(words, count, &at);
+    size_t a = match_run(words, count, &at, 1, A_FRAMES, false);
+    size_t b = match_run(words, count, &at, 2, B_FRAMES, false);
+    printf("heard %zu frames; paused run %zu, stopped run %zu of %zu, gapless %zu + %zu\n",
+           count, paused, stopped, want, a, b);
+    CHECK_EQ(a, A_FRAMES);
+    CHECK_EQ(b, B_FRAMES);
+
+    // The pick, whole
+    skip_silence(words, count, &at);
+    CHECK_EQ(match_run(words, count, &at, 2, B_FRAMES, false), B_FRAMES);
+
+    // Opening B did not cut off the end of A
+    skip_silence(words, count, &at);
+    CHECK_EQ(match_run(words, count, &at, 1, A_FRAMES, false), A_FRAMES);
+    skip_silence(words, count, &at);
+    CHECK_EQ(match_run(words, count, &at, 2, B_FRAMES, false), B_FRAMES);
+
+    skip_silence(words, count, &at);
+    CHECK_EQ(at, count);
+    free(words);
+}
+
+int main(void)
+{
+    main_thread = pthread_self();
+    CHECK(write_track(TRACK_A, 1, A_FRAMES));
+    CHECK(write_track(TRACK_B, 2, B_FRAMES));
+    queue_paths[0] = TRACK_A;
+    queue_len = 1;
+
+    CHECK(i2s_host_capture(CAPTURE, SPEED));
+    audio_player_init();
+    CHECK(strcmp(current_file, TRACK_A) == 0);
+    CHECK_EQ(audio_player_get_state(), AUDIO_STATE_IDLE);
+
+    audio_output_set(AUDIO_OUTPUT_I2S);
+    WAIT_FOR(i2s_host_running());
+
+    test_pause_resume();
+    test_stop_while_paused();
+    test_gapless();
+    test_pick();
+    test_open_after_eof();
+
+    // Stopping I2S flushes the capture
+    audio_output_set(AUDIO_OUTPUT_BT);
+    WAIT_FOR(!i2s_host_running());
+    check_capture();
+    test_volume();
+    return TEST_RESULT();
+}
@@ -0,0 +1,299 @@
+/*
+ * audio_queue: a long shuffled playlist against an in-memory library, the
+ * queue following a library rebuild, and that rebuild's reload not holding
+ * up a pick made meanwhile. The load is timed over a 5,000-line list.
+ *
+ * The library stand-in counts its lookups: a long list should cost one pass
+ * over the index plus a search for each of the first few lines.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "audio_queue.h"
+#include "audio_library.h"
+#include "audio_player.h"
+#include "file_manager.h"
+#include "test_util.h"
+
+#define PLAYLIST        "aqueue_5000.m3u"
+#define LIST_TRACKS     5000
+#define LIB_DIRS        60
+#define LIB_PER_DIR     100         // 6,000 tracks, a 4,000 track SD card is common
+#define LIB_EXTRA       100         // put in front by the rebuild
+#define LIB_MAX         (LIB_DIRS * LIB_PER_DIR + LIB_EXTRA)
+#define BENCH_LOADS     20
+
+/* ---------------- the library, sorted as the index is ---------------- */
+
+static char lib_paths[LIB_MAX][48];
+static uint32_t lib_count;
+static uint32_t lib_gen = 1;
+static uint32_t path_reads, finds;
+
+// A library call on this thread waits while the gate is shut
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_shut;
+static pthread_t gate_thread;
+static int gate_waiting;
+
+static void gate(void)
+{
+    pthread_mutex_lock(&gate_lock);
+    if (gate_shut && pthread_equal(pthread_self(), gate_thread)) {
+        gate_waiting++;
+        pthread_cond_broadcast(&gate_cond);
+        while (gate_shut) {
+            pthread_cond_wait(&gate_cond, &gate_lock);
+        }
+        gate_waiting--;
+    }
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static void lib_build(bool extra)
+{
+    lib_count = 0;
+    for (int i = 0; extra && i < LIB_EXTRA; i++) {
+        snprintf(lib_paths[lib_count++], sizeof(lib_paths[0]), "/sdcard/Aaa/%03d.flac", i);
+    }
+    for (int d = 0; d < LIB_DIRS; d++) {
+        for (int t = 0; t < LIB_PER_DIR; t++) {
+            snprintf(lib_paths[lib_count++], sizeof(lib_paths[0]), "/sdcard/Music/D%02d/%03d Track.mp3", d, t);
+        }
+    }
+    lib_gen++;
+}
+
+uint32_t audio_library_count(void) { return lib_count; }
+uint32_t audio_library_generation(void) { return lib_gen; }
+
+bool audio_library_path(uint32_t index, char *buf, size_t len)
+{
+    gate();
+    __atomic_add_fetch(&path_reads, 1, __ATOMIC_RELAXED);
+    if (index >= lib_count) {
+        return false;
+    }
+    snprintf(buf, len, "%s", lib_paths[index]);
+    return true;
+}
+
+static int path_cmp(const void *key, const void *entry)
+{
+    return strcasecmp(key, entry);
+}
+
+int32_t audio_library_find(const char *path)
+{
+    gate();
+    __atomic_add_fetch(&finds, 1, __ATOMIC_RELAXED);
+    const char (*hit)[48] = bsearch(path, lib_paths, lib_count, sizeof(lib_paths[0]), path_cmp);
+    return hit ? (int32_t)(hit - lib_paths) : -1;
+}
+
+/* ---------------- what audio_queue.c takes from file_manager ---------------- */
+
+// ASCII is the same in every code page
+bool sd_path_from_text(const char *src, char *dst, size_t len)
+{
+    for (const char *c = src; *c; c++) {
+        if ((unsigned char)*c >= 0x80) {
+            return false;
+        }
+    }
+    return (size_t)snprintf(dst, len, "%s", src) < len;
+}
+
+bool sd_fs_walk(const char *dir, sd_walk_cb_t cb, void *arg)
+{
+    return true;
+}
+
+/* ---------------- helpers ---------------- */
+
+static uint32_t list[LIST_TRACKS];  // library index of each line, as first built
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// A shuffled pick of the library, written three ways, with lines that are skipped
+static bool write_playlist(void)
+{
+    static uint32_t order[LIB_DIRS * LIB_PER_DIR];
+    FILE *fp = fopen(PLAYLIST, "w");
+
+    if (!fp) {
+        return false;
+    }
+    for (uint32_t i = 0; i < lib_count; i++) {
+        order[i] = i;
+    }
+    for (uint32_t i = lib_count - 1; i > 0; i--) {
+        uint32_t j = rand() % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    fputs("\xEF\xBB\xBF#EXTM3U\n", fp);
+    for (int i = 0; i < LIST_TRACKS; i++) {
+        const char *path = lib_paths[order[i]];
+        list[i] = order[i];
+
+        fprintf(fp, "#EXTINF:%d,Track %d\n", 180 + i % 60, i);
+        switch (i % 3) {
+        case 0:
+            fprintf(fp, "%s\n", path);
+            break;
+        case 1:
+            // Absolute on the card, without the mount point
+            fprintf(fp, "%s\n", path + strlen(SD_MOUNT_POINT));
+            break;
+        default:
+            // As a PC writes it
+            fputs("E:", fp);
+            for (const char *c = path + strlen(SD_MOUNT_POINT); *c; c++) {
+                fputc(*c == '/' ? '\\' : *c, fp);
+            }
+            fputs("\r\n", fp);
+            break;
+        }
+        if (i % 1000 == 500) {
+            fputs("http://radio.example/stream\n/Music/Gone/missing.mp3\n", fp);
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+static bool queue_at(int32_t step, const char *want)
+{
+    char path[AUDIO_PATH_MAX];
+
+    return audio_queue_peek(step, path, sizeof(path)) && strcmp(path, want) == 0;
+}
+
+/* ---------------- tests ---------------- */
+
+static void test_load(void)
+{
+    char path[AUDIO_PATH_MAX];
+    int wrong = 0;
+
+    CHECK(audio_queue_load(PLAYLIST));
+    CHECK_EQ(audio_queue_count(), LIST_TRACKS);
+    for (int i = 0; i < LIST_TRACKS; i++) {
+        wrong += !queue_at(i, lib_paths[list[i]]);
+    }
+    CHECK_EQ(wrong, 0);
+
+    CHECK(audio_queue_step(1, path, sizeof(path)));
+    CHECK(strcmp(path, lib_paths[list[1]]) == 0);
+    CHECK(!audio_queue_peek(LIST_TRACKS - 1, path, sizeof(path)));
+    CHECK(!audio_queue_load("aqueue_none.m3u"));
+    CHECK_EQ(audio_queue_count(), LIST_TRACKS);
+}
+
+static void bench_load(void)
+{
+    path_reads = finds = 0;
+    double t0 = now_ms();
+    for (int n = 0; n < BENCH_LOADS; n++) {
+        audio_queue_load(PLAYLIST);
+    }
+    double ms = (now_ms() - t0) / BENCH_LOADS;
+
+    printf("%d line playlist over a %u track library: %.2f ms a load, "
+           "%u path reads and %u searches\n", LIST_TRACKS, (unsigned)lib_count, ms,
+           (unsigned)(path_reads / BENCH_LOADS), (unsigned)(finds / BENCH_LOADS));
+    // One pass over the index, the first lines searched for, the first entry's path
+    CHECK(path_reads / BENCH_LOADS <= lib_count + 64);
+    CHECK(finds / BENCH_LOADS <= 64);
+}
+
+static void test_rebuild(void)
+{
+    char path[AUDIO_PATH_MAX];
+
+    // Every index moves; the queue reloads and stays on the same track
+    CHECK(audio_queue_step(10, path, sizeof(path)));
+    lib_build(true);
+    CHECK(queue_at(0, lib_paths[list[10] + LIB_EXTRA]));
+    CHECK(queue_at(1, lib_paths[list[11] + LIB_EXTRA]));
+    CHECK_EQ(audio_queue_count(), LIST_TRACKS);
+}
+
+static void *refresh_thread(void *arg)
+{
+    char path[AUDIO_PATH_MAX];
+
+    audio_queue_peek(1, path, sizeof(path));
+    return NULL;
+}
+
+static int pick_done;
+
+static void *pick_thread(void *arg)
+{
+    audio_queue_library(7);
+    __atomic_store_n(&pick_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_pick_during_reload(void)
+{
+    pthread_t refresh, pick;
+
+    // Hold the reload after another rebuild in its first library call
+    lib_build(false);
+    pthread_mutex_lock(&gate_lock);
+    gate_shut = true;
+    pthread_create(&refresh, NULL, refresh_thread, NULL);
+    gate_thread = refresh;
+    pthread_mutex_unlock(&gate_lock);
+
+    pthread_mutex_lock(&gate_lock);
+    while (!gate_waiting) {
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    }
+    pthread_mutex_unlock(&gate_lock);
+
+    // A library pick meanwhile goes straight through
+    pthread_create(&pick, NULL, pick_thread, NULL);
+    for (int i = 0; i < 2000 && !__atomic_load_n(&pick_done, __ATOMIC_ACQUIRE); i++) {
+        nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+    CHECK(__atomic_load_n(&pick_done, __ATOMIC_ACQUIRE));
+
+    pthread_mutex_lock(&gate_lock);
+    gate_shut = false;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+    pthread_join(refresh, NULL);
+    pthread_join(pick, NULL);
+
+    // and the reload, being older, is dropped
+    CHECK_EQ(audio_queue_count(), lib_count);
+    CHECK(queue_at(0, lib_paths[7]));
+}
+
+int main(void)
+{
+    srand(1);
+    lib_build(false);
+    CHECK(write_playlist());
+    CHECK(audio_queue_init());
+
+    test_load();
+    bench_load();
+    test_rebuild();
+    test_pick_during_reload();
+    return TEST_RESULT();
+}
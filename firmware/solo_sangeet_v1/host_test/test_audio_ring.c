@@ -0,0 +1,231 @@
+/*
+ * audio_ring: single-threaded edge cases, then a producer, a consumer and
+ * a peeking observer on three threads.
+ *
+ * The stream is 32-bit words counting up, restarted at a new epoch after
+ * every flush, so each reader can tell a lost, repeated, torn or stale word
+ * from the word itself.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_ring.h"
+#include "test_util.h"
+
+#define RING_SIZE       4096
+#define RING_SLACK      1024
+#define STRESS_COMMITS  20000
+#define FLUSH_EVERY     200
+
+#define WORD(epoch, idx)    ((uint32_t)(epoch) << 22 | (idx))
+#define WORD_EPOCH(w)       ((w) >> 22)
+#define WORD_IDX(w)         ((w) & ((1u << 22) - 1))
+
+typedef struct {
+    bool have;
+    uint32_t prev;
+} stream_t;
+
+// Next word follows on, or starts a later epoch from its beginning
+static bool stream_check(stream_t *s, const uint32_t *w, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        bool ok = !s->have || w[i] == s->prev + 1 ||
+                  (WORD_EPOCH(w[i]) > WORD_EPOCH(s->prev) && WORD_IDX(w[i]) == 0);
+        if (!ok) {
+            fprintf(stderr, "word %08x after %08x\n", (unsigned)w[i], (unsigned)s->prev);
+            return false;
+        }
+        s->have = true;
+        s->prev = w[i];
+    }
+    return true;
+}
+
+static void put_words(audio_ring_t *rb, uint32_t first, uint32_t n)
+{
+    uint32_t *span = (uint32_t *)audio_ring_acquire(rb, n * 4);
+
+    CHECK(span != NULL);
+    if (span) {
+        for (uint32_t i = 0; i < n; i++) {
+            span[i] = first + i;
+        }
+        audio_ring_commit(rb, n * 4);
+    }
+}
+
+static void test_basic(uint32_t start)
+{
+    audio_ring_t rb;
+    uint32_t out[RING_SIZE / 4];
+
+    CHECK(!audio_ring_init(&rb, 3000, 100));
+    CHECK(audio_ring_init(&rb, RING_SIZE, RING_SLACK));
+    // Free-running indices wrap at 2^32 too
+    rb.head = rb.tail = rb.flush_head = start;
+
+    CHECK(audio_ring_acquire(&rb, RING_SLACK + 4) == NULL);
+    CHECK_EQ(audio_ring_read(&rb, (uint8_t *)out, sizeof(out)), 0);
+
+    // Fill to the top in slack-sized spans; the last ones run past the end and fold
+    uint32_t w = 0;
+    while (audio_ring_free(&rb) >= RING_SLACK) {
+        put_words(&rb, w, RING_SLACK / 4);
+        w += RING_SLACK / 4;
+    }
+    CHECK(audio_ring_acquire(&rb, 4) == NULL || audio_ring_free(&rb) >= 4);
+    CHECK_EQ(audio_ring_fill(&rb), RING_SIZE);
+
+    // Peek leaves it queued
+    CHECK(audio_ring_peek(&rb, (uint8_t *)out, 64));
+    CHECK_EQ(out[0], 0);
+    CHECK(!audio_ring_peek(&rb, (uint8_t *)out, RING_SIZE + 4));
+    CHECK_EQ(audio_ring_fill(&rb), RING_SIZE);
+
+    // Odd-sized reads and writes walk the fold point across the ring
+    stream_t s = { 0 };
+    for (int round = 0; round < 200; round++) {
+        uint32_t n = audio_ring_read(&rb, (uint8_t *)out, 4 * (1 + round * 7 % 300));
+        CHECK(stream_check(&s, out, n / 4));
+        uint32_t k = 1 + round * 13 % (RING_SLACK / 4);
+        if (audio_ring_free(&rb) >= k * 4) {
+            put_words(&rb, w, k);
+            w += k;
+        }
+    }
+    while (audio_ring_fill(&rb)) {
+        uint32_t n = audio_ring_read(&rb, (uint8_t *)out, sizeof(out));
+        CHECK(stream_check(&s, out, n / 4));
+    }
+    CHECK_EQ(s.prev, w - 1);
+
+    // Nothing committed before a flush is read after it
+    put_words(&rb, WORD(1, 0), 100);
+    audio_ring_flush(&rb);
+    CHECK_EQ(audio_ring_read(&rb, (uint8_t *)out, sizeof(out)), 0);
+    put_words(&rb, WORD(2, 0), 10);
+    audio_ring_flush(&rb);
+    put_words(&rb, WORD(3, 0), 10);
+    CHECK_EQ(audio_ring_read(&rb, (uint8_t *)out, sizeof(out)), 40);
+    CHECK_EQ(out[0], WORD(3, 0));
+
+    free(rb.buf);
+}
+
+/* ---------------- three threads ---------------- */
+
+static audio_ring_t ring;
+static volatile bool producer_done;
+static volatile bool consumer_done;
+static int stress_failures;
+static uint32_t peeks_ok;
+
+static void *producer(void *arg)
+{
+    unsigned seed = 1;
+    uint32_t epoch = 0, idx = 0;
+
+    for (int commits = 0; commits < STRESS_COMMITS; ) {
+        uint32_t n = 1 + rand_r(&seed) % (RING_SLACK / 4);
+        uint32_t *span = (uint32_t *)audio_ring_acquire(&ring, n * 4);
+
+        if (!span) {
+            // Both ways the firmware waits: asleep to a level, or spinning
+            if (rand_r(&seed) & 1) {
+                audio_ring_wait_below(&ring, rand_r(&seed) % RING_SIZE, pdMS_TO_TICKS(10));
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            span[i] = WORD(epoch, idx + i);
+        }
+        audio_ring_commit(&ring, n * 4);
+        idx += n;
+
+        if (++commits % FLUSH_EVERY == 0) {
+            audio_ring_flush(&ring);
+            epoch++;
+            idx = 0;
+        }
+    }
+    __atomic_store_n(&producer_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    static uint32_t out[RING_SIZE / 4];
+    unsigned seed = 2;
+    stream_t s = { 0 };
+
+    while (!__atomic_load_n(&producer_done, __ATOMIC_ACQUIRE) || audio_ring_fill(&ring)) {
+        uint32_t n = audio_ring_read(&ring, (uint8_t *)out, 4 * (1 + rand_r(&seed) % 512));
+        if (!stream_check(&s, out, n / 4)) {
+            __atomic_add_fetch(&stress_failures, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if (n == 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&consumer_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Any copy peek() vouches for must be one piece of the stream
+static void *observer(void *arg)
+{
+    static uint32_t out[RING_SIZE / 4];
+    unsigned seed = 3;
+
+    while (!__atomic_load_n(&consumer_done, __ATOMIC_ACQUIRE)) {
+        uint32_t n = 1 + rand_r(&seed) % (RING_SIZE / 4);
+        stream_t s = { 0 };
+
+        if (audio_ring_peek(&ring, (uint8_t *)out, n * 4)) {
+            if (!stream_check(&s, out, n)) {
+                __atomic_add_fetch(&stress_failures, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            peeks_ok++;
+        }
+    }
+    return NULL;
+}
+
+static void test_stress(uint32_t start)
+{
+    pthread_t p, c, o;
+
+    CHECK(audio_ring_init(&ring, RING_SIZE, RING_SLACK));
+    ring.head = ring.tail = ring.flush_head = start;
+    producer_done = consumer_done = false;
+    stress_failures = 0;
+    peeks_ok = 0;
+
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&o, NULL, observer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    pthread_join(o, NULL);
+
+    CHECK_EQ(stress_failures, 0);
+    CHECK(peeks_ok > 0);
+    printf("stress from %08x: %u good peeks\n", (unsigned)start, (unsigned)peeks_ok);
+    free(ring.buf);
+}
+
+int main(void)
+{
+    test_basic(0);
+    test_basic(0xfffff000u);
+    test_stress(0);
+    test_stress(0xffff0000u);
+    return TEST_RESULT();
+}
@@ -0,0 +1,193 @@
+/*
+ * audio_spectrum: Q15 FFT against a double DFT, tones landing in their band,
+ * the dB scale of bars and VU, the double buffer under a concurrent reader,
+ * and the cost of one update.
+ *
+ * The FFT and level code are static, so the module is built into this file.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../components/audio_player/audio_spectrum.c"
+#include "test_util.h"
+
+#define RATE            44100
+#define BENCH_UPDATES   5000
+#define STRESS_PUBLISH  200000
+
+// What the module takes from the player
+audio_ring_t audio_ring;
+
+bool audio_player_is_playing(void)
+{
+    return true;
+}
+
+static void tap_sine(double freq, double amp)
+{
+    for (int i = 0; i < FFT_N; i++) {
+        s_tap[2 * i] = s_tap[2 * i + 1] = (int16_t)lrint(amp * sin(2 * M_PI * freq * i / RATE));
+    }
+}
+
+// One update from a clean slate, so the fall-off does not carry over
+static void update(void)
+{
+    memset(&s_levels, 0, sizeof(s_levels));
+    spectrum_compute(true);
+}
+
+static void test_fft(void)
+{
+    static double ref_re[FFT_N], ref_im[FFT_N];
+    double err = 0, worst = 0;
+
+    for (int i = 0; i < FFT_N; i++) {
+        s_re[i] = (int16_t)(rand() % 32768 - 16384);
+        s_im[i] = 0;
+    }
+    // The Q15 FFT scales by 1/N
+    for (int k = 0; k < FFT_N; k++) {
+        ref_re[k] = ref_im[k] = 0;
+        for (int i = 0; i < FFT_N; i++) {
+            ref_re[k] += s_re[i] * cos(2 * M_PI * k * i / FFT_N) / FFT_N;
+            ref_im[k] -= s_re[i] * sin(2 * M_PI * k * i / FFT_N) / FFT_N;
+        }
+    }
+    fft_q15(s_re, s_im);
+    for (int k = 0; k < FFT_N; k++) {
+        double e = hypot(s_re[k] - ref_re[k], s_im[k] - ref_im[k]);
+        err += e * e;
+        worst = e > worst ? e : worst;
+    }
+    printf("FFT error vs double: rms %.2f, max %.2f LSB\n", sqrt(err / FFT_N), worst);
+    CHECK(sqrt(err / FFT_N) < 2);
+    CHECK(worst < 8);
+}
+
+static void test_bands(void)
+{
+    // A full-scale tone centred in each band tops it and reads full scale
+    for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+        int bin = (s_band_edge[b] + s_band_edge[b + 1]) / 2;
+        int top = 0;
+
+        tap_sine((double)bin * RATE / FFT_N, 32767);
+        update();
+        for (int i = 1; i < AUDIO_SPECTRUM_BANDS; i++) {
+            top = s_levels.band[i] > s_levels.band[top] ? i : top;
+        }
+        if (top != b || s_levels.band[b] < LEVEL_MAX - 5) {
+            fprintf(stderr, "band %d (bin %d): loudest is band %d, level %u\n",
+                    b, bin, top, s_levels.band[b]);
+            test_failures++;
+        }
+    }
+
+    // -20 dBFS is a third down the 60 dB scale, on the bars and the VU; ~1 kHz, on a bin
+    int want = LEVEL_MAX * (AUDIO_SPECTRUM_RANGE_DB - 20) / AUDIO_SPECTRUM_RANGE_DB;
+    tap_sine(12.0 * RATE / FFT_N, 3277);
+    update();
+    int band_1k = 0;
+    for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+        band_1k = s_levels.band[b] > band_1k ? s_levels.band[b] : band_1k;
+    }
+    printf("-20 dBFS tone: bar %d, vu %u/%u, expected %d\n", band_1k,
+           s_levels.vu[0], s_levels.vu[1], want);
+    CHECK(abs(band_1k - want) <= 4);
+    CHECK(abs(s_levels.vu[0] - want) <= 2);
+    CHECK_EQ(s_levels.vu[0], s_levels.vu[1]);
+
+    // Silence, and the bars fall by AUDIO_SPECTRUM_FALL per update after a tone
+    memset(s_tap, 0, sizeof(s_tap));
+    update();
+    for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+        CHECK_EQ(s_levels.band[b], 0);
+    }
+    tap_sine(1000, 32767);
+    update();
+    uint8_t before = s_levels.vu[0];
+    spectrum_compute(false);
+    CHECK_EQ(s_levels.vu[0], before - AUDIO_SPECTRUM_FALL);
+}
+
+static volatile bool stress_done;
+
+static void *stress_writer(void *arg)
+{
+    for (uint32_t n = 0; n < STRESS_PUBLISH; n++) {
+        // Every field of an update carries the low byte of its sequence
+        memset(s_levels.band, (s_published + 1) & 0xff, sizeof(s_levels.band));
+        memset(s_levels.vu, (s_published + 1) & 0xff, sizeof(s_levels.vu));
+        spectrum_publish();
+        // Let the reader in on a single-core host
+        if (n % 16 == 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&stress_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_double_buffer(void)
+{
+    audio_spectrum_t got = { 0 };
+    uint32_t reads = 0, torn = 0, last = 0;
+    pthread_t writer;
+
+    s_published = s_writing = 0;
+    pthread_create(&writer, NULL, stress_writer, NULL);
+    while (!__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE)) {
+        if (!audio_spectrum_get(&got)) {
+            continue;
+        }
+        reads++;
+        for (int b = 0; b < AUDIO_SPECTRUM_BANDS; b++) {
+            torn += got.band[b] != (got.seq & 0xff);
+        }
+        torn += got.vu[0] != (got.seq & 0xff) || got.vu[1] != (got.seq & 0xff);
+        // Never goes backwards
+        torn += got.seq < last;
+        last = got.seq;
+    }
+    pthread_join(writer, NULL);
+
+    printf("double buffer: %u reads over %d publishes\n", (unsigned)reads, STRESS_PUBLISH);
+    CHECK(reads > 0);
+    CHECK_EQ(torn, 0);
+    // Catch up with the last publish, after which there is nothing new
+    audio_spectrum_get(&got);
+    CHECK_EQ(got.seq, STRESS_PUBLISH);
+    CHECK(!audio_spectrum_get(&got));
+}
+
+static void bench(void)
+{
+    struct timespec t0, t1;
+
+    for (int i = 0; i < FFT_N * 2; i++) {
+        s_tap[i] = (int16_t)(rand() % 20000 - 10000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int n = 0; n < BENCH_UPDATES; n++) {
+        spectrum_compute(true);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_UPDATES;
+    printf("%d point FFT update: %.1f us, %.3f%% of the %d ms period\n", FFT_N, ns / 1000,
+           ns / 1e4 / AUDIO_SPECTRUM_PERIOD_MS, AUDIO_SPECTRUM_PERIOD_MS);
+}
+
+int main(void)
+{
+    srand(1);
+    tables_init();
+    test_fft();
+    test_bands();
+    test_double_buffer();
+    bench();
+    return TEST_RESULT();
+}
@@ -0,0 +1,433 @@
+/*
+ * flac_decoder, bit-exact: a small encoder here writes streams that use
+ * every subframe type (constant, verbatim, fixed 0-4, LPC, wasted bits,
+ * escaped and 5-bit Rice partitions) under every stereo decorrelation
+ * (independent, left/side, side/right, mid/side), with real header CRC-8s
+ * and frame CRC-16s. The decoder must give back the input samples, and
+ * must drop a frame whose CRC-16 does not match.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flac_decoder.h"
+#include "test_util.h"
+
+#define BLOCK           1024
+#define MAX_FRAMES      64
+#define MAX_SAMPLES     (MAX_FRAMES * BLOCK)
+
+enum { SUB_CONSTANT, SUB_VERBATIM, SUB_FIXED, SUB_LPC };
+
+typedef struct {
+    int ch_code;            // 1 independent, 8 left/side, 9 side/right, 10 mid/side
+    int type;
+    int order;              // FIXED / LPC
+    int part_order;
+    int rice_method;        // 0: 4-bit parameters, 1: 5-bit
+    bool escape;            // first partition stored verbatim
+    int wasted;
+} frame_plan_t;
+
+/* ---------------- bit writer ---------------- */
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    uint32_t acc;
+    int bits;
+} bw_t;
+
+static void bw_put(bw_t *w, uint32_t v, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        w->acc = (w->acc << 1) | ((v >> i) & 1);
+        if (++w->bits == 8) {
+            if (w->len == w->cap) {
+                w->cap = w->cap ? w->cap * 2 : 4096;
+                w->buf = realloc(w->buf, w->cap);
+            }
+            w->buf[w->len++] = (uint8_t)w->acc;
+            w->acc = 0;
+            w->bits = 0;
+        }
+    }
+}
+
+static void bw_signed(bw_t *w, int32_t v, int n)
+{
+    bw_put(w, (uint32_t)v & (n == 32 ? 0xffffffffu : (1u << n) - 1), n);
+}
+
+static void bw_unary(bw_t *w, uint32_t q)
+{
+    while (q--) {
+        bw_put(w, 0, 1);
+    }
+    bw_put(w, 1, 1);
+}
+
+static void bw_align(bw_t *w)
+{
+    while (w->bits) {
+        bw_put(w, 0, 1);
+    }
+}
+
+static uint8_t crc8(const uint8_t *p, size_t n)
+{
+    uint8_t crc = 0;
+    while (n--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t n)
+{
+    uint16_t crc = 0;
+    while (n--) {
+        crc ^= (uint16_t)*p++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* ---------------- encoder ---------------- */
+
+static const int32_t lpc_coefs[] = { 3000, -1500, 700, -300, 120, -40, 10, -3 };
+#define LPC_PRECISION   13
+#define LPC_SHIFT       11
+
+static void put_residual(bw_t *w, const int32_t *res, int n, int order, const frame_plan_t *fp)
+{
+    int parts = 1 << fp->part_order;
+    int psize = n >> fp->part_order;
+    uint32_t escape = fp->rice_method ? 31 : 15;
+
+    bw_put(w, fp->rice_method, 2);
+    bw_put(w, fp->part_order, 4);
+
+    const int32_t *r = res + order;
+    for (int p = 0; p < parts; p++) {
+        int cnt = p == 0 ? psize - order : psize;
+
+        if (p == 0 && fp->escape) {
+            // Verbatim partition: wide enough for the largest residual
+            int bits = 1;
+            for (int i = 0; i < cnt; i++) {
+                while (r[i] < -(1 << (bits - 1)) || r[i] >= (1 << (bits - 1))) {
+                    bits++;
+                }
+            }
+            bw_put(w, escape, fp->rice_method ? 5 : 4);
+            bw_put(w, bits, 5);
+            for (int i = 0; i < cnt; i++) {
+                bw_signed(w, r[i], bits);
+            }
+            r += cnt;
+            continue;
+        }
+
+        // Parameter from the mean magnitude
+        uint64_t sum = 0;
+        for (int i = 0; i < cnt; i++) {
+            sum += ((uint32_t)r[i] << 1) ^ (uint32_t)(r[i] >> 31);
+        }
+        uint32_t k = 0;
+        while (cnt && (sum >> (k + 1)) > (uint64_t)cnt) {
+            k++;
+        }
+        if (k >= escape) {
+            k = escape - 1;
+        }
+        bw_put(w, k, fp->rice_method ? 5 : 4);
+        for (int i = 0; i < cnt; i++) {
+            uint32_t u = ((uint32_t)r[i] << 1) ^ (uint32_t)(r[i] >> 31);
+            bw_unary(w, u >> k);
+            bw_put(w, u & ((1u << k) - 1), k);
+        }
+        r += cnt;
+    }
+}
+
+static void put_subframe(bw_t *w, const int32_t *in, int n, int bps, const frame_plan_t *fp)
+{
+    static int32_t s[BLOCK], res[BLOCK];
+    int type = fp->type, order = fp->order;
+
+    bps -= fp->wasted;
+    for (int i = 0; i < n; i++) {
+        s[i] = in[i] >> fp->wasted;
+    }
+
+    bw_put(w, 0, 1);
+    if (type == SUB_CONSTANT) {
+        bw_put(w, 0, 6);
+    } else if (type == SUB_VERBATIM) {
+        bw_put(w, 1, 6);
+    } else if (type == SUB_FIXED) {
+        bw_put(w, 8 + order, 6);
+    } else {
+        bw_put(w, 31 + order, 6);
+    }
+    if (fp->wasted) {
+        bw_put(w, 1, 1);
+        bw_unary(w, fp->wasted - 1);
+    } else {
+        bw_put(w, 0, 1);
+    }
+
+    if (type == SUB_CONSTANT) {
+        bw_signed(w, s[0], bps);
+        return;
+    }
+    if (type == SUB_VERBATIM) {
+        for (int i = 0; i < n; i++) {
+            bw_signed(w, s[i], bps);
+        }
+        return;
+    }
+
+    for (int i = 0; i < order; i++) {
+        bw_signed(w, s[i], bps);
+    }
+    for (int i = order; i < n; i++) {
+        int64_t pred = 0;
+        if (type == SUB_FIXED) {
+            static const int fixed[5][4] = {
+                { 0 }, { 1 }, { 2, -1 }, { 3, -3, 1 }, { 4, -6, 4, -1 },
+            };
+            for (int j = 0; j < order; j++) {
+                pred += (int64_t)fixed[order][j] * s[i - 1 - j];
+            }
+        } else {
+            for (int j = 0; j < order; j++) {
+                pred += (int64_t)lpc_coefs[j] * s[i - 1 - j];
+            }
+            pred >>= LPC_SHIFT;
+        }
+        res[i] = s[i] - (int32_t)pred;
+    }
+    if (type == SUB_LPC) {
+        bw_put(w, LPC_PRECISION - 1, 4);
+        bw_signed(w, LPC_SHIFT, 5);
+        for (int j = 0; j < order; j++) {
+            bw_signed(w, lpc_coefs[j], LPC_PRECISION);
+        }
+    }
+    put_residual(w, res, n, order, fp);
+}
+
+static void put_utf8(bw_t *w, uint32_t v)
+{
+    if (v < 0x80) {
+        bw_put(w, v, 8);
+    } else if (v < 0x800) {
+        bw_put(w, 0xC0 | (v >> 6), 8);
+        bw_put(w, 0x80 | (v & 0x3f), 8);
+    } else {
+        bw_put(w, 0xE0 | (v >> 12), 8);
+        bw_put(w, 0x80 | ((v >> 6) & 0x3f), 8);
+        bw_put(w, 0x80 | (v & 0x3f), 8);
+    }
+}
+
+static void put_frame(bw_t *w, uint32_t num, int32_t *const ch[2], int nch, int n, int bps,
+                      const frame_plan_t *fp)
+{
+    static int32_t a[BLOCK], b[BLOCK];
+    size_t start = w->len;
+    int ch_code = nch == 1 ? 0 : fp->ch_code;
+
+    bw_put(w, 0x3ffe, 14);
+    bw_put(w, 0, 2);
+    bw_put(w, n == BLOCK ? 10 : 7, 4);          // 1024, or 16-bit size at the end
+    bw_put(w, 9, 4);                            // 44.1 kHz
+    bw_put(w, ch_code, 4);
+    bw_put(w, bps == 16 ? 4 : 6, 3);
+    bw_put(w, 0, 1);
+    put_utf8(w, num);
+    if (n != BLOCK) {
+        bw_put(w, n - 1, 16);
+    }
+    bw_put(w, crc8(w->buf + start, w->len - start), 8);
+
+    for (int i = 0; i < n; i++) {
+        int32_t l = ch[0][i], r = nch > 1 ? ch[1][i] : 0;
+        switch (ch_code) {
+        case 8:  a[i] = l;            b[i] = l - r; break;
+        case 9:  a[i] = l - r;        b[i] = r;     break;
+        case 10: a[i] = (l + r) >> 1; b[i] = l - r; break;
+        default: a[i] = l;            b[i] = r;     break;
+        }
+    }
+
+    frame_plan_t p = *fp;
+    put_subframe(w, a, n, bps + (ch_code == 9), &p);
+    if (nch > 1) {
+        // The second channel gets the next simpler predictor, for variety
+        p.type = fp->type == SUB_LPC ? SUB_FIXED : fp->type;
+        p.order = fp->type == SUB_LPC ? 2 : fp->order;
+        p.escape = false;
+        put_subframe(w, b, n, bps + (ch_code == 8 || ch_code == 10), &p);
+    }
+    bw_align(w);
+    uint16_t crc = crc16(w->buf + start, w->len - start);
+    bw_put(w, crc, 16);
+}
+
+// fLaC + STREAMINFO + a block for the decoder to skip
+static void put_header(bw_t *w, uint32_t rate, int nch, int bps, uint64_t total)
+{
+    bw_put(w, 'f', 8); bw_put(w, 'L', 8); bw_put(w, 'a', 8); bw_put(w, 'C', 8);
+    bw_put(w, 0, 1);
+    bw_put(w, 0, 7);
+    bw_put(w, 34, 24);
+    bw_put(w, BLOCK, 16);
+    bw_put(w, BLOCK, 16);
+    bw_put(w, 0, 24);
+    bw_put(w, 0, 24);
+    bw_put(w, rate, 20);
+    bw_put(w, nch - 1, 3);
+    bw_put(w, bps - 1, 5);
+    bw_put(w, (uint32_t)(total >> 32), 4);
+    bw_put(w, (uint32_t)total, 32);
+    for (int i = 0; i < 16; i++) {
+        bw_put(w, 0, 8);        // MD5, unchecked
+    }
+    bw_put(w, 1, 1);            // last: a PADDING block
+    bw_put(w, 1, 7);
+    bw_put(w, 10, 24);
+    for (int i = 0; i < 10; i++) {
+        bw_put(w, 0, 8);
+    }
+}
+
+/* ---------------- tests ---------------- */
+
+static int32_t in_l[MAX_SAMPLES], in_r[MAX_SAMPLES];
+
+static void make_signal(int frames, int bps, uint32_t seed)
+{
+    double amp = (1 << (bps - 1)) * 0.9;
+
+    for (int i = 0; i < frames * BLOCK; i++) {
+        seed = seed * 1103515245 + 12345;
+        int noise = (int)((seed >> 16) & 0xff) - 128;
+        in_l[i] = (int32_t)(amp * sin(i * 0.031) * sin(i * 0.0007)) + noise;
+        in_r[i] = (int32_t)(amp * sin(i * 0.047 + 1)) - noise / 2;
+    }
+}
+
+static size_t decode_all(bw_t *w, int16_t *out, size_t max_frames)
+{
+    FILE *fp = tmpfile();
+    flac_decoder_t *dec = malloc(sizeof(flac_decoder_t));
+    size_t frames = 0, n;
+
+    fwrite(w->buf, 1, w->len, fp);
+    rewind(fp);
+    CHECK(flac_decoder_open(dec, fp));
+
+    // Odd read sizes, so blocks are handed out in pieces
+    while ((n = flac_decoder_read(dec, (uint8_t *)(out + 2 * frames),
+                                  4 * (frames + 777 < max_frames ? 777 : max_frames - frames))) > 0) {
+        frames += n / 4;
+    }
+    fclose(fp);
+    free(dec);
+    return frames;
+}
+
+static void test_stream(int nch, int bps, bool corrupt)
+{
+    static const frame_plan_t plans[] = {
+        { 1, SUB_VERBATIM, 0, 0, 0, false, 0 },
+        { 1, SUB_CONSTANT, 0, 0, 0, false, 0 },
+        { 1, SUB_FIXED, 0, 0, 0, false, 0 },
+        { 8, SUB_FIXED, 1, 1, 0, false, 0 },
+        { 9, SUB_FIXED, 2, 2, 0, false, 0 },
+        { 10, SUB_FIXED, 3, 3, 1, false, 0 },
+        { 10, SUB_FIXED, 4, 4, 0, true, 0 },
+        { 1, SUB_LPC, 8, 3, 0, false, 0 },
+        { 8, SUB_LPC, 5, 2, 1, false, 0 },
+        { 9, SUB_LPC, 8, 0, 0, true, 0 },
+        { 10, SUB_LPC, 6, 4, 0, false, 0 },
+        { 1, SUB_FIXED, 2, 2, 0, false, 3 },
+    };
+    const int nplans = sizeof(plans) / sizeof(plans[0]);
+    const int frames = 2 * nplans + 1;
+    const int total = (frames - 1) * BLOCK + BLOCK / 3;    // short last frame
+    static int16_t out[(MAX_SAMPLES + 777) * 2];
+    bw_t w = { 0 };
+    size_t frame_at[MAX_FRAMES];
+
+    make_signal(frames, bps, nch * 100 + bps);
+    put_header(&w, 44100, nch, bps, total);
+
+    for (int f = 0; f < frames; f++) {
+        frame_plan_t p = plans[f % nplans];
+        int n = f == frames - 1 ? total - f * BLOCK : BLOCK;
+        int32_t *ch[2] = { in_l + f * BLOCK, in_r + f * BLOCK };
+
+        if (p.type == SUB_CONSTANT) {
+            for (int i = 0; i < n; i++) {
+                ch[0][i] = -1234;
+                ch[1][i] = 77;
+            }
+        }
+        if (p.wasted) {
+            for (int i = 0; i < n; i++) {
+                ch[0][i] &= ~((1 << p.wasted) - 1);
+                ch[1][i] &= ~((1 << p.wasted) - 1);
+            }
+        }
+        frame_at[f] = w.len;
+        put_frame(&w, f, ch, nch, n, bps, &p);
+    }
+
+    // One flipped residual bit in frame 5 leaves its CRC-16 wrong
+    const int bad = 5;
+    if (corrupt) {
+        w.buf[(frame_at[bad] + frame_at[bad + 1]) / 2] ^= 0x10;
+    }
+
+    size_t got = decode_all(&w, out, MAX_SAMPLES + 777);
+    CHECK_EQ(got, corrupt ? total - BLOCK : total);
+
+    int mismatches = 0;
+    for (int i = 0, o = 0; i < total && o < (int)got; i++) {
+        if (corrupt && i / BLOCK == bad) {
+            continue;
+        }
+        int16_t l = (int16_t)(in_l[i] >> (bps - 16));
+        int16_t r = (int16_t)((nch > 1 ? in_r[i] : in_l[i]) >> (bps - 16));
+        if (out[2 * o] != l || out[2 * o + 1] != r) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "%d ch %d bit, sample %d: %d/%d, expected %d/%d\n",
+                        nch, bps, i, out[2 * o], out[2 * o + 1], l, r);
+            }
+        }
+        o++;
+    }
+    CHECK_EQ(mismatches, 0);
+    printf("%d ch %2d bit%s: %d frames, %zu bytes, %zu samples ok\n", nch, bps,
+           corrupt ? " (one bad CRC)" : "", frames, w.len, got);
+    free(w.buf);
+}
+
+int main(void)
+{
+    test_stream(2, 16, false);
+    test_stream(1, 16, false);
+    test_stream(2, 24, false);
+    test_stream(2, 16, true);
+    return TEST_RESULT();
+}
@@ -0,0 +1,477 @@
+/*
+ * media_tags against malformed files: ID3v2 tags and frames that claim more
+ * than is there, unsynchronised frames, Vorbis comment lengths past their
+ * block. Then a mutation loop over good files, which must never give a
+ * field that is not NUL-terminated valid UTF-8 or a picture outside the file.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "media_tags.h"
+#include "test_util.h"
+
+#define FUZZ_ITERATIONS     4000
+
+typedef struct {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+} bytes_t;
+
+static char path[] = "/tmp/media_tags_XXXXXX";
+
+static void put(bytes_t *b, const void *src, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    if (b->len + n > b->cap) {
+        b->cap = (b->len + n) * 2;
+        b->p = realloc(b->p, b->cap);
+    }
+    memcpy(b->p + b->len, src, n);
+    b->len += n;
+}
+
+static void put_str(bytes_t *b, const char *s)
+{
+    put(b, s, strlen(s));
+}
+
+static void put_fill(bytes_t *b, uint8_t v, size_t n)
+{
+    while (n--) {
+        put(b, &v, 1);
+    }
+}
+
+static void put_be(bytes_t *b, uint32_t v, int n)
+{
+    while (n--) {
+        uint8_t x = v >> (8 * n);
+        put(b, &x, 1);
+    }
+}
+
+static void put_le32(bytes_t *b, uint32_t v)
+{
+    uint8_t x[4] = { v, v >> 8, v >> 16, v >> 24 };
+    put(b, x, 4);
+}
+
+static void put_syncsafe(bytes_t *b, uint32_t v)
+{
+    uint8_t x[4] = { v >> 21 & 0x7F, v >> 14 & 0x7F, v >> 7 & 0x7F, v & 0x7F };
+    put(b, x, 4);
+}
+
+// ID3v2 frame; size is what the header claims, len what follows it
+static void id3_frame(bytes_t *b, int ver, const char *id, const void *data, size_t len,
+                      uint32_t size, uint8_t flags)
+{
+    put_str(b, id);
+    if (ver == 4) {
+        put_syncsafe(b, size);
+    } else {
+        put_be(b, size, 4);
+    }
+    put_be(b, flags, 2);
+    put(b, data, len);
+}
+
+static void id3_text(bytes_t *b, int ver, const char *id, uint8_t enc, const char *text)
+{
+    bytes_t f = { 0 };
+    put(&f, &enc, 1);
+    put_str(&f, text);
+    id3_frame(b, ver, id, f.p, f.len, f.len, 0);
+    free(f.p);
+}
+
+static void id3_header(bytes_t *b, int ver, uint8_t flags, uint32_t size)
+{
+    put_str(b, "ID3");
+    put_be(b, ver, 1);
+    put_be(b, 0, 1);
+    put_be(b, flags, 1);
+    put_syncsafe(b, size);
+}
+
+// MPEG-1 layer III, 128 kbit/s, 44.1 kHz: 417-byte frames
+static void mp3_frames(bytes_t *b, int n)
+{
+    while (n--) {
+        put_be(b, 0xFFFB9064, 4);
+        put_fill(b, 0, 413);
+    }
+}
+
+static void flac_streaminfo(bytes_t *b, bool last)
+{
+    uint8_t si[34] = { 0 };
+    uint64_t total = 44100 * 10;
+
+    si[10] = 44100 >> 12;
+    si[11] = 44100 >> 4 & 0xFF;
+    si[12] = (44100 & 15) << 4 | 1 << 1;
+    si[13] = 15 << 4 | (total >> 32 & 15);
+    si[14] = total >> 24;
+    si[15] = total >> 16;
+    si[16] = total >> 8;
+    si[17] = total;
+    put_be(b, last ? 0x80 : 0, 1);
+    put_be(b, sizeof(si), 3);
+    put(b, si, sizeof(si));
+}
+
+static bool read_bytes(const bytes_t *b, media_tags_t *t)
+{
+    FILE *fp = fopen(path, "wb");
+    if (b->len) {
+        fwrite(b->p, 1, b->len, fp);
+    }
+    fclose(fp);
+    return media_tags_read(path, t);
+}
+
+static bool valid_utf8(const char *s, size_t max)
+{
+    const uint8_t *p = (const uint8_t *)s;
+    size_t len = strnlen(s, max);
+
+    if (len == max) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ) {
+        size_t n = p[i] < 0x80 ? 1 : (p[i] & 0xE0) == 0xC0 ? 2 : (p[i] & 0xF0) == 0xE0 ? 3 :
+                   (p[i] & 0xF8) == 0xF0 ? 4 : 0;
+        if (n == 0 || i + n > len) {
+            return false;
+        }
+        for (size_t k = 1; k < n; k++) {
+            if ((p[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        i += n;
+    }
+    return true;
+}
+
+static bool tags_sane(const media_tags_t *t, size_t file_len)
+{
+    return valid_utf8(t->title, sizeof(t->title)) && valid_utf8(t->artist, sizeof(t->artist)) &&
+           valid_utf8(t->album, sizeof(t->album)) &&
+           (uint64_t)t->art_offset + t->art_size <= file_len;
+}
+
+/* ---------------- ID3v2 ---------------- */
+
+static void test_id3_good(bytes_t *b)
+{
+    media_tags_t t;
+    bytes_t f = { 0 };
+    static const uint8_t utf16[] = { 1, 0xFF, 0xFE, 'R', 0, 0x01, 0x01, 'g', 0, 'a', 0, 0, 0 };
+
+    id3_frame(&f, 3, "TIT2", utf16, sizeof(utf16), sizeof(utf16), 0);
+    id3_text(&f, 3, "TPE2", 0, "Band");
+    id3_text(&f, 3, "TALB", 3, "Alb\xC3\xA9");
+    id3_header(b, 3, 0, f.len + 100);
+    put(b, f.p, f.len);
+    put_fill(b, 0, 100);
+    mp3_frames(b, 20);
+    free(f.p);
+
+    CHECK(read_bytes(b, &t));
+    CHECK(strcmp(t.title, "R\xC4\x81ga") == 0);
+    CHECK(strcmp(t.artist, "Band") == 0);          // album artist stands in
+    CHECK(strcmp(t.album, "Alb\xC3\xA9") == 0);
+    CHECK_EQ(t.duration_ms, 20 * 417 * 8 / 128);
+}
+
+// Tag and frame sizes larger than the file, cut at every length
+static void test_id3_truncated(const bytes_t *good)
+{
+    media_tags_t t;
+
+    for (size_t cut = 0; cut <= 120 && cut <= good->len; cut++) {
+        bytes_t b = { 0 };
+        put(&b, good->p, cut);
+        CHECK(read_bytes(&b, &t));
+        CHECK(tags_sane(&t, cut));
+        // The title frame ends at 33; a shorter file must not yield part of it
+        if (cut < 33) {
+            CHECK_EQ(t.title[0], 0);
+        }
+        free(b.p);
+    }
+}
+
+static void test_id3_oversized(void)
+{
+    media_tags_t t;
+    bytes_t b = { 0 }, f = { 0 };
+    char big[1000];
+
+    // A title far past FIELD_MAX is cut on a character; 3-byte characters do not divide 63
+    for (size_t i = 0; i + 3 <= sizeof(big) - 1; i += 3) {
+        memcpy(big + i, "\xE0\xA4\xB8", 3);
+    }
+    big[sizeof(big) - 1 - (sizeof(big) - 1) % 3] = '\0';
+    id3_text(&f, 4, "TIT2", 3, big);
+    id3_text(&f, 4, "TPE1", 0, "After big");
+    // A frame claiming more than the tag holds ends the walk
+    id3_frame(&f, 4, "TALB", "\0Lost", 5, 100000, 0);
+    id3_text(&f, 4, "TPE2", 0, "Never read");
+    id3_header(&b, 4, 0, f.len);
+    put(&b, f.p, f.len);
+    mp3_frames(&b, 4);
+
+    CHECK(read_bytes(&b, &t));
+    CHECK(tags_sane(&t, b.len));
+    CHECK_EQ(strlen(t.title), 63);
+    CHECK(strncmp(t.title, big, 63) == 0);
+    CHECK(strcmp(t.artist, "After big") == 0);
+    CHECK_EQ(t.album[0], 0);
+    free(f.p);
+    free(b.p);
+
+    // v2.3 frame size with the top bit set: not a wrap-around to a small one
+    b = (bytes_t){ 0 };
+    f = (bytes_t){ 0 };
+    id3_frame(&f, 3, "TIT2", "\0X", 2, 0xFFFFFFF0u, 0);
+    id3_header(&b, 3, 0, f.len + 20);
+    put(&b, f.p, f.len);
+    put_fill(&b, 0, 20);
+    CHECK(read_bytes(&b, &t));
+    CHECK_EQ(t.title[0], 0);
+    free(f.p);
+    free(b.p);
+
+    // A tag size that is not syncsafe is no tag
+    b = (bytes_t){ 0 };
+    put(&b, "ID3\x04\x00\x00\x80\x00\x00\x10", 10);
+    id3_text(&b, 4, "TIT2", 0, "Bogus");
+    CHECK(read_bytes(&b, &t));
+    CHECK_EQ(t.title[0], 0);
+    free(b.p);
+}
+
+static void test_id3_unsync(void)
+{
+    media_tags_t t;
+    bytes_t b = { 0 }, f = { 0 };
+
+    // 2.4: per frame, and over the whole tag
+    id3_frame(&f, 4, "TIT2", "\0A\xFF\x00" "B", 5, 5, 0x02);
+    id3_frame(&f, 4, "TALB", "\0\0\0\x04\0C\xFF\x00", 8, 8, 0x03);   // with a length indicator
+    id3_header(&b, 4, 0, f.len);
+    put(&b, f.p, f.len);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "A\xC3\xBF" "B") == 0);
+    CHECK(strcmp(t.album, "C\xC3\xBF") == 0);
+    free(b.p);
+
+    b = (bytes_t){ 0 };
+    id3_header(&b, 4, 0x80, f.len);
+    put(&b, f.p, f.len);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "A\xC3\xBF" "B") == 0);
+    free(b.p);
+    free(f.p);
+
+    // 2.3 unsynchronises the frame headers too: skipped, and the ID3v1 tag used
+    b = (bytes_t){ 0 };
+    f = (bytes_t){ 0 };
+    id3_text(&f, 3, "TIT2", 0, "Unsynced");
+    id3_header(&b, 3, 0x80, f.len);
+    put(&b, f.p, f.len);
+    mp3_frames(&b, 2);
+    put_str(&b, "TAG");
+    put_str(&b, "V1 title");
+    put_fill(&b, 0, 125 - strlen("V1 title"));
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "V1 title") == 0);
+    free(f.p);
+    free(b.p);
+}
+
+/* ---------------- Vorbis comments ---------------- */
+
+// FLAC with a VORBIS_COMMENT block of block_len bytes holding the comments as given
+static void flac_vorbis(bytes_t *b, uint32_t vendor_len, const char *const *c, const uint32_t *len,
+                        int n, uint32_t count, uint32_t block_len)
+{
+    bytes_t v = { 0 };
+
+    put_le32(&v, vendor_len);
+    put_str(&v, "ref");
+    put_le32(&v, count);
+    for (int i = 0; i < n; i++) {
+        put_le32(&v, len[i]);
+        put_str(&v, c[i]);
+    }
+    put_str(b, "fLaC");
+    flac_streaminfo(b, false);
+    put_be(b, 0x80 | 4, 1);
+    put_be(b, block_len ? block_len : v.len, 3);
+    put(b, v.p, v.len);
+    put_fill(b, 0, 64);         // the audio
+    free(v.p);
+}
+
+static void test_vorbis(void)
+{
+    static const char *const c[] = { "TITLE=One", "ARTIST=Two", "ALBUM=Three" };
+    uint32_t len[] = { 9, 10, 11 };
+    media_tags_t t;
+    bytes_t b = { 0 };
+
+    flac_vorbis(&b, 3, c, len, 3, 3, 0);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "One") == 0 && strcmp(t.artist, "Two") == 0 && strcmp(t.album, "Three") == 0);
+    CHECK_EQ(t.duration_ms, 10000);
+    free(b.p);
+
+    // A comment longer than the block: the ones before it stand
+    len[1] = 0x7FFFFFFF;
+    b = (bytes_t){ 0 };
+    flac_vorbis(&b, 3, c, len, 3, 3, 0);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "One") == 0 && !t.artist[0] && !t.album[0]);
+    free(b.p);
+
+    // One that only fits by running past the block into the audio
+    len[1] = 10 + 20;
+    b = (bytes_t){ 0 };
+    flac_vorbis(&b, 3, c, len, 3, 3, 0);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.title, "One") == 0 && !t.artist[0] && !t.album[0]);
+    free(b.p);
+
+    // Vendor string longer than the block, or length wrapping 32 bits
+    len[1] = 10;
+    uint32_t vendors[] = { 1000, 0xFFFFFFFF, 0xFFFFFFFC };
+    for (int i = 0; i < 3; i++) {
+        b = (bytes_t){ 0 };
+        flac_vorbis(&b, vendors[i], c, len, 3, 3, 0);
+        CHECK(read_bytes(&b, &t));
+        CHECK(!t.title[0] && !t.artist[0] && !t.album[0]);
+        free(b.p);
+    }
+
+    // More comments claimed than there are, and a block longer than the file
+    b = (bytes_t){ 0 };
+    flac_vorbis(&b, 3, c, len, 3, 0xFFFFFFFF, 0);
+    CHECK(read_bytes(&b, &t));
+    CHECK(strcmp(t.album, "Three") == 0);
+    free(b.p);
+    b = (bytes_t){ 0 };
+    flac_vorbis(&b, 3, c, len, 3, 3, 0xFFFFFF);
+    CHECK(read_bytes(&b, &t));
+    CHECK(tags_sane(&t, b.len));
+    CHECK(!t.title[0]);
+    free(b.p);
+}
+
+/* ---------------- mutations ---------------- */
+
+static void test_fuzz(const bytes_t *const *seeds, int nseeds)
+{
+    unsigned seed = 1;
+    media_tags_t t;
+    int bad = 0;
+
+    for (int it = 0; it < FUZZ_ITERATIONS && bad < 5; it++) {
+        const bytes_t *s = seeds[it % nseeds];
+        bytes_t b = { 0 };
+        put(&b, s->p, s->len);
+
+        // A few bytes of the headers, and every fifth file cut short
+        size_t span = b.len < 512 ? b.len : 512;
+        for (int m = 1 + rand_r(&seed) % 8; m > 0; m--) {
+            size_t at = rand_r(&seed) % span;
+            switch (rand_r(&seed) % 4) {
+            case 0:  b.p[at] = rand_r(&seed); break;
+            case 1:  b.p[at] ^= 1 << rand_r(&seed) % 8; break;
+            case 2:  b.p[at] = 0xFF; break;
+            default: b.p[at] = rand_r(&seed) & 1 ? 0x00 : 0x7F; break;
+            }
+        }
+        if (rand_r(&seed) % 5 == 0) {
+            b.len = rand_r(&seed) % b.len;
+        }
+
+        CHECK(read_bytes(&b, &t));
+        if (!tags_sane(&t, b.len)) {
+            fprintf(stderr, "iteration %d: bad fields from seed %d\n", it, it % nseeds);
+            bad++;
+        }
+        free(b.p);
+    }
+    CHECK_EQ(bad, 0);
+    printf("%d mutated files\n", FUZZ_ITERATIONS);
+}
+
+int main(void)
+{
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    bytes_t id3 = { 0 };
+    test_id3_good(&id3);
+    test_id3_truncated(&id3);
+    test_id3_oversized();
+    test_id3_unsync();
+    test_vorbis();
+
+    // Seeds: the ID3 file, FLAC with comments and a picture, WAV with LIST/INFO
+    static const char *const c[] = { "title=Flac", "ALBUMARTIST=AA" };
+    uint32_t len[] = { 10, 14 };
+    bytes_t flac = { 0 }, wav = { 0 };
+    flac_vorbis(&flac, 3, c, len, 2, 2, 0);
+    flac.p[8 + 34] &= 0x7F;     // the comments are not the last block now
+    put_be(&flac, 0x86, 1);
+    put_be(&flac, 8 + 10 + 4 + 16 + 4 + 32, 3);
+    put_be(&flac, 3, 4);
+    put_be(&flac, 10, 4);
+    put_str(&flac, "image/jpeg");
+    put_be(&flac, 0, 4);
+    put_fill(&flac, 0, 16);
+    put_be(&flac, 32, 4);
+    put_fill(&flac, 0xAB, 32);
+
+    put_str(&wav, "RIFF");
+    put_le32(&wav, 0);
+    put_str(&wav, "WAVEfmt ");
+    put_le32(&wav, 16);
+    put(&wav, "\1\0\2\0\x44\xAC\0\0\x10\xB1\2\0\4\0\x10\0", 16);
+    put_str(&wav, "LIST");
+    put_le32(&wav, 4 + 8 + 5 + 1 + 8 + 4);
+    put_str(&wav, "INFOINAM");
+    put_le32(&wav, 5);
+    put(&wav, "Wave\0\0", 6);
+    put_str(&wav, "IART");
+    put_le32(&wav, 4);
+    put(&wav, "Art\0", 4);
+    put_str(&wav, "data");
+    put_le32(&wav, 1000);
+    put_fill(&wav, 0, 1000);
+
+    media_tags_t t;
+    CHECK(read_bytes(&flac, &t));
+    CHECK(strcmp(t.title, "Flac") == 0 && strcmp(t.artist, "AA") == 0 && t.art_size == 32);
+    CHECK(read_bytes(&wav, &t));
+    CHECK(strcmp(t.title, "Wave") == 0 && strcmp(t.artist, "Art") == 0);
+
+    const bytes_t *seeds[] = { &id3, &flac, &wav };
+    test_fuzz(seeds, 3);
+
+    free(id3.p);
+    free(flac.p);
+    free(wav.p);
+    unlink(path);
+    return TEST_RESULT();
+}
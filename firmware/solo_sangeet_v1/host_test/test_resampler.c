@@ -0,0 +1,183 @@
+/*
+ * resampler: output length with the tail flushed, tone accuracy, passband
+ * and alias rejection for each quality tier, and the cost per output frame.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resampler.h"
+#include "test_util.h"
+
+#define OUT_RATE        44100
+#define TONE_FRAMES     (1 << 15)
+#define BENCH_SECONDS   20          // of 48 kHz input per tier
+
+static resampler_t rs;
+static int16_t in[TONE_FRAMES * 2];
+static int16_t out[TONE_FRAMES * 4 * 2];
+
+static const char *const tier_name[] = { "linear", "16 taps", "32 taps" };
+
+// Feed in blocks of the given size, flush, and collect everything
+static size_t run(const int16_t *src, size_t frames, size_t block, int16_t *dst, size_t max)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < frames; ) {
+        size_t want = frames - i < block ? frames - i : block;
+        i += resampler_write(&rs, src + 2 * i, want);
+        n += resampler_read(&rs, dst + 2 * n, max - n);
+    }
+    resampler_flush(&rs);
+    n += resampler_read(&rs, dst + 2 * n, max - n);
+    CHECK(!resampler_ready(&rs));
+    return n;
+}
+
+static void tone(int16_t *dst, size_t frames, double freq, uint32_t rate, double amp)
+{
+    for (size_t i = 0; i < frames; i++) {
+        dst[2 * i] = (int16_t)lrint(amp * sin(2 * M_PI * freq * i / rate));
+        dst[2 * i + 1] = (int16_t)lrint(amp * cos(2 * M_PI * freq * i / rate));
+    }
+}
+
+// Output frames the input covers: every k with k * in_rate / out_rate inside it
+static size_t expected_frames(size_t frames, uint32_t in_rate)
+{
+    return ((uint64_t)frames * OUT_RATE + in_rate - 1) / in_rate;
+}
+
+static void test_length(void)
+{
+    static const uint32_t rates[] = { 8000, 22050, 32000, 48000, 88200, 96000 };
+    static const size_t blocks[] = { 1, 37, 576, RESAMPLER_BLOCK_FRAMES };
+
+    tone(in, TONE_FRAMES, 440, 48000, 8000);
+    for (int q = RESAMPLER_LINEAR; q <= RESAMPLER_TAPS_32; q++) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+                size_t frames = 4000 + 13 * b;
+                resampler_init(&rs, rates[r], OUT_RATE, q);
+                size_t n = run(in, frames, blocks[b], out, sizeof(out) / 4);
+                size_t want = expected_frames(frames, rates[r]);
+                // The Q32 step rounds down, which may fit one more frame in
+                if (n != want && n != want + 1) {
+                    fprintf(stderr, "%s %u Hz, blocks of %zu: %zu frames out, expected %zu\n",
+                            tier_name[q], (unsigned)rates[r], blocks[b], n, want);
+                    test_failures++;
+                }
+            }
+        }
+
+        // reset() after a flush starts over: same output again
+        resampler_init(&rs, 48000, OUT_RATE, q);
+        size_t n1 = run(in, 3000, 500, out, sizeof(out) / 4);
+        static int16_t again[8000 * 2];
+        resampler_reset(&rs);
+        size_t n2 = run(in, 3000, 700, again, 8000);
+        CHECK_EQ(n1, n2);
+        CHECK(memcmp(out, again, n1 * 4) == 0);
+    }
+}
+
+// Level of the output against the ideal tone, in dB; the filter edges are left out
+static double tone_snr(size_t n, double freq, double amp, double *gain_db)
+{
+    double sig = 0, err = 0, pow_out = 0;
+    size_t edge = RESAMPLER_MAX_TAPS;
+
+    for (size_t k = edge; k + edge < n; k++) {
+        double l = amp * sin(2 * M_PI * freq * k / OUT_RATE);
+        double r = amp * cos(2 * M_PI * freq * k / OUT_RATE);
+        sig += l * l + r * r;
+        err += (out[2 * k] - l) * (out[2 * k] - l) + (out[2 * k + 1] - r) * (out[2 * k + 1] - r);
+        pow_out += (double)out[2 * k] * out[2 * k] + (double)out[2 * k + 1] * out[2 * k + 1];
+    }
+    if (gain_db) {
+        *gain_db = 10 * log10(pow_out / sig);
+    }
+    return 10 * log10(sig / (err + 1e-9));
+}
+
+static void test_accuracy(void)
+{
+    // Minimum SNR of a 1 kHz tone per tier, a few dB under what the Q14 table gives
+    static const double min_snr[] = { 45, 75, 74 };
+    static const uint32_t rates[] = { 32000, 48000, 96000 };
+
+    for (int q = RESAMPLER_LINEAR; q <= RESAMPLER_TAPS_32; q++) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            tone(in, TONE_FRAMES, 1000, rates[r], 16000);
+            resampler_init(&rs, rates[r], OUT_RATE, q);
+            size_t n = run(in, TONE_FRAMES, 1000, out, sizeof(out) / 4);
+            double snr = tone_snr(n, 1000, 16000, NULL);
+            printf("%-7s %5u Hz: 1 kHz at %5.1f dB SNR\n", tier_name[q], (unsigned)rates[r], snr);
+            CHECK(snr >= min_snr[q]);
+        }
+    }
+
+    // Filtered tiers: flat to 16 kHz, and 48 kHz content above 22.05 kHz kept out
+    for (int q = RESAMPLER_TAPS_16; q <= RESAMPLER_TAPS_32; q++) {
+        double gain;
+
+        tone(in, TONE_FRAMES, 16000, 48000, 16000);
+        resampler_init(&rs, 48000, OUT_RATE, q);
+        size_t n = run(in, TONE_FRAMES, 1000, out, sizeof(out) / 4);
+        tone_snr(n, 16000, 16000, &gain);
+        printf("%-7s 16 kHz passband %+.2f dB\n", tier_name[q], gain);
+        CHECK(fabs(gain) < 1.0);
+
+        // 23 kHz would fold to 21.1 kHz
+        tone(in, TONE_FRAMES, 23000, 48000, 16000);
+        resampler_init(&rs, 48000, OUT_RATE, q);
+        n = run(in, TONE_FRAMES, 1000, out, sizeof(out) / 4);
+        tone_snr(n, 21100, 16000, &gain);
+        printf("%-7s 23 kHz alias   %+.1f dB\n", tier_name[q], gain);
+        CHECK(gain < (q == RESAMPLER_TAPS_16 ? -14 : -35));
+    }
+
+    // Full-scale DC stays in range, off by no more than the per-tap coefficient rounding
+    for (size_t i = 0; i < 4096; i++) {
+        in[2 * i] = INT16_MAX;
+        in[2 * i + 1] = INT16_MIN;
+    }
+    resampler_init(&rs, 48000, OUT_RATE, RESAMPLER_TAPS_32);
+    size_t n = run(in, 4096, 4096, out, sizeof(out) / 4);
+    for (size_t k = RESAMPLER_MAX_TAPS; k + RESAMPLER_MAX_TAPS < n; k++) {
+        if (out[2 * k] < INT16_MAX - 8 || out[2 * k + 1] > INT16_MIN + 8) {
+            CHECK(!"DC level");
+            break;
+        }
+    }
+}
+
+static void bench(void)
+{
+    tone(in, RESAMPLER_BLOCK_FRAMES, 1000, 48000, 16000);
+    for (int q = RESAMPLER_LINEAR; q <= RESAMPLER_TAPS_32; q++) {
+        struct timespec t0, t1;
+        uint64_t frames = 0;
+
+        resampler_init(&rs, 48000, OUT_RATE, q);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (uint32_t i = 0; i < BENCH_SECONDS * 48000 / RESAMPLER_BLOCK_FRAMES; i++) {
+            resampler_write(&rs, in, RESAMPLER_BLOCK_FRAMES);
+            frames += resampler_read(&rs, out, sizeof(out) / 4);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        printf("%-7s %5.1f ns/frame, %4.0f x real time\n", tier_name[q], s * 1e9 / frames,
+               frames / (double)OUT_RATE / s);
+    }
+}
+
+int main(void)
+{
+    test_length();
+    test_accuracy();
+    bench();
+    return TEST_RESULT();
+}
@@ -0,0 +1,315 @@
+/*
+ * seek_index: tables built over synthetic MP3 and FLAC streams, every point
+ * checked against where the frames were written, the saved table, a build
+ * cut short by a read error, and the cost of a seek on an hour-long track.
+ *
+ * The frames carry headers only, the scan never looks past them.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "seek_index.h"
+#include "mp3_decoder.h"
+#include "test_util.h"
+
+#define RATE            44100
+#define MP3_LONG        "aseek_long.mp3"
+#define MP3_SHORT       "aseek_short.mp3"
+#define MP3_CUT         "aseek_cut.mp3"
+#define FLAC_FIXED      "aseek_fixed.flac"
+#define FLAC_VARIABLE   "aseek_variable.flac"
+#define MP3_FRAME_LEN   104         // 32 kbit/s MPEG-1 Layer III at 44.1 kHz, no padding
+#define MP3_ID3_LEN     300         // skipped by the decoder, the index starts after it
+#define LONG_FRAMES     (60 * 60 * RATE / 1152)
+#define SHORT_FRAMES    (4 * 60 * RATE / 1152)
+#define FLAC_BLOCK      4096
+#define FLAC_FRAMES     3000
+#define FLAC_PAYLOAD    200
+#define BENCH_SEEKS     2000
+
+static seek_index_t idx;
+static uint32_t flac_offsets[FLAC_FRAMES + 1];
+
+/* ---------------- synthetic streams ---------------- */
+
+static bool write_mp3(const char *path, uint32_t frames)
+{
+    static const uint8_t hdr[4] = { 0xFF, 0xFB, 0x10, 0xC4 };
+    uint8_t frame[MP3_FRAME_LEN] = { 0 };
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp) {
+        return false;
+    }
+    memcpy(frame, hdr, sizeof(hdr));
+    for (int i = 0; i < MP3_ID3_LEN; i++) {
+        fputc(0, fp);
+    }
+    for (uint32_t n = 0; n < frames; n++) {
+        fwrite(frame, 1, sizeof(frame), fp);
+    }
+    // ID3v1 at the end
+    fputs("TAG", fp);
+    for (int i = 3; i < 128; i++) {
+        fputc(' ', fp);
+    }
+    return fclose(fp) == 0;
+}
+
+static uint8_t crc8(const uint8_t *p, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// A frame header, 44.1 kHz 16-bit stereo, then payload bytes that hold no sync
+static void write_flac_frame(FILE *fp, bool variable, uint32_t num, uint32_t block)
+{
+    uint8_t h[16];
+    int n = 0;
+
+    h[n++] = 0xFF;
+    h[n++] = 0xF8 | variable;
+    h[n++] = (block == FLAC_BLOCK ? 0xC0 : 0x70) | 0x09;
+    h[n++] = 0x18;
+    // UTF-8 style frame or sample number: a lead byte, then 6 bits a byte
+    if (num < 0x80) {
+        h[n++] = num;
+    } else {
+        int extra = 1;
+        while (extra < 6 && num >> (6 * extra) >= (0x40u >> extra)) {
+            extra++;
+        }
+        h[n++] = (uint8_t)(0xFF00 >> (extra + 1)) | num >> (6 * extra);
+        while (extra--) {
+            h[n++] = 0x80 | (num >> (6 * extra) & 0x3f);
+        }
+    }
+    if (block != FLAC_BLOCK) {
+        h[n++] = (block - 1) >> 8;
+        h[n++] = (block - 1) & 0xff;
+    }
+    h[n] = crc8(h, n);
+    n++;
+    fwrite(h, 1, n, fp);
+    for (int i = 0; i < FLAC_PAYLOAD; i++) {
+        fputc(i & 0x7f, fp);
+    }
+}
+
+// Fixed blocks with a short last one; or variable blocks of two sizes
+static bool write_flac(const char *path, bool variable)
+{
+    FILE *fp = fopen(path, "wb");
+    uint32_t sample = 0;
+
+    if (!fp) {
+        return false;
+    }
+    fputs("fLaC", fp);
+    for (uint32_t f = 0; f < FLAC_FRAMES; f++) {
+        uint32_t block = f == FLAC_FRAMES - 1 ? 1000 : FLAC_BLOCK;
+        if (variable && f >= FLAC_FRAMES / 2) {
+            block = FLAC_BLOCK / 2;
+        }
+        flac_offsets[f] = ftell(fp);
+        write_flac_frame(fp, variable, variable ? sample : f, block);
+        sample += block;
+    }
+    flac_offsets[FLAC_FRAMES] = ftell(fp);
+    return fclose(fp) == 0;
+}
+
+/* ---------------- helpers ---------------- */
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Open with no table saved by an earlier run
+static bool open_fresh(const char *path, seek_index_kind_t kind, uint32_t start, uint32_t rate)
+{
+    if (!seek_index_open(&idx, path, kind, start, rate)) {
+        return false;
+    }
+    remove(idx.cache_path);
+    return !idx.complete || seek_index_open(&idx, path, kind, start, rate);
+}
+
+static int build(void)
+{
+    int steps = 0;
+
+    while (seek_index_step(&idx)) {
+        steps++;
+    }
+    return steps;
+}
+
+static bool cached(void)
+{
+    struct stat st;
+
+    return stat(idx.cache_path, &st) == 0;
+}
+
+/* ---------------- tests ---------------- */
+
+static void test_mp3(void)
+{
+    seek_point_t pt;
+    uint32_t span, wrong = 0;
+
+    // Four minutes: a point every six frames, 157 ms
+    CHECK(write_mp3(MP3_SHORT, SHORT_FRAMES));
+    CHECK(open_fresh(MP3_SHORT, SEEK_INDEX_MP3, MP3_ID3_LEN, 0));
+    build();
+    CHECK(idx.complete);
+    CHECK_EQ(idx.total_samples, SHORT_FRAMES * 1152);
+    CHECK_EQ(idx.group, 6);
+    span = idx.group * idx.frame_samples;
+    for (uint32_t s = 0; s < idx.total_samples; s += 997) {
+        CHECK(seek_index_lookup(&idx, s, &pt));
+        wrong += pt.sample > s || s - pt.sample >= span ||
+                 pt.offset != MP3_ID3_LEN + pt.sample / 1152 * MP3_FRAME_LEN;
+    }
+    CHECK_EQ(wrong, 0);
+
+    // Saved, and taken back on the next open without a scan
+    CHECK(cached());
+    uint32_t count = idx.count;
+    CHECK(seek_index_open(&idx, MP3_SHORT, SEEK_INDEX_MP3, MP3_ID3_LEN, 0));
+    CHECK(idx.complete);
+    CHECK_EQ(idx.count, count);
+    CHECK(!seek_index_step(&idx));
+
+    // A changed file is scanned again
+    CHECK(write_mp3(MP3_SHORT, SHORT_FRAMES + 1));
+    CHECK(seek_index_open(&idx, MP3_SHORT, SEEK_INDEX_MP3, MP3_ID3_LEN, 0));
+    CHECK(!idx.complete);
+    build();
+    CHECK_EQ(idx.total_samples, (SHORT_FRAMES + 1) * 1152);
+}
+
+static void test_read_error(void)
+{
+    // The card stops reading half way through the scan
+    CHECK(write_mp3(MP3_CUT, SHORT_FRAMES));
+    CHECK(open_fresh(MP3_CUT, SEEK_INDEX_MP3, MP3_ID3_LEN, 0));
+    for (int i = 0; i < 50; i++) {
+        seek_index_step(&idx);
+    }
+    CHECK(truncate(MP3_CUT, MP3_ID3_LEN + SHORT_FRAMES / 2 * MP3_FRAME_LEN) == 0);
+    build();
+    CHECK(idx.failed);
+    CHECK(!idx.complete);
+    CHECK(!cached());
+
+    // What was indexed before the error still holds
+    seek_point_t pt;
+    CHECK(idx.count > 0);
+    CHECK(seek_index_lookup(&idx, idx.next_sample / 2, &pt));
+    CHECK_EQ(pt.offset, MP3_ID3_LEN + pt.sample / 1152 * MP3_FRAME_LEN);
+}
+
+static void test_flac(void)
+{
+    seek_point_t pt;
+    uint32_t wrong = 0;
+
+    // Fixed blocks, the last one short
+    CHECK(write_flac(FLAC_FIXED, false));
+    CHECK(open_fresh(FLAC_FIXED, SEEK_INDEX_FLAC, 4, RATE));
+    build();
+    CHECK(idx.complete);
+    CHECK_EQ(idx.total_samples, (FLAC_FRAMES - 1) * FLAC_BLOCK + 1000);
+    CHECK_EQ(idx.frame_samples, FLAC_BLOCK);
+    CHECK_EQ(idx.group, 2);
+    for (uint32_t s = 0; s < idx.total_samples; s += 1009) {
+        CHECK(seek_index_lookup(&idx, s, &pt));
+        wrong += pt.sample > s || s - pt.sample >= idx.group * FLAC_BLOCK ||
+                 pt.offset != flac_offsets[pt.sample / FLAC_BLOCK];
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(cached());
+
+    // Variable blocks: no table past the first change, nothing saved
+    CHECK(write_flac(FLAC_VARIABLE, true));
+    CHECK(open_fresh(FLAC_VARIABLE, SEEK_INDEX_FLAC, 4, RATE));
+    build();
+    CHECK(idx.failed);
+    CHECK(!idx.complete);
+    CHECK(!cached());
+    CHECK(seek_index_lookup(&idx, FLAC_BLOCK * 10 + 5, &pt));
+    CHECK_EQ(pt.offset, flac_offsets[pt.sample / FLAC_BLOCK]);
+}
+
+static void bench_seek(void)
+{
+    static uint8_t buf[SEEK_INDEX_SCAN_BUF];
+    seek_point_t pt;
+    uint32_t worst = 0, wrong = 0;
+
+    CHECK(write_mp3(MP3_LONG, LONG_FRAMES));
+    CHECK(open_fresh(MP3_LONG, SEEK_INDEX_MP3, MP3_ID3_LEN, 0));
+    double t0 = now_us();
+    int steps = build();
+    double build_ms = (now_us() - t0) / 1000;
+    CHECK(idx.complete);
+    CHECK_EQ(idx.total_samples, LONG_FRAMES * 1152);
+    CHECK(idx.count <= SEEK_INDEX_MAX_POINTS);
+
+    // A seek: the lookup, one fseek and the read the decoder starts with
+    FILE *fp = fopen(MP3_LONG, "rb");
+    CHECK(fp != NULL);
+    if (!fp) {
+        return;
+    }
+    srand(1);
+    t0 = now_us();
+    for (int i = 0; i < BENCH_SEEKS; i++) {
+        uint32_t target = (uint32_t)((uint64_t)rand() * idx.total_samples / ((uint64_t)RAND_MAX + 1));
+        seek_index_lookup(&idx, target, &pt);
+        fseek(fp, pt.offset, SEEK_SET);
+        wrong += fread(buf, 1, sizeof(buf), fp) < MP3_HEADER_SIZE || buf[0] != 0xFF;
+        worst = target - pt.sample > worst ? target - pt.sample : worst;
+    }
+    double seek_us = (now_us() - t0) / BENCH_SEEKS;
+    fclose(fp);
+
+    // The old 512 point table, halving from 1/10 s, for comparison
+    uint32_t old_spacing = RATE / 10;
+    while ((uint64_t)old_spacing * 512 < idx.total_samples) {
+        old_spacing *= 2;
+    }
+    printf("60 min MP3: indexed in %d steps, %.1f ms; %u points, %u frames apart\n",
+           steps, build_ms, (unsigned)idx.count, (unsigned)idx.group);
+    printf("seek: %.2f us, decodes at most %u ms before the target (was %u ms)\n", seek_us,
+           (unsigned)((uint64_t)worst * 1000 / RATE), (unsigned)((uint64_t)old_spacing * 1000 / RATE));
+    CHECK_EQ(wrong, 0);
+    CHECK(worst < idx.group * 1152);
+    CHECK(worst * 4 < old_spacing);
+}
+
+int main(void)
+{
+    test_mp3();
+    test_read_error();
+    test_flac();
+    bench_seek();
+    return TEST_RESULT();
+}
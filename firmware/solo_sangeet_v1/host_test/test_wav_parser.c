@@ -0,0 +1,331 @@
+/*
+ * wav_parser: chunk walking (order, padding, streaming sizes, bad fmt
+ * chunks), in-place conversion of every supported layout against reference
+ * samples, float clamping, and the conversion cost per format on a
+ * reader-sized chunk.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wav_parser.h"
+#include "test_util.h"
+
+#define CHUNK           2048        // AUDIO_READ_CHUNK
+#define BENCH_BYTES     (8u << 20)  // input converted per format
+
+typedef struct {
+    uint16_t tag;                   // as written, WAV_FMT_EXTENSIBLE wraps sub_tag
+    uint16_t sub_tag;
+    uint16_t channels;
+    uint16_t bits;
+    uint16_t block_align;           // 0: derived
+} fmt_t;
+
+static void put_le(FILE *fp, uint32_t v, int n)
+{
+    for (int i = 0; i < n; i++) {
+        fputc(v >> (8 * i) & 0xFF, fp);
+    }
+}
+
+static void put_chunk(FILE *fp, const char *id, uint32_t size)
+{
+    fwrite(id, 1, 4, fp);
+    put_le(fp, size, 4);
+}
+
+static void put_fmt(FILE *fp, const fmt_t *f, uint32_t size)
+{
+    uint16_t ba = f->block_align ? f->block_align : f->channels * f->bits / 8;
+
+    put_chunk(fp, "fmt ", size);
+    put_le(fp, f->tag, 2);
+    put_le(fp, f->channels, 2);
+    put_le(fp, 44100, 4);
+    put_le(fp, 44100 * ba, 4);
+    put_le(fp, ba, 2);
+    put_le(fp, f->bits, 2);
+    for (uint32_t i = 16; i < size; i++) {
+        // cbSize, valid bits, channel mask, then the SubFormat GUID
+        fputc(i == 24 ? f->sub_tag & 0xFF : i == 25 ? f->sub_tag >> 8 : 0, fp);
+    }
+}
+
+// RIFF/WAVE with a LIST chunk, an odd-sized chunk and its pad byte ahead of fmt
+static FILE *wav_file(const fmt_t *f, uint32_t fmt_size, uint32_t data_field, uint32_t data_len,
+                      bool data_first)
+{
+    FILE *fp = tmpfile();
+
+    fwrite("RIFF\0\0\0\0WAVE", 1, 12, fp);
+    put_chunk(fp, "LIST", 8);
+    fwrite("INFOjunk", 1, 8, fp);
+    put_chunk(fp, "odd ", 3);
+    fwrite("abc\0", 1, 4, fp);
+    if (!data_first) {
+        put_fmt(fp, f, fmt_size);
+    }
+    put_chunk(fp, "data", data_field);
+    for (uint32_t i = 0; i < data_len; i++) {
+        fputc(i * 7, fp);
+    }
+    if (data_first) {
+        if (data_len & 1) {
+            fputc(0, fp);
+        }
+        put_fmt(fp, f, fmt_size);
+    }
+    rewind(fp);
+    return fp;
+}
+
+static void test_header(void)
+{
+    const fmt_t s16 = { WAV_FMT_PCM, 0, 2, 16, 0 };
+    const fmt_t ext24 = { WAV_FMT_EXTENSIBLE, WAV_FMT_PCM, 2, 24, 0 };
+    wav_info_t info;
+    FILE *fp;
+
+    fp = wav_file(&s16, 16, 4000, 4000, false);
+    CHECK(wav_parse_header(fp, &info));
+    CHECK_EQ(info.format, WAV_FMT_PCM);
+    CHECK_EQ(info.channels, 2);
+    CHECK_EQ(info.sample_rate, 44100);
+    CHECK_EQ(info.data_size, 4000);
+    CHECK_EQ(info.data_offset, 12 + 16 + 12 + 24 + 8);
+    CHECK_EQ(ftell(fp), info.data_offset);
+    fclose(fp);
+
+    // data ahead of fmt, odd-sized: padded, and trimmed to whole frames
+    fp = wav_file(&ext24, 40, 601, 601, true);
+    CHECK(wav_parse_header(fp, &info));
+    CHECK_EQ(info.format, WAV_FMT_PCM);
+    CHECK_EQ(info.bits_per_sample, 24);
+    CHECK_EQ(info.data_size, 600);
+    CHECK_EQ(ftell(fp), info.data_offset);
+    fclose(fp);
+
+    // Streaming writers: 0 or 0xFFFFFFFF, and a size past the end of the file
+    uint32_t fields[] = { 0, 0xFFFFFFFF, 100000 };
+    for (int i = 0; i < 3; i++) {
+        fp = wav_file(&s16, 16, fields[i], 1026, false);
+        CHECK(wav_parse_header(fp, &info));
+        CHECK_EQ(info.data_size, 1024);
+        fclose(fp);
+    }
+
+    // Refused: float below 32 bit, wrong block align, short extensible fmt,
+    // unknown format, 12-bit, no data chunk, not RIFF
+    const fmt_t bad[] = {
+        { WAV_FMT_IEEE_FLOAT, 0, 2, 16, 0 },
+        { WAV_FMT_PCM, 0, 2, 16, 6 },
+        { WAV_FMT_EXTENSIBLE, WAV_FMT_PCM, 2, 16, 0 },
+        { 0x0055, 0, 2, 16, 0 },
+        { WAV_FMT_PCM, 0, 2, 12, 4 },
+        { WAV_FMT_PCM, 0, 0, 16, 0 },
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        fp = wav_file(&bad[i], bad[i].tag == WAV_FMT_EXTENSIBLE ? 24 : 16, 400, 400, false);
+        CHECK(!wav_parse_header(fp, &info));
+        fclose(fp);
+    }
+    fp = wav_file(&s16, 14, 400, 400, false);
+    CHECK(!wav_parse_header(fp, &info));
+    fclose(fp);
+
+    fp = tmpfile();
+    fwrite("RIFF\0\0\0\0WAVE", 1, 12, fp);
+    put_fmt(fp, &s16, 16);
+    rewind(fp);
+    CHECK(!wav_parse_header(fp, &info));
+    fclose(fp);
+
+    fp = tmpfile();
+    fwrite("RIFX\0\0\0\0WAVE", 1, 12, fp);
+    rewind(fp);
+    CHECK(!wav_parse_header(fp, &info));
+    fclose(fp);
+}
+
+/* ---------------- conversion ---------------- */
+
+// Reference sample n of channel ch, and the same sample written in the given layout
+static int16_t ref_sample(uint32_t n, int ch)
+{
+    return (int16_t)(32767 * sin(n * 0.05 + ch) * (n % 97 == 0 ? 1.0 : 0.8)) ^ (n & 3);
+}
+
+static void encode(const wav_info_t *info, int16_t v, uint8_t *p)
+{
+    switch (info->bits_per_sample) {
+    case 8:
+        p[0] = (uint8_t)((v >> 8) + 128);
+        break;
+    case 16:
+        p[0] = v;
+        p[1] = v >> 8;
+        break;
+    case 24:
+        p[0] = 0x5A;            // below 16 bits: dropped
+        p[1] = v;
+        p[2] = v >> 8;
+        break;
+    default:
+        if (info->format == WAV_FMT_IEEE_FLOAT) {
+            float f = v / 32767.0f;
+            memcpy(p, &f, 4);
+        } else {
+            p[0] = 0xA5;
+            p[1] = 0x5A;
+            p[2] = v;
+            p[3] = v >> 8;
+        }
+        break;
+    }
+}
+
+static int16_t expect(const wav_info_t *info, int16_t v)
+{
+    if (info->bits_per_sample == 8) {
+        return (int16_t)(v & ~0xFF);
+    }
+    if (info->format == WAV_FMT_IEEE_FLOAT) {
+        return v == INT16_MIN ? v : (int16_t)((v / 32767.0f) * 32767.0f);
+    }
+    return v;
+}
+
+static void fill(const wav_info_t *info, uint8_t *buf, uint32_t first, size_t frames)
+{
+    size_t bps = info->bits_per_sample / 8;
+
+    for (size_t i = 0; i < frames; i++) {
+        for (int ch = 0; ch < info->channels; ch++) {
+            encode(info, ref_sample(first + i, ch), buf + i * info->block_align + ch * bps);
+        }
+    }
+}
+
+static const wav_info_t layouts[] = {
+    { WAV_FMT_PCM, 1, 44100, 8, 1 },
+    { WAV_FMT_PCM, 2, 44100, 8, 2 },
+    { WAV_FMT_PCM, 1, 44100, 16, 2 },
+    { WAV_FMT_PCM, 2, 44100, 16, 4 },
+    { WAV_FMT_PCM, 1, 44100, 24, 3 },
+    { WAV_FMT_PCM, 2, 44100, 24, 6 },
+    { WAV_FMT_PCM, 6, 44100, 24, 18 },
+    { WAV_FMT_PCM, 2, 44100, 32, 8 },
+    { WAV_FMT_IEEE_FLOAT, 1, 44100, 32, 4 },
+    { WAV_FMT_IEEE_FLOAT, 2, 44100, 32, 8 },
+};
+#define LAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+
+static void test_convert(void)
+{
+    static uint8_t buf[CHUNK];
+
+    for (size_t l = 0; l < LAYOUTS; l++) {
+        const wav_info_t *info = &layouts[l];
+        size_t in = pcm_input_bytes_for(info, sizeof(buf));
+        size_t frames = in / info->block_align;
+        int bad = 0;
+
+        CHECK_EQ(in % info->block_align, 0);
+        CHECK(pcm_output_bytes(info, in) <= sizeof(buf));
+        CHECK(in <= sizeof(buf));
+
+        fill(info, buf, 1000, frames);
+        CHECK_EQ(pcm_to_s16_stereo(info, buf, in), frames * PCM_OUT_FRAME_BYTES);
+
+        const int16_t *out = (const int16_t *)buf;
+        for (size_t i = 0; i < frames; i++) {
+            int16_t l0 = expect(info, ref_sample(1000 + i, 0));
+            int16_t r0 = expect(info, ref_sample(1000 + i, info->channels > 1));
+            if (out[2 * i] != l0 || out[2 * i + 1] != r0) {
+                if (bad++ < 3) {
+                    fprintf(stderr, "%u ch %u bit fmt %u, frame %zu: %d/%d, expected %d/%d\n",
+                            info->channels, info->bits_per_sample, info->format, i,
+                            out[2 * i], out[2 * i + 1], l0, r0);
+                }
+            }
+        }
+        CHECK_EQ(bad, 0);
+    }
+
+    // 8-bit extremes: 0 and 255 around the 128 midpoint
+    const wav_info_t *u8 = &layouts[0];
+    uint8_t b8[8] = { 0, 128, 255, 1 };
+    CHECK_EQ(pcm_to_s16_stereo(u8, b8, 2), 8);
+    CHECK_EQ(((int16_t *)b8)[0], -32768);
+    CHECK_EQ(((int16_t *)b8)[2], 0);
+}
+
+static void test_float_clamp(void)
+{
+    const wav_info_t *f32 = &layouts[8];
+    const float in[] = { NAN, -NAN, INFINITY, -INFINITY, 2.0f, -1.5f, 1.0f, -1.0f, 0.5f, 1e-30f,
+                         1e30f, -1e30f };
+    const int16_t want[] = { 0, 0, INT16_MAX, INT16_MIN, INT16_MAX, INT16_MIN, INT16_MAX, INT16_MIN,
+                             16383, 0, INT16_MAX, INT16_MIN };
+    const size_t n = sizeof(in) / sizeof(in[0]);
+    uint8_t buf[sizeof(in)];
+
+    memcpy(buf, in, sizeof(in));
+    CHECK_EQ(pcm_to_s16_stereo(f32, buf, sizeof(in)), n * PCM_OUT_FRAME_BYTES);
+
+    // Mono grows in place, so convert through a buffer with room for it
+    uint8_t out[sizeof(in) * 2];
+    memcpy(out, in, sizeof(in));
+    pcm_to_s16_stereo(f32, out, sizeof(in));
+    for (size_t i = 0; i < n; i++) {
+        CHECK_EQ(((int16_t *)out)[2 * i], want[i]);
+        CHECK_EQ(((int16_t *)out)[2 * i + 1], want[i]);
+    }
+}
+
+/* ---------------- cost ---------------- */
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(void)
+{
+    static uint8_t src[CHUNK], buf[CHUNK];
+
+    for (size_t l = 0; l < LAYOUTS; l++) {
+        const wav_info_t *info = &layouts[l];
+        size_t in = pcm_input_bytes_for(info, sizeof(buf));
+        size_t frames = in / info->block_align;
+        uint32_t reps = BENCH_BYTES / in;
+        volatile int16_t sink = 0;
+
+        fill(info, src, 0, frames);
+        double t0 = now_s();
+        for (uint32_t r = 0; r < reps; r++) {
+            memcpy(buf, src, in);
+            pcm_to_s16_stereo(info, buf, in);
+            sink += ((int16_t *)buf)[r % frames];
+        }
+        double t = now_s() - t0;
+        printf("%u ch %2u bit %s: %5.1f ns/frame, %6.0f x real time at 44.1 kHz\n",
+               info->channels, info->bits_per_sample,
+               info->format == WAV_FMT_IEEE_FLOAT ? "float" : "int  ",
+               t * 1e9 / ((double)reps * frames), (double)reps * frames / 44100 / t);
+    }
+}
+
+int main(void)
+{
+    test_header();
+    test_convert();
+    test_float_clamp();
+    bench();
+    return TEST_RESULT();
+}